@@ -3,6 +3,11 @@
 file(READ ${CS_FILE} COMPUTE_SHADER)
 file(READ ${VS_FILE} VERTEX_SHADER)
 file(READ ${FS_FILE} FRAGMENT_SHADER)
+file(READ ${TEXT_VS_FILE} TEXT_VERTEX_SHADER)
+file(READ ${TEXT_FS_FILE} TEXT_FRAGMENT_SHADER)
+file(READ ${SEGMENT_VS_FILE} SEGMENT_VERTEX_SHADER)
+file(READ ${SEGMENT_FS_FILE} SEGMENT_FRAGMENT_SHADER)
+file(READ ${CULL_CS_FILE} CULL_SHADER)
 
 # # Run configure_file
 # # The @ONLY option ensures only @VAR@ syntax is expanded, not ${VAR}
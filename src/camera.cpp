@@ -0,0 +1,128 @@
+#include "camera.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+// Time constants of the exponential decays, in seconds
+constexpr double ZOOM_TIME_CONSTANT = 0.06;
+constexpr double FLING_TIME_CONSTANT = 0.325;
+// Smoothing of the drag velocity
+constexpr double VELOCITY_TIME_CONSTANT = 0.03;
+// No fling when the pointer rested this long before the release
+constexpr double FLING_MAX_REST = 0.05;
+// Animations end below these thresholds
+constexpr double MIN_FLING_SPEED = 20.0; // pixels per second
+constexpr double SNAP_DISTANCE = 0.01;   // pixels
+constexpr double SNAP_LOG_SCALE = 1e-5;
+// Longest step, so a stall does not turn into a jump
+constexpr double MAX_STEP = 0.1;
+} // namespace
+
+bool Camera::Rect::operator==(const Rect &other) const {
+    return x == other.x && y == other.y && width == other.width && height == other.height;
+}
+
+void Camera::Reset(const Rect &rect) {
+    current_ = target_ = rect;
+    velocityX_ = velocityY_ = 0.0;
+    dragging_ = false;
+}
+
+void Camera::Translate(double dx, double dy) {
+    current_.x += dx;
+    current_.y += dy;
+    target_.x += dx;
+    target_.y += dy;
+}
+
+void Camera::BeginDrag(Clock::time_point time) {
+    dragging_ = true;
+    velocityX_ = velocityY_ = 0.0;
+    lastDragTime_ = time;
+}
+
+void Camera::Drag(double dx, double dy, Clock::time_point time) {
+    Translate(dx, dy);
+
+    const double dt = std::max(Seconds(time - lastDragTime_).count(), 1e-3);
+    const double weight = 1.0 - std::exp(-dt / VELOCITY_TIME_CONSTANT);
+    velocityX_ += (dx / dt - velocityX_) * weight;
+    velocityY_ += (dy / dt - velocityY_) * weight;
+    lastDragTime_ = time;
+}
+
+void Camera::EndDrag(Clock::time_point time) {
+    dragging_ = false;
+    if (Seconds(time - lastDragTime_).count() > FLING_MAX_REST ||
+        std::hypot(velocityX_, velocityY_) < MIN_FLING_SPEED) {
+        velocityX_ = velocityY_ = 0.0;
+    }
+    lastAdvanceTime_ = time;
+}
+
+void Camera::ZoomBy(double scale, double anchorX, double anchorY, bool animate, Clock::time_point time) {
+    if (scale <= 0.0) {
+        return;
+    }
+    if (!IsAnimating()) {
+        lastAdvanceTime_ = time;
+    }
+
+    // Keep the anchor at the same relative position of the target
+    target_.x = anchorX - (anchorX - target_.x) * scale;
+    target_.y = anchorY - (anchorY - target_.y) * scale;
+    target_.width *= scale;
+    target_.height *= scale;
+
+    if (!animate) {
+        current_.x = anchorX - (anchorX - current_.x) * scale;
+        current_.y = anchorY - (anchorY - current_.y) * scale;
+        current_.width *= scale;
+        current_.height *= scale;
+    }
+}
+
+bool Camera::Advance(Clock::time_point time) {
+    const double dt = std::clamp(Seconds(time - lastAdvanceTime_).count(), 0.0, MAX_STEP);
+    lastAdvanceTime_ = time;
+    if (!IsAnimating()) {
+        return false;
+    }
+
+    // Fling, moving the zoom target along
+    if (!dragging_ && (velocityX_ != 0.0 || velocityY_ != 0.0)) {
+        Translate(velocityX_ * dt, velocityY_ * dt);
+        const double decay = std::exp(-dt / FLING_TIME_CONSTANT);
+        velocityX_ *= decay;
+        velocityY_ *= decay;
+        if (std::hypot(velocityX_, velocityY_) < MIN_FLING_SPEED) {
+            velocityX_ = velocityY_ = 0.0;
+        }
+    }
+
+    // Zoom: current_ and target_ are related by a scaling about a fixed point
+    // f, target = f + (current - f) * k. Apply the fraction of k due in dt.
+    const double k = target_.width / current_.width;
+    const double fraction = 1.0 - std::exp(-dt / ZOOM_TIME_CONSTANT);
+    if (std::abs(std::log(k)) < SNAP_LOG_SCALE) {
+        current_.x += (target_.x - current_.x) * fraction;
+        current_.y += (target_.y - current_.y) * fraction;
+    } else {
+        const double fixedX = (target_.x - k * current_.x) / (1.0 - k);
+        const double fixedY = (target_.y - k * current_.y) / (1.0 - k);
+        const double step = std::pow(k, fraction);
+        current_.x = fixedX + (current_.x - fixedX) * step;
+        current_.y = fixedY + (current_.y - fixedY) * step;
+        current_.width *= step;
+        current_.height *= step;
+    }
+    if (std::abs(std::log(target_.width / current_.width)) < SNAP_LOG_SCALE &&
+        std::abs(target_.x - current_.x) < SNAP_DISTANCE && std::abs(target_.y - current_.y) < SNAP_DISTANCE) {
+        current_ = target_;
+    }
+
+    return IsAnimating();
+}
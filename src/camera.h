@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+
+/**
+ * Double precision 2D camera: the rectangle, in physical pixels with y up,
+ * that the coordinate bounds of the data are mapped to.
+ *
+ * Zooming can be animated. ZoomBy moves a target rectangle and Advance moves
+ * the current rectangle towards it, scaling about the fixed point of the two
+ * rectangles so the point under the cursor stays in place even when several
+ * wheel steps pile up. Releasing a drag keeps panning with the velocity of
+ * the drag, decaying exponentially.
+ */
+class Camera {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Rect {
+        double x;
+        double y;
+        double width;
+        double height;
+
+        bool operator==(const Rect &other) const;
+        bool operator!=(const Rect &other) const { return !(*this == other); }
+    };
+
+    // Jump to `rect` and stop all animations
+    void Reset(const Rect &rect);
+
+    const Rect &Current() const { return current_; }
+
+    // Move by (dx, dy) pixels right away, e.g. when the window is resized
+    void Translate(double dx, double dy);
+
+    // Dragging pans right away and tracks the velocity for the fling started
+    // by EndDrag
+    void BeginDrag(Clock::time_point time);
+    void Drag(double dx, double dy, Clock::time_point time);
+    void EndDrag(Clock::time_point time);
+
+    // Scale by `scale` about (anchorX, anchorY). Without `animate` the current
+    // rectangle follows immediately, e.g. for pinch gestures which are
+    // continuous already.
+    void ZoomBy(double scale, double anchorX, double anchorY, bool animate, Clock::time_point time);
+
+    // Step the animations to `time`. Returns true while still animating.
+    bool Advance(Clock::time_point time);
+
+    bool IsAnimating() const {
+        return current_ != target_ || (!dragging_ && (velocityX_ != 0.0 || velocityY_ != 0.0));
+    }
+
+  protected:
+    Rect current_{0.0, 0.0, 1.0, 1.0};
+    Rect target_{0.0, 0.0, 1.0, 1.0};
+
+    // pixels per second
+    double velocityX_{0.0};
+    double velocityY_{0.0};
+    bool dragging_{false};
+    Clock::time_point lastDragTime_{};
+    Clock::time_point lastAdvanceTime_{};
+};
@@ -0,0 +1,226 @@
+#include "cpu_extruder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_EXTRUDER_SSE2 1
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+
+namespace {
+// See compute.comp.glsl and OpenGLCanvas::AddLineStripAdjacencyToBuffers
+constexpr uint32_t BEGIN_BIT = 1 << 0;
+constexpr uint32_t END_BIT = 1 << 1;
+constexpr uint32_t INVALID_IDX = 0xFFFFFFFF;
+
+// Indices handled together, one per SIMD lane
+constexpr size_t BATCH_SIZE = 4;
+// Smaller ranges are not worth handing to another thread
+constexpr size_t MIN_RANGE_SIZE = 16384;
+
+// The inputs of one batch gathered into lanes: the position of the index and
+// of its neighbours on the screen, which neighbours take part and the half
+// line width
+struct Batch {
+    alignas(16) float x[BATCH_SIZE];
+    alignas(16) float y[BATCH_SIZE];
+    alignas(16) float prevX[BATCH_SIZE];
+    alignas(16) float prevY[BATCH_SIZE];
+    alignas(16) float nextX[BATCH_SIZE];
+    alignas(16) float nextY[BATCH_SIZE];
+    alignas(16) uint32_t hasPrev[BATCH_SIZE];
+    alignas(16) uint32_t hasNext[BATCH_SIZE];
+    alignas(16) float halfWidth[BATCH_SIZE];
+    // results
+    alignas(16) float normalX[BATCH_SIZE];
+    alignas(16) float normalY[BATCH_SIZE];
+};
+
+void mapToScreen(const float *positions, uint32_t node, const CpuExtruder::View &view, float &x, float &y) {
+    const float *position = positions + node * 2;
+    x = (position[0] - view.minLon) / view.lonRange * view.width;
+    y = (position[1] - view.minLat) / view.latRange * view.height;
+}
+
+// Same steps as the shader: the normal of the average of the normalized
+// directions of the adjacent segments. Degenerate segments give NaN, which
+// fails the length test and ends up as a zero normal like on the GPU.
+void lineNormal(Batch &batch, size_t lane) {
+    float dirX = 0.0f;
+    float dirY = 0.0f;
+    if (batch.hasPrev[lane]) {
+        const float dx = batch.x[lane] - batch.prevX[lane];
+        const float dy = batch.y[lane] - batch.prevY[lane];
+        const float length = std::sqrt(dx * dx + dy * dy);
+        dirX += dx / length;
+        dirY += dy / length;
+    }
+    if (batch.hasNext[lane]) {
+        const float dx = batch.nextX[lane] - batch.x[lane];
+        const float dy = batch.nextY[lane] - batch.y[lane];
+        const float length = std::sqrt(dx * dx + dy * dy);
+        dirX += dx / length;
+        dirY += dy / length;
+    }
+    const float length = std::sqrt(dirX * dirX + dirY * dirY);
+    if (length > 0.0f) {
+        batch.normalX[lane] = -(dirY / length);
+        batch.normalY[lane] = dirX / length;
+    } else {
+        batch.normalX[lane] = 0.0f;
+        batch.normalY[lane] = 0.0f;
+    }
+}
+
+#ifdef CPU_EXTRUDER_SSE2
+// lineNormal for all lanes. Lanes without a neighbour have its direction
+// masked to zero instead of branching.
+void lineNormals(Batch &batch) {
+    const __m128 x = _mm_load_ps(batch.x);
+    const __m128 y = _mm_load_ps(batch.y);
+    const __m128 zero = _mm_setzero_ps();
+
+    auto direction = [](__m128 dx, __m128 dy, __m128 mask, __m128 &dirX, __m128 &dirY) {
+        const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        dirX = _mm_add_ps(dirX, _mm_and_ps(mask, _mm_div_ps(dx, length)));
+        dirY = _mm_add_ps(dirY, _mm_and_ps(mask, _mm_div_ps(dy, length)));
+    };
+
+    __m128 dirX = zero;
+    __m128 dirY = zero;
+    const __m128 hasPrev =
+        _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(batch.hasPrev)),
+                                         _mm_setzero_si128()));
+    direction(_mm_sub_ps(x, _mm_load_ps(batch.prevX)), _mm_sub_ps(y, _mm_load_ps(batch.prevY)), hasPrev, dirX,
+              dirY);
+    const __m128 hasNext =
+        _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(batch.hasNext)),
+                                         _mm_setzero_si128()));
+    direction(_mm_sub_ps(_mm_load_ps(batch.nextX), x), _mm_sub_ps(_mm_load_ps(batch.nextY), y), hasNext, dirX,
+              dirY);
+
+    // -0.0 - v flips the sign bit only, like the scalar negation
+    const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dirX, dirX), _mm_mul_ps(dirY, dirY)));
+    const __m128 valid = _mm_cmpgt_ps(length, zero);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    _mm_store_ps(batch.normalX, _mm_and_ps(valid, _mm_xor_ps(signBit, _mm_div_ps(dirY, length))));
+    _mm_store_ps(batch.normalY, _mm_and_ps(valid, _mm_div_ps(dirX, length)));
+}
+#else
+void lineNormals(Batch &batch) {
+    for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+        lineNormal(batch, lane);
+    }
+}
+#endif
+} // namespace
+
+void CpuExtruder::Extrude(const float *positions, const uint32_t *styleIds, const uint32_t *indices, size_t indexCount,
+                          const std::vector<StyleSheet::GpuStyle> &styles, const View &view,
+                          std::vector<OutputVertex> &outVertices, std::vector<uint32_t> &outIndices) {
+    outVertices.resize(indexCount * 2);
+    outIndices.resize(indexCount * 6);
+
+    const size_t threadCount = static_cast<size_t>(std::max(pool_.num_threads(), 1));
+    if (indexCount < 2 * MIN_RANGE_SIZE || threadCount == 1) {
+        ExtrudeRange(positions, styleIds, indices, indexCount, styles, view, 0, indexCount, outVertices.data(),
+                     outIndices.data());
+        return;
+    }
+
+    // A few ranges per thread so that uneven progress evens out, each a
+    // multiple of the batch size
+    size_t rangeSize = std::max(MIN_RANGE_SIZE, (indexCount + threadCount * 4 - 1) / (threadCount * 4));
+    rangeSize = (rangeSize + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+    std::vector<std::future<void>> ranges;
+    for (size_t begin = 0; begin < indexCount; begin += rangeSize) {
+        const size_t end = std::min(begin + rangeSize, indexCount);
+        ranges.push_back(pool_.submit([&, begin, end] {
+            ExtrudeRange(positions, styleIds, indices, indexCount, styles, view, begin, end, outVertices.data(),
+                         outIndices.data());
+        }));
+    }
+    for (auto &range : ranges) {
+        range.get();
+    }
+}
+
+void CpuExtruder::ExtrudeRange(const float *positions, const uint32_t *styleIds, const uint32_t *indices,
+                               size_t indexCount, const std::vector<StyleSheet::GpuStyle> &styles, const View &view,
+                               size_t begin, size_t end, OutputVertex *outVertices, uint32_t *outIndices) const {
+    Batch batch{};
+    uint32_t batchStyleIds[BATCH_SIZE]{};
+    // Screen positions of the batch and one index on either side, like the
+    // tile of the shader. Every position is mapped once per batch.
+    float tileX[BATCH_SIZE + 2]{};
+    float tileY[BATCH_SIZE + 2]{};
+
+    for (size_t first = begin; first < end; first += BATCH_SIZE) {
+        const size_t count = std::min(BATCH_SIZE, end - first);
+        for (size_t tileId = 0; tileId < count + 2; ++tileId) {
+            const size_t id = first + tileId - 1;
+            if (id < indexCount) {
+                mapToScreen(positions, indices[id] >> 2, view, tileX[tileId], tileY[tileId]);
+            }
+        }
+
+        // Gather, as in the first half of the shader. Lanes past the end
+        // repeat the last index and are not written back.
+        for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+            const size_t tileId = std::min(lane, count - 1) + 1;
+            const size_t id = first + tileId - 1;
+            const uint32_t index = indices[id];
+            batch.x[lane] = tileX[tileId];
+            batch.y[lane] = tileY[tileId];
+            batch.prevX[lane] = tileX[tileId - 1];
+            batch.prevY[lane] = tileY[tileId - 1];
+            batch.nextX[lane] = tileX[tileId + 1];
+            batch.nextY[lane] = tileY[tileId + 1];
+            batchStyleIds[lane] = styleIds[id];
+            batch.halfWidth[lane] = styles[batchStyleIds[lane]].width * 0.5f;
+            batch.hasPrev[lane] = (index & BEGIN_BIT) == 0 && id > 0;
+            batch.hasNext[lane] = (index & END_BIT) == 0 && id + 1 < indexCount;
+        }
+
+        lineNormals(batch);
+
+        // Scatter the two offset vertices and the indices of the quad to the
+        // next index
+        for (size_t lane = 0; lane < count; ++lane) {
+            const size_t id = first + lane;
+            const auto &style = styles[batchStyleIds[lane]];
+            const float offsetX = batch.normalX[lane] * batch.halfWidth[lane];
+            const float offsetY = batch.normalY[lane] * batch.halfWidth[lane];
+            const uint32_t vertIdx = static_cast<uint32_t>(id * 2);
+            outVertices[vertIdx] = {batch.x[lane] + offsetX,
+                                    batch.y[lane] + offsetY,
+                                    {0.0f, 0.0f},
+                                    style.color[0],
+                                    style.color[1],
+                                    style.color[2],
+                                    style.color[3]};
+            outVertices[vertIdx + 1] = {batch.x[lane] - offsetX,
+                                        batch.y[lane] - offsetY,
+                                        {0.0f, 0.0f},
+                                        style.color[0],
+                                        style.color[1],
+                                        style.color[2],
+                                        style.color[3]};
+
+            uint32_t *quad = outIndices + id * 6;
+            if (batch.hasNext[lane] && view.zoom >= style.minZoom) {
+                const uint32_t nextVertIdx = vertIdx + 2;
+                quad[0] = vertIdx;
+                quad[1] = vertIdx + 1;
+                quad[2] = nextVertIdx;
+                quad[3] = nextVertIdx;
+                quad[4] = vertIdx + 1;
+                quad[5] = nextVertIdx + 1;
+            } else {
+                std::fill(quad, quad + 6, INVALID_IDX);
+            }
+        }
+    }
+}
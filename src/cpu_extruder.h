@@ -0,0 +1,62 @@
+#pragma once
+
+#include "style_sheet.h"
+
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One extruded vertex, std430 layout of OutputVertex in compute.comp.glsl
+struct OutputVertex {
+    float x, y;
+    float pad[2];
+    float r, g, b, a;
+};
+
+/**
+ * CPU implementation of compute.comp.glsl, for drivers without compute
+ * shaders and software rasterizers, where the shader runs emulated and much
+ * slower than this.
+ *
+ * Takes the same input (a lon/lat pair per node, a style id per index,
+ * indices with the node above the begin/end flags in the low bits, the style
+ * table) and writes the same output: two OutputVertex and six indices (or
+ * primitive restarts) per input index. Batches of four indices are mapped to
+ * the screen, normalized and offset together with SSE2 where available;
+ * index ranges are spread over a thread pool.
+ *
+ * The arithmetic follows the shader operation by operation in single
+ * precision, so the results match the GPU up to the precision the driver
+ * uses for division and square roots. Indices match exactly.
+ */
+class CpuExtruder {
+  public:
+    // uBounds, uScreenSize and uZoom of the shader
+    struct View {
+        float minLon;
+        float minLat;
+        float lonRange;
+        float latRange;
+        float width;
+        float height;
+        float zoom;
+    };
+
+    // 0 uses all cores, a negative number leaves that many cores free
+    explicit CpuExtruder(int threadCount = 0) : pool_{threadCount} {}
+
+    // Extrude indices[0, indexCount) into `outVertices` (2 per index) and
+    // `outIndices` (6 per index), which are resized to fit
+    void Extrude(const float *positions, const uint32_t *styleIds, const uint32_t *indices, size_t indexCount,
+                 const std::vector<StyleSheet::GpuStyle> &styles, const View &view,
+                 std::vector<OutputVertex> &outVertices, std::vector<uint32_t> &outIndices);
+
+  protected:
+    void ExtrudeRange(const float *positions, const uint32_t *styleIds, const uint32_t *indices, size_t indexCount,
+                      const std::vector<StyleSheet::GpuStyle> &styles, const View &view, size_t begin, size_t end,
+                      OutputVertex *outVertices, uint32_t *outIndices) const;
+
+    osmium::thread::Pool pool_;
+};
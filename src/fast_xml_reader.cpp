@@ -0,0 +1,755 @@
+#include "fast_xml_reader.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FAST_XML_SSE2 1
+#endif
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/xml_input.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/visitor.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#ifdef _WIN32
+#include <intrin.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+// Input per parallel task, and the size of the buffers handed to the handlers
+constexpr size_t CHUNK_SIZE = size_t{8} << 20;
+constexpr size_t BUFFER_SIZE = size_t{1} << 20;
+// Bytes of the structural character masks
+constexpr size_t BLOCK_SIZE = 64;
+// Read by Supports() to find the root element
+constexpr size_t HEADER_SIZE = 4096;
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+bool isNameEnd(char c) { return isSpace(c) || c == '/' || c == '>'; }
+
+int countTrailingZeros(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward64(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// One bit per byte of the 64 at `p` which is one of < > " '
+#ifdef FAST_XML_SSE2
+uint64_t structuralMask(const char *p) {
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i apostrophe = _mm_set1_epi8('\'');
+    uint64_t mask = 0;
+    for (size_t ii = 0; ii < BLOCK_SIZE / 16; ++ii) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + ii * 16));
+        const __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(bytes, lt), _mm_cmpeq_epi8(bytes, gt));
+        const __m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, apostrophe));
+        const __m128i hits = _mm_or_si128(brackets, quotes);
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(hits))) << (ii * 16);
+    }
+    return mask;
+}
+#else
+uint64_t structuralMask(const char *p) {
+    uint64_t mask = 0;
+    for (size_t ii = 0; ii < BLOCK_SIZE; ++ii) {
+        const char c = p[ii];
+        mask |= static_cast<uint64_t>(c == '<' || c == '>' || c == '"' || c == '\'') << ii;
+    }
+    return mask;
+}
+#endif
+
+// The positions of the structural characters of [begin, end), one mask per
+// block of 64 bytes, computed when the parser first reaches the block
+class StructuralScanner {
+  public:
+    StructuralScanner(const char *begin, const char *end) : begin_(begin), end_(end) {}
+
+    // First structural character at or after `p`, or end
+    const char *Next(const char *p) {
+        if (p >= end_) {
+            return end_;
+        }
+        const auto offset = static_cast<size_t>(p - begin_);
+        if (offset / BLOCK_SIZE != block_) {
+            Load(offset / BLOCK_SIZE);
+        }
+        uint64_t mask = mask_ & (~uint64_t{0} << (offset % BLOCK_SIZE));
+        while (mask == 0) {
+            if ((block_ + 1) * BLOCK_SIZE >= static_cast<size_t>(end_ - begin_)) {
+                return end_;
+            }
+            Load(block_ + 1);
+            mask = mask_;
+        }
+        return begin_ + block_ * BLOCK_SIZE + countTrailingZeros(mask);
+    }
+
+    // First `c` (a structural character) at or after `p`, or end
+    const char *Find(const char *p, char c) {
+        for (p = Next(p); p != end_ && *p != c; p = Next(p + 1)) {
+        }
+        return p;
+    }
+
+  protected:
+    void Load(size_t block) {
+        block_ = block;
+        const char *p = begin_ + block * BLOCK_SIZE;
+        if (end_ - p >= static_cast<std::ptrdiff_t>(BLOCK_SIZE)) {
+            mask_ = structuralMask(p);
+            return;
+        }
+        // the tail, without reading past the end of the mapping
+        char tail[BLOCK_SIZE]{};
+        std::memcpy(tail, p, static_cast<size_t>(end_ - p));
+        mask_ = structuralMask(tail) & ((uint64_t{1} << (end_ - p)) - 1);
+    }
+
+    const char *begin_;
+    const char *end_;
+    size_t block_{~size_t{0}};
+    uint64_t mask_{0};
+};
+
+// Whether an element <node, <way or <relation starts at `p`, which points at
+// a '<' followed by at least one byte before `end`
+bool isObjectStart(const char *p, const char *end) {
+    for (const std::string_view name : {"node", "way", "relation"}) {
+        if (static_cast<size_t>(end - p) > name.size() + 1 && std::memcmp(p + 1, name.data(), name.size()) == 0 &&
+            isNameEnd(p[name.size() + 1])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses the elements of one chunk into buffers
+class ChunkParser {
+  public:
+    ChunkParser(const char *fileBegin, const char *begin, const char *end, osmium::osm_entity_bits::type entities,
+                const std::function<void(osmium::memory::Buffer &)> &onBuffer)
+        : fileBegin_(fileBegin), end_(end), begin_(begin), scanner_(begin, end), entities_(entities),
+          onBuffer_(onBuffer) {}
+
+    void Parse() {
+        const char *p = begin_;
+        for (;;) {
+            p = scanner_.Find(p, '<');
+            if (p + 1 >= end_) {
+                break;
+            }
+            if (p[1] == '?') {
+                p = Skip(p, "?>");
+                continue;
+            }
+            if (p[1] == '!') {
+                p = std::string_view(p, static_cast<size_t>(end_ - p)).substr(0, 4) == "<!--" ? Skip(p, "-->")
+                                                                                               : Skip(p, ">");
+                continue;
+            }
+            if (p[1] == '/') {
+                p = Skip(p, ">");
+                continue;
+            }
+
+            const std::string_view name = Name(p + 1);
+            bool selfClosing = false;
+            const char *content = StartTag(p + 1 + name.size(), selfClosing);
+            osmium::item_type type = osmium::item_type::undefined;
+            if (name == "node") {
+                type = osmium::item_type::node;
+            } else if (name == "way") {
+                type = osmium::item_type::way;
+            } else if (name == "relation") {
+                type = osmium::item_type::relation;
+            }
+            if (type == osmium::item_type::undefined) {
+                // containers like <osm> and leaves like <bounds>: their
+                // children, if any, are read as top level elements
+                p = content;
+            } else if ((entities_ & osmium::osm_entity_bits::from_item_type(type)) == 0) {
+                p = selfClosing ? content : Skip(content, "</");
+                p = selfClosing ? p : Skip(p, ">");
+            } else {
+                p = Object(type, content, selfClosing);
+            }
+        }
+        if (buffer_.committed() > 0) {
+            onBuffer_(buffer_);
+        }
+    }
+
+  protected:
+    struct Attribute {
+        std::string_view name;
+        // still encoded
+        std::string_view value;
+    };
+
+    struct Member {
+        osmium::item_type type;
+        osmium::object_id_type ref;
+        std::string_view role;
+    };
+
+    [[noreturn]] void Fail(const char *p, const std::string &message) const {
+        throw std::runtime_error("XML input at byte " + std::to_string(p - fileBegin_) + ": " + message);
+    }
+
+    // Past the next `terminator` after `p`
+    const char *Skip(const char *p, std::string_view terminator) const {
+        const auto rest = std::string_view(p, static_cast<size_t>(end_ - p));
+        const size_t found = rest.find(terminator);
+        if (found == std::string_view::npos) {
+            Fail(p, "missing '" + std::string(terminator) + "'");
+        }
+        return p + found + terminator.size();
+    }
+
+    std::string_view Name(const char *p) const {
+        const char *begin = p;
+        while (p < end_ && !isNameEnd(*p)) {
+            ++p;
+        }
+        return {begin, static_cast<size_t>(p - begin)};
+    }
+
+    // Read the attributes of the start tag whose name ends at `p` into
+    // attributes_, returning the position after the tag
+    const char *StartTag(const char *p, bool &selfClosing) {
+        attributes_.clear();
+        for (;;) {
+            while (p < end_ && isSpace(*p)) {
+                ++p;
+            }
+            if (p >= end_) {
+                Fail(p, "unterminated tag");
+            }
+            if (*p == '>') {
+                selfClosing = false;
+                return p + 1;
+            }
+            if (*p == '/' && p + 1 < end_ && p[1] == '>') {
+                selfClosing = true;
+                return p + 2;
+            }
+
+            const char *nameBegin = p;
+            while (p < end_ && *p != '=' && !isNameEnd(*p)) {
+                ++p;
+            }
+            const std::string_view name(nameBegin, static_cast<size_t>(p - nameBegin));
+            while (p < end_ && isSpace(*p)) {
+                ++p;
+            }
+            if (p >= end_ || *p != '=') {
+                Fail(p, "expected '=' after attribute '" + std::string(name) + "'");
+            }
+            ++p;
+            while (p < end_ && isSpace(*p)) {
+                ++p;
+            }
+            if (p >= end_ || (*p != '"' && *p != '\'')) {
+                Fail(p, "expected a quoted value");
+            }
+            const char *valueBegin = p + 1;
+            p = scanner_.Find(valueBegin, *p);
+            if (p >= end_) {
+                Fail(valueBegin, "unterminated attribute value");
+            }
+            attributes_.push_back({name, {valueBegin, static_cast<size_t>(p - valueBegin)}});
+            ++p;
+        }
+    }
+
+    // The value with references replaced and whitespace normalized, as
+    // expat reports attribute values. Usually the value itself.
+    std::string_view Decode(std::string_view value) {
+        if (std::none_of(value.begin(), value.end(),
+                         [](char c) { return c == '&' || c == '\t' || c == '\n' || c == '\r'; })) {
+            return value;
+        }
+        std::string &decoded = decoded_.emplace_back();
+        for (size_t ii = 0; ii < value.size(); ++ii) {
+            const char c = value[ii];
+            if (c == '\r' && ii + 1 < value.size() && value[ii + 1] == '\n') {
+                continue;
+            }
+            if (c == '\t' || c == '\n' || c == '\r') {
+                decoded.push_back(' ');
+                continue;
+            }
+            if (c != '&') {
+                decoded.push_back(c);
+                continue;
+            }
+            const size_t semicolon = value.find(';', ii);
+            if (semicolon == std::string_view::npos) {
+                Fail(value.data() + ii, "unterminated reference");
+            }
+            const std::string_view reference = value.substr(ii + 1, semicolon - ii - 1);
+            ii = semicolon;
+            if (reference == "amp") {
+                decoded.push_back('&');
+            } else if (reference == "lt") {
+                decoded.push_back('<');
+            } else if (reference == "gt") {
+                decoded.push_back('>');
+            } else if (reference == "quot") {
+                decoded.push_back('"');
+            } else if (reference == "apos") {
+                decoded.push_back('\'');
+            } else if (reference.size() > 1 && reference[0] == '#') {
+                const bool hex = reference[1] == 'x';
+                const std::string digits(reference.substr(hex ? 2 : 1));
+                char *digitsEnd = nullptr;
+                const unsigned long code = std::strtoul(digits.c_str(), &digitsEnd, hex ? 16 : 10);
+                if (digits.empty() || *digitsEnd != '\0' || code == 0 || code > 0x10FFFF) {
+                    Fail(value.data() + ii, "invalid character reference");
+                }
+                AppendUtf8(static_cast<uint32_t>(code), decoded);
+            } else {
+                Fail(value.data() + ii, "unknown entity '" + std::string(reference) + "'");
+            }
+        }
+        return decoded;
+    }
+
+    static void AppendUtf8(uint32_t code, std::string &out) {
+        if (code < 0x80) {
+            out.push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else if (code < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+
+    int64_t Integer(std::string_view value) const {
+        const bool negative = !value.empty() && value[0] == '-';
+        const size_t first = negative ? 1 : 0;
+        if (value.size() <= first || value.size() - first > 18) {
+            Fail(value.data(), "invalid number '" + std::string(value) + "'");
+        }
+        int64_t result = 0;
+        for (size_t ii = first; ii < value.size(); ++ii) {
+            if (value[ii] < '0' || value[ii] > '9') {
+                Fail(value.data(), "invalid number '" + std::string(value) + "'");
+            }
+            result = result * 10 + (value[ii] - '0');
+        }
+        return negative ? -result : result;
+    }
+
+    // lon or lat of `location`, parsed by osmium like its own XML parser does
+    void Coordinate(std::string_view value, bool lon, osmium::Location &location) const {
+        const char *p = value.data();
+        if (lon) {
+            location.set_lon_partial(&p);
+        } else {
+            location.set_lat_partial(&p);
+        }
+        if (p != value.data() + value.size()) {
+            Fail(value.data(), "invalid coordinate '" + std::string(value) + "'");
+        }
+    }
+
+    // Parse the element of `type` whose children start at `p` and add it to
+    // the buffer, returning the position after it
+    const char *Object(osmium::item_type type, const char *p, bool selfClosing) {
+        decoded_.clear();
+        tags_.clear();
+        nodeRefs_.clear();
+        members_.clear();
+
+        // attributes of the object itself
+        osmium::object_id_type id = 0;
+        int64_t version = 0;
+        int64_t changeset = 0;
+        int64_t uid = 0;
+        bool visible = true;
+        osmium::Timestamp timestamp{};
+        std::string_view user{};
+        osmium::Location location{};
+        for (const auto &attribute : attributes_) {
+            if (attribute.name == "id") {
+                id = Integer(attribute.value);
+            } else if (attribute.name == "version") {
+                version = Integer(attribute.value);
+            } else if (attribute.name == "changeset") {
+                changeset = Integer(attribute.value);
+            } else if (attribute.name == "uid") {
+                uid = Integer(attribute.value);
+            } else if (attribute.name == "user") {
+                user = Decode(attribute.value);
+            } else if (attribute.name == "timestamp") {
+                timestamp = osmium::Timestamp{std::string(attribute.value).c_str()};
+            } else if (attribute.name == "visible") {
+                if (attribute.value != "true" && attribute.value != "false") {
+                    Fail(attribute.value.data(), "invalid visible flag");
+                }
+                visible = attribute.value == "true";
+            } else if (type == osmium::item_type::node && attribute.name == "lon") {
+                Coordinate(attribute.value, true, location);
+            } else if (type == osmium::item_type::node && attribute.name == "lat") {
+                Coordinate(attribute.value, false, location);
+            }
+        }
+
+        // children up to the end tag
+        while (!selfClosing) {
+            p = scanner_.Find(p, '<');
+            if (p + 1 >= end_) {
+                Fail(p, "unterminated element");
+            }
+            if (p[1] == '/') {
+                p = Skip(p, ">");
+                break;
+            }
+            if (p[1] == '!') {
+                p = Skip(p, "-->");
+                continue;
+            }
+            const std::string_view name = Name(p + 1);
+            bool childSelfClosing = false;
+            p = StartTag(p + 1 + name.size(), childSelfClosing);
+            if (!childSelfClosing) {
+                p = Skip(Skip(p, "</"), ">");
+            }
+            Child(name);
+        }
+
+        {
+            auto setAttributes = [&](auto &builder) {
+                auto &object = builder.object();
+                object.set_id(id);
+                object.set_version(static_cast<osmium::object_version_type>(version));
+                object.set_changeset(static_cast<osmium::changeset_id_type>(changeset));
+                object.set_uid_from_signed(static_cast<osmium::signed_user_id_type>(uid));
+                object.set_timestamp(timestamp);
+                object.set_visible(visible);
+                builder.set_user(user.data(), static_cast<osmium::string_size_type>(user.size()));
+            };
+            auto addTags = [&](osmium::builder::Builder &parent) {
+                if (tags_.empty()) {
+                    return;
+                }
+                osmium::builder::TagListBuilder tags{parent};
+                for (const auto &[key, value] : tags_) {
+                    tags.add_tag(key.data(), key.size(), value.data(), value.size());
+                }
+            };
+
+            // children in the order the libosmium parser adds them for OSM
+            // files, which list nodes and members before tags
+            if (type == osmium::item_type::node) {
+                osmium::builder::NodeBuilder builder{buffer_};
+                builder.object().set_location(location);
+                setAttributes(builder);
+                addTags(builder);
+            } else if (type == osmium::item_type::way) {
+                osmium::builder::WayBuilder builder{buffer_};
+                setAttributes(builder);
+                if (!nodeRefs_.empty()) {
+                    osmium::builder::WayNodeListBuilder nodes{builder};
+                    for (const auto &nodeRef : nodeRefs_) {
+                        nodes.add_node_ref(nodeRef);
+                    }
+                }
+                addTags(builder);
+            } else {
+                osmium::builder::RelationBuilder builder{buffer_};
+                setAttributes(builder);
+                if (!members_.empty()) {
+                    osmium::builder::RelationMemberListBuilder members{builder};
+                    for (const auto &member : members_) {
+                        members.add_member(member.type, member.ref, member.role.data(), member.role.size());
+                    }
+                }
+                addTags(builder);
+            }
+        }
+        buffer_.commit();
+
+        if (buffer_.committed() >= BUFFER_SIZE) {
+            onBuffer_(buffer_);
+            buffer_ = osmium::memory::Buffer{BUFFER_SIZE * 2, osmium::memory::Buffer::auto_grow::yes};
+        }
+        return p;
+    }
+
+    // Record the <tag>, <nd> or <member> whose attributes are in attributes_
+    void Child(std::string_view name) {
+        auto attribute = [this](std::string_view attributeName) -> const Attribute * {
+            for (const auto &attribute : attributes_) {
+                if (attribute.name == attributeName) {
+                    return &attribute;
+                }
+            }
+            return nullptr;
+        };
+
+        if (name == "tag") {
+            const auto *key = attribute("k");
+            const auto *value = attribute("v");
+            if (!key || !value) {
+                Fail(name.data(), "<tag> without k or v");
+            }
+            tags_.emplace_back(Decode(key->value), Decode(value->value));
+        } else if (name == "nd") {
+            const auto *ref = attribute("ref");
+            if (!ref) {
+                Fail(name.data(), "<nd> without ref");
+            }
+            osmium::Location location{};
+            if (const auto *lon = attribute("lon")) {
+                Coordinate(lon->value, true, location);
+            }
+            if (const auto *lat = attribute("lat")) {
+                Coordinate(lat->value, false, location);
+            }
+            nodeRefs_.emplace_back(Integer(ref->value), location);
+        } else if (name == "member") {
+            const auto *type = attribute("type");
+            const auto *ref = attribute("ref");
+            const auto *role = attribute("role");
+            if (!type || !ref) {
+                Fail(name.data(), "<member> without type or ref");
+            }
+            osmium::item_type itemType = osmium::item_type::undefined;
+            if (type->value == "node") {
+                itemType = osmium::item_type::node;
+            } else if (type->value == "way") {
+                itemType = osmium::item_type::way;
+            } else if (type->value == "relation") {
+                itemType = osmium::item_type::relation;
+            } else {
+                Fail(type->value.data(), "unknown member type '" + std::string(type->value) + "'");
+            }
+            members_.push_back({itemType, Integer(ref->value), role ? Decode(role->value) : std::string_view{}});
+        }
+    }
+
+    const char *fileBegin_;
+    const char *end_;
+    const char *begin_;
+    StructuralScanner scanner_;
+    osmium::osm_entity_bits::type entities_;
+    const std::function<void(osmium::memory::Buffer &)> &onBuffer_;
+    osmium::memory::Buffer buffer_{BUFFER_SIZE * 2, osmium::memory::Buffer::auto_grow::yes};
+
+    std::vector<Attribute> attributes_;
+    // decoded values of the current object; a deque so views stay valid
+    std::deque<std::string> decoded_;
+    std::vector<std::pair<std::string_view, std::string_view>> tags_;
+    std::vector<osmium::NodeRef> nodeRefs_;
+    std::vector<Member> members_;
+};
+
+// Every object as one line of text, to compare the two readers
+struct DescribeHandler : public osmium::handler::Handler {
+    std::deque<std::string> descriptions;
+
+    void describe(const osmium::OSMObject &object, std::ostringstream &out) {
+        out << osmium::item_type_to_name(object.type()) << ' ' << object.id() << " v" << object.version() << " c"
+            << object.changeset() << " u" << object.uid() << ' ' << object.timestamp().to_iso() << " '"
+            << object.user() << "' " << (object.visible() ? "visible" : "deleted") << " tags";
+        for (const auto &tag : object.tags()) {
+            out << " '" << tag.key() << "'='" << tag.value() << "'";
+        }
+    }
+
+    void node(const osmium::Node &node) {
+        std::ostringstream out;
+        describe(node, out);
+        out << " at " << node.location().x() << ',' << node.location().y();
+        descriptions.push_back(out.str());
+    }
+
+    void way(const osmium::Way &way) {
+        std::ostringstream out;
+        describe(way, out);
+        out << " nodes";
+        for (const auto &nodeRef : way.nodes()) {
+            out << ' ' << nodeRef.ref();
+        }
+        descriptions.push_back(out.str());
+    }
+
+    void relation(const osmium::Relation &relation) {
+        std::ostringstream out;
+        describe(relation, out);
+        out << " members";
+        for (const auto &member : relation.members()) {
+            out << ' ' << osmium::item_type_to_name(member.type()) << ' ' << member.ref() << " '" << member.role()
+                << "'";
+        }
+        descriptions.push_back(out.str());
+    }
+};
+} // namespace
+
+FastXmlReader::FastXmlReader(const std::string &filepath) {
+    fd_ = osmium::io::detail::open_for_reading(filepath);
+    size_ = osmium::util::file_size(fd_);
+    boundaries_.push_back(0);
+    if (size_ > 0) {
+        mapping_ = std::make_unique<osmium::util::MemoryMapping>(
+            size_, osmium::util::MemoryMapping::mapping_mode::readonly, fd_);
+        data_ = mapping_->get_addr<char>();
+
+        // Split at the first object after every CHUNK_SIZE bytes
+        for (size_t offset = CHUNK_SIZE; offset < size_; offset += CHUNK_SIZE) {
+            const char *p = data_ + offset;
+            const char *end = data_ + size_;
+            while ((p = static_cast<const char *>(std::memchr(p, '<', static_cast<size_t>(end - p)))) != nullptr &&
+                   !isObjectStart(p, end)) {
+                ++p;
+            }
+            if (!p) {
+                break;
+            }
+            if (static_cast<size_t>(p - data_) > boundaries_.back()) {
+                boundaries_.push_back(static_cast<size_t>(p - data_));
+            }
+        }
+    }
+    boundaries_.push_back(size_);
+}
+
+FastXmlReader::~FastXmlReader() {
+    mapping_.reset();
+    if (fd_ >= 0) {
+#ifdef _WIN32
+        _close(fd_);
+#else
+        ::close(fd_);
+#endif
+    }
+}
+
+bool FastXmlReader::Supports(const std::string &filepath) {
+    const std::string suffix = ".osm";
+    if (filepath.size() < suffix.size() || filepath.compare(filepath.size() - suffix.size(), suffix.size(), suffix)) {
+        return false;
+    }
+
+    // The root element has to be <osm>, not <osmChange>
+    std::ifstream file(filepath, std::ios::binary);
+    std::string header(HEADER_SIZE, '\0');
+    file.read(header.data(), static_cast<std::streamsize>(header.size()));
+    header.resize(static_cast<size_t>(file.gcount()));
+    for (size_t pos = header.find('<'); pos != std::string::npos; pos = header.find('<', pos)) {
+        if (header.compare(pos, 4, "<!--") == 0) {
+            pos = header.find("-->", pos);
+        } else if (header.compare(pos, 2, "<?") == 0 || header.compare(pos, 2, "<!") == 0) {
+            pos = header.find('>', pos);
+        } else {
+            return header.compare(pos, 4, "<osm") == 0 && pos + 4 < header.size() && isNameEnd(header[pos + 4]);
+        }
+    }
+    return false;
+}
+
+void FastXmlReader::ParseChunk(size_t chunk, osmium::osm_entity_bits::type entities,
+                               const std::function<void(osmium::memory::Buffer &)> &onBuffer) const {
+    ChunkParser parser(data_, data_ + boundaries_[chunk], data_ + boundaries_[chunk + 1], entities, onBuffer);
+    parser.Parse();
+}
+
+bool FastXmlReader::Validate(const std::string &filepath) {
+    if (!Supports(filepath)) {
+        std::cerr << filepath << " is not an uncompressed OSM XML file." << std::endl;
+        return false;
+    }
+
+    try {
+        const FastXmlReader fast(filepath);
+        osmium::io::Reader reader{osmium::io::File{filepath}, osmium::osm_entity_bits::nwr};
+        DescribeHandler expected;
+        auto readExpected = [&] {
+            while (expected.descriptions.empty()) {
+                osmium::memory::Buffer buffer = reader.read();
+                if (!buffer) {
+                    return false;
+                }
+                osmium::apply(buffer, expected);
+            }
+            return true;
+        };
+
+        // Parse chunk by chunk, in step with the libosmium reader
+        size_t compared = 0;
+        bool matches = true;
+        for (size_t chunk = 0; chunk < fast.ChunkCount() && matches; ++chunk) {
+            fast.ParseChunk(chunk, osmium::osm_entity_bits::nwr, [&](osmium::memory::Buffer &buffer) {
+                DescribeHandler actual;
+                osmium::apply(buffer, actual);
+                for (const auto &description : actual.descriptions) {
+                    if (!matches) {
+                        return;
+                    }
+                    if (!readExpected()) {
+                        std::cerr << "Object " << compared << " is not in the libosmium result: " << description
+                                  << std::endl;
+                        matches = false;
+                    } else if (expected.descriptions.front() != description) {
+                        std::cerr << "Object " << compared << " differs:\n  libosmium: "
+                                  << expected.descriptions.front() << "\n  fast:      " << description << std::endl;
+                        matches = false;
+                    } else {
+                        expected.descriptions.pop_front();
+                        ++compared;
+                    }
+                }
+            });
+        }
+        if (matches && readExpected()) {
+            std::cerr << "Object " << compared << " is missing: " << expected.descriptions.front() << std::endl;
+            matches = false;
+        }
+        reader.close();
+
+        if (matches) {
+            std::cout << "The fast XML reader matches libosmium on all " << compared << " objects ("
+                      << fast.ChunkCount() << " chunks)" << std::endl;
+        }
+        return matches;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Reader for plain OSM XML files (.osm) which memory maps the file and parses
+ * parts of it in parallel, as a faster alternative to osmium::io::Reader.
+ *
+ * Only the XML that OSM files use is understood: <node>, <way> and
+ * <relation> with their <tag>, <nd> and <member> children. Other elements
+ * such as <osm> and <bounds>, comments and processing instructions are
+ * skipped. Attribute values are decoded like expat does: entity and
+ * character references are replaced and literal whitespace becomes a space.
+ *
+ * A first stage marks the structural characters (< > " ') of 64 bytes at a
+ * time with SSE2 in a bit mask, and the parser jumps from one to the next
+ * instead of looking at every byte. Elements do not nest in OSM files and '<'
+ * can not appear in attribute values, so the file is split into chunks at the
+ * first <node>, <way> or <relation> after every few MiB, and the chunks are
+ * parsed independently. They fill osmium::memory::Buffer with the same
+ * objects as the libosmium reader, so the handlers of the loader run on them
+ * unchanged; Validate() checks that for a given file.
+ */
+class FastXmlReader {
+  public:
+    // Map `filepath`; throws std::system_error if it can not be read
+    explicit FastXmlReader(const std::string &filepath);
+    ~FastXmlReader();
+    FastXmlReader(const FastXmlReader &) = delete;
+    FastXmlReader &operator=(const FastXmlReader &) = delete;
+
+    // True for uncompressed OSM XML files, false for anything else
+    // (compressed, PBF, OsmChange) which is left to libosmium
+    static bool Supports(const std::string &filepath);
+
+    // Read `filepath` with this reader and with libosmium and compare every
+    // object, printing the first difference
+    static bool Validate(const std::string &filepath);
+
+    size_t ChunkCount() const { return boundaries_.size() - 1; }
+
+    // Parse the objects of the `entities` types in chunk `chunk`, calling
+    // `onBuffer` for each filled buffer. Throws std::runtime_error on input
+    // outside of the subset above.
+    void ParseChunk(size_t chunk, osmium::osm_entity_bits::type entities,
+                    const std::function<void(osmium::memory::Buffer &)> &onBuffer) const;
+
+    // Run `process` on every buffer of the `entities` in `pool`, the chunks
+    // parsed in parallel, and hand the results to `consume` in file order
+    // as the chunks complete. Only a few chunks per thread are in flight.
+    template <typename TProcess, typename TConsume>
+    void Stream(osmium::osm_entity_bits::type entities, osmium::thread::Pool &pool, const TProcess &process,
+                const TConsume &consume) const {
+        using Result = std::invoke_result_t<const TProcess &, osmium::memory::Buffer &>;
+        const size_t window = CHUNKS_PER_THREAD * static_cast<size_t>(std::max(1, pool.num_threads()));
+        std::deque<std::future<std::vector<Result>>> futures;
+        auto consumeFront = [&] {
+            std::vector<Result> results = futures.front().get();
+            futures.pop_front();
+            for (auto &result : results) {
+                consume(result);
+            }
+        };
+        try {
+            for (size_t chunk = 0; chunk < ChunkCount(); ++chunk) {
+                futures.push_back(pool.submit([this, chunk, entities, &process] {
+                    std::vector<Result> results;
+                    ParseChunk(chunk, entities,
+                               [&](osmium::memory::Buffer &buffer) { results.push_back(process(buffer)); });
+                    return results;
+                }));
+                if (futures.size() >= window) {
+                    consumeFront();
+                }
+            }
+            while (!futures.empty()) {
+                consumeFront();
+            }
+        } catch (...) {
+            // Every chunk task references `process` and the mapping, so all
+            // of them have to finish before an error is passed on
+            for (auto &future : futures) {
+                if (future.valid()) {
+                    future.wait();
+                }
+            }
+            throw;
+        }
+    }
+
+    // Stream() into a vector of the results in file order
+    template <typename TFunction>
+    auto Process(osmium::osm_entity_bits::type entities, osmium::thread::Pool &pool, const TFunction &process) const {
+        using Result = std::invoke_result_t<const TFunction &, osmium::memory::Buffer &>;
+        std::vector<Result> results;
+        Stream(entities, pool, process, [&results](Result &result) { results.push_back(std::move(result)); });
+        return results;
+    }
+
+  protected:
+    // chunks in flight per thread while streaming
+    static constexpr size_t CHUNKS_PER_THREAD = 2;
+
+    int fd_{-1};
+    std::unique_ptr<osmium::util::MemoryMapping> mapping_{};
+    const char *data_{nullptr};
+    size_t size_{0};
+    // offsets of the chunks, the last one the end of the file
+    std::vector<size_t> boundaries_{};
+};
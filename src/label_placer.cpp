@@ -0,0 +1,278 @@
+#include "label_placer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+// Largest change of direction between neighbouring glyphs, cos(30 degrees)
+constexpr float MIN_GLYPH_DOT = 0.866f;
+// Distance kept between labels, in pixels
+constexpr float LABEL_PADDING = 2.0f;
+// Offset from the baseline to the middle of lower case letters, in em
+constexpr float BASELINE_SHIFT = 0.35f;
+// Check the clock only every few candidates
+constexpr size_t BUDGET_CHECK_INTERVAL = 16;
+} // namespace
+
+bool LabelPlacer::View::operator==(const View &other) const {
+    return minLon == other.minLon && minLat == other.minLat && lonRange == other.lonRange &&
+           latRange == other.latRange && width == other.width && height == other.height && zoom == other.zoom;
+}
+
+void LabelPlacer::SetCandidates(std::vector<Candidate> candidates) {
+    candidates_ = std::move(candidates);
+
+    // Most important first, longer routes before shorter ones
+    std::vector<double> lengths(candidates_.size(), 0.0);
+    for (size_t ii = 0; ii < candidates_.size(); ++ii) {
+        const auto &path = candidates_[ii].path;
+        for (size_t jj = 1; jj < path.size(); ++jj) {
+            lengths[ii] += std::hypot(path[jj].lon() - path[jj - 1].lon(), path[jj].lat() - path[jj - 1].lat());
+        }
+    }
+    std::vector<size_t> order(candidates_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (candidates_[a].priority != candidates_[b].priority) {
+            return candidates_[a].priority > candidates_[b].priority;
+        }
+        return lengths[a] > lengths[b];
+    });
+    std::vector<Candidate> sorted;
+    sorted.reserve(candidates_.size());
+    for (size_t index : order) {
+        sorted.push_back(std::move(candidates_[index]));
+    }
+    candidates_ = std::move(sorted);
+
+    candidateBounds_.clear();
+    for (const auto &candidate : candidates_) {
+        osmium::Box bounds;
+        for (const auto &location : candidate.path) {
+            bounds.extend(location);
+        }
+        candidateBounds_.push_back(bounds);
+    }
+
+    placedGeneration_.assign(candidates_.size(), 0);
+    placed_.clear();
+    previous_.clear();
+    hasView_ = false;
+}
+
+bool LabelPlacer::Place(const View &view, std::chrono::microseconds budget, TextRenderer &text) {
+    if (!hasView_ || !(view == view_)) {
+        // Start over, keeping the labels of the previous view first in line
+        previous_.clear();
+        for (const auto &label : placed_) {
+            previous_.push_back(label.candidate);
+        }
+        previousCursor_ = 0;
+        cursor_ = 0;
+        placed_.clear();
+        ++generation_;
+        view_ = view;
+        hasView_ = true;
+        ResetGrid();
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + budget;
+    size_t attempts = 0;
+    auto outOfTime = [&]() {
+        return ++attempts % BUDGET_CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() > deadline;
+    };
+
+    while (previousCursor_ < previous_.size()) {
+        const size_t candidate = previous_[previousCursor_++];
+        if (candidate < candidates_.size() && placedGeneration_[candidate] != generation_) {
+            TryPlace(candidate, text);
+        }
+        if (outOfTime()) {
+            return false;
+        }
+    }
+    while (cursor_ < candidates_.size()) {
+        const size_t candidate = cursor_++;
+        if (placedGeneration_[candidate] != generation_) {
+            TryPlace(candidate, text);
+        }
+        if (outOfTime()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LabelPlacer::TryPlace(size_t candidateIndex, TextRenderer &text) {
+    const auto &candidate = candidates_[candidateIndex];
+    if (view_.zoom < candidate.minZoom || candidate.path.size() < 2) {
+        return false;
+    }
+
+    const auto &bounds = candidateBounds_[candidateIndex];
+    if (bounds.right() < view_.minLon || bounds.left() > view_.minLon + view_.lonRange ||
+        bounds.top() < view_.minLat || bounds.bottom() > view_.minLat + view_.latRange) {
+        return false;
+    }
+
+    // Project the route and measure it
+    const size_t pointCount = candidate.path.size();
+    screenPath_.resize(pointCount * 2);
+    pathLength_.resize(pointCount);
+    for (size_t ii = 0; ii < pointCount; ++ii) {
+        const auto &location = candidate.path[ii];
+        screenPath_[ii * 2] = static_cast<float>((location.lon() - view_.minLon) / view_.lonRange * view_.width);
+        screenPath_[ii * 2 + 1] = static_cast<float>((location.lat() - view_.minLat) / view_.latRange * view_.height);
+        pathLength_[ii] = ii == 0 ? 0.0f
+                                  : pathLength_[ii - 1] + std::hypot(screenPath_[ii * 2] - screenPath_[ii * 2 - 2],
+                                                                     screenPath_[ii * 2 + 1] - screenPath_[ii * 2 - 1]);
+    }
+    const float totalLength = pathLength_.back();
+    const float textWidth = text.Measure(candidate.text, fontSize_);
+    if (textWidth <= 0.0f || totalLength < textWidth + 2.0f * LABEL_PADDING) {
+        return false;
+    }
+
+    // Point and direction at arc length `s`
+    auto sample = [this](float s, float &x, float &y, float &dirX, float &dirY) {
+        size_t segment = std::upper_bound(pathLength_.begin(), pathLength_.end(), s) - pathLength_.begin();
+        segment = std::clamp<size_t>(segment, 1, pathLength_.size() - 1);
+        // skip zero length segments
+        while (segment + 1 < pathLength_.size() && pathLength_[segment] == pathLength_[segment - 1]) {
+            ++segment;
+        }
+        const float length = pathLength_[segment] - pathLength_[segment - 1];
+        const float t = length > 0.0f ? (s - pathLength_[segment - 1]) / length : 0.0f;
+        const float x0 = screenPath_[segment * 2 - 2];
+        const float y0 = screenPath_[segment * 2 - 1];
+        const float dx = screenPath_[segment * 2] - x0;
+        const float dy = screenPath_[segment * 2 + 1] - y0;
+        x = x0 + t * dx;
+        y = y0 + t * dy;
+        dirX = length > 0.0f ? dx / length : 1.0f;
+        dirY = length > 0.0f ? dy / length : 0.0f;
+    };
+
+    std::vector<PlacedGlyph> glyphs;
+    std::vector<Box> boxes;
+    // Try the middle of the route first, then halfway to either end
+    for (float anchor : {0.5f, 0.25f, 0.75f}) {
+        const float start = anchor * totalLength - 0.5f * textWidth;
+        const float end = start + textWidth;
+        if (start < LABEL_PADDING || end > totalLength - LABEL_PADDING) {
+            continue;
+        }
+
+        // Keep the text upright: read along the route or against it
+        float x0, y0, x1, y1, dirX, dirY;
+        sample(start, x0, y0, dirX, dirY);
+        sample(end, x1, y1, dirX, dirY);
+        const bool reversed = x1 < x0;
+
+        glyphs.clear();
+        boxes.clear();
+        bool fits = true;
+        float offset = 0.0f;
+        float prevDirX = 0.0f;
+        float prevDirY = 0.0f;
+        for (char32_t codepoint : candidate.text) {
+            const auto *glyph = text.Atlas().Get(codepoint);
+            if (!glyph) {
+                continue;
+            }
+            const float advance = glyph->advance * fontSize_;
+            const float s = reversed ? end - offset - 0.5f * advance : start + offset + 0.5f * advance;
+            offset += advance;
+
+            float x, y;
+            sample(s, x, y, dirX, dirY);
+            if (reversed) {
+                dirX = -dirX;
+                dirY = -dirY;
+            }
+            if (!glyphs.empty() && dirX * prevDirX + dirY * prevDirY < MIN_GLYPH_DOT) {
+                fits = false;
+                break;
+            }
+            prevDirX = dirX;
+            prevDirY = dirY;
+
+            const float halfSize = 0.5f * fontSize_ * std::max(glyph->advance, 0.7f) + LABEL_PADDING;
+            const Box box{x - halfSize, y - halfSize, x + halfSize, y + halfSize};
+            if (box.x0 < 0.0f || box.y0 < 0.0f || box.x1 > view_.width || box.y1 > view_.height) {
+                fits = false;
+                break;
+            }
+            boxes.push_back(box);
+
+            // pen on the baseline, shifted so the text is centered on the route
+            const float shift = BASELINE_SHIFT * fontSize_;
+            glyphs.push_back(PlacedGlyph{glyph, x - dirX * 0.5f * advance + dirY * shift,
+                                         y - dirY * 0.5f * advance - dirX * shift, dirX, dirY});
+        }
+
+        if (fits && !glyphs.empty() && !Collides(boxes)) {
+            Insert(boxes);
+            placed_.push_back(PlacedLabel{candidateIndex, std::move(glyphs)});
+            placedGeneration_[candidateIndex] = generation_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void LabelPlacer::Draw(TextRenderer &text, uint32_t color, uint32_t haloColor) const {
+    for (const auto &label : placed_) {
+        for (const auto &glyph : label.glyphs) {
+            text.AddGlyph(*glyph.glyph, glyph.x, glyph.y, glyph.dirX, glyph.dirY, fontSize_, color, haloColor);
+        }
+    }
+}
+
+void LabelPlacer::ResetGrid() {
+    columns_ = std::max(1, static_cast<int>(std::ceil(view_.width / CELL_SIZE)));
+    rows_ = std::max(1, static_cast<int>(std::ceil(view_.height / CELL_SIZE)));
+    cells_.resize(static_cast<size_t>(columns_) * rows_);
+    // keep the capacity of the cells, they fill up the same way every time
+    for (auto &cell : cells_) {
+        cell.clear();
+    }
+    boxes_.clear();
+}
+
+bool LabelPlacer::Collides(const std::vector<Box> &boxes) const {
+    for (const auto &box : boxes) {
+        const int cx0 = std::clamp(static_cast<int>(box.x0 / CELL_SIZE), 0, columns_ - 1);
+        const int cx1 = std::clamp(static_cast<int>(box.x1 / CELL_SIZE), 0, columns_ - 1);
+        const int cy0 = std::clamp(static_cast<int>(box.y0 / CELL_SIZE), 0, rows_ - 1);
+        const int cy1 = std::clamp(static_cast<int>(box.y1 / CELL_SIZE), 0, rows_ - 1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) {
+                for (uint32_t index : cells_[static_cast<size_t>(cy) * columns_ + cx]) {
+                    const auto &other = boxes_[index];
+                    if (box.x0 < other.x1 && other.x0 < box.x1 && box.y0 < other.y1 && other.y0 < box.y1) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void LabelPlacer::Insert(const std::vector<Box> &boxes) {
+    for (const auto &box : boxes) {
+        const auto index = static_cast<uint32_t>(boxes_.size());
+        boxes_.push_back(box);
+        const int cx0 = std::clamp(static_cast<int>(box.x0 / CELL_SIZE), 0, columns_ - 1);
+        const int cx1 = std::clamp(static_cast<int>(box.x1 / CELL_SIZE), 0, columns_ - 1);
+        const int cy0 = std::clamp(static_cast<int>(box.y0 / CELL_SIZE), 0, rows_ - 1);
+        const int cy1 = std::clamp(static_cast<int>(box.y1 / CELL_SIZE), 0, rows_ - 1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) {
+                cells_[static_cast<size_t>(cy) * columns_ + cx].push_back(index);
+            }
+        }
+    }
+}
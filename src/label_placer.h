@@ -0,0 +1,110 @@
+#pragma once
+
+#include "osm_loader.h"
+#include "text_renderer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Places route names along their polylines.
+ *
+ * Every named route is a label candidate. Candidates are tried in priority
+ * order (style z-order, then length) and a candidate is placed when its
+ * glyphs, laid out along a not too curvy stretch of the projected route, do
+ * not overlap any label placed before. Overlap tests go through a uniform
+ * grid of glyph boxes in screen space.
+ *
+ * Placement is incremental: Place() stops when its time budget is used up
+ * and continues on the next call. When the view changes the labels placed
+ * for the previous view are tried first, so labels stay put while panning
+ * and zooming instead of flickering between candidates.
+ */
+class LabelPlacer {
+  public:
+    // Maps lon/lat to screen pixels (y-up)
+    struct View {
+        double minLon;
+        double minLat;
+        double lonRange;
+        double latRange;
+        float width;
+        float height;
+        double zoom;
+
+        bool operator==(const View &other) const;
+    };
+
+    struct Candidate {
+        osmium::object_id_type id;
+        std::u32string text;
+        OSMLoader::Coordinates path;
+        int priority;
+        float minZoom;
+    };
+
+    // Replace all candidates and start over
+    void SetCandidates(std::vector<Candidate> candidates);
+
+    void SetFontSize(float size) { fontSize_ = size; }
+
+    // Continue placing labels for `view` for at most `budget`. Returns true
+    // once all candidates were considered for this view.
+    bool Place(const View &view, std::chrono::microseconds budget, TextRenderer &text);
+
+    // Queue the glyphs of all placed labels
+    void Draw(TextRenderer &text, uint32_t color, uint32_t haloColor) const;
+
+    size_t PlacedCount() const { return placed_.size(); }
+
+  protected:
+    struct Box {
+        float x0, y0, x1, y1;
+    };
+
+    struct PlacedGlyph {
+        const GlyphAtlas::Glyph *glyph;
+        float x, y;
+        float dirX, dirY;
+    };
+
+    struct PlacedLabel {
+        size_t candidate;
+        std::vector<PlacedGlyph> glyphs;
+    };
+
+    bool TryPlace(size_t candidateIndex, TextRenderer &text);
+    bool Collides(const std::vector<Box> &boxes) const;
+    void Insert(const std::vector<Box> &boxes);
+    void ResetGrid();
+
+    std::vector<Candidate> candidates_{};
+    // candidate bounding boxes in lon/lat, for culling
+    std::vector<osmium::Box> candidateBounds_{};
+    std::vector<uint32_t> placedGeneration_{};
+
+    float fontSize_{13.0f};
+
+    View view_{};
+    bool hasView_{false};
+    uint32_t generation_{0};
+
+    // candidates to try first: the labels placed for the previous view
+    std::vector<size_t> previous_{};
+    size_t previousCursor_{0};
+    size_t cursor_{0};
+    std::vector<PlacedLabel> placed_{};
+
+    // collision grid
+    static constexpr float CELL_SIZE = 32.0f;
+    int columns_{0};
+    int rows_{0};
+    std::vector<std::vector<uint32_t>> cells_{};
+    std::vector<Box> boxes_{};
+
+    // scratch buffers of TryPlace
+    std::vector<float> screenPath_{};
+    std::vector<float> pathLength_{};
+};
@@ -1,6 +1,8 @@
 
 #include "openglcanvas.h"
 #include "osm_loader.h"
+#include "style_sheet.h"
+#include "tag_filter.h"
 
 // TODO: move the wxWidgets functionality into a separate module
 #include <wx/cmdline.h>
@@ -9,10 +11,13 @@
 #include <wx/log.h>
 #include <wx/settings.h>
 #include <wx/splitter.h>
+#include <wx/stdpaths.h>
 #include <wx/stc/stc.h>
 #include <wx/wx.h>
 
 #include <memory>
+#include <optional>
+#include <set>
 
 constexpr size_t IndentWidth = 4;
 
@@ -24,10 +29,31 @@ class MyApp : public wxApp {
     bool OnInit() wxOVERRIDE;
     void OnInitCmdLine(wxCmdLineParser &parser) wxOVERRIDE;
     bool OnCmdLineParsed(wxCmdLineParser &parser) wxOVERRIDE;
+    void OnEventLoopEnter(wxEventLoopBase *loop) wxOVERRIDE;
 
   protected:
     wxString osmDataFilePath_{};
+    wxString shaderDirectory_{};
+    wxString changeDirectory_{};
+    bool useProgramCache_{true};
+    long threadCount_{0};
+    double boundsMargin_{-1.0};
+    OSMLoader::NodeIndex nodeIndex_{OSMLoader::NodeIndex::Auto};
+    TagFilter routeFilter_{TagFilter::DefaultRoutes()};
+    TagFilter areaFilter_{TagFilter::DefaultAreas()};
+    bool fastXml_{false};
+    bool vsync_{true};
+    bool benchmark_{false};
+    // picked by the canvas when not given
+    std::optional<OpenGLCanvas::RenderPath> renderPath_{};
+    bool benchmarkRenderPaths_{false};
+    bool validateCpuExtrusion_{false};
+    long workgroupSize_{0};
+    bool benchmarkWorkgroupSizes_{false};
+    bool measureLocality_{false};
+    bool gpuCulling_{true};
     osmium::Box bounds_{};
+    StyleSheet styleSheet_{StyleSheet::Default()};
     MyFrame *frame_{nullptr};
     std::shared_ptr<OSMLoader> osmLoader_{nullptr};
 };
@@ -35,17 +61,59 @@ class MyApp : public wxApp {
 class MyFrame : public wxFrame {
   public:
     MyFrame(const wxString &title);
-    bool initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmium::Box &bounds);
+    bool initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmium::Box &bounds,
+                    const StyleSheet &styleSheet, const wxString &shaderDirectory, bool useProgramCache);
     bool BuildShaderProgram();
+    void SetFramePacing(bool vsync, bool benchmark);
+    void SetRenderPath(OpenGLCanvas::RenderPath path);
+    // Compare the render paths once OpenGL is initialized, then close
+    void BenchmarkRenderPaths() { benchmarkRenderPaths_ = true; }
+    // Compare the CPU extrusion with the compute shader once OpenGL is
+    // initialized, then close
+    void ValidateCpuExtrusion() { validateCpuExtrusion_ = true; }
+    void SetComputeWorkgroupSize(unsigned int size);
+    // Time the compute shader for every workgroup size once OpenGL is
+    // initialized, then close
+    void BenchmarkWorkgroupSizes() { benchmarkWorkgroupSizes_ = true; }
+    // Compare the buffer layouts once OpenGL is initialized, then close
+    void MeasureLocality() { measureLocality_ = true; }
+    void SetGpuCulling(bool enabled);
+
+    // Recompile the shaders whenever they change in `shaderDirectory`. Needs a
+    // running event loop.
+    void WatchShaderDirectory(const wxString &shaderDirectory);
+
+    // Apply OsmChange files (*.osc, *.osc.gz) as they appear in
+    // `changeDirectory`. Needs a running event loop.
+    void WatchChangeDirectory(const wxString &changeDirectory);
 
   protected:
     void OnOpenGLInitialized(wxCommandEvent &event);
+    void OnFileSystemChanged(wxFileSystemWatcherEvent &event);
+    void OnShaderFileChanged(const wxFileName &path);
+    void OnChangeFileChanged(const wxFileName &path);
+    void ApplyPendingChanges();
+    wxFileSystemWatcher &FileSystemWatcher();
     void StylizeTextCtrl();
     void OnSize(wxSizeEvent &event);
 
     OpenGLCanvas *openGLCanvas{nullptr};
 
     std::shared_ptr<OSMLoader> osmLoader_{nullptr};
+
+    std::unique_ptr<wxFileSystemWatcher> fileSystemWatcher_{};
+    wxFileName shaderDirectory_{};
+    bool shaderReloadPending_{false};
+    bool benchmarkRenderPaths_{false};
+    bool validateCpuExtrusion_{false};
+    bool benchmarkWorkgroupSizes_{false};
+    bool measureLocality_{false};
+
+    wxFileName changeDirectory_{};
+    // Change files waiting to be applied, ordered by name since diff
+    // replication names them by sequence number
+    std::set<wxString> pendingChangeFiles_{};
+    std::set<wxString> appliedChangeFiles_{};
 };
 
 wxIMPLEMENT_APP(MyApp);
@@ -56,16 +124,60 @@ bool MyApp::OnInit() {
 
     osmLoader_ = std::make_shared<OSMLoader>();
     osmLoader_->setFilepath(osmDataFilePath_.ToStdString());
+    osmLoader_->addTagKeys(styleSheet_.TagKeys());
+    osmLoader_->setThreadCount(static_cast<int>(threadCount_));
+    if (boundsMargin_ >= 0.0) {
+        osmLoader_->setBoundsMargin(boundsMargin_);
+    }
+    osmLoader_->setNodeIndex(nodeIndex_);
+    osmLoader_->setRouteFilter(routeFilter_);
+    osmLoader_->setAreaFilter(areaFilter_);
+    osmLoader_->setFastXml(fastXml_);
 
     frame_ = new MyFrame("OpenStreetMap: " + osmDataFilePath_);
-    if (!frame_->initialize(osmLoader_, bounds_)) {
+    if (!frame_->initialize(osmLoader_, bounds_, styleSheet_, shaderDirectory_, useProgramCache_)) {
         return false;
     }
+    frame_->SetFramePacing(vsync_, benchmark_);
+    if (renderPath_) {
+        frame_->SetRenderPath(*renderPath_);
+    }
+    if (benchmarkRenderPaths_) {
+        frame_->BenchmarkRenderPaths();
+    }
+    if (validateCpuExtrusion_) {
+        frame_->ValidateCpuExtrusion();
+    }
+    if (workgroupSize_ > 0) {
+        frame_->SetComputeWorkgroupSize(static_cast<unsigned int>(workgroupSize_));
+    }
+    if (benchmarkWorkgroupSizes_) {
+        frame_->BenchmarkWorkgroupSizes();
+    }
+    if (measureLocality_) {
+        frame_->MeasureLocality();
+    }
+    frame_->SetGpuCulling(gpuCulling_);
     frame_->Show(true);
 
     return true;
 }
 
+void MyApp::OnEventLoopEnter(wxEventLoopBase *loop) {
+    wxApp::OnEventLoopEnter(loop);
+
+    // wxFileSystemWatcher can only be created once the event loop runs
+    if (!frame_ || !loop->IsMain()) {
+        return;
+    }
+    if (!shaderDirectory_.IsEmpty()) {
+        frame_->WatchShaderDirectory(shaderDirectory_);
+    }
+    if (!changeDirectory_.IsEmpty()) {
+        frame_->WatchChangeDirectory(changeDirectory_);
+    }
+}
+
 void MyApp::OnInitCmdLine(wxCmdLineParser &parser) {
     wxApp::OnInitCmdLine(parser);
 
@@ -73,6 +185,47 @@ void MyApp::OnInitCmdLine(wxCmdLineParser &parser) {
         {wxCMD_LINE_PARAM, NULL, NULL, "Input OSM datafile", wxCMD_LINE_VAL_STRING},
         {wxCMD_LINE_OPTION, "c", "coordinates", "Coordinate boundary of input map", wxCMD_LINE_VAL_STRING,
          wxCMD_LINE_OPTION_MANDATORY},
+        {wxCMD_LINE_OPTION, "s", "style", "Style sheet file (see style_sheet.h for the format)", wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_OPTION, NULL, "shader-dir",
+         "Load the *.glsl shaders from this directory and reload them when they change",
+         wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_SWITCH, NULL, "no-program-cache", "Do not cache the linked shader program binaries"},
+        {wxCMD_LINE_OPTION, NULL, "change-dir", "Apply OsmChange files (.osc, .osc.gz) written to this directory",
+         wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_OPTION, NULL, "margin",
+         "Also load nodes this many degrees outside of the coordinate boundary, to clip ways exactly at its edge",
+         wxCMD_LINE_VAL_DOUBLE},
+        {wxCMD_LINE_OPTION, NULL, "threads", "Threads used to load the data (default: all cores)",
+         wxCMD_LINE_VAL_NUMBER},
+        {wxCMD_LINE_OPTION, NULL, "node-index",
+         "Where node locations are kept while loading: auto, memory or file (default: auto, by input size)",
+         wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_OPTION, NULL, "filter",
+         "Ways loaded as routes, e.g. 'highway in (motorway,primary) and not access=private' (see tag_filter.h, "
+         "default: 'highway or area')",
+         wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_OPTION, NULL, "area-filter",
+         "Relations loaded as areas (default: 'type=boundary or building=yes or area=yes')", wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_SWITCH, NULL, "fast-xml",
+         "Parse uncompressed .osm input with the memory mapped parallel XML reader instead of libosmium"},
+        {wxCMD_LINE_SWITCH, NULL, "no-vsync", "Do not wait for the vertical blank when swapping buffers"},
+        {wxCMD_LINE_SWITCH, NULL, "benchmark", "Render continuously without vsync and print frame times"},
+        {wxCMD_LINE_OPTION, NULL, "render-path",
+         "How routes are turned into triangles: compute, instanced or cpu (default: compute, or cpu without usable "
+         "compute shaders)",
+         wxCMD_LINE_VAL_STRING},
+        {wxCMD_LINE_SWITCH, NULL, "benchmark-render-paths",
+         "Print the GPU time and buffer memory of the render paths for growing parts of the data, then exit"},
+        {wxCMD_LINE_SWITCH, NULL, "validate-cpu-extrusion",
+         "Compare the CPU extrusion with the compute shader for the initial view, then exit"},
+        {wxCMD_LINE_OPTION, NULL, "workgroup-size", "Invocations per workgroup of the compute shader (default: 128)",
+         wxCMD_LINE_VAL_NUMBER},
+        {wxCMD_LINE_SWITCH, NULL, "benchmark-workgroup-sizes",
+         "Print the compute shader throughput for each workgroup size, then exit"},
+        {wxCMD_LINE_SWITCH, NULL, "no-gpu-culling",
+         "Extrude and draw every route on the compute path instead of culling them to the view on the GPU first"},
+        {wxCMD_LINE_SWITCH, NULL, "measure-locality",
+         "Print vertex cache hit rates and draw range counts of the buffers in load and in z-order, then exit"},
         {wxCMD_LINE_NONE},
     };
 
@@ -106,12 +259,85 @@ bool MyApp::OnCmdLineParsed(wxCmdLineParser &parser) {
 
     bounds_ = osmium::Box({minLon, minLat}, {maxLon, maxLat});
 
+    wxString stylePath;
+    if (parser.Found("style", &stylePath)) {
+        auto styleSheet = StyleSheet::FromFile(stylePath.ToStdString());
+        if (!styleSheet) {
+            wxLogError("Could not load style sheet '%s'.", stylePath);
+            return false;
+        }
+        styleSheet_ = *styleSheet;
+    }
+
+    parser.Found("shader-dir", &shaderDirectory_);
+    useProgramCache_ = !parser.Found("no-program-cache");
+    parser.Found("change-dir", &changeDirectory_);
+    parser.Found("threads", &threadCount_);
+    parser.Found("margin", &boundsMargin_);
+
+    wxString nodeIndex;
+    if (parser.Found("node-index", &nodeIndex)) {
+        if (nodeIndex == "auto") {
+            nodeIndex_ = OSMLoader::NodeIndex::Auto;
+        } else if (nodeIndex == "memory") {
+            nodeIndex_ = OSMLoader::NodeIndex::Memory;
+        } else if (nodeIndex == "file") {
+            nodeIndex_ = OSMLoader::NodeIndex::File;
+        } else {
+            wxLogError("Invalid node index '%s'. Expected 'auto', 'memory' or 'file'.", nodeIndex);
+            return false;
+        }
+    }
+
+    auto parseFilter = [&parser](const char *name, TagFilter &filter) {
+        wxString expression;
+        if (!parser.Found(name, &expression)) {
+            return true;
+        }
+        std::string error;
+        auto parsed = TagFilter::Parse(expression.ToStdString(), error);
+        if (!parsed) {
+            wxLogError("Invalid --%s '%s': %s", name, expression, error);
+            return false;
+        }
+        filter = *parsed;
+        return true;
+    };
+    if (!parseFilter("filter", routeFilter_) || !parseFilter("area-filter", areaFilter_)) {
+        return false;
+    }
+    fastXml_ = parser.Found("fast-xml");
+
+    vsync_ = !parser.Found("no-vsync");
+    benchmark_ = parser.Found("benchmark");
+
+    wxString renderPath;
+    if (parser.Found("render-path", &renderPath)) {
+        if (renderPath == "compute") {
+            renderPath_ = OpenGLCanvas::RenderPath::Compute;
+        } else if (renderPath == "instanced") {
+            renderPath_ = OpenGLCanvas::RenderPath::Instanced;
+        } else if (renderPath == "cpu") {
+            renderPath_ = OpenGLCanvas::RenderPath::Cpu;
+        } else {
+            wxLogError("Invalid render path '%s'. Expected 'compute', 'instanced' or 'cpu'.", renderPath);
+            return false;
+        }
+    }
+    benchmarkRenderPaths_ = parser.Found("benchmark-render-paths");
+    validateCpuExtrusion_ = parser.Found("validate-cpu-extrusion");
+    parser.Found("workgroup-size", &workgroupSize_);
+    benchmarkWorkgroupSizes_ = parser.Found("benchmark-workgroup-sizes");
+    gpuCulling_ = !parser.Found("no-gpu-culling");
+    measureLocality_ = parser.Found("measure-locality");
+
     return true;
 }
 
 MyFrame::MyFrame(const wxString &title) : wxFrame(nullptr, wxID_ANY, title) {}
 
-bool MyFrame::initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmium::Box &bounds) {
+bool MyFrame::initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmium::Box &bounds,
+                         const StyleSheet &styleSheet, const wxString &shaderDirectory, bool useProgramCache) {
     osmLoader_ = osmLoader;
 
     wxGLAttributes vAttrs;
@@ -123,6 +349,16 @@ bool MyFrame::initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmi
     }
 
     openGLCanvas = new OpenGLCanvas(this, vAttrs);
+    openGLCanvas->SetStyleSheet(styleSheet);
+    openGLCanvas->SetShaderDirectory(shaderDirectory.ToStdString());
+
+    if (useProgramCache) {
+        wxFileName cacheDir = wxFileName::DirName(wxStandardPaths::Get().GetUserDir(wxStandardPaths::Dir_Cache));
+        cacheDir.AppendDir("osm_opengl_rendering_example");
+        if (cacheDir.Mkdir(wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL)) {
+            openGLCanvas->SetProgramBinaryCache(ProgramBinaryCache(cacheDir.GetPath().ToStdString()));
+        }
+    }
 
     this->Bind(wxEVT_OPENGL_INITIALIZED, &MyFrame::OnOpenGLInitialized, this);
 
@@ -167,7 +403,144 @@ bool MyFrame::initialize(const std::shared_ptr<OSMLoader> &osmLoader, const osmi
     return true;
 }
 
-void MyFrame::OnOpenGLInitialized(wxCommandEvent &event) {}
+void MyFrame::OnOpenGLInitialized(wxCommandEvent &event) {
+    if (!benchmarkRenderPaths_ && !validateCpuExtrusion_ && !benchmarkWorkgroupSizes_ && !measureLocality_) {
+        return;
+    }
+    CallAfter([this]() {
+        if (validateCpuExtrusion_) {
+            openGLCanvas->ValidateCpuExtrusion(std::cout);
+        }
+        if (benchmarkWorkgroupSizes_) {
+            openGLCanvas->BenchmarkWorkgroupSizes(std::cout);
+        }
+        if (benchmarkRenderPaths_) {
+            openGLCanvas->BenchmarkRenderPaths(std::cout);
+        }
+        if (measureLocality_) {
+            openGLCanvas->MeasureBufferLocality(std::cout);
+        }
+        Close();
+    });
+}
+
+wxFileSystemWatcher &MyFrame::FileSystemWatcher() {
+    if (!fileSystemWatcher_) {
+        fileSystemWatcher_ = std::make_unique<wxFileSystemWatcher>();
+        fileSystemWatcher_->SetOwner(this);
+        this->Bind(wxEVT_FSWATCHER, &MyFrame::OnFileSystemChanged, this);
+    }
+    return *fileSystemWatcher_;
+}
+
+void MyFrame::SetFramePacing(bool vsync, bool benchmark) { openGLCanvas->SetFramePacing(vsync, benchmark); }
+
+void MyFrame::SetRenderPath(OpenGLCanvas::RenderPath path) { openGLCanvas->SetRenderPath(path); }
+
+void MyFrame::SetComputeWorkgroupSize(unsigned int size) { openGLCanvas->SetComputeWorkgroupSize(size); }
+
+void MyFrame::SetGpuCulling(bool enabled) { openGLCanvas->SetGpuCulling(enabled); }
+
+void MyFrame::WatchShaderDirectory(const wxString &shaderDirectory) {
+    shaderDirectory_ = wxFileName::DirName(shaderDirectory);
+    shaderDirectory_.MakeAbsolute();
+
+    // Watch the directory rather than the files, since many editors save by
+    // writing a new file and renaming it over the old one
+    FileSystemWatcher().Add(shaderDirectory_, wxFSW_EVENT_MODIFY | wxFSW_EVENT_CREATE | wxFSW_EVENT_RENAME);
+}
+
+void MyFrame::WatchChangeDirectory(const wxString &changeDirectory) {
+    changeDirectory_ = wxFileName::DirName(changeDirectory);
+    changeDirectory_.MakeAbsolute();
+
+    // Files already there predate the loaded data
+    FileSystemWatcher().Add(changeDirectory_, wxFSW_EVENT_MODIFY | wxFSW_EVENT_CREATE | wxFSW_EVENT_RENAME);
+}
+
+void MyFrame::OnFileSystemChanged(wxFileSystemWatcherEvent &event) {
+    wxFileName path = event.GetChangeType() == wxFSW_EVENT_RENAME ? event.GetNewPath() : event.GetPath();
+    path.MakeAbsolute();
+
+    if (changeDirectory_.IsOk() && path.GetPath() == changeDirectory_.GetPath()) {
+        OnChangeFileChanged(path);
+    }
+    if (shaderDirectory_.IsOk() && path.GetPath() == shaderDirectory_.GetPath()) {
+        OnShaderFileChanged(path);
+    }
+}
+
+void MyFrame::OnShaderFileChanged(const wxFileName &path) {
+    const wxString name = path.GetFullName();
+    if (name != "compute.comp.glsl" && name != "compute.vert.glsl" && name != "compute.frag.glsl" &&
+        name != "text.vert.glsl" && name != "text.frag.glsl" && name != "segment.vert.glsl" &&
+        name != "segment.frag.glsl" && name != "cull.comp.glsl") {
+        return;
+    }
+
+    // A single save usually produces several events, reload only once
+    if (shaderReloadPending_) {
+        return;
+    }
+    shaderReloadPending_ = true;
+    CallAfter([this]() {
+        shaderReloadPending_ = false;
+        openGLCanvas->ReloadShaders();
+    });
+}
+
+void MyFrame::OnChangeFileChanged(const wxFileName &path) {
+    const wxString name = path.GetFullName();
+    if (!name.EndsWith(".osc") && !name.EndsWith(".osc.gz")) {
+        return;
+    }
+    if (appliedChangeFiles_.count(path.GetFullPath()) > 0) {
+        return;
+    }
+
+    // Batch the events of one burst of files, they are applied in order
+    const bool scheduled = !pendingChangeFiles_.empty();
+    pendingChangeFiles_.insert(path.GetFullPath());
+    if (!scheduled) {
+        CallAfter([this]() { ApplyPendingChanges(); });
+    }
+}
+
+void MyFrame::ApplyPendingChanges() {
+    OSMLoader::Id2Route changedRoutes;
+    std::vector<osmium::object_id_type> removedRoutes;
+
+    auto pending = std::move(pendingChangeFiles_);
+    pendingChangeFiles_.clear();
+    for (const auto &filepath : pending) {
+        auto changes = osmLoader_->applyChanges(filepath.ToStdString());
+        if (!changes) {
+            // Most likely still being written, retried on its next modify event
+            continue;
+        }
+        appliedChangeFiles_.insert(filepath);
+        std::cout << "Applied " << filepath << ": " << changes->routes.size() << " routes changed, "
+                  << changes->removedRoutes.size() << " removed" << std::endl;
+
+        // Later files win over earlier ones
+        for (auto id : changes->removedRoutes) {
+            changedRoutes.erase(id);
+            removedRoutes.push_back(id);
+        }
+        for (auto &[id, route] : changes->routes) {
+            changedRoutes[id] = std::move(route);
+        }
+    }
+
+    if (!changedRoutes.empty() || !removedRoutes.empty()) {
+        std::vector<OSMLoader::Route_t> routes;
+        routes.reserve(changedRoutes.size());
+        for (auto &[id, route] : changedRoutes) {
+            routes.push_back(std::move(route));
+        }
+        openGLCanvas->UpdateRoutes(routes, removedRoutes);
+    }
+}
 
 wxFont GetMonospacedFont(wxFontInfo &&fontInfo) {
     const wxString preferredFonts[] = {"Menlo", "Consolas", "Monaco", "DejaVu Sans Mono", "Courier New"};
@@ -0,0 +1,165 @@
+#include "map_store.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+// Aim for a few boxes per cell
+constexpr double ITEMS_PER_CELL = 4.0;
+
+// Grow a box by the valid locations in `nodes`; `empty` until the first one
+void extendBox(const OSMLoader::Coordinates &nodes, bool &empty, int32_t &minX, int32_t &minY, int32_t &maxX,
+               int32_t &maxY) {
+    for (const auto &node : nodes) {
+        if (!node.valid()) {
+            continue;
+        }
+        minX = empty ? node.x() : std::min(minX, node.x());
+        minY = empty ? node.y() : std::min(minY, node.y());
+        maxX = empty ? node.x() : std::max(maxX, node.x());
+        maxY = empty ? node.y() : std::max(maxY, node.y());
+        empty = false;
+    }
+}
+} // namespace
+
+MapStore::MapStore(OSMLoader::OSMData data) {
+    routes_.reserve(data.first.size());
+    areas_.reserve(data.second.size());
+    for (auto &[id, route] : data.first) {
+        AddRoute(std::move(route));
+    }
+    for (auto &[id, area] : data.second) {
+        AddArea(std::move(area));
+    }
+    Rebuild();
+}
+
+size_t MapStore::RouteCount() const {
+    std::shared_lock lock(mutex_);
+    return routeItems_.size();
+}
+
+size_t MapStore::AreaCount() const {
+    std::shared_lock lock(mutex_);
+    return areaItems_.size();
+}
+
+void MapStore::AddRoute(OSMLoader::Route_t route) {
+    Item item{0, 0, 0, 0, static_cast<uint32_t>(routes_.size()), false, false};
+    bool empty = true;
+    extendBox(route.nodes, empty, item.minX, item.minY, item.maxX, item.maxY);
+    if (empty) {
+        return;
+    }
+    routeItems_[route.id] = static_cast<uint32_t>(items_.size());
+    items_.push_back(item);
+    routes_.push_back(std::move(route));
+}
+
+void MapStore::AddArea(OSMLoader::Area_t area) {
+    Item item{0, 0, 0, 0, static_cast<uint32_t>(areas_.size()), true, false};
+    bool empty = true;
+    for (const auto &ring : area.outerRings) {
+        extendBox(ring, empty, item.minX, item.minY, item.maxX, item.maxY);
+    }
+    if (empty) {
+        return;
+    }
+    areaItems_[area.id] = static_cast<uint32_t>(items_.size());
+    items_.push_back(item);
+    areas_.push_back(std::move(area));
+}
+
+void MapStore::Remove(std::unordered_map<osmium::object_id_type, uint32_t> &items, osmium::object_id_type id) {
+    auto it = items.find(id);
+    if (it == items.end()) {
+        return;
+    }
+    items_[it->second].removed = true;
+    ++removedItems_;
+    items.erase(it);
+}
+
+void MapStore::Update(const OSMLoader::OSMChanges &changes) {
+    std::unique_lock lock(mutex_);
+    const auto firstAdded = static_cast<uint32_t>(items_.size());
+    for (auto id : changes.removedRoutes) {
+        Remove(routeItems_, id);
+    }
+    for (const auto &[id, route] : changes.routes) {
+        Remove(routeItems_, id);
+        AddRoute(route);
+    }
+    for (auto id : changes.removedAreas) {
+        Remove(areaItems_, id);
+    }
+    for (const auto &[id, area] : changes.areas) {
+        Remove(areaItems_, id);
+        AddArea(area);
+    }
+
+    for (uint32_t ii = firstAdded; ii < items_.size(); ++ii) {
+        grid_.Insert(ii, ItemBox(items_[ii]));
+    }
+    if (grid_.ShouldRebuild(removedItems_, items_.size())) {
+        Rebuild();
+    }
+}
+
+void MapStore::Rebuild() {
+    // Drop removed items and what they point to
+    std::vector<OSMLoader::Route_t> routes;
+    std::vector<OSMLoader::Area_t> areas;
+    std::vector<Item> items;
+    items.reserve(items_.size() - removedItems_);
+    for (auto item : items_) {
+        if (item.removed) {
+            continue;
+        }
+        const auto itemIndex = static_cast<uint32_t>(items.size());
+        if (item.area) {
+            areaItems_[areas_[item.index].id] = itemIndex;
+            areas.push_back(std::move(areas_[item.index]));
+            item.index = static_cast<uint32_t>(areas.size() - 1);
+        } else {
+            routeItems_[routes_[item.index].id] = itemIndex;
+            routes.push_back(std::move(routes_[item.index]));
+            item.index = static_cast<uint32_t>(routes.size() - 1);
+        }
+        items.push_back(item);
+    }
+    routes_ = std::move(routes);
+    areas_ = std::move(areas);
+    items_ = std::move(items);
+    removedItems_ = 0;
+
+    grid_.Build(items_.size(), [this](uint32_t ii) { return ItemBox(items_[ii]); }, ITEMS_PER_CELL);
+}
+
+void MapStore::Query(const osmium::Box &bounds, const std::function<void(const OSMLoader::Route_t &)> &onRoute,
+                     const std::function<void(const OSMLoader::Area_t &)> &onArea) const {
+    if (!bounds.valid()) {
+        return;
+    }
+    const int32_t minX = bounds.bottom_left().x();
+    const int32_t minY = bounds.bottom_left().y();
+    const int32_t maxX = bounds.top_right().x();
+    const int32_t maxY = bounds.top_right().y();
+
+    std::shared_lock lock(mutex_);
+    auto visit = [&](const Item &item) {
+        if (item.removed || item.maxX < minX || item.minX > maxX || item.maxY < minY || item.minY > maxY) {
+            return;
+        }
+        if (item.area) {
+            onArea(areas_[item.index]);
+        } else {
+            onRoute(routes_[item.index]);
+        }
+    };
+
+    grid_.Query(
+        {static_cast<double>(minX), static_cast<double>(minY), static_cast<double>(maxX), static_cast<double>(maxY)},
+        [this](uint32_t ii) { return ItemBox(items_[ii]); }, [&](uint32_t ii) { visit(items_[ii]); });
+}
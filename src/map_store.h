@@ -0,0 +1,70 @@
+#pragma once
+
+#include "osm_loader.h"
+#include "uniform_grid.h"
+
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Resident copy of all routes and areas of a file, indexed by their bounding
+ * boxes so that any bounds can be queried without reading the file again.
+ *
+ * The boxes are binned into a UniformGrid sized for a few boxes per cell, so
+ * a query visits the cells of its bounds plus its results.
+ *
+ * Queries only read and run concurrently under a shared lock; Update() takes
+ * it exclusively. Like SegmentIndex, updated items are inserted into the
+ * cells of the grid and removed ones are tombstoned until it is rebuilt.
+ */
+class MapStore {
+  public:
+    explicit MapStore(OSMLoader::OSMData data);
+
+    // Call `onRoute` and `onArea` for every stored route and area whose
+    // bounding box intersects `bounds`. They may run on several threads at
+    // once for concurrent queries, but not for the same one.
+    void Query(const osmium::Box &bounds, const std::function<void(const OSMLoader::Route_t &)> &onRoute,
+               const std::function<void(const OSMLoader::Area_t &)> &onArea) const;
+
+    // Replace the changed routes and areas and drop the removed ones
+    void Update(const OSMLoader::OSMChanges &changes);
+
+    size_t RouteCount() const;
+    size_t AreaCount() const;
+
+  protected:
+    // Bounding box in osmium::Location units, and the route or area it
+    // belongs to
+    struct Item {
+        int32_t minX, minY, maxX, maxY;
+        uint32_t index;
+        bool area;
+        bool removed;
+    };
+
+    void AddRoute(OSMLoader::Route_t route);
+    void AddArea(OSMLoader::Area_t area);
+    void Remove(std::unordered_map<osmium::object_id_type, uint32_t> &items, osmium::object_id_type id);
+    void Rebuild();
+    static UniformGrid::Box ItemBox(const Item &item) {
+        return {static_cast<double>(item.minX), static_cast<double>(item.minY), static_cast<double>(item.maxX),
+                static_cast<double>(item.maxY)};
+    }
+
+    mutable std::shared_mutex mutex_{};
+
+    std::vector<OSMLoader::Route_t> routes_{};
+    std::vector<OSMLoader::Area_t> areas_{};
+    std::vector<Item> items_{};
+    // id -> index into items_
+    std::unordered_map<osmium::object_id_type, uint32_t> routeItems_{};
+    std::unordered_map<osmium::object_id_type, uint32_t> areaItems_{};
+    size_t removedItems_{0};
+
+    // over items_
+    UniformGrid grid_{};
+};
@@ -0,0 +1,45 @@
+#include "node_table.h"
+
+uint32_t NodeTable::Acquire(const osmium::Location &location, bool &added) {
+    auto it = index_.find(location);
+    if (it != index_.end()) {
+        added = false;
+        if (++references_[it->second] == 2) {
+            ++sharedCount_;
+        }
+        return it->second;
+    }
+
+    added = true;
+    uint32_t node;
+    if (!freeNodes_.empty()) {
+        node = freeNodes_.back();
+        freeNodes_.pop_back();
+        locations_[node] = location;
+        references_[node] = 1;
+    } else {
+        node = Size();
+        locations_.push_back(location);
+        references_.push_back(1);
+    }
+    index_.emplace(location, node);
+    return node;
+}
+
+void NodeTable::Release(uint32_t node) {
+    const uint32_t references = --references_[node];
+    if (references == 1) {
+        --sharedCount_;
+    } else if (references == 0) {
+        index_.erase(locations_[node]);
+        freeNodes_.push_back(node);
+    }
+}
+
+void NodeTable::Clear() {
+    index_.clear();
+    locations_.clear();
+    references_.clear();
+    freeNodes_.clear();
+    sharedCount_ = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <osmium/osm/location.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The distinct vertex positions of the extrusion input. Ways meeting at a
+ * junction reference the same node, so its location is stored once however
+ * many routes pass through it, and the routes sharing a node can be told from
+ * its reference count.
+ *
+ * Nodes are keyed by location: ways sharing a node id always share its
+ * location, and distinct nodes at the same location (or the points added by
+ * clipping) may as well share a vertex. Every index referencing a node holds
+ * one reference; entries of unreferenced nodes are reused.
+ */
+class NodeTable {
+  public:
+    // Index of the node at `location`, with one more reference. `added` is
+    // set when the node is new and its position still has to be stored.
+    uint32_t Acquire(const osmium::Location &location, bool &added);
+    void Release(uint32_t node);
+    void Clear();
+
+    // Entries in use or free, so every node index is below this
+    uint32_t Size() const { return static_cast<uint32_t>(locations_.size()); }
+    size_t NodeCount() const { return index_.size(); }
+    // Nodes referenced more than once: junctions and the ends of closed ways
+    size_t SharedCount() const { return sharedCount_; }
+    uint32_t References(uint32_t node) const { return references_[node]; }
+    const osmium::Location &Location(uint32_t node) const { return locations_[node]; }
+
+  protected:
+    struct LocationHash {
+        size_t operator()(const osmium::Location &location) const {
+            const uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(location.x())) << 32 |
+                                 static_cast<uint32_t>(location.y());
+            return std::hash<uint64_t>()(key);
+        }
+    };
+
+    std::unordered_map<osmium::Location, uint32_t, LocationHash> index_{};
+    std::vector<osmium::Location> locations_{};
+    std::vector<uint32_t> references_{};
+    std::vector<uint32_t> freeNodes_{};
+    size_t sharedCount_{0};
+};
@@ -2,11 +2,21 @@
 
 #include <shaders.h>
 
+// Swap interval control, loaded by glewInit
+#if defined(__WXMSW__)
+#include <GL/wglew.h>
+#elif defined(__WXGTK__)
+#include <GL/eglew.h>
+#endif
+
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <limits>
 #include <sstream>
 #include <string>
@@ -96,6 +106,14 @@ OpenGLCanvas::OpenGLCanvas(wxWindow *parent, const wxGLAttributes &canvasAttrs)
     ctxAttrs.PlatformDefaults().CoreProfile().OGLVersion(4, 3).EndList();
     openGLContext_ = new wxGLContext(this, nullptr, &ctxAttrs);
 
+    if (!openGLContext_->IsOK()) {
+        // Without 4.3 only the instanced path runs, it needs 3.3
+        delete openGLContext_;
+        wxGLContextAttrs legacyAttrs;
+        legacyAttrs.PlatformDefaults().CoreProfile().OGLVersion(3, 3).EndList();
+        openGLContext_ = new wxGLContext(this, nullptr, &legacyAttrs);
+        legacyContext_ = true;
+    }
     if (!openGLContext_->IsOK()) {
         wxMessageBox("This sample needs an OpenGL 3.3 capable driver.", "OpenGL version error",
                      wxOK | wxICON_INFORMATION, this);
@@ -116,12 +134,8 @@ OpenGLCanvas::OpenGLCanvas(wxWindow *parent, const wxGLAttributes &canvasAttrs)
     Bind(wxEVT_GESTURE_ZOOM, &OpenGLCanvas::OnZoomGesture, this);
     EnableTouchEvents(wxTOUCH_ZOOM_GESTURE);
 
-    timer_.SetOwner(this);
-    this->Bind(wxEVT_TIMER, &OpenGLCanvas::OnTimer, this);
-
-    // TODO: try to make the FPS higher
-    constexpr auto FPS = 60.0;
-    timer_.Start(1000 / FPS);
+    // Frames are rendered on demand, see OnIdle
+    Bind(wxEVT_IDLE, &OpenGLCanvas::OnIdle, this);
 }
 
 void OpenGLCanvas::SetData(const OSMLoader::OSMData &data, const osmium::Box &bounds) {
@@ -172,6 +186,8 @@ void OpenGLCanvas::SetData(const OSMLoader::OSMData &data, const osmium::Box &bo
 
     // Take all ways
     storedRoutes_ = ways;
+    segmentIndex_.Build(storedRoutes_);
+    hoveredRouteId_ = 0;
     // storedAreas_ = areas;
 
     // add the boundary with fake id==42
@@ -186,105 +202,300 @@ void OpenGLCanvas::SetData(const OSMLoader::OSMData &data, const osmium::Box &bo
     storedRoutes_[boundsWay.id] = boundsWay;
 
     UpdateBuffersFromRoutes();
+    UpdateLabelCandidates();
 }
 
-constexpr GLuint VERTEX_SIZE = 5;
-
-void OpenGLCanvas::AddLineStripAdjacencyToBuffers(const OSMLoader::Coordinates &coords, const Color_t &color,
-                                                  std::vector<float> &vertices, std::vector<GLuint> &indices) {
-    if (coords.size() < 2) {
-        return;
+void OpenGLCanvas::UpdateLabelCandidates() {
+    std::vector<LabelPlacer::Candidate> candidates;
+    const auto &styles = styleSheet_.styles();
+    for (const auto &[id, route] : storedRoutes_) {
+        auto name = route.tags.find(NAME_TAG);
+        if (name == route.tags.end() || name->second.empty() || route.nodes.size() < 2) {
+            continue;
+        }
+        const GLuint styleId = styleSheet_.Match(route.tags);
+        if (styleId == StyleSheet::NO_STYLE) {
+            continue;
+        }
+        // Label the longest piece of routes split by clipping
+        size_t begin = 0;
+        size_t end = route.nodes.size();
+        if (!route.breaks.empty()) {
+            size_t pieceBegin = 0;
+            end = 0;
+            for (size_t ii = 0; ii <= route.breaks.size(); ++ii) {
+                const size_t pieceEnd = ii < route.breaks.size() ? route.breaks[ii] : route.nodes.size();
+                if (pieceEnd - pieceBegin > end - begin) {
+                    begin = pieceBegin;
+                    end = pieceEnd;
+                }
+                pieceBegin = pieceEnd;
+            }
+        }
+        const auto &style = styles[styleId];
+        candidates.push_back(LabelPlacer::Candidate{
+            id, TextRenderer::DecodeUtf8(name->second),
+            OSMLoader::Coordinates(route.nodes.begin() + begin, route.nodes.begin() + end), style.zOrder,
+            style.minZoom});
     }
+    labelPlacer_.SetCandidates(std::move(candidates));
+}
+
+void OpenGLCanvas::SetStyleSheet(const StyleSheet &styleSheet) {
+    const bool rebuild = !styleSheet_.SameClassification(styleSheet);
+    styleSheet_ = styleSheet;
 
-    // Store the starting index for this line strip in the vertices array
-    GLuint base = static_cast<GLuint>(vertices.size() / VERTEX_SIZE);
+    if (rebuild) {
+        UpdateBuffersFromRoutes();
+    } else {
+        UploadStyleTable();
+    }
+    UpdateLabelCandidates();
+    Refresh(false);
+}
 
-    vertices.reserve(vertices.size() + coords.size() * VERTEX_SIZE);
+void OpenGLCanvas::UploadStyleTable() {
+    if (!isOpenGLInitialized_) {
+        return;
+    }
+    extrusionValid_ = false;
+
+    const auto table = styleSheet_.GpuTable();
+    cpuStyles_ = table;
+    if (styleBuffer_ == 0)
+        glGenBuffers(1, &styleBuffer_);
+    // read as a storage block and as a texture buffer, so upload through a
+    // target which 3.3 contexts have as well
+    glBindBuffer(GL_COPY_WRITE_BUFFER, styleBuffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, table.size() * sizeof(StyleSheet::GpuStyle), table.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
 
-    auto nC = color;
+// Index flags, see compute.comp.glsl
+constexpr GLuint BEGIN_BIT = 1 << 0;
+constexpr GLuint END_BIT = 1 << 1;
 
-    // Add vertices for the current line strip
-    for (const auto &loc : coords) {
-        assert(loc.valid());
-        double lon = loc.lon();
-        double lat = loc.lat();
-        // Store raw lon/lat in vertex attributes; shader will normalize
-        vertices.push_back(static_cast<float>(lon));
-        vertices.push_back(static_cast<float>(lat));
-        vertices.push_back(nC[0]);
-        vertices.push_back(nC[1]);
-        vertices.push_back(nC[2]);
-        // nC[0] *= 0.5f;
-        // nC[1] *= 0.5f;
-        // nC[2] *= 0.5f;
+void OpenGLCanvas::AddLineStripAdjacencyToBuffers(const OSMLoader::Route_t &route, GLuint styleId,
+                                                  InputGeometry &geometry, std::vector<GLuint> &addedNodes) {
+    const auto &coords = route.nodes;
+    if (coords.size() < 2) {
+        return;
     }
+    auto &indices = geometry.indices;
+    geometry.styleIds.insert(geometry.styleIds.end(), coords.size(), styleId);
+
+    // One index per node of the route, one strip per piece
+    auto nextBreak = route.breaks.begin();
+    for (size_t ii = 0; ii < coords.size(); ++ii) {
+        assert(coords[ii].valid());
+        bool added = false;
+        const GLuint node = nodeTable_.Acquire(coords[ii], added);
+        if (added) {
+            addedNodes.push_back(node);
+        }
 
-    // Add all vertices of the current line strip
-    const GLuint endVertexIdx = static_cast<GLuint>(vertices.size() / VERTEX_SIZE);
-    for (GLuint ii = base; ii < endVertexIdx; ++ii) {
         // Set bottom most bits if first or last
-        GLuint idx = ii << 2;
-        if (ii == base) {
-            // set begin bit
-            idx = idx | 1 << 0;
+        GLuint idx = node << 2;
+        if (ii == 0) {
+            idx = idx | BEGIN_BIT;
+        }
+        if (ii + 1 == coords.size()) {
+            idx = idx | END_BIT;
         }
-        if (ii + 1 == endVertexIdx) {
-            // set end bit
-            idx = idx | 1 << 1;
+        if (nextBreak != route.breaks.end() && ii == *nextBreak) {
+            idx = idx | BEGIN_BIT;
+            indices.back() |= END_BIT;
+            ++nextBreak;
         }
 
         indices.push_back(idx);
     }
 }
 
-struct OutputVertex {
-    float x, y;
-    float pad[2];
-    float r, g, b, a;
-};
+// Free slots at the end of every style layer, so routes can be added or grown
+// without moving the other layers
+constexpr GLuint MIN_LAYER_SLACK = 256;
+static GLuint LayerSlack(GLuint slotCount) { return std::max(slotCount / 8, MIN_LAYER_SLACK); }
+// Likewise for the route records of a layer
+constexpr GLuint MIN_RECORD_SLACK = 16;
+static GLuint RecordSlack(GLuint recordCount) { return std::max(recordCount / 8, MIN_RECORD_SLACK); }
+// Likewise for the nodes, shared by all layers
+constexpr GLuint MIN_NODE_SLACK = 1024;
+static GLuint NodeSlack(GLuint nodeCount) { return std::max(nodeCount / 8, MIN_NODE_SLACK); }
+
+void OpenGLCanvas::AppendUnusedSlots(GLuint count, InputGeometry &geometry) {
+    // node 0 and style 0
+    geometry.styleIds.insert(geometry.styleIds.end(), count, 0);
+    geometry.indices.insert(geometry.indices.end(), count, BEGIN_BIT | END_BIT);
+}
+
+void OpenGLCanvas::ReleaseSlotNodes(GLuint first, GLuint end) {
+    for (GLuint slot = first; slot < end; ++slot) {
+        if (slotNodes_[slot] != NO_NODE) {
+            nodeTable_.Release(slotNodes_[slot]);
+            slotNodes_[slot] = NO_NODE;
+        }
+    }
+}
+
+// Position of (x, y), each within [0, 1], along a Z-order curve over a
+// 65536 x 65536 grid: the bits of both coordinates interleaved
+static uint32_t MortonCode(double x, double y) {
+    auto spread = [](double value) {
+        uint32_t bits = static_cast<uint32_t>(std::clamp(value, 0.0, 1.0) * 65535.0);
+        bits = (bits | (bits << 8)) & 0x00FF00FF;
+        bits = (bits | (bits << 4)) & 0x0F0F0F0F;
+        bits = (bits | (bits << 2)) & 0x33333333;
+        bits = (bits | (bits << 1)) & 0x55555555;
+        return bits;
+    };
+    return spread(x) | spread(y) << 1;
+}
+
+// Sort `routes` by the Morton code of the center of their bounds within
+// `bounds`, and by id where that is the same
+static void SortAlongZOrderCurve(std::vector<std::pair<const OSMLoader::Route_t *, GLuint>> &routes,
+                                 const osmium::Box &bounds) {
+    const double lonRange = std::max(bounds.right() - bounds.left(), 1e-9);
+    const double latRange = std::max(bounds.top() - bounds.bottom(), 1e-9);
+    std::vector<std::pair<uint32_t, size_t>> keys;
+    keys.reserve(routes.size());
+    for (size_t ii = 0; ii < routes.size(); ++ii) {
+        const auto &nodes = routes[ii].first->nodes;
+        double minLon = nodes.front().lon();
+        double minLat = nodes.front().lat();
+        double maxLon = minLon;
+        double maxLat = minLat;
+        for (const auto &loc : nodes) {
+            minLon = std::min(minLon, loc.lon());
+            minLat = std::min(minLat, loc.lat());
+            maxLon = std::max(maxLon, loc.lon());
+            maxLat = std::max(maxLat, loc.lat());
+        }
+        const double x = ((minLon + maxLon) * 0.5 - bounds.left()) / lonRange;
+        const double y = ((minLat + maxLat) * 0.5 - bounds.bottom()) / latRange;
+        keys.emplace_back(MortonCode(x, y), ii);
+    }
+    std::sort(keys.begin(), keys.end(), [&routes](const auto &a, const auto &b) {
+        return a.first != b.first ? a.first < b.first : routes[a.second].first->id < routes[b.second].first->id;
+    });
+
+    std::vector<std::pair<const OSMLoader::Route_t *, GLuint>> sorted;
+    sorted.reserve(routes.size());
+    for (const auto &key : keys) {
+        sorted.push_back(routes[key.second]);
+    }
+    routes = std::move(sorted);
+}
 
 void OpenGLCanvas::UpdateBuffersFromRoutes() {
     if (!isOpenGLInitialized_) {
         return;
     }
+    extrusionValid_ = false;
+
+    // Build vertex and index arrays from storedRoutes_
+    InputGeometry geometry;
+    auto &indices = geometry.indices;
 
-    // Build vertex and index arrays from storedRoutes_. Vertex layout:
-    // x,y,r,g,b
-    std::vector<float> vertices;
-    std::vector<GLuint> indices;
+    drawCommands_.clear();
+    layerSlots_.clear();
+    routeSlots_.clear();
+    routeRecords_.clear();
+    nodeTable_.Clear();
+    slotNodes_.clear();
+    UploadStyleTable();
 
     if (storedRoutes_.empty()) {
         inputIndexCount_ = 0;
+        nodeCapacity_ = 0;
+        cpuInput_ = {};
         return;
     }
 
-    using MapType = std::unordered_map<std::string, Color_t>;
-    static MapType HIGHWAY2COLOR = {{"motorway", {1.0f, 0.35f, 0.35f}},   {"motorway_link", {1.0f, 0.6f, 0.6f}},
-                                    {"secondary", {1.0f, 0.75f, 0.4f}},   {"tertiary", {1.0f, 1.0f, 0.6f}},
-                                    {"residential", {1.0f, 1.0f, 1.0f}},  {"unclassified", {0.95f, 0.95f, 0.95f}},
-                                    {"service", {0.8f, 0.8f, 0.8f}},      {"track", {0.65f, 0.55f, 0.4f}},
-                                    {"pedestrian", {0.85f, 0.8f, 0.85f}}, {"footway", {0.9f, 0.7f, 0.7f}},
-                                    {"path", {0.6f, 0.7f, 0.6f}},         {"steps", {0.7f, 0.4f, 0.4f}},
-                                    {"platform", {0.6f, 0.6f, 0.8f}}};
-    Color_t DEFAULT_COLOR = {0.5f, 0.5f, 0.5f};
-    Color_t AREA_COLOR = {0.2f, 0.89f, 0.1f};
-
+    // Bucket the routes per z-order so that each style layer ends up as one
+    // contiguous range of the index buffer, drawn in ascending z-order. Every
+    // z-order of the style sheet gets a layer, even when empty for now, so
+    // that UpdateRoutes can add routes to it.
+    const auto &styles = styleSheet_.styles();
+    std::map<int, std::vector<std::pair<const OSMLoader::Route_t *, GLuint>>> layerRoutes;
+    for (const auto &style : styles) {
+        layerRoutes[style.zOrder];
+    }
     for (const auto &entry : storedRoutes_) {
-        const auto &coords = entry.second;
-        if (coords.nodes.size() < 2)
+        const auto &route = entry.second;
+        if (route.nodes.size() < 2)
+            continue;
+
+        const GLuint styleId = styleSheet_.Match(route.tags);
+        if (styleId == StyleSheet::NO_STYLE)
             continue;
+        layerRoutes[styles[styleId].zOrder].emplace_back(&route, styleId);
+    }
+
+    // Within a layer, routes close to each other on the map end up close in
+    // the buffers, and so do their nodes, which are numbered as they are
+    // first used. A view then covers a few contiguous ranges of slots.
+    if (spatialOrder_) {
+        for (auto &entry : layerRoutes) {
+            SortAlongZOrderCurve(entry.second, coordinateBounds_);
+        }
+    }
+
+    std::vector<GLuint> addedNodes;
+    for (const auto &[zOrder, routes] : layerRoutes) {
+        LayerSlots layer{};
+        layer.zOrder = zOrder;
+        layer.first = static_cast<GLuint>(indices.size());
+        layer.firstRecord = static_cast<GLuint>(routeRecords_.size());
+        for (const auto &[route, styleId] : routes) {
+            const GLuint first = static_cast<GLuint>(indices.size());
+            // All positions are written from nodeTable_ below
+            AddLineStripAdjacencyToBuffers(*route, styleId, geometry, addedNodes);
+            addedNodes.clear();
+            const GLuint count = static_cast<GLuint>(indices.size()) - first;
+            const RouteSlots slots{first, count, count, layerSlots_.size(), static_cast<GLuint>(routeRecords_.size())};
+            routeSlots_[route->id] = slots;
+            routeRecords_.push_back(MakeRouteRecord(*route, styleId, slots));
+        }
+        layer.end = static_cast<GLuint>(indices.size());
+        AppendUnusedSlots(LayerSlack(layer.end - layer.first), geometry);
+        layer.capacity = static_cast<GLuint>(indices.size()) - layer.first;
+        layer.recordEnd = static_cast<GLuint>(routeRecords_.size());
+        routeRecords_.resize(routeRecords_.size() + RecordSlack(layer.recordEnd - layer.firstRecord), RouteRecord{});
+        layer.recordCapacity = static_cast<GLuint>(routeRecords_.size()) - layer.firstRecord;
+        layerSlots_.push_back(layer);
+
+        // Each input index is extruded into 6 output indices
+        DrawElementsIndirectCommand cmd{};
+        cmd.count = layer.capacity * 6;
+        cmd.instanceCount = 1;
+        cmd.firstIndex = layer.first * 6;
+        drawCommands_.push_back(cmd);
+    }
 
-        GLuint base = static_cast<GLuint>(vertices.size() / VERTEX_SIZE);
-        const std::string &highwayType = entry.second.tags.count(HIGHWAY_TAG) ? entry.second.tags.at(HIGHWAY_TAG) : "";
-        const auto &color = HIGHWAY2COLOR.count(highwayType) ? HIGHWAY2COLOR.at(highwayType) : DEFAULT_COLOR;
-        AddLineStripAdjacencyToBuffers(coords.nodes, color, vertices, indices);
+    // The positions of the nodes in the order they were added, with room for
+    // the nodes of updated routes
+    nodeCapacity_ = nodeTable_.Size() + NodeSlack(nodeTable_.Size());
+    geometry.positions.assign(static_cast<size_t>(nodeCapacity_) * 2, 0.0f);
+    for (GLuint node = 0; node < nodeTable_.Size(); ++node) {
+        const auto &location = nodeTable_.Location(node);
+        geometry.positions[node * 2] = static_cast<float>(location.lon());
+        geometry.positions[node * 2 + 1] = static_cast<float>(location.lat());
+    }
+    slotNodes_.assign(indices.size(), NO_NODE);
+    for (const auto &entry : routeSlots_) {
+        const auto &slots = entry.second;
+        for (GLuint slot = slots.first; slot < slots.first + slots.count; ++slot) {
+            slotNodes_[slot] = indices[slot] >> 2;
+        }
     }
 
-    // std::cout << "Vertices count: " << vertices.size() / VERTEX_SIZE << std::endl;
+    // std::cout << "Vertices count: " << geometry.SlotCount() << std::endl;
     // constexpr auto max_precision = std::numeric_limits<float>::max_digits10;
-    // for (size_t i = 0; i < vertices.size(); i += 5) {
-    //     std::cout << std::setprecision(max_precision) << "\t" << i / VERTEX_SIZE << ": " << vertices[i] << ","
-    //               << vertices[i + 1] << std::endl;
+    // for (size_t i = 0; i < geometry.positions.size(); i += 2) {
+    //     std::cout << std::setprecision(max_precision) << "\t" << i / 2 << ": " << geometry.positions[i] << ","
+    //               << geometry.positions[i + 1] << std::endl;
     // }
 
     // std::cout << "Indices count: " << indices.size() << std::endl;
@@ -298,102 +509,491 @@ void OpenGLCanvas::UpdateBuffersFromRoutes() {
     // 6 output indices per input
     outputIndexCount_ = inputIndexCount_ * 6;
 
-    // Create VAO/VBO/EBO if necessary and upload
+    // Grow the buffers if needed and upload through the ring. Growing keeps
+    // some headroom so that rebuilds after running out of layer slack do not
+    // reallocate every time.
+    VBO_.Reserve(geometry.positions.size() * sizeof(float));
+    styleIdBuffer_.Reserve(geometry.styleIds.size() * sizeof(GLuint));
+    EBO_.Reserve(indices.size() * sizeof(GLuint));
+    uploadRing_.Upload(VBO_.Id(), 0, geometry.positions.data(), geometry.positions.size() * sizeof(float));
+    uploadRing_.Upload(styleIdBuffer_.Id(), 0, geometry.styleIds.data(), geometry.styleIds.size() * sizeof(GLuint));
+    uploadRing_.Upload(EBO_.Id(), 0, indices.data(), indices.size() * sizeof(GLuint));
+
+    // Create VAO if necessary and point it at the current buffers
     if (VAO_ == 0)
         glGenVertexArrays(1, &VAO_);
     glBindVertexArray(VAO_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_.Id());
 
-    if (VBO_ == 0)
-        glGenBuffers(1, &VBO_);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_);
-    if (!vertices.empty())
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-
-    if (EBO_ == 0)
-        glGenBuffers(1, &EBO_);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_);
-    if (!indices.empty())
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-
-    // vertex attributes
+    // vertex attributes, one buffer each
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_.Id());
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(float), reinterpret_cast<void *>(0));
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), reinterpret_cast<void *>(0));
+    glBindBuffer(GL_ARRAY_BUFFER, styleIdBuffer_.Id());
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE * sizeof(float),
-                          reinterpret_cast<void *>(2 * sizeof(float)));
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), reinterpret_cast<void *>(0));
 
     // Unbind
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // Setup output buffer for compute shader
-    if (output_vbo_ == 0)
-        glGenBuffers(1, &output_vbo_);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, output_vbo_);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, outputVertexCount_ * sizeof(OutputVertex), nullptr, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    UpdateOutputBuffers();
+
+    drawCommandBuffer_.Reserve(drawCommands_.size() * sizeof(DrawElementsIndirectCommand));
+    uploadRing_.Upload(drawCommandBuffer_.Id(), 0, drawCommands_.data(),
+                       drawCommands_.size() * sizeof(DrawElementsIndirectCommand));
+
+    // The culling pass lists up to every slot and writes a draw command per
+    // record
+    if (renderPath_ == RenderPath::Compute && gpuCulling_) {
+        routeRecordBuffer_.Reserve(routeRecords_.size() * sizeof(RouteRecord));
+        uploadRing_.Upload(routeRecordBuffer_.Id(), 0, routeRecords_.data(),
+                           routeRecords_.size() * sizeof(RouteRecord));
+        visibleSlotsBuffer_.Reserve(indices.size() * sizeof(GLuint));
+        cullResultBuffer_.Reserve(4 * sizeof(GLuint));
+        routeDrawCommandBuffer_.Reserve(routeRecords_.size() * sizeof(DrawElementsIndirectCommand));
+    } else {
+        routeRecordBuffer_.Release();
+        visibleSlotsBuffer_.Release();
+        cullResultBuffer_.Release();
+        routeDrawCommandBuffer_.Release();
+    }
+    uploadRing_.Submit();
+
+    // The CPU path extrudes from its own copy of the input
+    cpuInput_ = renderPath_ == RenderPath::Cpu ? std::move(geometry) : InputGeometry{};
+}
 
-    if (output_ebo_ == 0)
-        glGenBuffers(1, &output_ebo_);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, output_ebo_);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, outputIndexCount_ * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+static const char *RenderPathName(OpenGLCanvas::RenderPath path) {
+    switch (path) {
+    case OpenGLCanvas::RenderPath::Compute:
+        return "compute";
+    case OpenGLCanvas::RenderPath::Instanced:
+        return "instanced";
+    case OpenGLCanvas::RenderPath::Cpu:
+        return "cpu";
+    }
+    return "";
+}
+
+void OpenGLCanvas::UpdateOutputBuffers() {
+    if (renderPath_ == RenderPath::Instanced) {
+        output_vbo_.Release();
+        output_ebo_.Release();
+        return;
+    }
+
+    // Setup output buffer for compute shader, or the CPU extrusion
+    output_vbo_.Reserve(outputVertexCount_ * sizeof(OutputVertex));
+    output_ebo_.Reserve(outputIndexCount_ * sizeof(GLuint));
 
     if (output_vao_ == 0)
         glGenVertexArrays(1, &output_vao_);
     glBindVertexArray(output_vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, output_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, output_vbo_.Id());
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OutputVertex), (void *)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(OutputVertex), (void *)16);
     glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, output_ebo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, output_ebo_.Id());
     glBindVertexArray(0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void OpenGLCanvas::SetRenderPath(RenderPath path) {
+    renderPathChosen_ = true;
+    if (path == renderPath_) {
+        return;
+    }
+    if (path != RenderPath::Instanced && legacyContext_) {
+        std::cerr << "Only the instanced render path runs on OpenGL 3.3" << std::endl;
+        return;
+    }
+    if (path == RenderPath::Compute && isOpenGLInitialized_ && !computeAvailable_) {
+        std::cerr << "Compute shaders are not available, keeping the " << RenderPathName(renderPath_)
+                  << " render path" << std::endl;
+        return;
+    }
+    renderPath_ = path;
+    if (isOpenGLInitialized_) {
+        // Only the CPU path keeps a copy of the input
+        SetCurrent(*openGLContext_);
+        UpdateBuffersFromRoutes();
+        Refresh(false);
+    }
 }
 
-void OpenGLCanvas::CompileShaderProgram() {
-    auto compile = [](GLenum type, const char *src) {
-        GLuint s = glCreateShader(type);
-        glShaderSource(s, 1, &src, nullptr);
-        glCompileShader(s);
-        GLint success;
-        glGetShaderiv(s, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(s, 512, nullptr, infoLog);
-            std::cerr << "Shader compilation error: " << infoLog << std::endl;
+void OpenGLCanvas::SetGpuCulling(bool enabled) {
+    if (enabled == gpuCulling_ || (enabled && legacyContext_)) {
+        return;
+    }
+    gpuCulling_ = enabled;
+    if (isOpenGLInitialized_) {
+        // The culling buffers are only kept while culling
+        SetCurrent(*openGLContext_);
+        UpdateBuffersFromRoutes();
+        Refresh(false);
+    }
+}
+
+bool OpenGLCanvas::AllocateRouteSlots(size_t layerIndex, GLuint count, RouteSlots &slots) {
+    auto &layer = layerSlots_[layerIndex];
+
+    // first fit in the ranges freed by earlier updates
+    for (auto it = layer.freeRanges.begin(); it != layer.freeRanges.end(); ++it) {
+        if (it->second >= count) {
+            slots = {it->first, count, it->second, layerIndex};
+            layer.freeRanges.erase(it);
+            return true;
         }
-        return s;
+    }
+
+    if (layer.end + count > layer.first + layer.capacity) {
+        return false;
+    }
+    slots = {layer.end, count, count, layerIndex};
+    layer.end += count;
+    return true;
+}
+
+bool OpenGLCanvas::AllocateRouteRecord(size_t layerIndex, GLuint &record) {
+    auto &layer = layerSlots_[layerIndex];
+    if (!layer.freeRecords.empty()) {
+        record = layer.freeRecords.back();
+        layer.freeRecords.pop_back();
+        return true;
+    }
+    if (layer.recordEnd == layer.firstRecord + layer.recordCapacity) {
+        return false;
+    }
+    record = layer.recordEnd++;
+    return true;
+}
+
+OpenGLCanvas::RouteRecord OpenGLCanvas::MakeRouteRecord(const OSMLoader::Route_t &route, GLuint styleId,
+                                                        const RouteSlots &slots) {
+    RouteRecord record{std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::lowest(),
+                       std::numeric_limits<float>::lowest(),
+                       slots.first,
+                       slots.count,
+                       styleId,
+                       0};
+    for (const auto &loc : route.nodes) {
+        // The same rounding as the positions in VBO_
+        const float lon = static_cast<float>(loc.lon());
+        const float lat = static_cast<float>(loc.lat());
+        record.minLon = std::min(record.minLon, lon);
+        record.minLat = std::min(record.minLat, lat);
+        record.maxLon = std::max(record.maxLon, lon);
+        record.maxLat = std::max(record.maxLat, lat);
+    }
+    return record;
+}
+
+void OpenGLCanvas::WriteRouteRecord(GLuint index, const RouteRecord &record) {
+    extrusionValid_ = false;
+    routeRecords_[index] = record;
+    if (routeRecordBuffer_.Id() != 0) {
+        uploadRing_.Upload(routeRecordBuffer_.Id(), index * sizeof(RouteRecord), &record, sizeof(RouteRecord));
+    }
+}
+
+bool OpenGLCanvas::WriteRouteSlots(const OSMLoader::Route_t *route, GLuint styleId, const RouteSlots &slots) {
+    extrusionValid_ = false;
+    InputGeometry geometry;
+    std::vector<GLuint> addedNodes;
+    if (route) {
+        AddLineStripAdjacencyToBuffers(*route, styleId, geometry, addedNodes);
+    }
+    if (std::any_of(addedNodes.begin(), addedNodes.end(), [this](GLuint node) { return node >= nodeCapacity_; })) {
+        return false;
+    }
+    const GLuint count = geometry.SlotCount();
+    AppendUnusedSlots(slots.capacity - count, geometry);
+
+    // Released only now, so that nodes the route keeps are not re-added
+    auto &indices = geometry.indices;
+    ReleaseSlotNodes(slots.first, slots.first + slots.capacity);
+    for (GLuint ii = 0; ii < count; ++ii) {
+        slotNodes_[slots.first + ii] = indices[ii] >> 2;
+    }
+
+    // Positions of the new nodes, uploaded in runs of consecutive nodes
+    std::sort(addedNodes.begin(), addedNodes.end());
+    for (size_t begin = 0; begin < addedNodes.size();) {
+        size_t end = begin + 1;
+        while (end < addedNodes.size() && addedNodes[end] == addedNodes[end - 1] + 1) {
+            ++end;
+        }
+        std::vector<float> positions;
+        positions.reserve((end - begin) * 2);
+        for (size_t ii = begin; ii < end; ++ii) {
+            const auto &location = nodeTable_.Location(addedNodes[ii]);
+            positions.push_back(static_cast<float>(location.lon()));
+            positions.push_back(static_cast<float>(location.lat()));
+        }
+        const GLuint firstNode = addedNodes[begin];
+        uploadRing_.Upload(VBO_.Id(), firstNode * 2 * sizeof(float), positions.data(),
+                           positions.size() * sizeof(float));
+        if (renderPath_ == RenderPath::Cpu) {
+            std::copy(positions.begin(), positions.end(), cpuInput_.positions.begin() + firstNode * 2);
+        }
+        begin = end;
+    }
+
+    uploadRing_.Upload(styleIdBuffer_.Id(), slots.first * sizeof(GLuint), geometry.styleIds.data(),
+                       geometry.styleIds.size() * sizeof(GLuint));
+    uploadRing_.Upload(EBO_.Id(), slots.first * sizeof(GLuint), indices.data(), indices.size() * sizeof(GLuint));
+    if (renderPath_ == RenderPath::Cpu) {
+        std::copy(geometry.styleIds.begin(), geometry.styleIds.end(), cpuInput_.styleIds.begin() + slots.first);
+        std::copy(indices.begin(), indices.end(), cpuInput_.indices.begin() + slots.first);
+    }
+    return true;
+}
+
+void OpenGLCanvas::UpdateRoutes(const std::vector<OSMLoader::Route_t> &routes,
+                                const std::vector<osmium::object_id_type> &removedIds) {
+    for (auto id : removedIds) {
+        storedRoutes_.erase(id);
+        segmentIndex_.Remove(id);
+    }
+    for (const auto &route : routes) {
+        storedRoutes_[route.id] = route;
+        segmentIndex_.Insert(route);
+    }
+    UpdateLabelCandidates();
+
+    if (!isOpenGLInitialized_) {
+        return;
+    }
+    if (layerSlots_.empty()) {
+        UpdateBuffersFromRoutes();
+        return;
+    }
+    SetCurrent(*openGLContext_);
+
+    // Out of slack in a layer or of room for nodes: lay everything out again
+    auto layOutAgain = [this] {
+        uploadRing_.Submit();
+        UpdateBuffersFromRoutes();
     };
+    auto releaseSlots = [this](osmium::object_id_type id) {
+        auto it = routeSlots_.find(id);
+        if (it == routeSlots_.end()) {
+            return;
+        }
+        const auto slots = it->second;
+        routeSlots_.erase(it);
+        WriteRouteSlots(nullptr, 0, slots);
+        WriteRouteRecord(slots.record, RouteRecord{});
+        layerSlots_[slots.layer].freeRanges.emplace_back(slots.first, slots.capacity);
+        layerSlots_[slots.layer].freeRecords.push_back(slots.record);
+    };
+
+    for (auto id : removedIds) {
+        releaseSlots(id);
+    }
 
-    GLuint cs = compile(GL_COMPUTE_SHADER, ComputeShader);
-    map_compute_program_ = glCreateProgram();
-    glAttachShader(map_compute_program_, cs);
-    glLinkProgram(map_compute_program_);
-    glDeleteShader(cs);
+    const auto &styles = styleSheet_.styles();
+    for (const auto &route : routes) {
+        const GLuint styleId = route.nodes.size() < 2 ? StyleSheet::NO_STYLE : styleSheet_.Match(route.tags);
+        if (styleId == StyleSheet::NO_STYLE) {
+            releaseSlots(route.id);
+            continue;
+        }
 
-    GLuint vs = compile(GL_VERTEX_SHADER, VertexShader);
-    GLuint fs = compile(GL_FRAGMENT_SHADER, FragmentShader);
-    display_program_ = glCreateProgram();
-    glAttachShader(display_program_, vs);
-    glAttachShader(display_program_, fs);
-    glLinkProgram(display_program_);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+        auto layerIt = std::find_if(layerSlots_.begin(), layerSlots_.end(), [&](const LayerSlots &layer) {
+            return layer.zOrder == styles[styleId].zOrder;
+        });
+        const size_t layerIndex = std::distance(layerSlots_.begin(), layerIt);
+        const GLuint count = static_cast<GLuint>(route.nodes.size());
+
+        // Rewrite in place if the route still fits, otherwise move it
+        auto it = routeSlots_.find(route.id);
+        if (it != routeSlots_.end() && it->second.layer == layerIndex && it->second.capacity >= count) {
+            it->second.count = count;
+            if (!WriteRouteSlots(&route, styleId, it->second)) {
+                layOutAgain();
+                return;
+            }
+            WriteRouteRecord(it->second.record, MakeRouteRecord(route, styleId, it->second));
+            continue;
+        }
+
+        releaseSlots(route.id);
+        RouteSlots slots{};
+        if (!AllocateRouteSlots(layerIndex, count, slots) || !AllocateRouteRecord(layerIndex, slots.record)) {
+            layOutAgain();
+            return;
+        }
+        routeSlots_[route.id] = slots;
+        if (!WriteRouteSlots(&route, styleId, slots)) {
+            layOutAgain();
+            return;
+        }
+        WriteRouteRecord(slots.record, MakeRouteRecord(route, styleId, slots));
+    }
+
+    uploadRing_.Submit();
+    Refresh(false);
+}
+
+static bool ReadShaderFile(const std::string &filepath, std::string &source) {
+    std::ifstream file(filepath);
+    if (!file) {
+        std::cerr << "Could not open shader file " << filepath << std::endl;
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    source = ss.str();
+    return true;
+}
+
+// `source` with WORKGROUP_SIZE, and CULL_ROUTES if `cullRoutes`, defined
+// right after its #version line
+static std::string WithWorkgroupSize(const std::string &source, GLuint workgroupSize, bool cullRoutes = false) {
+    const size_t lineEnd = source.find('\n');
+    const size_t insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+    std::string defines = "#define WORKGROUP_SIZE " + std::to_string(workgroupSize) + "\n";
+    if (cullRoutes) {
+        defines += "#define CULL_ROUTES\n";
+    }
+    std::string result = source;
+    result.insert(insertAt, defines);
+    return result;
+}
+
+bool OpenGLCanvas::CompileShaderProgram() {
+    std::string computeSource = ComputeShader;
+    std::string cullSource = CullShader;
+    std::string vertexSource = VertexShader;
+    std::string fragmentSource = FragmentShader;
+    std::string textVertexSource = TextVertexShader;
+    std::string textFragmentSource = TextFragmentShader;
+    std::string segmentVertexSource = SegmentVertexShader;
+    std::string segmentFragmentSource = SegmentFragmentShader;
+
+    if (!shaderDirectory_.empty()) {
+        if (!ReadShaderFile(shaderDirectory_ + "/compute.comp.glsl", computeSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/cull.comp.glsl", cullSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/compute.vert.glsl", vertexSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/compute.frag.glsl", fragmentSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/text.vert.glsl", textVertexSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/text.frag.glsl", textFragmentSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/segment.vert.glsl", segmentVertexSource) ||
+            !ReadShaderFile(shaderDirectory_ + "/segment.frag.glsl", segmentFragmentSource)) {
+            return false;
+        }
+    }
+
+    ShaderProgram computeProgram;
+    computeProgram.SetSource(GL_COMPUTE_SHADER, WithWorkgroupSize(computeSource, computeWorkgroupSize_));
+    ShaderProgram culledComputeProgram;
+    culledComputeProgram.SetSource(GL_COMPUTE_SHADER, WithWorkgroupSize(computeSource, computeWorkgroupSize_, true));
+    ShaderProgram cullProgram;
+    cullProgram.SetSource(GL_COMPUTE_SHADER, cullSource);
+    ShaderProgram displayProgram;
+    displayProgram.SetSource(GL_VERTEX_SHADER, vertexSource);
+    displayProgram.SetSource(GL_FRAGMENT_SHADER, fragmentSource);
+    ShaderProgram textProgram;
+    textProgram.SetSource(GL_VERTEX_SHADER, textVertexSource);
+    textProgram.SetSource(GL_FRAGMENT_SHADER, textFragmentSource);
+    ShaderProgram segmentProgram;
+    segmentProgram.SetSource(GL_VERTEX_SHADER, segmentVertexSource);
+    segmentProgram.SetSource(GL_FRAGMENT_SHADER, segmentFragmentSource);
+
+    std::vector<ShaderProgram *> programs{&textProgram, &segmentProgram};
+    if (!legacyContext_) {
+        programs.push_back(&displayProgram);
+    }
+    if (computeAvailable_) {
+        programs.insert(programs.end(), {&computeProgram, &culledComputeProgram, &cullProgram});
+    }
+    bool success = true;
+    for (auto *program : programs) {
+        if (!program->Build(programCache_)) {
+            std::cerr << program->BuildLog();
+            success = false;
+        }
+    }
+    if (!success) {
+        return false;
+    }
+
+    map_compute_program_ = std::move(computeProgram);
+    culled_compute_program_ = std::move(culledComputeProgram);
+    cull_program_ = std::move(cullProgram);
+    computeSource_ = computeSource;
+    display_program_ = std::move(displayProgram);
+    segment_program_ = std::move(segmentProgram);
+    textRenderer_.SetProgram(std::move(textProgram));
+
+    return true;
+}
+
+bool OpenGLCanvas::BuildComputeProgram(GLuint workgroupSize, ShaderProgram &program) {
+    program.SetSource(GL_COMPUTE_SHADER, WithWorkgroupSize(computeSource_, workgroupSize));
+    if (!program.Build(programCache_)) {
+        std::cerr << program.BuildLog();
+        return false;
+    }
+    return true;
+}
+
+bool OpenGLCanvas::ReloadShaders() {
+    if (!isOpenGLInitialized_) {
+        return false;
+    }
+
+    SetCurrent(*openGLContext_);
+    if (!CompileShaderProgram()) {
+        std::cerr << "Shader reload failed, keeping the previous shaders" << std::endl;
+        return false;
+    }
+    std::cout << "Reloaded shaders from " << shaderDirectory_ << std::endl;
+
+    extrusionValid_ = false;
+    Refresh(false);
+    return true;
 }
 
 OpenGLCanvas::~OpenGLCanvas() {
     glDeleteVertexArrays(1, &VAO_);
-    glDeleteBuffers(1, &VBO_);
-    glDeleteBuffers(1, &EBO_);
+    VBO_.Release();
+    styleIdBuffer_.Release();
+    EBO_.Release();
     glDeleteVertexArrays(1, &quad_vao_);
     glDeleteBuffers(1, &quad_vbo_);
-    glDeleteBuffers(1, &output_vbo_);
-    glDeleteBuffers(1, &output_ebo_);
+    output_vbo_.Release();
+    output_ebo_.Release();
     glDeleteVertexArrays(1, &output_vao_);
-    glDeleteProgram(map_compute_program_);
-    glDeleteProgram(display_program_);
+    glDeleteVertexArrays(1, &segmentVao_);
+    glDeleteTextures(static_cast<GLsizei>(segmentTextures_.size()), segmentTextures_.data());
+    drawCommandBuffer_.Release();
+    routeRecordBuffer_.Release();
+    visibleSlotsBuffer_.Release();
+    cullResultBuffer_.Release();
+    routeDrawCommandBuffer_.Release();
+    uploadRing_.Release();
+    glDeleteBuffers(1, &styleBuffer_);
+    map_compute_program_.Release();
+    culled_compute_program_.Release();
+    cull_program_.Release();
+    display_program_.Release();
+    segment_program_.Release();
+    textRenderer_.Release();
+    for (auto &frame : pendingFrames_) {
+        glDeleteSync(frame.fence);
+    }
+    for (auto &query : timerQueries_) {
+        if (query != 0) {
+            glDeleteQueries(1, &query);
+        }
+    }
 
     delete openGLContext_;
 }
@@ -441,6 +1041,37 @@ bool OpenGLCanvas::InitializeOpenGL() {
         wxLogDebug("KHR_debug not available; GL debug output disabled");
     }
 
+    // Compute shaders are core in 4.3. Software rasterizers offer them but
+    // run them far slower than CpuExtruder.
+    computeAvailable_ = !legacyContext_ && (GLEW_VERSION_4_3 || GLEW_ARB_compute_shader);
+    const std::string renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    const bool softwareRenderer = renderer.find("llvmpipe") != std::string::npos ||
+                                  renderer.find("softpipe") != std::string::npos ||
+                                  renderer.find("SwiftShader") != std::string::npos ||
+                                  renderer.find("GDI Generic") != std::string::npos;
+    if (computeAvailable_) {
+        GLint maxSize = 0;
+        GLint maxInvocations = 0;
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSize);
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+        const GLuint limit = static_cast<GLuint>(std::min(maxSize, maxInvocations));
+        if (computeWorkgroupSize_ == 0 || computeWorkgroupSize_ > limit) {
+            computeWorkgroupSize_ = std::min(DEFAULT_WORKGROUP_SIZE, limit);
+            std::cerr << "Unsupported compute workgroup size, using " << computeWorkgroupSize_ << std::endl;
+        }
+    }
+    if (legacyContext_) {
+        // the compute and CPU paths draw with 4.3 shaders and indirect draws
+        renderPath_ = RenderPath::Instanced;
+        gpuCulling_ = false;
+        std::cout << "OpenGL 4.3 is not available, drawing instanced segments, renderer: " << renderer
+                  << std::endl;
+    } else if ((!renderPathChosen_ && (softwareRenderer || !computeAvailable_)) ||
+               (renderPath_ == RenderPath::Compute && !computeAvailable_)) {
+        renderPath_ = RenderPath::Cpu;
+        std::cout << "Extruding on the CPU, renderer: " << renderer << std::endl;
+    }
+
     // Setup quad for display
     float quadVertices[] = {
         -1.0f, 1.0f, 0.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f,
@@ -456,22 +1087,30 @@ bool OpenGLCanvas::InitializeOpenGL() {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
 
-    CompileShaderProgram();
+    textRenderer_.Initialize();
+
+    if (!CompileShaderProgram()) {
+        wxMessageBox("Error: Could not compile the shaders.", "OpenGL initialization error", wxOK | wxICON_INFORMATION,
+                     this);
+        return false;
+    }
+
+    // 3 x 4 MiB staging regions for geometry uploads
+    uploadRing_.Initialize(4 << 20);
 
     isOpenGLInitialized_ = true;
 
     // If ways were provided before GL initialization, upload them now.
     UpdateBuffersFromRoutes();
 
-    openGLInitializationTime_ = std::chrono::high_resolution_clock::now();
+    ApplySwapInterval();
+
     // initialize FPS timer state
     lastFpsUpdateTime_ = std::chrono::high_resolution_clock::now();
     framesSinceLastFps_ = 0;
 
-    auto initRect = GetClientRect();
-    initRect.SetSize(GetSize() * GetContentScaleFactor());
-
-    this->viewportBounds_ = initRect;
+    const auto initSize = GetSize() * GetContentScaleFactor();
+    camera_.Reset({0.0, 0.0, static_cast<double>(initSize.x), static_cast<double>(initSize.y)});
     // std::cout << "InitializeOpenGL: called\n";
 
     wxCommandEvent evt(wxEVT_OPENGL_INITIALIZED);
@@ -489,6 +1128,25 @@ void OpenGLCanvas::OnPaint(wxPaintEvent &WXUNUSED(event)) {
     }
 
     SetCurrent(*openGLContext_);
+    const auto frameStart = std::chrono::high_resolution_clock::now();
+    PollFrameLatency();
+    camera_.Advance(Camera::Clock::now());
+
+    // GPU time of the frame, read back a few frames later so it never stalls
+    GLuint &timerQuery = timerQueries_[frameIndex_ % timerQueries_.size()];
+    if (timerQuery != 0) {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsed);
+            gpuFrameMs_ = elapsed / 1e6f;
+        }
+    } else {
+        glGenQueries(1, &timerQuery);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+    ++frameIndex_;
 
     // glEnable(GL_BLEND);
     // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -498,51 +1156,44 @@ void OpenGLCanvas::OnPaint(wxPaintEvent &WXUNUSED(event)) {
     glClear(GL_COLOR_BUFFER_BIT); // | GL_DEPTH_BUFFER_BIT);
 
     auto size = GetClientSize() * GetContentScaleFactor();
-    wxPoint bottomLeft{};
-    wxPoint topRight(size.x, size.y);
-
-    auto bottomLeftCoord = mapViewport2OSM(bottomLeft);
-    auto topRightCoord = mapViewport2OSM(topRight);
-    double minLon = bottomLeftCoord.lon();
-    double minLat = bottomLeftCoord.lat();
-
-    double lonRange = (topRightCoord.lon() - bottomLeftCoord.lon());
-    double latRange = (topRightCoord.lat() - bottomLeftCoord.lat());
-
-    if (lonRange == 0.0)
-        lonRange = 1.0;
-    if (latRange == 0.0)
-        latRange = 1.0;
+    const Camera::Rect &view = camera_.Current();
+
+    const bool moving = isDragging_ || zoomGestureActive_ || camera_.IsAnimating();
+    const bool rebuilt = DrawRoutes(view, size, moving);
+
+    // 3. Road names on top
+    if (!moving || rebuilt) {
+        double minLon, minLat, lonRange, latRange;
+        ViewBounds(view, size, minLon, minLat, lonRange, latRange);
+        const LabelPlacer::View labelView{minLon,
+                                          minLat,
+                                          lonRange,
+                                          latRange,
+                                          static_cast<float>(size.x),
+                                          static_cast<float>(size.y),
+                                          ZoomLevel(lonRange, size.x)};
+        labelPlacer_.SetFontSize(LABEL_FONT_SIZE * GetContentScaleFactor());
+        labelsPending_ = !labelPlacer_.Place(labelView, LABEL_TIME_BUDGET, textRenderer_);
+        labelView_ = view;
+    }
+    labelPlacer_.Draw(textRenderer_, TextRenderer::PackColor(0.2f, 0.2f, 0.2f), TextRenderer::PackColor(1, 1, 1, 0.9f));
+    textRenderer_.Draw(static_cast<float>(size.x), static_cast<float>(size.y), ViewTransform(labelView_, view));
 
-    // 1. Dispatch compute to extrude lines
-    glUseProgram(map_compute_program_);
-    glUniform4f(glGetUniformLocation(map_compute_program_, "uBounds"), static_cast<float>(minLon),
-                static_cast<float>(minLat), static_cast<float>(lonRange), static_cast<float>(latRange));
-    glUniform2f(glGetUniformLocation(map_compute_program_, "uScreenSize"), static_cast<float>(size.x),
-                static_cast<float>(size.y));
-    glUniform1ui(glGetUniformLocation(map_compute_program_, "uNumIndices"), static_cast<GLuint>(inputIndexCount_));
-    glUniform1f(glGetUniformLocation(map_compute_program_, "uWidth"), 5.0f); // Line width
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, VBO_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, EBO_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, output_vbo_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, output_ebo_);
-
-    glDispatchCompute((inputIndexCount_ + 127) / 128, 1, 1);
-    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
-
-    // 2. Draw extruded triangle strip
-    glUseProgram(display_program_);
-    glUniform2f(glGetUniformLocation(display_program_, "uScreenSize"), (float)size.x, (float)size.y);
-    glBindVertexArray(output_vao_);
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(0xFFFFFFFF);
-    glDrawElements(GL_TRIANGLE_STRIP, outputIndexCount_, GL_UNSIGNED_INT, 0);
-    glDisable(GL_PRIMITIVE_RESTART);
-    glBindVertexArray(0);
+    // 4. Statistics
+    UpdateFrameStats(frameStart);
+    AddHudText(size);
+    textRenderer_.Draw(static_cast<float>(size.x), static_cast<float>(size.y));
 
+    glEndQuery(GL_TIME_ELAPSED);
     SwapBuffers();
 
+    // The fence signals once the frame showing the pending input is done
+    if (inputTime_) {
+        pendingFrames_.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), *inputTime_});
+        inputTime_.reset();
+        glFlush();
+    }
+
     // static bool shown = false;
     // if (!shown) {
     //     shown = true;
@@ -573,35 +1224,600 @@ void OpenGLCanvas::OnPaint(wxPaintEvent &WXUNUSED(event)) {
     //     }
     //     delete[] outputIndices;
     // }
+}
 
-    // Update FPS counters and draw overlay text
-    ++framesSinceLastFps_;
+bool OpenGLCanvas::DrawRoutes(const Camera::Rect &view, const wxSize &size, bool moving) {
+    if (renderPath_ == RenderPath::Instanced) {
+        DrawInstancedSegments(view, size);
+        return false;
+    }
+
+    // While the view moves, frames only update uniforms: the lines extruded
+    // and the labels placed for an earlier view are moved into place by a
+    // scale and offset. Extrude again once the view settles, or earlier when
+    // the line widths drift too far from their style.
+    // Culled routes are missing once the view leaves the area around the
+    // extruded view.
+    const double overzoom = extrudedView_.width / view.width;
+    double minLon, minLat, lonRange, latRange;
+    ViewBounds(view, size, minLon, minLat, lonRange, latRange);
+    const bool outsideCulled = extrusionCulled_ && (minLon < culledBounds_[0] || minLat < culledBounds_[1] ||
+                                                    minLon + lonRange > culledBounds_[2] ||
+                                                    minLat + latRange > culledBounds_[3]);
+    const bool extrude = !extrusionValid_ || extrudedSize_ != size || (!moving && extrudedView_ != view) ||
+                         overzoom > MAX_OVERZOOM || overzoom < 1.0 / MAX_OVERZOOM || outsideCulled;
+    if (extrude) {
+        ExtrudeRoutes(view, size);
+    }
+
+    // 2. Draw extruded triangle strips, one command per style layer in
+    // z-order, or per route with culling. Routes are grouped by layer, so
+    // that keeps the z-order.
+    const auto lineTransform = ViewTransform(extrudedView_, view);
+    display_program_.Use();
+    glUniform2f(display_program_.Uniform("uScreenSize"), (float)size.x, (float)size.y);
+    glUniform4fv(display_program_.Uniform("uTransform"), 1, lineTransform.data());
+    glBindVertexArray(output_vao_);
+    size_t drawCount = drawCommands_.size();
+    if (extrusionCulled_) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, routeDrawCommandBuffer_.Id());
+        drawCount = routeRecords_.size();
+    } else {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer_.Id());
+    }
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(0xFFFFFFFF);
+    glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(drawCount), 0);
+    glDisable(GL_PRIMITIVE_RESTART);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    return extrude;
+}
+
+void OpenGLCanvas::DrawInstancedSegments(const Camera::Rect &view, const wxSize &size) {
+    if (inputIndexCount_ == 0) {
+        return;
+    }
+    double minLon, minLat, lonRange, latRange;
+    ViewBounds(view, size, minLon, minLat, lonRange, latRange);
+
+    // Point the texture buffers at the current buffers every frame, the
+    // input buffers are recreated when they grow. Texture unit 0 is left to the text.
+    if (segmentVao_ == 0) {
+        glGenVertexArrays(1, &segmentVao_);
+        glGenTextures(static_cast<GLsizei>(segmentTextures_.size()), segmentTextures_.data());
+    }
+    const std::array<std::pair<GLenum, GLuint>, 4> textureBuffers{
+        {{GL_RG32F, VBO_.Id()}, {GL_R32UI, styleIdBuffer_.Id()}, {GL_R32UI, EBO_.Id()}, {GL_RGBA32F, styleBuffer_}}};
+    for (size_t ii = 0; ii < textureBuffers.size(); ++ii) {
+        glActiveTexture(GL_TEXTURE1 + static_cast<GLenum>(ii));
+        glBindTexture(GL_TEXTURE_BUFFER, segmentTextures_[ii]);
+        glTexBuffer(GL_TEXTURE_BUFFER, textureBuffers[ii].first, textureBuffers[ii].second);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    segment_program_.Use();
+    glUniform1i(segment_program_.Uniform("uPositions"), 1);
+    glUniform1i(segment_program_.Uniform("uStyleIds"), 2);
+    glUniform1i(segment_program_.Uniform("uIndices"), 3);
+    glUniform1i(segment_program_.Uniform("uStyles"), 4);
+    glUniform4f(segment_program_.Uniform("uBounds"), static_cast<float>(minLon), static_cast<float>(minLat),
+                static_cast<float>(lonRange), static_cast<float>(latRange));
+    glUniform2f(segment_program_.Uniform("uScreenSize"), static_cast<float>(size.x), static_cast<float>(size.y));
+    glUniform1i(segment_program_.Uniform("uNumIndices"), inputIndexCount_);
+    glUniform1f(segment_program_.Uniform("uZoom"), static_cast<float>(ZoomLevel(lonRange, size.x)));
+
+    // One quad per slot of each style layer, in z-order. The offset goes
+    // through a uniform instead of baseInstance, which needs OpenGL 4.2.
+    const GLint firstIndexLocation = segment_program_.Uniform("uFirstIndex");
+    glBindVertexArray(segmentVao_);
+    for (const auto &layer : layerSlots_) {
+        glUniform1i(firstIndexLocation, static_cast<GLint>(layer.first));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(layer.capacity));
+    }
+    glBindVertexArray(0);
+}
+
+void OpenGLCanvas::ExtrudeRoutes(const Camera::Rect &view, const wxSize &size) {
+    const auto extrusionView = ExtrusionView(view, size);
+    extrusionCulled_ = renderPath_ == RenderPath::Compute && gpuCulling_ && routeRecordBuffer_.Id() != 0;
+    if (renderPath_ == RenderPath::Cpu) {
+        ExtrudeOnCpu(extrusionView);
+    } else if (extrusionCulled_) {
+        double minLon, minLat, lonRange, latRange;
+        ViewBounds(view, size, minLon, minLat, lonRange, latRange);
+        culledBounds_ = {minLon - lonRange * CULL_MARGIN, minLat - latRange * CULL_MARGIN,
+                         minLon + lonRange * (1.0 + CULL_MARGIN), minLat + latRange * (1.0 + CULL_MARGIN)};
+
+        // Routes just outside still reach in with their line width
+        float maxWidth = 0.0f;
+        for (const auto &style : styleSheet_.styles()) {
+            maxWidth = std::max(maxWidth, style.width);
+        }
+        const double lonPadding = maxWidth * 0.5 * lonRange / size.x;
+        const double latPadding = maxWidth * 0.5 * latRange / size.y;
+        CullAndExtrude(extrusionView, {culledBounds_[0] - lonPadding, culledBounds_[1] - latPadding,
+                                       culledBounds_[2] + lonPadding, culledBounds_[3] + latPadding});
+    } else {
+        DispatchExtrusion(extrusionView);
+    }
+
+    extrudedView_ = view;
+    extrudedSize_ = size;
+    extrusionValid_ = true;
+}
+
+CpuExtruder::View OpenGLCanvas::ExtrusionView(const Camera::Rect &view, const wxSize &size) const {
+    double minLon, minLat, lonRange, latRange;
+    ViewBounds(view, size, minLon, minLat, lonRange, latRange);
+    return {static_cast<float>(minLon),
+            static_cast<float>(minLat),
+            static_cast<float>(lonRange),
+            static_cast<float>(latRange),
+            static_cast<float>(size.x),
+            static_cast<float>(size.y),
+            static_cast<float>(ZoomLevel(lonRange, size.x))};
+}
+
+void OpenGLCanvas::SetExtrusionInputs(const ShaderProgram &program, const CpuExtruder::View &view) {
+    program.Use();
+    glUniform4f(program.Uniform("uBounds"), view.minLon, view.minLat, view.lonRange, view.latRange);
+    glUniform2f(program.Uniform("uScreenSize"), view.width, view.height);
+    glUniform1ui(program.Uniform("uNumIndices"), static_cast<GLuint>(inputIndexCount_));
+    glUniform1f(program.Uniform("uZoom"), view.zoom);
+
+    program.BindStorageBlock("InputPositions", VBO_.Id());
+    program.BindStorageBlock("InputStyleIds", styleIdBuffer_.Id());
+    program.BindStorageBlock("InputEBO", EBO_.Id());
+    program.BindStorageBlock("OutputVBO", output_vbo_.Id());
+    program.BindStorageBlock("OutputEBO", output_ebo_.Id());
+    program.BindStorageBlock("StyleTable", styleBuffer_);
+}
+
+void OpenGLCanvas::DispatchExtrusion(const CpuExtruder::View &view) {
+    // 1. Dispatch compute to extrude lines
+    SetExtrusionInputs(map_compute_program_, view);
+    glDispatchCompute((inputIndexCount_ + computeWorkgroupSize_ - 1) / computeWorkgroupSize_, 1, 1);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+}
+
+// See cull.comp.glsl
+constexpr GLuint CULL_WORKGROUP_SIZE = 64;
+// The smallest GL_MAX_COMPUTE_WORK_GROUP_COUNT the specification allows
+constexpr GLuint MAX_CULLED_GROUPS = 65535;
+
+void OpenGLCanvas::CullAndExtrude(const CpuExtruder::View &view, const std::array<double, 4> &cullBounds) {
+    // Nothing to extrude until the cull pass finds visible routes. Updating
+    // the buffer waits for the previous frame to be done with it.
+    const std::array<GLuint, 4> cullReset{0, 1, 1, 0};
+    glBindBuffer(GL_COPY_WRITE_BUFFER, cullResultBuffer_.Id());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(cullReset), cullReset.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // 1. Cull the routes
+    const GLuint recordCount = static_cast<GLuint>(routeRecords_.size());
+    cull_program_.Use();
+    glUniform4f(cull_program_.Uniform("uCullBounds"), static_cast<float>(cullBounds[0]),
+                static_cast<float>(cullBounds[1]), static_cast<float>(cullBounds[2]),
+                static_cast<float>(cullBounds[3]));
+    glUniform1f(cull_program_.Uniform("uZoom"), view.zoom);
+    glUniform1ui(cull_program_.Uniform("uNumRoutes"), recordCount);
+    glUniform1ui(cull_program_.Uniform("uWorkgroupSize"), computeWorkgroupSize_);
+    glUniform1ui(cull_program_.Uniform("uMaxGroups"), MAX_CULLED_GROUPS);
+    cull_program_.BindStorageBlock("RouteRecords", routeRecordBuffer_.Id());
+    cull_program_.BindStorageBlock("VisibleSlots", visibleSlotsBuffer_.Id());
+    cull_program_.BindStorageBlock("CullResult", cullResultBuffer_.Id());
+    cull_program_.BindStorageBlock("DrawCommands", routeDrawCommandBuffer_.Id());
+    cull_program_.BindStorageBlock("StyleTable", styleBuffer_);
+    glDispatchCompute((recordCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    // 2. Extrude the visible slots, with as many workgroups as the cull pass
+    // asked for
+    SetExtrusionInputs(culled_compute_program_, view);
+    culled_compute_program_.BindStorageBlock("VisibleSlots", visibleSlotsBuffer_.Id());
+    culled_compute_program_.BindStorageBlock("CullResult", cullResultBuffer_.Id());
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, cullResultBuffer_.Id());
+    glDispatchComputeIndirect(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void OpenGLCanvas::ExtrudeOnCpu(const CpuExtruder::View &view) {
+    if (!cpuExtruder_) {
+        cpuExtruder_ = std::make_unique<CpuExtruder>();
+    }
+    cpuExtruder_->Extrude(cpuInput_.positions.data(), cpuInput_.styleIds.data(), cpuInput_.indices.data(),
+                          cpuInput_.indices.size(), cpuStyles_, view, cpuOutputVertices_, cpuOutputIndices_);
+
+    // Everything changes every time, so this skips the upload ring: the
+    // driver copies it out right away or streams it through its own staging
+    glBindBuffer(GL_COPY_WRITE_BUFFER, output_vbo_.Id());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, cpuOutputVertices_.size() * sizeof(OutputVertex),
+                    cpuOutputVertices_.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, output_ebo_.Id());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, cpuOutputIndices_.size() * sizeof(GLuint), cpuOutputIndices_.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void OpenGLCanvas::BenchmarkRenderPaths(std::ostream &out) {
+    if (!isOpenGLInitialized_) {
+        return;
+    }
+    SetCurrent(*openGLContext_);
+
+    const OSMLoader::Id2Route routes = storedRoutes_;
+    const RenderPath renderPath = renderPath_;
+    std::vector<osmium::object_id_type> ids;
+    ids.reserve(routes.size());
+    for (const auto &entry : routes) {
+        ids.push_back(entry.first);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    const auto size = GetClientSize() * GetContentScaleFactor();
+    const Camera::Rect view = camera_.Current();
+    constexpr int WARMUP_FRAMES = 5;
+    constexpr int FRAMES = 50;
+    GLuint query = 0;
+    glGenQueries(1, &query);
+
+    out << std::setw(12) << "segments" << std::setw(12) << "path" << std::setw(16) << "CPU ms/frame"
+        << std::setw(16) << "GPU ms/frame" << std::setw(16) << "buffers MiB" << std::endl;
+    for (size_t fraction : {8, 4, 2, 1}) {
+        storedRoutes_.clear();
+        for (size_t ii = 0; ii < ids.size() / fraction; ++ii) {
+            storedRoutes_[ids[ii]] = routes.at(ids[ii]);
+        }
+
+        for (RenderPath path : {RenderPath::Compute, RenderPath::Instanced, RenderPath::Cpu}) {
+            if ((path == RenderPath::Compute && !computeAvailable_) ||
+                (path != RenderPath::Instanced && legacyContext_)) {
+                continue;
+            }
+            renderPath_ = path;
+            UpdateBuffersFromRoutes();
+            size_t segments = 0;
+            for (const auto &entry : routeSlots_) {
+                segments += entry.second.count - 1;
+            }
+
+            // Pan by a pixel every frame, so the compute and CPU paths
+            // extrude every frame like the instanced path does
+            double cpuMs = 0.0;
+            double gpuMs = 0.0;
+            for (int frame = -WARMUP_FRAMES; frame < FRAMES; ++frame) {
+                Camera::Rect frameView = view;
+                frameView.x += frame;
+                glClear(GL_COLOR_BUFFER_BIT);
+                if (frame >= 0) {
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                }
+                extrusionValid_ = false;
+                const auto drawStart = std::chrono::high_resolution_clock::now();
+                DrawRoutes(frameView, size, true);
+                if (frame >= 0) {
+                    cpuMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                                       drawStart)
+                                 .count();
+                    glEndQuery(GL_TIME_ELAPSED);
+                    GLuint64 elapsed = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                    gpuMs += elapsed / 1e6;
+                }
+            }
+
+            const GLsizeiptr bytes =
+                VBO_.Capacity() + styleIdBuffer_.Capacity() + EBO_.Capacity() + output_vbo_.Capacity() +
+                output_ebo_.Capacity() + routeRecordBuffer_.Capacity() + visibleSlotsBuffer_.Capacity() +
+                routeDrawCommandBuffer_.Capacity();
+            out << std::setw(12) << segments << std::setw(12) << RenderPathName(path) << std::fixed
+                << std::setprecision(3) << std::setw(16) << cpuMs / FRAMES << std::setw(16) << gpuMs / FRAMES
+                << std::setprecision(1) << std::setw(16) << bytes / (1024.0 * 1024.0) << std::endl;
+        }
+    }
+    glDeleteQueries(1, &query);
+
+    storedRoutes_ = routes;
+    renderPath_ = renderPath;
+    UpdateBuffersFromRoutes();
+    Refresh(false);
+}
+
+bool OpenGLCanvas::ValidateCpuExtrusion(std::ostream &out) {
+    if (!isOpenGLInitialized_ || !computeAvailable_) {
+        out << "Compute shaders are not available, nothing to compare with" << std::endl;
+        return false;
+    }
+    SetCurrent(*openGLContext_);
+
+    // The CPU path keeps the copy of the input, the compute shader reads the
+    // same data from VBO_/EBO_
+    const RenderPath renderPath = renderPath_;
+    renderPath_ = RenderPath::Cpu;
+    UpdateBuffersFromRoutes();
+    const auto size = GetClientSize() * GetContentScaleFactor();
+    const auto view = ExtrusionView(camera_.Current(), size);
+
+    DispatchExtrusion(view);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    std::vector<OutputVertex> gpuVertices(static_cast<size_t>(outputVertexCount_));
+    std::vector<GLuint> gpuIndices(static_cast<size_t>(outputIndexCount_));
+    glBindBuffer(GL_COPY_READ_BUFFER, output_vbo_.Id());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, gpuVertices.size() * sizeof(OutputVertex), gpuVertices.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, output_ebo_.Id());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, gpuIndices.size() * sizeof(GLuint), gpuIndices.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (!cpuExtruder_) {
+        cpuExtruder_ = std::make_unique<CpuExtruder>();
+    }
+    cpuExtruder_->Extrude(cpuInput_.positions.data(), cpuInput_.styleIds.data(), cpuInput_.indices.data(),
+                          cpuInput_.indices.size(), cpuStyles_, view, cpuOutputVertices_, cpuOutputIndices_);
+
+    size_t identical = 0;
+    size_t values = 0;
+    float maxDifference = 0.0f;
+    for (size_t ii = 0; ii < gpuVertices.size(); ++ii) {
+        const auto &gpu = gpuVertices[ii];
+        const auto &cpu = cpuOutputVertices_[ii];
+        for (auto member : {&OutputVertex::x, &OutputVertex::y, &OutputVertex::r, &OutputVertex::g, &OutputVertex::b,
+                            &OutputVertex::a}) {
+            identical += std::memcmp(&(gpu.*member), &(cpu.*member), sizeof(float)) == 0;
+            maxDifference = std::max(maxDifference, std::abs(gpu.*member - cpu.*member));
+            ++values;
+        }
+    }
+    size_t indexMismatches = 0;
+    for (size_t ii = 0; ii < gpuIndices.size(); ++ii) {
+        indexMismatches += gpuIndices[ii] != cpuOutputIndices_[ii];
+    }
+
+    const bool passed = indexMismatches == 0 && maxDifference <= 1e-3f;
+    out << "Vertex values bit identical: " << identical << " of " << values << "\n"
+        << "Largest vertex difference: " << maxDifference << " px\n"
+        << "Index mismatches: " << indexMismatches << " of " << gpuIndices.size() << "\n"
+        << (passed ? "CPU extrusion matches the compute shader" : "CPU extrusion differs from the compute shader")
+        << std::endl;
+
+    renderPath_ = renderPath;
+    UpdateBuffersFromRoutes();
+    Refresh(false);
+    return passed;
+}
+
+void OpenGLCanvas::BenchmarkWorkgroupSizes(std::ostream &out) {
+    if (!isOpenGLInitialized_ || !computeAvailable_ || inputIndexCount_ == 0) {
+        out << "Nothing to extrude with compute shaders" << std::endl;
+        return;
+    }
+    SetCurrent(*openGLContext_);
+
+    // The instanced path has no output buffers
+    const RenderPath renderPath = renderPath_;
+    renderPath_ = RenderPath::Compute;
+    UpdateOutputBuffers();
+
+    GLint maxSize = 0;
+    GLint maxInvocations = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSize);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+    const GLuint limit = static_cast<GLuint>(std::min(maxSize, maxInvocations));
+
+    const auto view = ExtrusionView(camera_.Current(), GetClientSize() * GetContentScaleFactor());
+    constexpr int WARMUP_DISPATCHES = 5;
+    constexpr int DISPATCHES = 100;
+    GLuint query = 0;
+    glGenQueries(1, &query);
+
+    ShaderProgram program = std::move(map_compute_program_);
+    const GLuint workgroupSize = computeWorkgroupSize_;
+    out << "Extruding " << inputIndexCount_ << " indices" << std::endl;
+    out << std::setw(16) << "workgroup size" << std::setw(16) << "ms/dispatch" << std::setw(20) << "M indices/s"
+        << std::endl;
+    for (GLuint size = 32; size <= limit; size *= 2) {
+        ShaderProgram variant;
+        if (!BuildComputeProgram(size, variant)) {
+            continue;
+        }
+        map_compute_program_ = std::move(variant);
+        computeWorkgroupSize_ = size;
+
+        double gpuMs = 0.0;
+        for (int dispatch = -WARMUP_DISPATCHES; dispatch < DISPATCHES; ++dispatch) {
+            if (dispatch >= 0) {
+                glBeginQuery(GL_TIME_ELAPSED, query);
+            }
+            DispatchExtrusion(view);
+            if (dispatch >= 0) {
+                glEndQuery(GL_TIME_ELAPSED);
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                gpuMs += elapsed / 1e6;
+            }
+        }
+        const double msPerDispatch = gpuMs / DISPATCHES;
+        out << std::setw(16) << size << std::fixed << std::setprecision(3) << std::setw(16) << msPerDispatch
+            << std::setprecision(1) << std::setw(20) << inputIndexCount_ / (msPerDispatch * 1e3) << std::endl;
+        map_compute_program_.Release();
+    }
+    glDeleteQueries(1, &query);
+
+    map_compute_program_ = std::move(program);
+    computeWorkgroupSize_ = workgroupSize;
+    renderPath_ = renderPath;
+    UpdateOutputBuffers();
+    extrusionValid_ = false;
+    Refresh(false);
+}
+
+// Hit rate of a FIFO cache of `capacity` entries over `keys`
+static double FifoHitRate(const std::vector<GLuint> &keys, size_t capacity) {
+    std::deque<GLuint> fifo;
+    std::unordered_map<GLuint, int> cached;
+    size_t hits = 0;
+    for (GLuint key : keys) {
+        auto it = cached.find(key);
+        if (it != cached.end() && it->second > 0) {
+            ++hits;
+            continue;
+        }
+        fifo.push_back(key);
+        ++cached[key];
+        if (fifo.size() > capacity) {
+            --cached[fifo.front()];
+            fifo.pop_front();
+        }
+    }
+    return keys.empty() ? 0.0 : static_cast<double>(hits) / keys.size();
+}
+
+void OpenGLCanvas::MeasureBufferLocality(std::ostream &out) {
+    if (!isOpenGLInitialized_) {
+        return;
+    }
+    SetCurrent(*openGLContext_);
+
+    // Vertex caches hold a few dozen vertices; the fetch cache model is a
+    // 16 KiB cache of 64 byte lines, 8 node positions each
+    constexpr size_t VERTEX_CACHE_SIZE = 32;
+    constexpr size_t FETCH_CACHE_LINES = 256;
+    constexpr GLuint NODES_PER_LINE = 64 / (2 * sizeof(float));
+
+    double minLon, minLat, lonRange, latRange;
+    ViewBounds(camera_.Current(), GetClientSize() * GetContentScaleFactor(), minLon, minLat, lonRange, latRange);
+    const bool spatialOrder = spatialOrder_;
+
+    out << std::setw(10) << "order" << std::setw(16) << "vertex cache %" << std::setw(16) << "fetch cache %"
+        << std::setw(16) << "visible routes" << std::setw(14) << "draw ranges" << std::endl;
+    for (bool ordered : {false, true}) {
+        spatialOrder_ = ordered;
+        UpdateBuffersFromRoutes();
+
+        // The nodes in the order the extrusion reads them
+        std::vector<GLuint> nodes;
+        std::vector<GLuint> lines;
+        nodes.reserve(slotNodes_.size());
+        for (GLuint node : slotNodes_) {
+            if (node != NO_NODE) {
+                nodes.push_back(node);
+                lines.push_back(node / NODES_PER_LINE);
+            }
+        }
+
+        // Runs of visible routes in slot order, each one draw or dispatch
+        // range. Records are laid out like the slots.
+        size_t visibleRoutes = 0;
+        size_t drawRanges = 0;
+        for (const auto &layer : layerSlots_) {
+            bool previousVisible = false;
+            for (GLuint ii = layer.firstRecord; ii < layer.recordEnd; ++ii) {
+                const auto &record = routeRecords_[ii];
+                const bool visible = record.count > 0 && record.minLon <= minLon + lonRange &&
+                                     record.maxLon >= minLon && record.minLat <= minLat + latRange &&
+                                     record.maxLat >= minLat;
+                visibleRoutes += visible;
+                drawRanges += visible && !previousVisible;
+                previousVisible = visible;
+            }
+        }
+
+        out << std::setw(10) << (ordered ? "z-order" : "load") << std::fixed << std::setprecision(1)
+            << std::setw(16) << 100.0 * FifoHitRate(nodes, VERTEX_CACHE_SIZE) << std::setw(16)
+            << 100.0 * FifoHitRate(lines, FETCH_CACHE_LINES) << std::setw(16) << visibleRoutes << std::setw(14)
+            << drawRanges << std::endl;
+    }
+
+    spatialOrder_ = spatialOrder;
+    UpdateBuffersFromRoutes();
+    Refresh(false);
+}
+
+void OpenGLCanvas::ViewBounds(const Camera::Rect &view, const wxSize &size, double &minLon, double &minLat,
+                              double &lonRange, double &latRange) const {
+    const double dataLonRange = coordinateBounds_.right() - coordinateBounds_.left();
+    const double dataLatRange = coordinateBounds_.top() - coordinateBounds_.bottom();
+    minLon = coordinateBounds_.left() - view.x / view.width * dataLonRange;
+    minLat = coordinateBounds_.bottom() - view.y / view.height * dataLatRange;
+    lonRange = dataLonRange * size.x / view.width;
+    latRange = dataLatRange * size.y / view.height;
+
+    if (lonRange == 0.0)
+        lonRange = 1.0;
+    if (latRange == 0.0)
+        latRange = 1.0;
+}
+
+double OpenGLCanvas::ZoomLevel(double lonRange, int width) {
+    // Slippy map style zoom level: at zoom 0 the whole world is 256 pixels wide
+    return std::log2(360.0 / lonRange * width / 256.0);
+}
+
+std::array<float, 4> OpenGLCanvas::ViewTransform(const Camera::Rect &from, const Camera::Rect &to) {
+    // Pixels relative to `from` keep their position relative to the data
+    const double scale = to.width / from.width;
+    return {static_cast<float>(scale), static_cast<float>(to.height / from.height),
+            static_cast<float>(to.x - from.x * scale), static_cast<float>(to.y - from.y * to.height / from.height)};
+}
+
+void OpenGLCanvas::UpdateFrameStats(std::chrono::high_resolution_clock::time_point frameStart) {
     auto now = std::chrono::high_resolution_clock::now();
+    cpuFrameMsSum_ += std::chrono::duration<float, std::milli>(now - frameStart).count();
+    ++framesSinceLastFps_;
+
     auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastFpsUpdateTime_);
     if (dur.count() >= 250) { // update FPS every 250ms for smoother display
         float seconds = dur.count() / 1000.0f;
         if (seconds > 0.0f) {
             fps_ = static_cast<float>(framesSinceLastFps_) / seconds;
         }
+        cpuFrameMs_ = cpuFrameMsSum_ / framesSinceLastFps_;
+        cpuFrameMsSum_ = 0.0f;
         framesSinceLastFps_ = 0;
         lastFpsUpdateTime_ = now;
+
+        if (latencyCount_ > 0) {
+            latencyMs_ = latencyMsSum_ / latencyCount_;
+            latencyMaxMs_ = latencyMsMax_;
+        }
+        latencyMsSum_ = 0.0f;
+        latencyMsMax_ = 0.0f;
+        latencyCount_ = 0;
+
+        if (benchmark_) {
+            std::cout << std::fixed << std::setprecision(1) << "FPS: " << fps_ << " CPU: " << std::setprecision(2)
+                      << cpuFrameMs_ << " ms GPU: " << gpuFrameMs_ << " ms" << std::endl;
+        }
     }
+}
 
-    // Draw FPS using wx overlay drawing so it's on top of GL content.
-    // Use a small margin from the top-left corner.
-    wxClientDC overlayDc(this);
-    wxFont font = overlayDc.GetFont();
-    font.SetWeight(wxFONTWEIGHT_BOLD);
-    font.SetPointSize(10);
-    overlayDc.SetFont(font);
-    overlayDc.SetTextForeground(*wxBLACK);
+void OpenGLCanvas::AddHudText(const wxSize &size) {
     std::ostringstream ss;
     ss.setf(std::ios::fixed);
     ss.precision(1);
-    ss << "FPS: " << fps_;
-    const std::string fpsText = ss.str();
-    const int margin = 8;
-    overlayDc.DrawText(fpsText, margin, margin);
+    ss << "FPS: " << fps_ << "\n";
+    ss.precision(2);
+    ss << "CPU: " << cpuFrameMs_ << " ms  GPU: " << gpuFrameMs_ << " ms\n";
+    ss.precision(1);
+    ss << "Input latency: " << latencyMs_ << " ms (max " << latencyMaxMs_ << " ms)\n";
+    ss << "Routes: " << routeSlots_.size() << "  Slots: " << inputIndexCount_ << "  Nodes: " << nodeTable_.NodeCount()
+       << " (" << nodeTable_.SharedCount() << " shared)\n";
+    ss << "Render path: " << RenderPathName(renderPath_) << "\n";
+    ss << "Labels: " << labelPlacer_.PlacedCount();
+
+    // Top left corner, one line after the other
+    const float scale = static_cast<float>(GetContentScaleFactor());
+    const float fontSize = HUD_FONT_SIZE * scale;
+    const float margin = 8.0f * scale;
+    const uint32_t color = TextRenderer::PackColor(0, 0, 0);
+    const uint32_t haloColor = TextRenderer::PackColor(1, 1, 1, 0.8f);
+    float y = size.y - margin - fontSize;
+    std::string line;
+    std::istringstream lines(ss.str());
+    while (std::getline(lines, line)) {
+        textRenderer_.AddText(TextRenderer::DecodeUtf8(line), margin, y, fontSize, color, haloColor);
+        y -= 1.3f * fontSize;
+    }
 }
 
 void OpenGLCanvas::OnSize(wxSizeEvent &event) {
@@ -620,9 +1836,7 @@ void OpenGLCanvas::OnSize(wxSizeEvent &event) {
         glViewport(0, 0, viewPortSize.x, viewPortSize.y);
 
         if (viewportSize_.GetWidth() > 0) {
-            auto vpPos = viewportBounds_.GetPosition();
-            vpPos += (viewPortSize - viewportSize_) / 2;
-            viewportBounds_.SetPosition(vpPos);
+            camera_.Translate(0.5 * (viewPortSize.x - viewportSize_.x), 0.5 * (viewPortSize.y - viewportSize_.y));
         }
 
         // Save the viewportSize for later
@@ -632,17 +1846,81 @@ void OpenGLCanvas::OnSize(wxSizeEvent &event) {
     event.Skip();
 }
 
-void OpenGLCanvas::OnTimer(wxTimerEvent &WXUNUSED(event)) {
+void OpenGLCanvas::SetFramePacing(bool vsync, bool benchmark) {
+    vsync_ = vsync && !benchmark;
+    benchmark_ = benchmark;
     if (isOpenGLInitialized_) {
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::high_resolution_clock::now() - openGLInitializationTime_);
-        elapsedSeconds_ = duration.count() / 1000.0f;
+        SetCurrent(*openGLContext_);
+        ApplySwapInterval();
+    }
+}
+
+void OpenGLCanvas::ApplySwapInterval() {
+    const int interval = vsync_ ? 1 : 0;
+    bool applied = false;
+#if defined(__WXMSW__)
+    if (WGLEW_EXT_swap_control) {
+        applied = wglSwapIntervalEXT(interval);
+    }
+#elif defined(__WXGTK__)
+    if (EGLDisplay display = eglGetCurrentDisplay(); display != EGL_NO_DISPLAY) {
+        applied = eglSwapInterval(display, interval);
+    }
+#endif
+    // macOS: NSOpenGLContext syncs to the display by default
+    if (!applied) {
+        wxLogDebug("Could not set the swap interval to %d", interval);
+    }
+}
+
+void OpenGLCanvas::OnIdle(wxIdleEvent &event) {
+    if (!isOpenGLInitialized_) {
+        return;
+    }
+
+    if (!pendingFrames_.empty()) {
+        SetCurrent(*openGLContext_);
+        PollFrameLatency();
+    }
+
+    // Only render when something changed, unless benchmarking, animating or
+    // labels are still being placed
+    if (benchmark_ || labelsPending_ || camera_.IsAnimating()) {
         Refresh(false);
     }
+    // keep idle events coming to render or poll as fast as possible
+    if (benchmark_ || !pendingFrames_.empty()) {
+        event.RequestMore();
+    }
+}
+
+void OpenGLCanvas::NoteInput() {
+    if (!inputTime_) {
+        inputTime_ = std::chrono::high_resolution_clock::now();
+    }
+}
+
+void OpenGLCanvas::PollFrameLatency() {
+    while (!pendingFrames_.empty()) {
+        auto &frame = pendingFrames_.front();
+        const GLenum status = glClientWaitSync(frame.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return;
+        }
+        const auto now = std::chrono::high_resolution_clock::now();
+        const float latency = std::chrono::duration<float, std::milli>(now - frame.inputTime).count();
+        latencyMsSum_ += latency;
+        latencyMsMax_ = std::max(latencyMsMax_, latency);
+        ++latencyCount_;
+        glDeleteSync(frame.fence);
+        pendingFrames_.pop_front();
+    }
 }
 
 void OpenGLCanvas::OnLeftDown(wxMouseEvent &event) {
     isDragging_ = true;
+    camera_.BeginDrag(Camera::Clock::now());
+    mouseDownPos_ = event.GetPosition();
     lastMousePos_ = event.GetPosition();
     lastMousePos_.y = GetClientSize().y - lastMousePos_.y; // flip Y
     // CaptureMouse();
@@ -653,12 +1931,74 @@ void OpenGLCanvas::OnLeftUp(wxMouseEvent &event) {
         isDragging_ = false;
         if (HasCapture())
             ReleaseMouse();
+        // Keeps panning for a while after a quick drag, and extrudes for the
+        // final view
+        camera_.EndDrag(Camera::Clock::now());
+        Refresh(false);
+    }
+
+    // A click without dragging selects the route under the cursor
+    if (event.GetPosition() == mouseDownPos_) {
+        if (const auto *route = RouteAt(event.GetPosition()); route) {
+            std::cout << "Way " << route->id << ":";
+            for (const auto &[key, value] : route->tags) {
+                if (!value.empty()) {
+                    std::cout << " " << key << "=" << value;
+                }
+            }
+            std::cout << std::endl;
+        }
     }
 }
 
+const OSMLoader::Route_t *OpenGLCanvas::RouteAt(const wxPoint &windowPos, int radius) const {
+    const auto &view = camera_.Current();
+    if (view.height <= 0.0) {
+        return nullptr;
+    }
+
+    // window -> viewport coordinates (physical pixels, Y-up)
+    const double scale = GetContentScaleFactor();
+    const double x = windowPos.x * scale;
+    const double y = (GetClientSize().y - windowPos.y) * scale;
+    const double degreesPerPixel = (coordinateBounds_.top() - coordinateBounds_.bottom()) / view.height;
+
+    auto hit = segmentIndex_.Nearest(mapViewport2OSM(x, y), radius * scale * degreesPerPixel);
+    if (!hit) {
+        return nullptr;
+    }
+    auto it = storedRoutes_.find(hit->id);
+    return it != storedRoutes_.end() ? &it->second : nullptr;
+}
+
+void OpenGLCanvas::UpdateHover(const wxPoint &windowPos) {
+    const auto *route = RouteAt(windowPos);
+    const osmium::object_id_type id = route ? route->id : 0;
+    if (id == hoveredRouteId_) {
+        return;
+    }
+    hoveredRouteId_ = id;
+
+    if (!route) {
+        UnsetToolTip();
+        return;
+    }
+    std::ostringstream text;
+    if (auto it = route->tags.find(NAME_TAG); it != route->tags.end() && !it->second.empty()) {
+        text << it->second << "\n";
+    }
+    if (auto it = route->tags.find(HIGHWAY_TAG); it != route->tags.end() && !it->second.empty()) {
+        text << "highway=" << it->second << "\n";
+    }
+    text << "way " << route->id;
+    SetToolTip(wxString::FromUTF8(text.str()));
+}
+
 void OpenGLCanvas::OnMouseMotion(wxMouseEvent &event) {
-    if (!isDragging_)
+    if (!isDragging_) {
+        UpdateHover(event.GetPosition());
         return;
+    }
 
     if (!event.Dragging() || !event.LeftIsDown())
         return;
@@ -670,17 +2010,15 @@ void OpenGLCanvas::OnMouseMotion(wxMouseEvent &event) {
     wxPoint pos = event.GetPosition();
     pos.y = GetClientSize().y - pos.y; // flip Y
     // use content scale factor to match viewport used for GL
-    auto scale = GetContentScaleFactor();
-    wxPoint posScaled = pos * scale;
-    wxPoint lastScaled = lastMousePos_ * scale;
+    const double scale = GetContentScaleFactor();
+    const wxPoint delta = pos - lastMousePos_;
 
-    // Update viewportBounds_
-    auto newPos = viewportBounds_.GetPosition() + posScaled - lastScaled;
-    this->viewportBounds_.SetPosition(newPos);
+    NoteInput();
+    camera_.Drag(delta.x * scale, delta.y * scale, Camera::Clock::now());
 
     lastMousePos_ = pos;
 
-    // just request redraw; shader reads `coordinateBounds_` uniform during paint
+    // just request redraw; the camera is applied during paint
     Refresh(false);
 }
 
@@ -704,12 +2042,16 @@ void OpenGLCanvas::OnMouseWheel(wxMouseEvent &event) {
     const double stepScale = 0.9;
     const double scale = std::pow(stepScale, steps);
 
-    Zoom(scale, event.GetPosition());
+    Zoom(scale, event.GetPosition(), true);
 }
 
 void OpenGLCanvas::OnZoomGesture(wxZoomGestureEvent &event) {
     if (event.IsGestureStart()) {
         lastZoomFactor_ = 1.0;
+        zoomGestureActive_ = true;
+    }
+    if (event.IsGestureEnd()) {
+        zoomGestureActive_ = false;
     }
 
     double currentZoomFactor = event.GetZoomFactor();
@@ -717,68 +2059,41 @@ void OpenGLCanvas::OnZoomGesture(wxZoomGestureEvent &event) {
     double scale = 1.0 / (currentZoomFactor / lastZoomFactor_);
     lastZoomFactor_ = currentZoomFactor;
 
-    Zoom(scale, event.GetPosition());
+    Zoom(scale, event.GetPosition(), false);
 }
 
-void OpenGLCanvas::Zoom(double scale, const wxPoint &mousePosIn) {
+void OpenGLCanvas::Zoom(double scale, const wxPoint &mousePosIn, bool animate) {
     if (scale <= 0.0)
         return;
 
+    NoteInput();
     double contentScale = GetContentScaleFactor();
 
-    // Convert mouse position to the coordinate system used by viewportBounds_
+    // Convert mouse position to the coordinate system of the camera
     // (Physical pixels, Y-up to match dragging logic in OnMouseMotion)
-    wxPoint mousePos = mousePosIn;
-    mousePos.y = GetClientSize().y - mousePos.y;
-
-    double mx = static_cast<double>(mousePos.x) * contentScale;
-    double my = static_cast<double>(mousePos.y) * contentScale;
-
-    // Current viewport box properties
-    double oldX = static_cast<double>(viewportBounds_.x);
-    double oldY = static_cast<double>(viewportBounds_.y);
-    double oldW = static_cast<double>(viewportBounds_.width);
-    double oldH = static_cast<double>(viewportBounds_.height);
-
-    // Calculate relative position of mouse in the current viewport box [0, 1]
-    double tx = (mx - oldX) / oldW;
-    double ty = (my - oldY) / oldH;
+    double mx = static_cast<double>(mousePosIn.x) * contentScale;
+    double my = static_cast<double>(GetClientSize().y - mousePosIn.y) * contentScale;
 
-    // New dimensions
-    double newW = oldW * scale;
-    double newH = oldH * scale;
-
-    // New origin to keep the point under the mouse at the same relative position
-    double newX = mx - tx * newW;
-    double newY = my - ty * newH;
-
-    // Update viewportBounds_
-    viewportBounds_.x = static_cast<int>(std::round(newX));
-    viewportBounds_.y = static_cast<int>(std::round(newY));
-    viewportBounds_.width = static_cast<int>(std::round(newW));
-    viewportBounds_.height = static_cast<int>(std::round(newH));
-
-    // std::cout << "Zoom: called" << std::endl;
+    // Keep the point under the mouse at the same relative position
+    camera_.ZoomBy(scale, mx, my, animate, Camera::Clock::now());
 
     Refresh(false);
 }
 
-osmium::Location OpenGLCanvas::mapViewport2OSM(const wxPoint &viewportCoord) {
-    const auto extents = viewportBounds_.GetSize();
+osmium::Location OpenGLCanvas::mapViewport2OSM(double x, double y) const {
+    const auto &view = camera_.Current();
 
-    const auto offset = viewportCoord - viewportBounds_.GetPosition();
-
-    auto normalized = static_cast<double>(offset.x) / (extents.x - 1);
+    auto normalized = (x - view.x) / view.width;
     double lon = coordinateBounds_.left() + normalized * (coordinateBounds_.right() - coordinateBounds_.left());
 
-    normalized = static_cast<double>(offset.y) / (extents.y - 1);
+    normalized = (y - view.y) / view.height;
     double lat = coordinateBounds_.bottom() + normalized * (coordinateBounds_.top() - coordinateBounds_.bottom());
 
     return osmium::Location(lon, lat);
 }
 
-wxPoint OpenGLCanvas::mapOSM2Viewport(const osmium::Location &coords) {
-    const auto extents = viewportBounds_.GetSize();
+void OpenGLCanvas::mapOSM2Viewport(const osmium::Location &coords, double &x, double &y) const {
+    const auto &view = camera_.Current();
 
     double lonRange = (coordinateBounds_.right() - coordinateBounds_.left());
     double latRange = (coordinateBounds_.top() - coordinateBounds_.bottom());
@@ -786,8 +2101,6 @@ wxPoint OpenGLCanvas::mapOSM2Viewport(const osmium::Location &coords) {
     double xNorm = (coords.lon() - coordinateBounds_.left()) / lonRange;
     double yNorm = (coords.lat() - coordinateBounds_.bottom()) / latRange;
 
-    int x = static_cast<int>(xNorm * extents.x) + viewportBounds_.GetLeft();
-    int y = static_cast<int>(yNorm * extents.y) + viewportBounds_.GetTop();
-
-    return wxPoint(x, y);
-}
\ No newline at end of file
+    x = xNorm * view.width + view.x;
+    y = yNorm * view.height + view.y;
+}
@@ -4,10 +4,25 @@
 #include <wx/glcanvas.h>
 #include <wx/wx.h>
 
+#include <array>
 #include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
 
+#include "camera.h"
+#include "cpu_extruder.h"
+#include "label_placer.h"
+#include "node_table.h"
 #include "osm_loader.h"
+#include "segment_index.h"
 #include "shaderprogram.h"
+#include "style_sheet.h"
+#include "text_renderer.h"
+#include "upload_ring.h"
 #include <unordered_map>
 
 wxDECLARE_EVENT(wxEVT_OPENGL_INITIALIZED, wxCommandEvent);
@@ -24,7 +39,7 @@ class OpenGLCanvas : public wxGLCanvas {
     void OnPaint(wxPaintEvent &event);
     void OnSize(wxSizeEvent &event);
 
-    void OnTimer(wxTimerEvent &event);
+    void OnIdle(wxIdleEvent &event);
 
     void OnLeftDown(wxMouseEvent &event);
     void OnLeftUp(wxMouseEvent &event);
@@ -32,76 +47,380 @@ class OpenGLCanvas : public wxGLCanvas {
     void OnMouseWheel(wxMouseEvent &event);
     void OnZoomGesture(wxZoomGestureEvent &event);
 
+    // Frames are rendered on demand. With `vsync` buffer swaps wait for the
+    // vertical blank; `benchmark` renders continuously without vsync to
+    // measure the highest frame rate.
+    void SetFramePacing(bool vsync, bool benchmark);
+
+    // How the routes are turned into triangles. Compute extrudes them into
+    // intermediate buffers once per view and redraws those while the view
+    // moves. Instanced expands every segment into a quad in the vertex
+    // shader each frame, reading the input buffers through texture buffers:
+    // no intermediate buffers and only OpenGL 3.3 features. Cpu extrudes
+    // into the same buffers as Compute with CpuExtruder, and is picked when
+    // no path was set and compute shaders are missing or run in software.
+    enum class RenderPath { Compute, Instanced, Cpu };
+    void SetRenderPath(RenderPath path);
+
+    // Render subsets of the loaded routes with both paths while moving the
+    // view every frame and write the GPU time per frame and the memory of
+    // the geometry buffers to `out`. Restores the routes afterwards.
+    void BenchmarkRenderPaths(std::ostream &out);
+
+    // Extrude the current view with the compute shader and with CpuExtruder
+    // and compare the output buffers. Writes how many values are bit
+    // identical and the largest difference to `out`; returns false if the
+    // indices differ or a vertex is more than a thousandth of a pixel off.
+    bool ValidateCpuExtrusion(std::ostream &out);
+
+    // Extrude the current data with the compute shader built for each
+    // workgroup size the driver supports and write the time per dispatch
+    // and the throughput to `out`
+    void BenchmarkWorkgroupSizes(std::ostream &out);
+
+    // Lay out the buffers in load order and in spatial order and write for
+    // each the hit rates of simulated vertex fetch caches over the input and
+    // the number of contiguous ranges the routes of the current view take
+    void MeasureBufferLocality(std::ostream &out);
+
     // Upload routes from OSMLoader into GPU buffers. This replaces the
     // existing VBO_/EBO_ contents when called.
     void SetData(const OSMLoader::OSMData &data, const osmium::Box &bounds);
 
+    // Switch to another style sheet. When it classifies routes the same way as
+    // the current one only the style table is uploaded, otherwise the buffers
+    // are rebuilt.
+    void SetStyleSheet(const StyleSheet &styleSheet);
+
+    // Add or replace `routes` and drop the routes in `removedIds`, patching
+    // only their slots of the GPU buffers. Falls back to a full rebuild when a
+    // style layer runs out of free slots.
+    void UpdateRoutes(const std::vector<OSMLoader::Route_t> &routes,
+                      const std::vector<osmium::object_id_type> &removedIds);
+
+    // Load the shaders from files in `directory` instead of the sources
+    // embedded at build time. Must be called before OpenGL is initialized.
+    void SetShaderDirectory(const std::string &directory) { shaderDirectory_ = directory; }
+    void SetProgramBinaryCache(const ProgramBinaryCache &cache) { programCache_ = cache; }
+    // Invocations per workgroup of the compute shader. Must be called before
+    // OpenGL is initialized; clamped to what the driver supports.
+    void SetComputeWorkgroupSize(GLuint size) { computeWorkgroupSize_ = size; }
+    // Cull routes outside of the view on the GPU before extruding them, on
+    // the compute path (on by default)
+    void SetGpuCulling(bool enabled);
+
+    // The route drawn closest to `windowPos` (window coordinates), if any is
+    // within `radius` pixels
+    const OSMLoader::Route_t *RouteAt(const wxPoint &windowPos, int radius = 6) const;
+
+    // Recompile and relink the shader programs. The current programs are kept
+    // if that fails, so a typo while editing a shader does not blank the map.
+    bool ReloadShaders();
+
   protected:
-    void CompileShaderProgram();
+    bool CompileShaderProgram();
+    // computeSource_ with its workgroup size set to `workgroupSize`
+    bool BuildComputeProgram(GLuint workgroupSize, ShaderProgram &program);
 
     bool InitializeOpenGLFunctions();
+    void ApplySwapInterval();
+
+    // Input-to-photon latency: the time from the first input event changing
+    // the view until the GPU finished the frame showing it. Scanout adds up
+    // to one refresh period on top.
+    void NoteInput();
+    void PollFrameLatency();
 
     // Update GPU buffers from `storedRoutes_` (called after GL init or when
     // SetData is invoked while GL is available).
     void UpdateBuffersFromRoutes();
 
-    void Zoom(double scale, const wxPoint &mousePos);
+    // Zoom about `mousePos`, animated for discrete steps like wheel clicks
+    void Zoom(double scale, const wxPoint &mousePos, bool animate);
 
     // utility methods to convert from Viewport->OSM and OSM->Viewport
-    osmium::Location mapViewport2OSM(const wxPoint &viewportCoord);
-    wxPoint mapOSM2Viewport(const osmium::Location &coords);
+    // (physical pixels, y-up)
+    osmium::Location mapViewport2OSM(double x, double y) const;
+    void mapOSM2Viewport(const osmium::Location &coords, double &x, double &y) const;
+
+    // Draw the routes for `view` with renderPath_. Returns true if the
+    // geometry was built for exactly this view, so labels are placed again.
+    bool DrawRoutes(const Camera::Rect &view, const wxSize &size, bool moving);
+    // Extrude all routes for `view` into output_vbo_/output_ebo_, with the
+    // compute shader or on the CPU depending on renderPath_
+    void ExtrudeRoutes(const Camera::Rect &view, const wxSize &size);
+    // The uniforms of the extrusion for `view`
+    CpuExtruder::View ExtrusionView(const Camera::Rect &view, const wxSize &size) const;
+    void DispatchExtrusion(const CpuExtruder::View &view);
+    // Cull the route records against `cullBounds` (min lon, min lat, max lon,
+    // max lat) and extrude the visible routes, without reading anything back
+    void CullAndExtrude(const CpuExtruder::View &view, const std::array<double, 4> &cullBounds);
+    // The uniforms and storage blocks shared by both extrusion programs
+    void SetExtrusionInputs(const ShaderProgram &program, const CpuExtruder::View &view);
+    void ExtrudeOnCpu(const CpuExtruder::View &view);
+    // Expand the segments for `view` into quads in the vertex shader
+    void DrawInstancedSegments(const Camera::Rect &view, const wxSize &size);
+    // Size the intermediate buffers of the compute path for inputIndexCount_,
+    // or release them when the instanced path is used
+    void UpdateOutputBuffers();
+    // Coordinates covered by `view` on a viewport of `size`
+    void ViewBounds(const Camera::Rect &view, const wxSize &size, double &minLon, double &minLat, double &lonRange,
+                    double &latRange) const;
+    static double ZoomLevel(double lonRange, int width);
+    // Scale x/y and offset x/y moving pixels of view `from` to view `to`
+    static std::array<float, 4> ViewTransform(const Camera::Rect &from, const Camera::Rect &to);
+
+    // Show the route under the cursor in a tooltip
+    void UpdateHover(const wxPoint &windowPos);
+
+    // Matches the layout expected by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Input of the extrusion as structure of arrays: lon/lat pairs per node of
+    // nodeTable_ (VBO_), and per slot style ids (styleIdBuffer_) and indices
+    // (EBO_) referencing the nodes
+    struct InputGeometry {
+        std::vector<float> positions;
+        std::vector<GLuint> styleIds;
+        std::vector<GLuint> indices;
+
+        GLuint SlotCount() const { return static_cast<GLuint>(styleIds.size()); }
+    };
+
+    // Append the indices and style ids of `route`, referencing its nodes in
+    // nodeTable_. Nodes new to the table are appended to `addedNodes`; their
+    // positions are not written.
+    void AddLineStripAdjacencyToBuffers(const OSMLoader::Route_t &route, GLuint styleId, InputGeometry &geometry,
+                                        std::vector<GLuint> &addedNodes);
+    // Fill `count` slots with single vertex strips on node 0. These have both
+    // the begin and end bits set, so the compute shader does not emit any
+    // triangles for them.
+    static void AppendUnusedSlots(GLuint count, InputGeometry &geometry);
+    // Drop the node references of slots [first, end)
+    void ReleaseSlotNodes(GLuint first, GLuint end);
 
-    using Color_t = std::array<GLfloat, 3>;
-    void AddLineStripAdjacencyToBuffers(const OSMLoader::Coordinates &coords, const Color_t &color,
-                                        std::vector<float> &vertices, std::vector<GLuint> &indices);
+    // Upload styleSheet_ into the style table SSBO read by the compute shader
+    void UploadStyleTable();
+
+    // Hand the named, styled routes of storedRoutes_ to labelPlacer_
+    void UpdateLabelCandidates();
+
+    // Frame statistics shown by the HUD
+    void UpdateFrameStats(std::chrono::high_resolution_clock::time_point frameStart);
+    void AddHudText(const wxSize &size);
+
+    // Input buffer slots (one per index/vertex) assigned to a route. capacity
+    // can exceed count when the route shrank or reuses a bigger free range.
+    // record is the index of its RouteRecord.
+    struct RouteSlots {
+        GLuint first;
+        GLuint count;
+        GLuint capacity;
+        size_t layer;
+        GLuint record;
+    };
+
+    // Slots of one style layer: [first, end) are assigned to routes or free,
+    // [end, first + capacity) is the slack left for new routes. The route
+    // records of the layer are laid out the same way.
+    struct LayerSlots {
+        int zOrder;
+        GLuint first;
+        GLuint end;
+        GLuint capacity;
+        std::vector<std::pair<GLuint, GLuint>> freeRanges;
+        GLuint firstRecord;
+        GLuint recordEnd;
+        GLuint recordCapacity;
+        std::vector<GLuint> freeRecords;
+    };
+
+    // Bounds and slots of one route for the culling pass, std430 layout of
+    // RouteRecord in cull.comp.glsl. Unused records have no slots.
+    struct RouteRecord {
+        float minLon, minLat, maxLon, maxLat;
+        GLuint first;
+        GLuint count;
+        GLuint styleId;
+        GLuint pad;
+    };
+
+    bool AllocateRouteSlots(size_t layerIndex, GLuint count, RouteSlots &slots);
+    bool AllocateRouteRecord(size_t layerIndex, GLuint &record);
+    static RouteRecord MakeRouteRecord(const OSMLoader::Route_t &route, GLuint styleId, const RouteSlots &slots);
+    // Store `record` at `index` of routeRecords_ and upload it
+    void WriteRouteRecord(GLuint index, const RouteRecord &record);
+
+    // Upload `route` into `slots` and mark the remaining capacity unused. A
+    // null route clears the slots. Returns false if the route needs more new
+    // nodes than VBO_ has room for.
+    bool WriteRouteSlots(const OSMLoader::Route_t *route, GLuint styleId, const RouteSlots &slots);
 
   private:
     wxGLContext *openGLContext_;
     bool isOpenGLInitialized_{false};
 
-    GLuint map_compute_program_{0};
-    GLuint display_program_{0};
+    ShaderProgram map_compute_program_{};
+    // Source of map_compute_program_ before the workgroup size is set
+    std::string computeSource_{};
+    static constexpr GLuint DEFAULT_WORKGROUP_SIZE = 128;
+    GLuint computeWorkgroupSize_{DEFAULT_WORKGROUP_SIZE};
+    ShaderProgram display_program_{};
+    ShaderProgram segment_program_{};
+    // GPU culling: cull_program_ turns routeRecords_ into the list of visible
+    // slots in visibleSlotsBuffer_, the dispatch arguments of
+    // culled_compute_program_ in cullResultBuffer_ and one draw command per
+    // record in routeDrawCommandBuffer_, empty when culled
+    bool gpuCulling_{true};
+    ShaderProgram cull_program_{};
+    ShaderProgram culled_compute_program_{};
+    std::vector<RouteRecord> routeRecords_{};
+    StorageBuffer routeRecordBuffer_{};
+    StorageBuffer visibleSlotsBuffer_{};
+    StorageBuffer cullResultBuffer_{};
+    StorageBuffer routeDrawCommandBuffer_{};
+    RenderPath renderPath_{RenderPath::Compute};
+    // set once SetRenderPath was called, which disables picking a path
+    bool renderPathChosen_{false};
+    bool computeAvailable_{true};
+    // the context is OpenGL 3.3, which only runs the instanced path
+    bool legacyContext_{false};
+
+    std::string shaderDirectory_{};
+    ProgramBinaryCache programCache_{};
+
+    bool vsync_{true};
+    bool benchmark_{false};
+    // label placement did not finish within its budget, render again
+    bool labelsPending_{false};
 
-    wxTimer timer_;
-    std::chrono::high_resolution_clock::time_point openGLInitializationTime_{};
-    float elapsedSeconds_{0.0f};
+    struct PendingFrame {
+        GLsync fence;
+        std::chrono::high_resolution_clock::time_point inputTime;
+    };
+    std::optional<std::chrono::high_resolution_clock::time_point> inputTime_{};
+    std::deque<PendingFrame> pendingFrames_{};
+    float latencyMsSum_{0.0f};
+    float latencyMsMax_{0.0f};
+    int latencyCount_{0};
+    float latencyMs_{0.0f};
+    float latencyMaxMs_{0.0f};
 
     // FPS display/state
     std::chrono::high_resolution_clock::time_point lastFpsUpdateTime_{};
     int framesSinceLastFps_{0};
     float fps_{0.0f};
+    float cpuFrameMsSum_{0.0f};
+    float cpuFrameMs_{0.0f};
+    float gpuFrameMs_{0.0f};
+    // GL_TIME_ELAPSED queries, used round robin
+    std::array<GLuint, 4> timerQueries_{};
+    uint64_t frameIndex_{0};
+    static constexpr float HUD_FONT_SIZE = 12.0f;
+
+    // All geometry uploads, full or partial, go through this ring
+    UploadRing uploadRing_{};
 
     GLuint VAO_{0};
-    GLuint VBO_{0};              // vertex buffer object
-    GLuint EBO_{0};              // element buffer object
-    GLsizei inputIndexCount_{0}; // number of indices in the EBO
+    StorageBuffer VBO_{};           // vertex positions, lon/lat per node
+    StorageBuffer styleIdBuffer_{}; // style id per slot
+    StorageBuffer EBO_{};           // element buffer object
+    GLsizei inputIndexCount_{0};    // number of indices in the EBO, including unused slots
+
+    // The nodes VBO_ holds, with room for nodeCapacity_, and the node each
+    // slot references (NO_NODE for unused slots)
+    static constexpr GLuint NO_NODE = 0xFFFFFFFF;
+    NodeTable nodeTable_{};
+    GLuint nodeCapacity_{0};
+    std::vector<GLuint> slotNodes_{};
 
     GLuint quad_vao_{0};
     GLuint quad_vbo_{0};
-    GLuint output_vbo_{0};
-    GLuint output_ebo_{0};
+    StorageBuffer output_vbo_{};
+    StorageBuffer output_ebo_{};
     GLuint output_vao_{0};
     GLsizei outputVertexCount_{0}; // number of output vertices in output_
     GLsizei outputIndexCount_{0};  // number of indices in output_ebo_
 
+    // Instanced path: the vertex shader only reads gl_VertexID and
+    // gl_InstanceID, so its VAO has no attributes. Texture buffers over VBO_,
+    // styleIdBuffer_, EBO_ and styleBuffer_.
+    GLuint segmentVao_{0};
+    std::array<GLuint, 4> segmentTextures_{};
+
+    // Cpu path: copies of the input buffers and the style table, and the
+    // extruded output uploaded into output_vbo_/output_ebo_
+    std::unique_ptr<CpuExtruder> cpuExtruder_{};
+    InputGeometry cpuInput_{};
+    std::vector<StyleSheet::GpuStyle> cpuStyles_{};
+    std::vector<OutputVertex> cpuOutputVertices_{};
+    std::vector<GLuint> cpuOutputIndices_{};
+
     // OSM Coordinate bounds
     osmium::Box coordinateBounds_{};
 
     // bounding box in viewport coordinate system
     wxSize viewportSize_{};
-    wxRect viewportBounds_{};
+    Camera camera_{};
+
+    // The view output_vbo_ was extruded for, and the view of the placed
+    // labels. Frames of other views draw them through ViewTransform.
+    static constexpr double MAX_OVERZOOM = 2.0;
+    // Culling keeps the routes within this many view sizes around the view,
+    // so frames panning or zooming out less than that reuse the extrusion
+    static constexpr double CULL_MARGIN = 1.0;
+    Camera::Rect extrudedView_{0.0, 0.0, 1.0, 1.0};
+    wxSize extrudedSize_{};
+    bool extrusionValid_{false};
+    // Routes outside of culledBounds_ were left out of the last extrusion,
+    // which then only holds for views within them
+    bool extrusionCulled_{false};
+    std::array<double, 4> culledBounds_{};
+    Camera::Rect labelView_{0.0, 0.0, 1.0, 1.0};
 
     // Stored routes (kept so buffers can be uploaded after GL init)
     OSMLoader::Id2Route storedRoutes_{};
     OSMLoader::Id2Area storedAreas_{};
 
-    // Draw commands: pair<count, byteOffsetInEBO>
-    std::vector<std::pair<GLsizei, size_t>> drawCommands_{};
+    // Road name labels, placed within LABEL_TIME_BUDGET per frame
+    static constexpr float LABEL_FONT_SIZE = 13.0f;
+    static constexpr std::chrono::microseconds LABEL_TIME_BUDGET{2000};
+    TextRenderer textRenderer_{};
+    LabelPlacer labelPlacer_{};
+
+    // Hit-testing over the segments of storedRoutes_
+    SegmentIndex segmentIndex_{};
+    osmium::object_id_type hoveredRouteId_{0};
+
+    // Vertices only store a style id, the style attributes are looked up in
+    // styleBuffer_
+    StyleSheet styleSheet_{StyleSheet::Default()};
+    GLuint styleBuffer_{0};
+
+    // One draw command per style layer (the routes sharing a z-order), stored
+    // in drawCommandBuffer_ and issued with a single
+    // glMultiDrawElementsIndirect call.
+    std::vector<DrawElementsIndirectCommand> drawCommands_{};
+    StorageBuffer drawCommandBuffer_{};
+
+    std::vector<LayerSlots> layerSlots_{};
+    // Sort the routes of each layer along a Z-order curve when building the
+    // buffers (off only to compare with load order)
+    bool spatialOrder_{true};
+    std::unordered_map<osmium::object_id_type, RouteSlots> routeSlots_{};
 
     // Event handling state
     // Mouse drag state for panning
     bool isDragging_{false};
     wxPoint lastMousePos_{0, 0};
+    wxPoint mouseDownPos_{0, 0};
     long prevEventTimestamp_{0};
     double lastZoomFactor_{1.0};
+    bool zoomGestureActive_{false};
 };
\ No newline at end of file
@@ -18,10 +18,16 @@
 */
 
 #include "osm_loader.h"
+#include "fast_xml_reader.h"
+#include "map_store.h"
 
-// Only work with XML input files here
+// XML input, and PBF for the statistics of Count()
+#include <osmium/io/pbf_input.hpp>
 #include <osmium/io/xml_input.hpp>
 
+// OsmChange diffs are usually distributed gzipped (.osc.gz)
+#include <osmium/io/gzip_compression.hpp>
+
 // We want to use the handler interface
 #include <osmium/handler.hpp>
 #include <osmium/osm/node.hpp>
@@ -36,15 +42,207 @@
 // efficient node location storage for ways
 #include <osmium/index/map/sparse_mem_array.hpp>
 
+// node location storage in a memory mapped file, for inputs larger than memory
+#include <osmium/index/map/sparse_file_array.hpp>
+
 // location handler for ways
 #include <osmium/handler/node_locations_for_ways.hpp>
 
+// worker threads for the handler passes
+#include <osmium/thread/pool.hpp>
+
 #include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdint> // for std::uint64_t
+#include <deque>
 #include <exception>
+#include <filesystem>
+#include <future>
 #include <iostream> // for std::cout, std::cerr
+#include <iterator>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <tuple>
+#include <type_traits>
 #include <unordered_set>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace {
+// The big maps of the loader are split by id into shards, so that the results
+// of all buffers can be merged into them in parallel
+constexpr size_t SHARD_BITS = 6;
+constexpr size_t SHARD_COUNT = size_t{1} << SHARD_BITS;
+template <typename T> using Shards = std::array<T, SHARD_COUNT>;
+
+size_t shardOf(osmium::object_id_type id) {
+    // Fibonacci hashing spreads runs of consecutive ids over all shards
+    return static_cast<size_t>((static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS));
+}
+
+// Wait for the tasks behind `futures` which are still pending. Called before
+// an exception leaves a function whose tasks reference its locals.
+template <typename TFutures> void waitAll(TFutures &futures) {
+    for (auto &future : futures) {
+        if (future.valid()) {
+            future.wait();
+        }
+    }
+}
+
+// Buffers in flight per thread while streaming a pass
+constexpr size_t STREAM_BUFFERS_PER_THREAD = 4;
+
+// Run `process` on every buffer of `reader` in `pool` and hand the results to
+// `consume` in file order as they complete. Only a few buffers per thread are
+// in flight, so neither the buffers nor the results pile up.
+template <typename TProcess, typename TConsume>
+void streamBuffers(osmium::io::Reader &reader, osmium::thread::Pool &pool, const TProcess &process,
+                   const TConsume &consume) {
+    using Result = std::invoke_result_t<const TProcess &, osmium::memory::Buffer &>;
+    const size_t window = STREAM_BUFFERS_PER_THREAD * static_cast<size_t>(std::max(1, pool.num_threads()));
+    std::deque<std::future<Result>> futures;
+    auto consumeFront = [&] {
+        Result result = futures.front().get();
+        futures.pop_front();
+        consume(result);
+    };
+    try {
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            futures.push_back(
+                pool.submit([&process, buffer = std::move(buffer)]() mutable { return process(buffer); }));
+            if (futures.size() >= window) {
+                consumeFront();
+            }
+        }
+        reader.close();
+        while (!futures.empty()) {
+            consumeFront();
+        }
+    } catch (...) {
+        // the queued tasks still use `process` and what it captures
+        waitAll(futures);
+        throw;
+    }
+}
+
+// Run `process` on every buffer of `reader` in `pool`, returning the results
+// in file order
+template <typename TFunction>
+auto processBuffers(osmium::io::Reader &reader, osmium::thread::Pool &pool, const TFunction &process) {
+    using Result = std::invoke_result_t<const TFunction &, osmium::memory::Buffer &>;
+    std::vector<Result> results;
+    streamBuffers(reader, pool, process, [&results](Result &result) { results.push_back(std::move(result)); });
+    return results;
+}
+
+// The file read by the load passes, through FastXmlReader when it is enabled
+// and supports the file, through libosmium otherwise
+struct InputFile {
+    osmium::io::File file;
+    std::unique_ptr<FastXmlReader> fastXml{};
+};
+
+InputFile openInput(const std::string &filepath, bool fastXml) {
+    InputFile input{osmium::io::File{filepath}};
+    if (fastXml && FastXmlReader::Supports(filepath)) {
+        input.fastXml = std::make_unique<FastXmlReader>(filepath);
+        std::cout << "Reading " << filepath << " with the fast XML reader in " << input.fastXml->ChunkCount()
+                  << " chunks" << std::endl;
+    }
+    return input;
+}
+
+// processBuffers() over the `entities` of `input`
+template <typename TFunction>
+auto processInput(const InputFile &input, osmium::osm_entity_bits::type entities, osmium::thread::Pool &pool,
+                  const TFunction &process) {
+    if (input.fastXml) {
+        return input.fastXml->Process(entities, pool, process);
+    }
+    osmium::io::Reader reader{input.file, entities};
+    return processBuffers(reader, pool, process);
+}
+
+// streamBuffers() over the `entities` of `input`
+template <typename TProcess, typename TConsume>
+void streamInput(const InputFile &input, osmium::osm_entity_bits::type entities, osmium::thread::Pool &pool,
+                 const TProcess &process, const TConsume &consume) {
+    if (input.fastXml) {
+        input.fastXml->Stream(entities, pool, process, consume);
+        return;
+    }
+    osmium::io::Reader reader{input.file, entities};
+    streamBuffers(reader, pool, process, consume);
+}
+
+// Run `merge(shard)` for every shard in `pool` and wait for all of them
+template <typename TFunction> void mergeShards(osmium::thread::Pool &pool, const TFunction &merge) {
+    std::vector<std::future<void>> futures;
+    for (size_t shard = 0; shard < SHARD_COUNT; ++shard) {
+        futures.push_back(pool.submit([&merge, shard] { merge(shard); }));
+    }
+    try {
+        for (auto &future : futures) {
+            future.get();
+        }
+    } catch (...) {
+        waitAll(futures);
+        throw;
+    }
+}
+
+// Set of positive node ids, as a bitset over pages of consecutive ids. Node
+// ids are dense, so testing one is a shift, a page lookup and a bit test
+// instead of probing a hash map.
+class NodeIdSet {
+  public:
+    void insert(osmium::object_id_type id) {
+        if (id <= 0) {
+            hasNonPositive_ = true;
+            return;
+        }
+        const auto page = static_cast<size_t>(id) >> PAGE_BITS;
+        if (page >= pages_.size()) {
+            pages_.resize(page + 1);
+        }
+        if (!pages_[page]) {
+            pages_[page] = std::make_unique<uint64_t[]>(PAGE_WORDS);
+        }
+        const auto bit = static_cast<size_t>(id) & (PAGE_SIZE - 1);
+        pages_[page][bit >> 6] |= uint64_t{1} << (bit & 63);
+    }
+
+    // Ids which are not positive (e.g. from editor files) are not tracked,
+    // they always pass
+    bool mayContain(osmium::object_id_type id) const {
+        if (id <= 0) {
+            return hasNonPositive_;
+        }
+        const auto page = static_cast<size_t>(id) >> PAGE_BITS;
+        if (page >= pages_.size() || !pages_[page]) {
+            return false;
+        }
+        const auto bit = static_cast<size_t>(id) & (PAGE_SIZE - 1);
+        return (pages_[page][bit >> 6] >> (bit & 63)) & 1;
+    }
+
+  private:
+    static constexpr size_t PAGE_BITS = 16; // 8 KiB per page
+    static constexpr size_t PAGE_SIZE = size_t{1} << PAGE_BITS;
+    static constexpr size_t PAGE_WORDS = PAGE_SIZE / 64;
+
+    std::vector<std::unique_ptr<uint64_t[]>> pages_{};
+    bool hasNonPositive_{false};
+};
+
 struct IdIndexPair {
     osmium::object_id_type pairID;
     int64_t pairIndex;
@@ -66,8 +264,14 @@ using Id2Index = std::unordered_map<osmium::object_id_type, int64_t>;
 using Id2Id2Index = std::unordered_map<osmium::object_id_type, Id2Index>;
 
 struct MappedWayData {
-    Id2IdIndexMap node2Ways;
+    Shards<Id2IdIndexMap> node2Ways; // by shardOf(node id)
     OSMLoader::Id2Tags id2Tags;
+
+    const std::unordered_set<IdIndexPair, IdIndexPairHash> *findWays(osmium::object_id_type nodeId) const {
+        const auto &shard = node2Ways[shardOf(nodeId)];
+        auto it = shard.find(nodeId);
+        return it != shard.end() ? &it->second : nullptr;
+    }
 };
 
 // Map of Way -> Relationships
@@ -79,18 +283,22 @@ struct RelationshipData {
     OSMLoader::Id2Tags id2Tags;
 };
 
+void copyTags(const osmium::TagList &tags, const std::vector<std::string> &keys, OSMLoader::Tags &out) {
+    for (const auto &key : keys) {
+        if (auto tag_value = tags.get_value_by_key(key.c_str()); tag_value) {
+            out[key] = tag_value;
+        }
+    }
+}
+
 struct RelationshipHandler : public osmium::handler::Handler {
-    RelationshipData relationshipData;
+    const TagFilter &areaFilter_;
+    RelationshipData relationshipData{};
 
-    bool containsTagValue(const osmium::TagList &tags, const char *key, const char *value) {
-        auto tag_value = tags.get_value_by_key(key);
-        return tag_value && std::strcmp(tag_value, value) == 0;
-    }
+    explicit RelationshipHandler(const TagFilter &areaFilter) : areaFilter_(areaFilter) {}
 
     void relation(const osmium::Relation &relation) noexcept {
-        if (!(containsTagValue(relation.tags(), ::TYPE_TAG, ::BOUNDARY_VALUE) ||
-              containsTagValue(relation.tags(), ::BUILDING_TAG, ::YES_VALUE) ||
-              containsTagValue(relation.tags(), ::AREA_TAG, ::YES_VALUE))) {
+        if (!areaFilter_.Matches(relation.tags())) {
             return;
         }
 
@@ -115,25 +323,49 @@ struct RelationshipHandler : public osmium::handler::Handler {
     };
 };
 
+// Append the relations of a later buffer
+void mergeRelationshipData(RelationshipData &into, RelationshipData &from) {
+    for (auto &[wayId, relationIds] : from.way2Relationships) {
+        into.way2Relationships[wayId].merge(relationIds);
+    }
+    for (auto &[nodeId, relationIds] : from.node2Relationships) {
+        into.node2Relationships[nodeId].merge(relationIds);
+    }
+    for (auto &[nodeId, role] : from.node2Roles) {
+        into.node2Roles[nodeId] = std::move(role);
+    }
+    into.id2Tags.merge(from.id2Tags);
+}
+
+// Collects the ways of one buffer. Ring indices depend on the order of the
+// ways in the file, so they are assigned when merging the buffers in order.
 struct WayHandler : public osmium::handler::Handler {
-    // Map of Node IDs -> Way IDs to be retrieved later
+    struct NodeRef {
+        osmium::object_id_type node;
+        osmium::object_id_type way;
+        int64_t index;
+    };
+
     const RelationshipData &inputRelationships_;
+    const std::vector<std::string> &tagKeys_;
+    const TagFilter &routeFilter_;
 
-    Id2Index relationship2RingIndex{};
-    Id2Id2Index way2Relationship2RingIndex{};
-    MappedWayData wayData;
+    Shards<std::vector<NodeRef>> nodeRefs{}; // by shardOf(node id)
+    OSMLoader::Id2Tags id2Tags{};
+    // outer ways of relations and their node count, in file order
+    std::vector<std::pair<osmium::object_id_type, size_t>> relationWays{};
 
     // size_t largestWaySize = 0;
     // osmium::object_id_type largestWayID = 0;
 
-    WayHandler(const RelationshipData &relationshipData) : inputRelationships_(relationshipData) {}
+    WayHandler(const RelationshipData &relationshipData, const std::vector<std::string> &tagKeys,
+               const TagFilter &routeFilter)
+        : inputRelationships_(relationshipData), tagKeys_(tagKeys), routeFilter_(routeFilter) {}
 
     bool isWayInRelationship(const osmium::Way &way) const {
         return inputRelationships_.way2Relationships.count(way.id()) > 0;
     }
-    bool isWayAValidRoute(const osmium::Way &way) const {
-        return way.tags().get_value_by_key(HIGHWAY_TAG) != nullptr || way.tags().get_value_by_key(AREA_TAG) != nullptr;
-    }
+    bool isWayAValidRoute(const osmium::Way &way) const { return routeFilter_.Matches(way.tags()); }
 
     void way(const osmium::Way &way) noexcept {
         if (!(isWayInRelationship(way) || isWayAValidRoute(way))) {
@@ -145,126 +377,108 @@ struct WayHandler : public osmium::handler::Handler {
         //     largestWayID = way.id();
         // }
 
-        auto &wayData = this->wayData;
-
         if (isWayInRelationship(way)) {
             const auto &tags = way.tags();
             if (auto tag_value = tags.get_value_by_key(TYPE_TAG); tag_value) {
-                wayData.id2Tags[way.id()][TYPE_TAG] = tag_value;
+                id2Tags[way.id()][TYPE_TAG] = tag_value;
             }
-
-            std::cout << "Relationship Way " << way.id() << " is in relationship ";
-            for (const auto &relationshipId : inputRelationships_.way2Relationships.at(way.id())) {
-                auto &ringIndex = relationship2RingIndex[relationshipId];
-                way2Relationship2RingIndex[way.id()][relationshipId] = ringIndex;
-                std::cout << relationshipId << ", ringIndx=" << ringIndex << ", ";
-                ++ringIndex;
-            }
-            std::array<char, 128> buffer;
-            std::snprintf(buffer.data(), buffer.size(), " and has %lu nodes\n", way.nodes().size());
-            std::cout << buffer.data();
+            relationWays.emplace_back(way.id(), way.nodes().size());
         }
 
         if (isWayAValidRoute(way)) {
-            const auto &tags = way.tags();
-
-            if (auto tag_value = tags.get_value_by_key(HIGHWAY_TAG); tag_value) {
-                wayData.id2Tags[way.id()][HIGHWAY_TAG] = tag_value;
-            }
-
-            if (auto tag_value = tags.get_value_by_key(NAME_TAG); tag_value) {
-                wayData.id2Tags[way.id()][NAME_TAG] = tag_value;
-            }
+            copyTags(way.tags(), tagKeys_, id2Tags[way.id()]);
         }
 
-        if (isWayInRelationship(way)) {
-        }
-        // const size_t offset = isWayInRelationship(way) ? way.nodes().size() : 0;
         for (size_t ii = 0; ii < way.nodes().size(); ++ii) {
             const auto &node_ref = way.nodes()[ii];
             // Assume that we only get po
             assert(node_ref.ref() > 0);
-            auto &nodeMap = wayData.node2Ways[node_ref.ref()];
-            nodeMap.emplace(way.id(), ii); // + offset);
+            nodeRefs[shardOf(node_ref.ref())].push_back({node_ref.ref(), way.id(), static_cast<int64_t>(ii)});
         }
     }
 };
 
+// Collects the locations of the requested nodes of one buffer which are
+// within bounds (including the margin)
 struct NodeHandler : public osmium::handler::Handler {
+    struct WayNode {
+        osmium::object_id_type way;
+        int64_t index;
+        osmium::Location location;
+    };
+    struct RingNode {
+        osmium::object_id_type relation;
+        int64_t ring;
+        int64_t index;
+        osmium::Location location;
+    };
 
     const osmium::Box &bounds_;
+    // every node referenced by wayData_ or relationshipData_
+    const NodeIdSet &requestedNodes_;
     const MappedWayData &wayData_;
     const RelationshipData &relationshipData_;
     const Id2Id2Index &way2Relationship2RingIndex_;
 
-    OSMLoader::Id2Route routes_;
-    OSMLoader::Id2Area areas_;
+    Shards<std::vector<WayNode>> routeNodes_{}; // by shardOf(way id)
+    std::vector<RingNode> ringNodes_{};
+    std::vector<std::pair<osmium::object_id_type, OSMLoader::AreaNode>> areaNodes_{};
+    // Locations of all nodes used above, kept for applying changes later
+    std::vector<std::pair<osmium::object_id_type, osmium::Location>> nodeLocations_{};
 
-    NodeHandler(const osmium::Box &bounds, const MappedWayData &wayData, const RelationshipData &relationshipData,
-                const Id2Id2Index &way2Relationship2RingIndex)
-        : bounds_(bounds), wayData_(wayData), relationshipData_(relationshipData),
+    NodeHandler(const osmium::Box &bounds, const NodeIdSet &requestedNodes, const MappedWayData &wayData,
+                const RelationshipData &relationshipData, const Id2Id2Index &way2Relationship2RingIndex)
+        : bounds_(bounds), requestedNodes_(requestedNodes), wayData_(wayData), relationshipData_(relationshipData),
           way2Relationship2RingIndex_(way2Relationship2RingIndex) {}
 
     void node(const osmium::Node &node) noexcept {
-        if (!node.location().valid()) {
+        // Most nodes are not requested at all, sort them out with a bit test
+        if (!requestedNodes_.mayContain(node.id())) {
             return;
         }
 
-        // NOTE: maybe bounds needs to be expanded to include more nodes?
-        if (!bounds_.contains(node.location())) {
+        if (!node.location().valid() || !bounds_.contains(node.location())) {
             return;
         }
 
         // check if node is in relationship
         if (auto it = relationshipData_.node2Relationships.find(node.id());
             it != relationshipData_.node2Relationships.end()) {
+            nodeLocations_.emplace_back(node.id(), node.location());
             for (const auto &relationshipId : it->second) {
-                auto &area = areas_[relationshipId];
                 OSMLoader::AreaNode aNode{
                     .id = node.id(),
                     .role = relationshipData_.node2Roles.at(node.id()),
                     .location = node.location(),
                 };
-                area.nodes.push_back(aNode);
+                areaNodes_.emplace_back(relationshipId, std::move(aNode));
             }
         }
 
         // check if node is in a way
-        if (auto it = wayData_.node2Ways.find(node.id()); it != wayData_.node2Ways.end()) {
+        if (const auto *ways = wayData_.findWays(node.id()); ways) {
             // This node is part of one or more requested ways
-            for (const auto &way : it->second) {
+            nodeLocations_.emplace_back(node.id(), node.location());
+            for (const auto &way : *ways) {
                 if (relationshipData_.way2Relationships.count(way.pairID) > 0) {
                     for (const auto &relationshipId : relationshipData_.way2Relationships.at(way.pairID)) {
-                        auto &area = areas_[relationshipId];
                         const auto &ringIdx = way2Relationship2RingIndex_.at(way.pairID).at(relationshipId);
-                        if (ringIdx >= area.outerRings.size()) {
-                            area.outerRings.resize(ringIdx + 1);
-                        }
-                        auto &outerRing = area.outerRings.at(ringIdx);
-                        populateWay(node, way.pairIndex, outerRing);
+                        ringNodes_.push_back({relationshipId, ringIdx, way.pairIndex, node.location()});
                     }
                 } else {
-                    // Find or create the route for this wayID
-                    auto &route = routes_[way.pairID];
-                    populateWay(node, way.pairIndex, route.nodes);
-                    route.id = way.pairID;
-                    if (wayData_.id2Tags.count(way.pairID) > 0) {
-                        const auto &tags = wayData_.id2Tags.at(way.pairID);
-                        route.tags[NAME_TAG] = tags.count(NAME_TAG) > 0 ? tags.at(NAME_TAG) : "";
-                        route.tags[HIGHWAY_TAG] = tags.count(HIGHWAY_TAG) > 0 ? tags.at(HIGHWAY_TAG) : "";
-                    }
+                    routeNodes_[shardOf(way.pairID)].push_back({way.pairID, way.pairIndex, node.location()});
                 }
             }
         }
     }
+};
 
-    void populateWay(const osmium::Node &node, const int nodeIndex, OSMLoader::Coordinates &nodes) {
-        if (nodes.size() <= nodeIndex) {
-            nodes.resize(nodeIndex + 1);
-        }
-        nodes[nodeIndex] = node.location();
+void populateWay(const osmium::Location &location, const int64_t nodeIndex, OSMLoader::Coordinates &nodes) {
+    if (nodes.size() <= static_cast<size_t>(nodeIndex)) {
+        nodes.resize(nodeIndex + 1);
     }
-};
+    nodes[nodeIndex] = location;
+}
 
 bool cleanupWay(OSMLoader::Coordinates &nodes) {
     auto new_end =
@@ -274,9 +488,998 @@ bool cleanupWay(OSMLoader::Coordinates &nodes) {
     return nodes.empty();
 }
 
+// `bounds` grown by `margin` degrees on every side
+osmium::Box expandBounds(const osmium::Box &bounds, double margin) {
+    return osmium::Box{std::max(bounds.left() - margin, -180.0), std::max(bounds.bottom() - margin, -90.0),
+                       std::min(bounds.right() + margin, 180.0), std::min(bounds.top() + margin, 90.0)};
+}
+
+// The nodes of a clipped route with an invalid location between its pieces,
+// so that clipping it again keeps them apart. Nodes outside of `loadBounds`
+// become invalid too, as a load of those bounds would not have resolved them.
+OSMLoader::Coordinates withHoles(const OSMLoader::Route_t &route, const osmium::Box &loadBounds) {
+    OSMLoader::Coordinates nodes;
+    nodes.reserve(route.nodes.size() + route.breaks.size());
+    auto nextBreak = route.breaks.begin();
+    for (size_t ii = 0; ii < route.nodes.size(); ++ii) {
+        if (nextBreak != route.breaks.end() && ii == *nextBreak) {
+            nodes.emplace_back();
+            ++nextBreak;
+        }
+        nodes.push_back(loadBounds.contains(route.nodes[ii]) ? route.nodes[ii] : OSMLoader::Coordinate{});
+    }
+    return nodes;
+}
+
+// Clip the nodes of `route` at `bounds`. Invalid locations are nodes which
+// were not loaded; segments touching them are dropped. Segments crossing the
+// edge of `bounds` end in a vertex interpolated on the edge, and every piece
+// after the first is recorded in route.breaks. Returns true if nothing is
+// left.
+bool clipWay(OSMLoader::Route_t &route, const osmium::Box &bounds) {
+    const OSMLoader::Coordinates nodes = std::move(route.nodes);
+    route.nodes.clear();
+    route.breaks.clear();
+
+    if (nodes.size() == 1) {
+        if (nodes[0].valid() && bounds.contains(nodes[0])) {
+            route.nodes.push_back(nodes[0]);
+        }
+        return route.nodes.empty();
+    }
+
+    // Liang-Barsky in the fixed point coordinates of osmium::Location
+    const double minX = bounds.bottom_left().x();
+    const double minY = bounds.bottom_left().y();
+    const double maxX = bounds.top_right().x();
+    const double maxY = bounds.top_right().y();
+    auto lerp = [](const osmium::Location &a, double dx, double dy, double t) {
+        return osmium::Location{static_cast<int32_t>(std::lround(a.x() + t * dx)),
+                                static_cast<int32_t>(std::lround(a.y() + t * dy))};
+    };
+
+    bool connected = false;
+    for (size_t ii = 1; ii < nodes.size(); ++ii) {
+        const auto &a = nodes[ii - 1];
+        const auto &b = nodes[ii];
+        if (!a.valid() || !b.valid()) {
+            connected = false;
+            continue;
+        }
+
+        const double dx = static_cast<double>(b.x()) - a.x();
+        const double dy = static_cast<double>(b.y()) - a.y();
+        double t0 = 0.0;
+        double t1 = 1.0;
+        // p: direction towards the outside of an edge, q: distance to it
+        auto clipEdge = [&](double p, double q) {
+            if (p == 0.0) {
+                return q >= 0.0;
+            }
+            const double t = q / p;
+            if (p < 0.0) {
+                t0 = std::max(t0, t);
+            } else {
+                t1 = std::min(t1, t);
+            }
+            return t0 <= t1;
+        };
+        if (!(clipEdge(-dx, a.x() - minX) && clipEdge(dx, maxX - a.x()) && clipEdge(-dy, a.y() - minY) &&
+              clipEdge(dy, maxY - a.y()))) {
+            connected = false;
+            continue;
+        }
+
+        if (!connected) {
+            if (!route.nodes.empty()) {
+                route.breaks.push_back(static_cast<uint32_t>(route.nodes.size()));
+            }
+            route.nodes.push_back(t0 > 0.0 ? lerp(a, dx, dy, t0) : a);
+        }
+        route.nodes.push_back(t1 < 1.0 ? lerp(a, dx, dy, t1) : b);
+        connected = t1 == 1.0;
+    }
+
+    return route.nodes.empty();
+}
+
+// Collects the objects of an OsmChange file. Objects in its <delete> sections
+// come in with visible() == false; when an object changes several times
+// within one file the last version wins.
+struct ChangeHandler : public osmium::handler::Handler {
+    struct WayChange {
+        bool deleted{false};
+        bool isRoute{false};
+        std::vector<osmium::object_id_type> nodes;
+        OSMLoader::Tags tags;
+    };
+    struct RelationChange {
+        bool deleted{false};
+        bool isArea{false};
+        std::vector<osmium::object_id_type> outerWays;
+        std::vector<std::pair<osmium::object_id_type, std::string>> nodes;
+        OSMLoader::Tags tags;
+    };
+
+    const std::vector<std::string> &tagKeys_;
+    const TagFilter &routeFilter_;
+    const TagFilter &areaFilter_;
+
+    // invalid location for deleted nodes
+    std::unordered_map<osmium::object_id_type, osmium::Location> nodes;
+    std::unordered_map<osmium::object_id_type, WayChange> ways;
+    std::unordered_map<osmium::object_id_type, RelationChange> relations;
+
+    ChangeHandler(const std::vector<std::string> &tagKeys, const TagFilter &routeFilter, const TagFilter &areaFilter)
+        : tagKeys_(tagKeys), routeFilter_(routeFilter), areaFilter_(areaFilter) {}
+
+    void node(const osmium::Node &node) noexcept {
+        nodes[node.id()] = node.visible() ? node.location() : osmium::Location{};
+    }
+
+    void way(const osmium::Way &way) noexcept {
+        auto &change = ways[way.id()];
+        change = WayChange{};
+        change.deleted = !way.visible();
+        if (change.deleted) {
+            return;
+        }
+        change.isRoute = routeFilter_.Matches(way.tags());
+        for (const auto &node_ref : way.nodes()) {
+            change.nodes.push_back(node_ref.ref());
+        }
+        if (change.isRoute) {
+            copyTags(way.tags(), tagKeys_, change.tags);
+        }
+    }
+
+    void relation(const osmium::Relation &relation) noexcept {
+        auto &change = relations[relation.id()];
+        change = RelationChange{};
+        change.deleted = !relation.visible();
+        if (change.deleted) {
+            return;
+        }
+        change.isArea = areaFilter_.Matches(relation.tags());
+        for (const auto &member : relation.members()) {
+            if (member.type() == osmium::item_type::way && std::strcmp(member.role(), "outer") == 0) {
+                change.outerWays.push_back(member.ref());
+            } else if (member.type() == osmium::item_type::node) {
+                change.nodes.emplace_back(member.ref(), member.role());
+            }
+        }
+        copyTags(relation.tags(), {NAME_TAG, TYPE_TAG}, change.tags);
+    }
+};
+
+// Node locations within the load bounds, in a sorted array of (id, location)
+// pairs in an anonymous memory mapped file. Only the pages being touched have
+// to be resident, so the operating system can page the index out when the
+// input is larger than the physical memory.
+using LocationIndex = osmium::index::map::SparseFileArray<osmium::unsigned_object_id_type, osmium::Location>;
+
+// What the way and node passes produce, whichever index resolves the node
+// locations. Routes are not clipped yet and nodes outside of the load bounds
+// are invalid holes in routes and rings.
+struct LoadedWays {
+    OSMLoader::Id2Route routes;
+    OSMLoader::Id2Area areas;
+    OSMLoader::Id2Tags wayTags;
+    Id2Id2Index way2Relationship2RingIndex;
+    // in-bounds node locations, in memory or in the file backed index
+    std::unordered_map<osmium::object_id_type, osmium::Location> nodeLocations;
+    std::shared_ptr<LocationIndex> locationIndex;
+    // node ids of the routes and relation ways, kept for applying changes
+    std::unordered_map<osmium::object_id_type, std::vector<osmium::object_id_type>> wayNodes;
+};
+
+// Assign the ring indices of the outer ways of relations. Has to see the ways
+// in file order.
+void assignRingIndices(const std::vector<std::pair<osmium::object_id_type, size_t>> &relationWays,
+                       const RelationshipData &relationshipData, Id2Index &relationship2RingIndex,
+                       Id2Id2Index &way2Relationship2RingIndex) {
+    for (const auto &[wayId, nodeCount] : relationWays) {
+        std::cout << "Relationship Way " << wayId << " is in relationship ";
+        for (const auto &relationshipId : relationshipData.way2Relationships.at(wayId)) {
+            auto &ringIndex = relationship2RingIndex[relationshipId];
+            way2Relationship2RingIndex[wayId][relationshipId] = ringIndex;
+            std::cout << relationshipId << ", ringIndx=" << ringIndex << ", ";
+            ++ringIndex;
+        }
+        std::cout << " and has " << nodeCount << " nodes\n";
+    }
+}
+
+// Resolve the node locations through in memory maps: the ways pass maps every
+// node to the ways using it, the nodes pass then looks up each node in there.
+// Fast, but the maps grow with the number of way nodes in the whole file.
+LoadedWays loadWithNodeMaps(const InputFile &input, osmium::thread::Pool &pool,
+                            const osmium::Box &loadBounds, const RelationshipData &relationshipData,
+                            const std::vector<std::string> &tagKeys, const TagFilter &routeFilter) {
+    LoadedWays loaded;
+
+    // 2) generate a mapping of node to ways
+    auto wayResults = processInput(input, osmium::osm_entity_bits::way, pool, [&](osmium::memory::Buffer &buffer) {
+        WayHandler handler(relationshipData, tagKeys, routeFilter);
+        osmium::apply(buffer, handler);
+        return handler;
+    });
+    MappedWayData wayData;
+    auto wayTags = pool.submit([&] {
+        Id2Index relationship2RingIndex;
+        for (auto &result : wayResults) {
+            wayData.id2Tags.merge(result.id2Tags);
+            assignRingIndices(result.relationWays, relationshipData, relationship2RingIndex,
+                              loaded.way2Relationship2RingIndex);
+        }
+    });
+    NodeIdSet requestedNodes;
+    auto nodeFilter = pool.submit([&] {
+        for (const auto &result : wayResults) {
+            for (const auto &refs : result.nodeRefs) {
+                for (const auto &ref : refs) {
+                    requestedNodes.insert(ref.node);
+                }
+            }
+        }
+        for (const auto &entry : relationshipData.node2Relationships) {
+            requestedNodes.insert(entry.first);
+        }
+    });
+    try {
+        mergeShards(pool, [&](size_t shard) {
+            auto &node2Ways = wayData.node2Ways[shard];
+            for (const auto &result : wayResults) {
+                for (const auto &ref : result.nodeRefs[shard]) {
+                    node2Ways[ref.node].emplace(ref.way, ref.index);
+                }
+            }
+        });
+        wayTags.get();
+        nodeFilter.get();
+    } catch (...) {
+        // the tasks still running use the locals of this function
+        for (auto *task : {&wayTags, &nodeFilter}) {
+            if (task->valid()) {
+                task->wait();
+            }
+        }
+        throw;
+    }
+    wayResults.clear();
+
+    // std::cout << "Largest way " << wayHandler.largestWayID << ", size: " << wayHandler.largestWaySize <<
+    // std::endl;
+
+    //
+    // 3) find the nodes which were requested in (2) and are within bounds
+    // and build a buffer to hold them. Nodes within the margin around the
+    // bounds are loaded too, so that ways leaving the bounds can be
+    // clipped exactly at the edge.
+    auto nodeResults = processInput(input, osmium::osm_entity_bits::node, pool, [&](osmium::memory::Buffer &buffer) {
+        NodeHandler handler(loadBounds, requestedNodes, wayData, relationshipData, loaded.way2Relationship2RingIndex);
+        osmium::apply(buffer, handler);
+        return handler;
+    });
+
+    auto areaNodes = pool.submit([&] {
+        for (auto &result : nodeResults) {
+            for (auto &[relationshipId, aNode] : result.areaNodes_) {
+                loaded.areas[relationshipId].nodes.push_back(std::move(aNode));
+            }
+            for (const auto &ringNode : result.ringNodes_) {
+                auto &area = loaded.areas[ringNode.relation];
+                if (ringNode.ring >= static_cast<int64_t>(area.outerRings.size())) {
+                    area.outerRings.resize(ringNode.ring + 1);
+                }
+                populateWay(ringNode.location, ringNode.index, area.outerRings.at(ringNode.ring));
+            }
+        }
+    });
+    auto locations = pool.submit([&] {
+        size_t count = 0;
+        for (const auto &result : nodeResults) {
+            count += result.nodeLocations_.size();
+        }
+        loaded.nodeLocations.reserve(count);
+        for (const auto &result : nodeResults) {
+            loaded.nodeLocations.insert(result.nodeLocations_.begin(), result.nodeLocations_.end());
+        }
+    });
+    Shards<OSMLoader::Id2Route> routeShards;
+    try {
+        mergeShards(pool, [&](size_t shard) {
+            auto &shardRoutes = routeShards[shard];
+            for (const auto &result : nodeResults) {
+                for (const auto &wayNode : result.routeNodes_[shard]) {
+                    // Find or create the route for this wayID
+                    auto &route = shardRoutes[wayNode.way];
+                    populateWay(wayNode.location, wayNode.index, route.nodes);
+                    route.id = wayNode.way;
+                    if (route.tags.empty() && wayData.id2Tags.count(wayNode.way) > 0) {
+                        route.tags = wayData.id2Tags.at(wayNode.way);
+                        route.tags.emplace(NAME_TAG, "");
+                        route.tags.emplace(HIGHWAY_TAG, "");
+                    }
+                }
+            }
+        });
+        areaNodes.get();
+        locations.get();
+    } catch (...) {
+        // the tasks still running use the locals of this function
+        for (auto *task : {&areaNodes, &locations}) {
+            if (task->valid()) {
+                task->wait();
+            }
+        }
+        throw;
+    }
+    nodeResults.clear();
+    for (auto &shardRoutes : routeShards) {
+        loaded.routes.merge(shardRoutes);
+    }
+
+    for (const auto &shard : wayData.node2Ways) {
+        for (const auto &[nodeId, ways] : shard) {
+            for (const auto &way : ways) {
+                if (loaded.routes.count(way.pairID) == 0 &&
+                    relationshipData.way2Relationships.count(way.pairID) == 0) {
+                    continue;
+                }
+                auto &nodes = loaded.wayNodes[way.pairID];
+                if (nodes.size() <= static_cast<size_t>(way.pairIndex)) {
+                    nodes.resize(way.pairIndex + 1);
+                }
+                nodes[way.pairIndex] = nodeId;
+            }
+        }
+    }
+    loaded.wayTags = std::move(wayData.id2Tags);
+
+    return loaded;
+}
+
+// Collects the locations of the nodes of one buffer which are within bounds,
+// for the location index
+struct LocationHandler : public osmium::handler::Handler {
+    const osmium::Box &bounds_;
+    const RelationshipData &relationshipData_;
+
+    std::vector<std::pair<osmium::object_id_type, osmium::Location>> locations_{};
+    std::vector<std::pair<osmium::object_id_type, OSMLoader::AreaNode>> areaNodes_{};
+
+    LocationHandler(const osmium::Box &bounds, const RelationshipData &relationshipData)
+        : bounds_(bounds), relationshipData_(relationshipData) {}
+
+    void node(const osmium::Node &node) noexcept {
+        if (node.id() <= 0 || !node.location().valid() || !bounds_.contains(node.location())) {
+            return;
+        }
+        locations_.emplace_back(node.id(), node.location());
+
+        if (auto it = relationshipData_.node2Relationships.find(node.id());
+            it != relationshipData_.node2Relationships.end()) {
+            for (const auto &relationshipId : it->second) {
+                OSMLoader::AreaNode aNode{
+                    .id = node.id(),
+                    .role = relationshipData_.node2Roles.at(node.id()),
+                    .location = node.location(),
+                };
+                areaNodes_.emplace_back(relationshipId, std::move(aNode));
+            }
+        }
+    }
+};
+
+// Collects the ways of one buffer with their node locations looked up in the
+// location index. Nodes outside of the load bounds are not in the index and
+// end up as invalid locations.
+struct LocatedWayHandler : public osmium::handler::Handler {
+    struct LocatedWay {
+        osmium::object_id_type id;
+        bool inRelationship;
+        std::vector<osmium::object_id_type> nodes;
+        OSMLoader::Coordinates locations;
+        OSMLoader::Tags tags;
+    };
+
+    const RelationshipData &inputRelationships_;
+    const std::vector<std::string> &tagKeys_;
+    const TagFilter &routeFilter_;
+    const LocationIndex &index_;
+
+    std::vector<LocatedWay> ways{};
+    // outer ways of relations and their node count, in file order
+    std::vector<std::pair<osmium::object_id_type, size_t>> relationWays{};
+
+    LocatedWayHandler(const RelationshipData &relationshipData, const std::vector<std::string> &tagKeys,
+                      const TagFilter &routeFilter, const LocationIndex &index)
+        : inputRelationships_(relationshipData), tagKeys_(tagKeys), routeFilter_(routeFilter), index_(index) {}
+
+    void way(const osmium::Way &way) noexcept {
+        const bool inRelationship = inputRelationships_.way2Relationships.count(way.id()) > 0;
+        const bool isRoute = routeFilter_.Matches(way.tags());
+        if (!(inRelationship || isRoute)) {
+            return;
+        }
+        if (inRelationship) {
+            // ring indices count every outer way, loaded or not
+            relationWays.emplace_back(way.id(), way.nodes().size());
+        }
+
+        LocatedWay located{way.id(), inRelationship, {}, {}, {}};
+        located.nodes.reserve(way.nodes().size());
+        located.locations.reserve(way.nodes().size());
+        bool anyValid = false;
+        for (const auto &node_ref : way.nodes()) {
+            located.nodes.push_back(node_ref.ref());
+            const auto id = static_cast<osmium::unsigned_object_id_type>(node_ref.ref());
+            const auto location = node_ref.ref() > 0 ? index_.get_noexcept(id) : osmium::Location{};
+            anyValid = anyValid || location.valid();
+            located.locations.push_back(location);
+        }
+        // ways without a node in bounds are dropped, relation ways have been
+        // counted for the ring indices above
+        if (!anyValid) {
+            return;
+        }
+
+        if (inRelationship) {
+            if (auto tag_value = way.tags().get_value_by_key(TYPE_TAG); tag_value) {
+                located.tags[TYPE_TAG] = tag_value;
+            }
+        }
+        if (isRoute) {
+            copyTags(way.tags(), tagKeys_, located.tags);
+        }
+        ways.push_back(std::move(located));
+    }
+};
+
+// Resolve the node locations through a file backed index: the nodes pass
+// writes the locations of all nodes within the load bounds to the index, the
+// ways pass then looks up their nodes in there. Both passes consume the
+// results of each buffer as it completes, with a few buffers per thread in
+// flight. Besides the index, which lives on disk, only the loaded routes and
+// areas and the node ids of their ways are kept; the index is handed on for
+// looking up locations when changes are applied.
+LoadedWays loadWithLocationIndex(const InputFile &input, osmium::thread::Pool &pool,
+                                 const osmium::Box &loadBounds, const RelationshipData &relationshipData,
+                                 const std::vector<std::string> &tagKeys, const TagFilter &routeFilter) {
+    LoadedWays loaded;
+    loaded.locationIndex = std::make_shared<LocationIndex>();
+    LocationIndex &index = *loaded.locationIndex;
+
+    // 2) write the locations of the nodes within bounds to the index
+    streamInput(
+        input, osmium::osm_entity_bits::node, pool,
+        [&](osmium::memory::Buffer &buffer) {
+            LocationHandler handler(loadBounds, relationshipData);
+            osmium::apply(buffer, handler);
+            return handler;
+        },
+        [&](LocationHandler &result) {
+            for (const auto &[nodeId, location] : result.locations_) {
+                index.set(static_cast<osmium::unsigned_object_id_type>(nodeId), location);
+            }
+            for (auto &[relationshipId, aNode] : result.areaNodes_) {
+                loaded.areas[relationshipId].nodes.push_back(std::move(aNode));
+            }
+        });
+    index.sort();
+    std::cout << "Node location index holds " << index.size() << " nodes" << std::endl;
+
+    // 3) look up the nodes of the ways in the index
+    Id2Index relationship2RingIndex;
+    streamInput(
+        input, osmium::osm_entity_bits::way, pool,
+        [&](osmium::memory::Buffer &buffer) {
+            LocatedWayHandler handler(relationshipData, tagKeys, routeFilter, index);
+            osmium::apply(buffer, handler);
+            return handler;
+        },
+        [&](LocatedWayHandler &result) {
+            assignRingIndices(result.relationWays, relationshipData, relationship2RingIndex,
+                              loaded.way2Relationship2RingIndex);
+            for (auto &way : result.ways) {
+                if (way.inRelationship) {
+                    for (const auto &relationshipId : relationshipData.way2Relationships.at(way.id)) {
+                        const auto ringIndex = loaded.way2Relationship2RingIndex.at(way.id).at(relationshipId);
+                        auto &area = loaded.areas[relationshipId];
+                        if (ringIndex >= static_cast<int64_t>(area.outerRings.size())) {
+                            area.outerRings.resize(ringIndex + 1);
+                        }
+                        area.outerRings[ringIndex] = way.locations;
+                    }
+                } else {
+                    auto &route = loaded.routes[way.id];
+                    route.id = way.id;
+                    route.nodes = std::move(way.locations);
+                    route.tags = way.tags;
+                    route.tags.emplace(NAME_TAG, "");
+                    route.tags.emplace(HIGHWAY_TAG, "");
+                }
+
+                loaded.wayTags[way.id] = std::move(way.tags);
+                loaded.wayNodes[way.id] = std::move(way.nodes);
+            }
+        });
+
+    return loaded;
+}
+
+// Size of the physical memory in bytes, 0 if unknown
+uint64_t physicalMemory() {
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && pageSize > 0 ? static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize) : 0;
+#endif
+}
+
+// The in memory maps take about as much memory as the XML input is large.
+// Switch to the file backed index when that would take more than this
+// fraction of the physical memory.
+constexpr double MAX_NODE_MAP_MEMORY_FRACTION = 0.25;
+
+bool useLocationIndex(const std::string &filepath, OSMLoader::NodeIndex nodeIndex) {
+    if (nodeIndex != OSMLoader::NodeIndex::Auto) {
+        return nodeIndex == OSMLoader::NodeIndex::File;
+    }
+    std::error_code error;
+    const auto fileSize = std::filesystem::file_size(filepath, error);
+    const auto memory = physicalMemory();
+    if (error || memory == 0) {
+        return false;
+    }
+    return static_cast<double>(fileSize) > MAX_NODE_MAP_MEMORY_FRACTION * static_cast<double>(memory);
+}
+
+// Counts of strings in the order they first appeared, like Python's Counter
+class RankedCounter {
+  public:
+    void add(const std::string &key, uint64_t count = 1) {
+        auto [it, inserted] = indices_.try_emplace(key, entries_.size());
+        if (inserted) {
+            entries_.emplace_back(key, 0);
+        }
+        entries_[it->second].second += count;
+    }
+
+    // Append the counts of a later buffer
+    void merge(const RankedCounter &other) {
+        for (const auto &[key, count] : other.entries_) {
+            add(key, count);
+        }
+    }
+
+    // The `count` most common strings, ties in order of first appearance
+    // as in Counter.most_common()
+    std::vector<std::pair<std::string, uint64_t>> mostCommon(size_t count) const {
+        auto sorted = entries_;
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](const auto &a, const auto &b) { return a.second > b.second; });
+        sorted.resize(std::min(count, sorted.size()));
+        return sorted;
+    }
+
+  protected:
+    std::unordered_map<std::string, size_t> indices_;
+    std::vector<std::pair<std::string, uint64_t>> entries_;
+};
+
+// Statistics of one buffer for OSMLoader::Count(), the ones analyze_osm.py
+// gathers: objects with a highway tag per highway value with their
+// width/surface combinations, and the tags of relations
+struct CountHandler : public osmium::handler::Handler {
+    struct Highway {
+        uint64_t count{0};
+        std::set<std::pair<std::string, std::string>> widthSurfaces;
+    };
+
+    uint64_t nodes{0};
+    uint64_t ways{0};
+    uint64_t relations{0};
+    std::map<std::string, Highway> highways;
+    RankedCounter relationKeys;
+    RankedCounter relationTags;
+
+    void node(const osmium::Node &node) {
+        ++nodes;
+        countHighway(node.tags());
+    }
+
+    void way(const osmium::Way &way) {
+        ++ways;
+        countHighway(way.tags());
+    }
+
+    void relation(const osmium::Relation &relation) {
+        ++relations;
+        countHighway(relation.tags());
+        for (const auto &tag : relation.tags()) {
+            if (*tag.key() == '\0') {
+                continue;
+            }
+            relationKeys.add(tag.key());
+            if (*tag.value() != '\0') {
+                relationTags.add(std::string(tag.key()) + "=" + tag.value());
+            }
+        }
+    }
+
+    void countHighway(const osmium::TagList &tags) {
+        const char *highway = tags.get_value_by_key(HIGHWAY_TAG);
+        if (!highway) {
+            return;
+        }
+        auto &entry = highways[highway];
+        ++entry.count;
+        entry.widthSurfaces.emplace(tags.get_value_by_key("width", "N/A"), tags.get_value_by_key("surface", "N/A"));
+    }
+
+    // Append the statistics of a later buffer
+    void merge(CountHandler &other) {
+        nodes += other.nodes;
+        ways += other.ways;
+        relations += other.relations;
+        for (auto &[value, highway] : other.highways) {
+            auto &entry = highways[value];
+            entry.count += highway.count;
+            entry.widthSurfaces.merge(highway.widthSurfaces);
+        }
+        relationKeys.merge(other.relationKeys);
+        relationTags.merge(other.relationTags);
+    }
+};
+
 } // namespace
 
-std::optional<OSMLoader::OSMData> OSMLoader::getData(const CoordinateBounds &bounds) const {
+// The part of the input kept after getData() to apply changes to it
+struct OSMLoader::ChangeState {
+    struct Relation {
+        std::vector<osmium::object_id_type> outerWays; // in ring order
+        std::vector<std::pair<osmium::object_id_type, std::string>> nodes;
+        Tags tags;
+    };
+
+    // routes are clipped at `bounds`, nodes are kept within `loadBounds`
+    CoordinateBounds bounds;
+    CoordinateBounds loadBounds;
+    // in-bounds locations of the nodes of the ways and relations below. With
+    // a location index these are only the changes on top of the index, an
+    // invalid location for a node which was deleted or left the bounds.
+    std::unordered_map<osmium::object_id_type, osmium::Location> nodeLocations;
+    std::shared_ptr<const LocationIndex> locationIndex;
+    // node ids of the routes and of the outer ways of areas
+    std::unordered_map<osmium::object_id_type, std::vector<osmium::object_id_type>> wayNodes;
+    Id2Tags routeTags;
+    std::unordered_map<osmium::object_id_type, Relation> relations;
+
+    Id2Ids node2Ways;
+    Id2Ids node2Relations;
+    Id2Ids way2Relations;
+
+    // what the caller currently holds
+    std::unordered_set<osmium::object_id_type> routeIds;
+    std::unordered_set<osmium::object_id_type> areaIds;
+
+    void setWayNodes(osmium::object_id_type wayId, std::vector<osmium::object_id_type> nodes) {
+        eraseWayNodes(wayId);
+        for (auto nodeId : nodes) {
+            node2Ways[nodeId].insert(wayId);
+        }
+        wayNodes[wayId] = std::move(nodes);
+    }
+
+    void eraseWayNodes(osmium::object_id_type wayId) {
+        auto it = wayNodes.find(wayId);
+        if (it == wayNodes.end()) {
+            return;
+        }
+        for (auto nodeId : it->second) {
+            eraseFrom(node2Ways, nodeId, wayId);
+        }
+        wayNodes.erase(it);
+    }
+
+    void setRelation(osmium::object_id_type relationId, Relation relation) {
+        eraseRelation(relationId);
+        for (auto wayId : relation.outerWays) {
+            way2Relations[wayId].insert(relationId);
+        }
+        for (const auto &node : relation.nodes) {
+            node2Relations[node.first].insert(relationId);
+        }
+        relations[relationId] = std::move(relation);
+    }
+
+    void eraseRelation(osmium::object_id_type relationId) {
+        auto it = relations.find(relationId);
+        if (it == relations.end()) {
+            return;
+        }
+        for (auto wayId : it->second.outerWays) {
+            eraseFrom(way2Relations, wayId, relationId);
+        }
+        for (const auto &node : it->second.nodes) {
+            eraseFrom(node2Relations, node.first, relationId);
+        }
+        relations.erase(it);
+    }
+
+    static void eraseFrom(Id2Ids &map, osmium::object_id_type key, osmium::object_id_type value) {
+        if (auto it = map.find(key); it != map.end()) {
+            it->second.erase(value);
+            if (it->second.empty()) {
+                map.erase(it);
+            }
+        }
+    }
+
+    // Invalid for the nodes which are not loaded
+    osmium::Location location(osmium::object_id_type nodeId) const {
+        if (auto it = nodeLocations.find(nodeId); it != nodeLocations.end()) {
+            return it->second;
+        }
+        if (locationIndex && nodeId > 0) {
+            return locationIndex->get_noexcept(static_cast<osmium::unsigned_object_id_type>(nodeId));
+        }
+        return osmium::Location{};
+    }
+
+    void setLocation(osmium::object_id_type nodeId, osmium::Location location) {
+        if (location.valid() || locationIndex) {
+            // the invalid location hides the one in the index
+            nodeLocations[nodeId] = location;
+        } else {
+            nodeLocations.erase(nodeId);
+        }
+    }
+
+    // Invalid locations for the nodes which are not loaded
+    Coordinates wayCoordinates(osmium::object_id_type wayId) const {
+        Coordinates coordinates;
+        if (auto it = wayNodes.find(wayId); it != wayNodes.end()) {
+            for (auto nodeId : it->second) {
+                coordinates.push_back(location(nodeId));
+            }
+        }
+        return coordinates;
+    }
+
+    // Same rules as the NodeHandler: ways which are outer ways of an area
+    // are not routes themselves
+    std::optional<Route_t> buildRoute(osmium::object_id_type wayId) const {
+        auto tags = routeTags.find(wayId);
+        if (tags == routeTags.end() || way2Relations.count(wayId) > 0) {
+            return std::nullopt;
+        }
+        Route_t route{wayId, wayCoordinates(wayId), tags->second};
+        if (clipWay(route, bounds)) {
+            return std::nullopt;
+        }
+        route.tags.emplace(NAME_TAG, "");
+        route.tags.emplace(HIGHWAY_TAG, "");
+        return route;
+    }
+
+    std::optional<Area_t> buildArea(osmium::object_id_type relationId) const {
+        auto it = relations.find(relationId);
+        if (it == relations.end()) {
+            return std::nullopt;
+        }
+        Area_t area{};
+        area.id = relationId;
+        area.tags = it->second.tags;
+        for (auto wayId : it->second.outerWays) {
+            if (auto ring = wayCoordinates(wayId); !cleanupWay(ring)) {
+                area.outerRings.push_back(std::move(ring));
+            }
+        }
+        if (area.outerRings.empty()) {
+            return std::nullopt;
+        }
+        for (const auto &[nodeId, role] : it->second.nodes) {
+            if (auto loc = location(nodeId); loc.valid()) {
+                area.nodes.push_back(AreaNode{nodeId, role, loc});
+            }
+        }
+        return area;
+    }
+};
+
+bool OSMLoader::Count() {
+    if (filepath_.empty()) {
+        std::cerr << "No input file specified." << std::endl;
+        return false;
+    }
+
+    CountHandler counts;
+    try {
+        // One pass over all objects, the buffers counted in parallel and
+        // merged in file order as they complete, so that first appearances
+        // keep their order and only a few buffers are held at a time
+        osmium::thread::Pool pool{threadCount_};
+        const InputFile input = openInput(filepath_, fastXml_);
+        streamInput(
+            input, osmium::osm_entity_bits::nwr, pool,
+            [](osmium::memory::Buffer &buffer) {
+                CountHandler handler;
+                osmium::apply(buffer, handler);
+                return handler;
+            },
+            [&counts](CountHandler &result) { counts.merge(result); });
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    std::cout << "Nodes: " << counts.nodes << "\n"
+              << "Ways: " << counts.ways << "\n"
+              << "Relations: " << counts.relations << "\n\n";
+
+    // Same layout as analyze_osm.py
+    std::cout << std::left << std::setw(20) << "Highway Value" << " | " << std::setw(8) << "Count" << " | "
+              << std::setw(10) << "Width" << " | " << std::setw(15) << "Surface" << "\n"
+              << std::string(60, '-') << "\n";
+    uint64_t totalHighways = 0;
+    for (const auto &[value, highway] : counts.highways) {
+        totalHighways += highway.count;
+        for (const auto &[width, surface] : highway.widthSurfaces) {
+            std::cout << std::setw(20) << value << " | " << std::setw(8) << highway.count << " | " << std::setw(10)
+                      << width << " | " << std::setw(15) << surface << "\n";
+        }
+    }
+    std::cout << std::right << "Total number of highway types: " << counts.highways.size() << "\n"
+              << "Total number of highways: " << totalHighways << "\n\n";
+
+    if (counts.relations == 0) {
+        std::cout << "No relation elements found in the file." << std::endl;
+        return true;
+    }
+    std::cout << "Analyzed " << counts.relations << " relations.\n\n"
+              << "--- Most Common Tag Keys ---\n";
+    for (const auto &[key, count] : counts.relationKeys.mostCommon(5)) {
+        std::cout << key << ": " << count << "\n";
+    }
+    std::cout << "\n--- Most Common Tag Types (Key=Value) ---\n";
+    for (const auto &[tag, count] : counts.relationTags.mostCommon(10)) {
+        std::cout << tag << ": " << count << "\n";
+    }
+    std::cout << std::flush;
+    return true;
+}
+
+void OSMLoader::addTagKeys(const std::vector<std::string> &keys) {
+    for (const auto &key : keys) {
+        if (std::find(tagKeys_.begin(), tagKeys_.end(), key) == tagKeys_.end()) {
+            tagKeys_.push_back(key);
+        }
+    }
+}
+
+std::optional<OSMLoader::OSMData> OSMLoader::getData(const CoordinateBounds &bounds) {
+    return resident_ ? queryResident(bounds) : load(bounds);
+}
+
+std::optional<OSMLoader::OSMData> OSMLoader::queryResident(const CoordinateBounds &bounds) {
+    std::shared_ptr<MapStore> store;
+    {
+        std::lock_guard<std::mutex> lock(residentMutex_);
+        if (!residentStore_) {
+            auto data = load(osmium::Box{-180.0, -90.0, 180.0, 90.0});
+            if (!data) {
+                return std::nullopt;
+            }
+            residentStore_ = std::make_shared<MapStore>(std::move(*data));
+            std::cout << "Keeping " << residentStore_->RouteCount() << " routes and " << residentStore_->AreaCount()
+                      << " areas in memory" << std::endl;
+        }
+        store = residentStore_;
+    }
+
+    // The same result as load(bounds): routes with the nodes within the
+    // load bounds, clipped at the bounds, and areas with the nodes within
+    // the load bounds
+    const auto loadBounds = expandBounds(bounds, boundsMargin_);
+    OSMData data;
+    store->Query(
+        loadBounds,
+        [&](const Route_t &stored) {
+            Route_t route{stored.id, withHoles(stored, loadBounds), stored.tags};
+            if (!clipWay(route, bounds)) {
+                data.first.emplace(route.id, std::move(route));
+            }
+        },
+        [&](const Area_t &stored) {
+            Area_t area{};
+            area.id = stored.id;
+            area.tags = stored.tags;
+            for (const auto &storedRing : stored.outerRings) {
+                Coordinates ring;
+                std::copy_if(storedRing.begin(), storedRing.end(), std::back_inserter(ring),
+                             [&](const Coordinate &location) { return loadBounds.contains(location); });
+                if (!ring.empty()) {
+                    area.outerRings.push_back(std::move(ring));
+                }
+            }
+            if (area.outerRings.empty()) {
+                return;
+            }
+            std::copy_if(stored.nodes.begin(), stored.nodes.end(), std::back_inserter(area.nodes),
+                         [&](const AreaNode &node) { return loadBounds.contains(node.location); });
+            data.second.emplace(area.id, std::move(area));
+        });
+    return data;
+}
+
+bool OSMLoader::validateResident(const CoordinateBounds &bounds) {
+    const auto fromFile = load(bounds);
+    const auto resident = queryResident(bounds);
+    if (!fromFile || !resident) {
+        return false;
+    }
+
+    auto sortedNodes = [](std::vector<AreaNode> nodes) {
+        std::sort(nodes.begin(), nodes.end(), [](const AreaNode &a, const AreaNode &b) {
+            return std::tie(a.id, a.role) < std::tie(b.id, b.role);
+        });
+        return nodes;
+    };
+    auto sameNodes = [&](const std::vector<AreaNode> &a, const std::vector<AreaNode> &b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const AreaNode &x, const AreaNode &y) {
+            return x.id == y.id && x.role == y.role && x.location == y.location;
+        });
+    };
+    auto report = [](const char *kind, osmium::object_id_type id, const char *difference) {
+        std::cerr << "Resident " << kind << " " << id << " " << difference << std::endl;
+        return false;
+    };
+
+    bool matches = true;
+    for (const auto &[id, route] : fromFile->first) {
+        auto it = resident->first.find(id);
+        if (it == resident->first.end()) {
+            matches = report("route", id, "is missing");
+        } else if (it->second.nodes != route.nodes || it->second.breaks != route.breaks) {
+            matches = report("route", id, "has other nodes than in the file");
+        } else if (it->second.tags != route.tags) {
+            matches = report("route", id, "has other tags than in the file");
+        }
+    }
+    for (const auto &[id, area] : fromFile->second) {
+        auto it = resident->second.find(id);
+        if (it == resident->second.end()) {
+            matches = report("area", id, "is missing");
+        } else if (it->second.outerRings != area.outerRings) {
+            matches = report("area", id, "has other outer rings than in the file");
+        } else if (!sameNodes(sortedNodes(it->second.nodes), sortedNodes(area.nodes))) {
+            matches = report("area", id, "has other nodes than in the file");
+        } else if (it->second.tags != area.tags) {
+            matches = report("area", id, "has other tags than in the file");
+        }
+    }
+    if (resident->first.size() != fromFile->first.size() || resident->second.size() != fromFile->second.size()) {
+        std::cerr << "Resident data has " << resident->first.size() << " routes and " << resident->second.size()
+                  << " areas, the file " << fromFile->first.size() << " routes and " << fromFile->second.size()
+                  << " areas" << std::endl;
+        matches = false;
+    }
+
+    if (matches) {
+        std::cout << "Resident data matches the file for all " << fromFile->first.size() << " routes and "
+                  << fromFile->second.size() << " areas" << std::endl;
+    }
+    return matches;
+}
+
+std::optional<OSMLoader::OSMData> OSMLoader::load(const CoordinateBounds &bounds) {
     OSMData data;
 
     if (filepath_.empty()) {
@@ -285,39 +1488,42 @@ std::optional<OSMLoader::OSMData> OSMLoader::getData(const CoordinateBounds &bou
     }
 
     try {
-        const osmium::io::File input_file{filepath_};
+        const InputFile input = openInput(filepath_, fastXml_);
+
+        // Every pass runs its handler on each buffer in parallel, into per
+        // buffer results which are merged in file order at the end of the
+        // pass. The readers decode on osmium's default pool.
+        osmium::thread::Pool pool{threadCount_};
 
         // 1) Generate a mapping of ways&nodes to relationships
-        osmium::io::Reader relationshipReader{input_file, osmium::osm_entity_bits::relation};
-        RelationshipHandler relationshipHandler;
-        osmium::apply(relationshipReader, relationshipHandler);
-        relationshipReader.close();
-        const auto &relationshipData = relationshipHandler.relationshipData;
-
-        // 2) generate a mapping of node to ways
-        osmium::io::Reader wayReader{input_file, osmium::osm_entity_bits::way};
-        WayHandler wayHandler(relationshipData);
-        osmium::apply(wayReader, wayHandler);
-        wayReader.close();
-        const auto &wayData = wayHandler.wayData;
-
-        // std::cout << "Largest way " << wayHandler.largestWayID << ", size: " << wayHandler.largestWaySize <<
-        // std::endl;
-
-        //
-        // 2) find the nodes which were requested in (1) and are within bounds
-        // and build a buffer to hold them
-        osmium::io::Reader nodeReader{input_file, osmium::osm_entity_bits::node};
-        NodeHandler nodeHandler(bounds, wayData, relationshipData, wayHandler.way2Relationship2RingIndex);
-        osmium::apply(nodeReader, nodeHandler);
-        nodeReader.close();
-        auto &routes = nodeHandler.routes_;
-        auto &areas = nodeHandler.areas_;
-
-        // clean up routes to remove any incomplete ways
+        auto relationshipResults =
+            processInput(input, osmium::osm_entity_bits::relation, pool, [this](osmium::memory::Buffer &buffer) {
+                RelationshipHandler handler(areaFilter_);
+                osmium::apply(buffer, handler);
+                return std::move(handler.relationshipData);
+            });
+        RelationshipData relationshipData;
+        for (auto &result : relationshipResults) {
+            mergeRelationshipData(relationshipData, result);
+        }
+        relationshipResults.clear();
+
+        // 2) and 3) load the ways and the locations of their nodes
+        const auto loadBounds = expandBounds(bounds, boundsMargin_);
+        const bool locationIndex = useLocationIndex(filepath_, nodeIndex_);
+        std::cout << "Resolving node locations with " << (locationIndex ? "a file backed index" : "in memory maps")
+                  << std::endl;
+        auto loaded = locationIndex ? loadWithLocationIndex(input, pool, loadBounds, relationshipData, tagKeys_,
+                                                            routeFilter_)
+                                    : loadWithNodeMaps(input, pool, loadBounds, relationshipData, tagKeys_,
+                                                       routeFilter_);
+        auto &routes = loaded.routes;
+        auto &areas = loaded.areas;
+
+        // clip routes at the bounds, removing any ways without nodes inside
         for (auto it = routes.begin(); it != routes.end();) {
             auto &way = it->second;
-            if (cleanupWay(way.nodes)) {
+            if (clipWay(way, bounds)) {
                 it = routes.erase(it);
             } else {
                 ++it;
@@ -393,6 +1599,52 @@ std::optional<OSMLoader::OSMData> OSMLoader::getData(const CoordinateBounds &bou
         //     std::cout << type.first << ": " << type.second << std::endl;
         // }
 
+        // Keep what is needed to apply OsmChange files to this data later
+        auto state = std::make_shared<ChangeState>();
+        state->bounds = bounds;
+        state->loadBounds = loadBounds;
+        state->nodeLocations = std::move(loaded.nodeLocations);
+        state->locationIndex = std::move(loaded.locationIndex);
+
+        for (auto &[wayId, nodes] : loaded.wayNodes) {
+            if (routes.count(wayId) > 0 || relationshipData.way2Relationships.count(wayId) > 0) {
+                state->setWayNodes(wayId, std::move(nodes));
+            }
+        }
+
+        std::unordered_map<osmium::object_id_type, std::map<int64_t, osmium::object_id_type>> relationRings;
+        for (const auto &[wayId, relationIds] : loaded.way2Relationship2RingIndex) {
+            for (const auto &[relationId, ringIndex] : relationIds) {
+                relationRings[relationId][ringIndex] = wayId;
+            }
+        }
+        std::unordered_map<osmium::object_id_type, ChangeState::Relation> relations;
+        for (const auto &[relationId, rings] : relationRings) {
+            for (const auto &ring : rings) {
+                relations[relationId].outerWays.push_back(ring.second);
+            }
+        }
+        for (const auto &[nodeId, relationIds] : relationshipData.node2Relationships) {
+            for (auto relationId : relationIds) {
+                relations[relationId].nodes.emplace_back(nodeId, relationshipData.node2Roles.at(nodeId));
+            }
+        }
+        for (auto &[relationId, relation] : relations) {
+            if (auto it = relationshipData.id2Tags.find(relationId); it != relationshipData.id2Tags.end()) {
+                relation.tags = it->second;
+            }
+            state->setRelation(relationId, std::move(relation));
+        }
+
+        for (const auto &[id, route] : routes) {
+            state->routeIds.insert(id);
+            state->routeTags[id] = loaded.wayTags.at(id);
+        }
+        for (const auto &area : areas) {
+            state->areaIds.insert(area.first);
+        }
+        changeState_ = std::move(state);
+
         return std::make_pair(routes, areas);
 
     } catch (const std::exception &e) {
@@ -401,3 +1653,100 @@ std::optional<OSMLoader::OSMData> OSMLoader::getData(const CoordinateBounds &bou
 
     return std::nullopt;
 }
+
+std::optional<OSMLoader::OSMChanges> OSMLoader::applyChanges(const std::string &changeFilepath) {
+    if (!changeState_) {
+        std::cerr << "Changes can only be applied after loading data." << std::endl;
+        return std::nullopt;
+    }
+    auto &state = *changeState_;
+
+    ChangeHandler changeHandler(tagKeys_, routeFilter_, areaFilter_);
+    try {
+        osmium::io::Reader reader{osmium::io::File{changeFilepath}};
+        osmium::apply(reader, changeHandler);
+        reader.close();
+    } catch (const std::exception &e) {
+        std::cerr << "Could not read " << changeFilepath << ": " << e.what() << std::endl;
+        return std::nullopt;
+    }
+
+    std::unordered_set<osmium::object_id_type> touchedWays;
+    std::unordered_set<osmium::object_id_type> touchedRelations;
+
+    // Relations first, so that the way updates below know which ways are
+    // outer ways of an area
+    for (auto &[relationId, change] : changeHandler.relations) {
+        if (state.relations.count(relationId) > 0) {
+            touchedWays.insert(state.relations.at(relationId).outerWays.begin(),
+                               state.relations.at(relationId).outerWays.end());
+        }
+        if (change.deleted || !change.isArea) {
+            state.eraseRelation(relationId);
+        } else {
+            touchedWays.insert(change.outerWays.begin(), change.outerWays.end());
+            ChangeState::Relation relation{std::move(change.outerWays), std::move(change.nodes),
+                                           std::move(change.tags)};
+            state.setRelation(relationId, std::move(relation));
+        }
+        touchedRelations.insert(relationId);
+    }
+
+    for (auto &[wayId, change] : changeHandler.ways) {
+        if (change.deleted || !(change.isRoute || state.way2Relations.count(wayId) > 0)) {
+            state.eraseWayNodes(wayId);
+        } else {
+            state.setWayNodes(wayId, std::move(change.nodes));
+        }
+        if (change.isRoute) {
+            state.routeTags[wayId] = std::move(change.tags);
+        } else {
+            state.routeTags.erase(wayId);
+        }
+        touchedWays.insert(wayId);
+    }
+
+    for (const auto &[nodeId, location] : changeHandler.nodes) {
+        const bool referenced = state.node2Ways.count(nodeId) > 0 || state.node2Relations.count(nodeId) > 0;
+        const bool inBounds = referenced && location.valid() && state.loadBounds.contains(location);
+        state.setLocation(nodeId, inBounds ? location : osmium::Location{});
+        if (auto it = state.node2Ways.find(nodeId); it != state.node2Ways.end()) {
+            touchedWays.insert(it->second.begin(), it->second.end());
+        }
+        if (auto it = state.node2Relations.find(nodeId); it != state.node2Relations.end()) {
+            touchedRelations.insert(it->second.begin(), it->second.end());
+        }
+    }
+
+    OSMChanges changes;
+    for (auto wayId : touchedWays) {
+        if (auto it = state.way2Relations.find(wayId); it != state.way2Relations.end()) {
+            touchedRelations.insert(it->second.begin(), it->second.end());
+        }
+        if (auto route = state.buildRoute(wayId); route) {
+            state.routeIds.insert(wayId);
+            changes.routes[wayId] = std::move(*route);
+        } else if (state.routeIds.erase(wayId) > 0) {
+            changes.removedRoutes.push_back(wayId);
+        }
+    }
+    for (auto relationId : touchedRelations) {
+        if (auto area = state.buildArea(relationId); area) {
+            state.areaIds.insert(relationId);
+            changes.areas[relationId] = std::move(*area);
+        } else if (state.areaIds.erase(relationId) > 0) {
+            changes.removedAreas.push_back(relationId);
+        }
+    }
+
+    std::shared_ptr<MapStore> store;
+    {
+        std::lock_guard<std::mutex> lock(residentMutex_);
+        store = residentStore_;
+    }
+    if (store) {
+        store->Update(changes);
+    }
+
+    return changes;
+}
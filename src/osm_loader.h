@@ -1,26 +1,62 @@
 #pragma once
 
+#include "tag_filter.h"
+
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/location.hpp>
 #include <osmium/osm/types.hpp>
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 constexpr auto NAME_TAG = "name";
 constexpr auto HIGHWAY_TAG = "highway";
 constexpr auto TYPE_TAG = "type";
-constexpr auto BOUNDARY_VALUE = "boundary";
-constexpr auto BUILDING_TAG = "building";
-constexpr auto AREA_TAG = "area";
-constexpr auto YES_VALUE = "yes";
+
+class MapStore;
 
 class OSMLoader {
   public:
     OSMLoader() = default;
 
     void setFilepath(const std::string &filepath) { filepath_ = filepath; }
+    // Tags which are copied into Route_t::tags in addition to name and highway
+    void addTagKeys(const std::vector<std::string> &keys);
+    // Worker threads of the load passes: 0 uses all cores, a negative number
+    // leaves that many cores free
+    void setThreadCount(int threads) { threadCount_ = threads; }
+    // Nodes up to `degrees` outside of the bounds are loaded, so that ways
+    // crossing the edge of the bounds are clipped exactly
+    void setBoundsMargin(double degrees) { boundsMargin_ = degrees; }
+    // How node locations are resolved: in memory maps of the node ids of all
+    // ways (fast), or a memory mapped file holding the locations of the nodes
+    // within the bounds (for inputs larger than memory). Auto picks the file
+    // when the input is large compared to the physical memory.
+    enum class NodeIndex { Auto, Memory, File };
+    void setNodeIndex(NodeIndex nodeIndex) { nodeIndex_ = nodeIndex; }
+    // Which ways are loaded as routes and which relations as areas. Ways
+    // forming the outer ring of a loaded area are kept either way.
+    void setRouteFilter(const TagFilter &filter) { routeFilter_ = filter; }
+    void setAreaFilter(const TagFilter &filter) { areaFilter_ = filter; }
+    // Load every route and area of the file on the first getData() and keep
+    // them in memory, indexed by location, so that later calls answer any
+    // bounds from memory in time proportional to the result instead of
+    // reading the file again. getData() may then be called from several
+    // threads at once.
+    void setResident(bool resident) { resident_ = resident; }
+    // Read plain .osm files with FastXmlReader, which parses the memory
+    // mapped file on all threads, instead of libosmium. Other formats are
+    // read by libosmium either way.
+    void setFastXml(bool fastXml) { fastXml_ = fastXml; }
+    // Print the node, way and relation counts, the highway values with
+    // their width/surface combinations and the most common relation tags
+    // of the file (XML or PBF), as src/analyze_osm.py does, in one pass on
+    // all threads
     bool Count();
 
     // Using definition of Location:
@@ -36,6 +72,9 @@ class OSMLoader {
         osmium::object_id_type id{0};
         Coordinates nodes;
         Tags tags;
+        // Clipping at the bounds can split a way: indices into nodes where
+        // another piece starts
+        std::vector<uint32_t> breaks{};
     };
     using Id2Route = std::unordered_map<osmium::object_id_type, Route_t>;
 
@@ -62,8 +101,54 @@ class OSMLoader {
      * of coordinates
      */
     using OSMData = std::pair<Id2Route, Id2Area>;
-    std::optional<OSMData> getData(const CoordinateBounds &bounds) const;
+    std::optional<OSMData> getData(const CoordinateBounds &bounds);
+    // Read `bounds` from the file and from the resident data (see
+    // setResident()) and compare the routes and areas, printing every
+    // difference
+    bool validateResident(const CoordinateBounds &bounds);
+
+    // Result of applying an OsmChange file: the routes and areas which were
+    // created or modified, and the ids of those which disappeared
+    struct OSMChanges {
+        Id2Route routes;
+        std::vector<osmium::object_id_type> removedRoutes;
+        Id2Area areas;
+        std::vector<osmium::object_id_type> removedAreas;
+    };
+    /**
+     * Apply an OsmChange diff (.osc or .osc.gz) on top of the data returned by
+     * the last getData() call.
+     *
+     * getData() keeps the node ids of the loaded ways and the locations of
+     * their nodes within the bounds, so a diff only touches the routes and
+     * areas referencing a changed object. Nodes referenced by a changed way
+     * must either be known already or be part of the diff; a way entering
+     * the bounds with nodes that are neither is only picked up on the next
+     * full load.
+     *
+     * In resident mode the diff is applied to the resident data, so later
+     * getData() calls see it, and the changes returned are not clipped.
+     */
+    std::optional<OSMChanges> applyChanges(const std::string &changeFilepath);
 
   protected:
+    struct ChangeState;
+
+    // Read the routes and areas within `bounds` from the file
+    std::optional<OSMData> load(const CoordinateBounds &bounds);
+    std::optional<OSMData> queryResident(const CoordinateBounds &bounds);
+
     std::string filepath_{};
+    std::vector<std::string> tagKeys_{NAME_TAG, HIGHWAY_TAG};
+    int threadCount_{0};
+    double boundsMargin_{0.005};
+    NodeIndex nodeIndex_{NodeIndex::Auto};
+    TagFilter routeFilter_{TagFilter::DefaultRoutes()};
+    TagFilter areaFilter_{TagFilter::DefaultAreas()};
+    std::shared_ptr<ChangeState> changeState_{};
+    bool resident_{false};
+    // loaded on first use, under residentMutex_
+    std::mutex residentMutex_{};
+    std::shared_ptr<MapStore> residentStore_{};
+    bool fastXml_{false};
 };
\ No newline at end of file
@@ -0,0 +1,67 @@
+// Command line tool which prints the object counts and tag statistics of an
+// OSM file (XML or PBF) in one parallel pass, in the format of analyze_osm.py.
+
+#include "fast_xml_reader.h"
+#include "osm_loader.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+
+namespace {
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <input.osm|input.osm.pbf> [options]\n"
+              << "  --threads=<count>           Threads used to count (default: all cores)\n"
+              << "  --fast-xml                  Parse .osm input with the parallel XML reader instead of libosmium\n"
+              << "  --validate-fast-xml         Compare every object of the parallel XML reader with libosmium\n";
+}
+
+// Value of `--name=value` or `--name value` at argv[index]
+std::optional<std::string> optionValue(int argc, char **argv, int &index, const std::string &name) {
+    const std::string argument = argv[index];
+    const std::string longName = "--" + name;
+    if (argument.rfind(longName + "=", 0) == 0) {
+        return argument.substr(longName.size() + 1);
+    }
+    if (argument == longName && index + 1 < argc) {
+        return std::string(argv[++index]);
+    }
+    return std::nullopt;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string inputPath;
+    int threadCount = 0;
+    bool fastXml = false;
+    bool validateFastXml = false;
+
+    for (int ii = 1; ii < argc; ++ii) {
+        if (auto value = optionValue(argc, argv, ii, "threads")) {
+            threadCount = std::atoi(value->c_str());
+        } else if (std::string(argv[ii]) == "--fast-xml") {
+            fastXml = true;
+        } else if (std::string(argv[ii]) == "--validate-fast-xml") {
+            validateFastXml = true;
+        } else if (argv[ii][0] == '-' || !inputPath.empty()) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            inputPath = argv[ii];
+        }
+    }
+    if (inputPath.empty()) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (validateFastXml) {
+        return FastXmlReader::Validate(inputPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    OSMLoader loader;
+    loader.setFilepath(inputPath);
+    loader.setThreadCount(threadCount);
+    loader.setFastXml(fastXml);
+    return loader.Count() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
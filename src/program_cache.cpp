@@ -0,0 +1,111 @@
+#include "program_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+// FNV-1a, good enough to tell shader sources apart
+void HashBytes(uint64_t &hash, const char *data, size_t size) {
+    for (size_t ii = 0; ii < size; ++ii) {
+        hash ^= static_cast<unsigned char>(data[ii]);
+        hash *= 1099511628211ull;
+    }
+}
+
+void HashString(uint64_t &hash, const char *str) {
+    if (str) {
+        HashBytes(hash, str, std::char_traits<char>::length(str));
+    }
+    // separator so that ("ab", "c") and ("a", "bc") differ
+    HashBytes(hash, "", 1);
+}
+
+} // namespace
+
+std::string ProgramBinaryCache::Key(const std::vector<std::string> &sources) {
+    uint64_t hash = 14695981039346656037ull;
+    HashString(hash, reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+    HashString(hash, reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+    HashString(hash, reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+    for (const auto &source : sources) {
+        HashString(hash, source.c_str());
+    }
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+std::string ProgramBinaryCache::Path(const std::string &key) const { return directory_ + "/" + key + ".bin"; }
+
+GLuint ProgramBinaryCache::Load(const std::string &key) const {
+    if (!IsEnabled()) {
+        return 0;
+    }
+
+    std::ifstream file(Path(key), std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+
+    GLenum format = 0;
+    if (!file.read(reinterpret_cast<char *>(&format), sizeof(format))) {
+        return 0;
+    }
+    // istreambuf_iterator reads the buffer directly and never sets eofbit,
+    // so a truncated file shows up as an empty binary only
+    std::vector<char> binary{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    if (binary.empty()) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        // Binary from another driver version, recompile from source instead
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void ProgramBinaryCache::Store(const std::string &key, GLuint program) const {
+    if (!IsEnabled()) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::ofstream file(Path(key), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Could not write program binary cache " << Path(key) << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char *>(&format), sizeof(format));
+    file.write(binary.data(), binary.size());
+    file.close();
+
+    // Check that the entry restores a linked program, so that a cache which
+    // never hits does not go unnoticed
+    if (GLuint restored = Load(key)) {
+        glDeleteProgram(restored);
+    } else {
+        std::cerr << "Program binary cache " << Path(key) << " does not load back, removing it" << std::endl;
+        std::remove(Path(key).c_str());
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * On-disk cache of linked program binaries (glGetProgramBinary) to skip the
+ * shader compilation at startup.
+ *
+ * Entries are keyed by a hash of the shader sources together with the GL
+ * renderer and version strings, since binaries are only valid for the driver
+ * that produced them. A driver may still reject a binary (e.g. after an
+ * update), in which case Load fails and the caller compiles from source.
+ */
+class ProgramBinaryCache {
+  public:
+    ProgramBinaryCache() = default;
+    explicit ProgramBinaryCache(const std::string &directory) : directory_(directory) {}
+
+    // Program binaries are core in 4.1, 3.3 contexts may lack them
+    bool IsEnabled() const { return !directory_.empty() && GLEW_ARB_get_program_binary; }
+
+    // Key for the given shader sources on the current GL context
+    static std::string Key(const std::vector<std::string> &sources);
+
+    // Returns a linked program created from the cached binary, or 0
+    GLuint Load(const std::string &key) const;
+
+    // Store the binary of a program linked with
+    // GL_PROGRAM_BINARY_RETRIEVABLE_HINT set, and check that Load restores
+    // a linked program from it
+    void Store(const std::string &key, GLuint program) const;
+
+  protected:
+    std::string Path(const std::string &key) const;
+
+    std::string directory_{};
+};
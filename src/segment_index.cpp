@@ -0,0 +1,182 @@
+#include "segment_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+// Aim for a couple of segments per cell
+constexpr double SEGMENTS_PER_CELL = 2.0;
+constexpr double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+} // namespace
+
+void SegmentIndex::Build(const OSMLoader::Id2Route &routes) {
+    segments_.clear();
+    routeIds_.clear();
+    routeSegmentCounts_.clear();
+    routeIndices_.clear();
+    removedSegments_ = 0;
+
+    // Local frame around the center of the data
+    double minLon = std::numeric_limits<double>::max();
+    double minLat = std::numeric_limits<double>::max();
+    double maxLon = std::numeric_limits<double>::lowest();
+    double maxLat = std::numeric_limits<double>::lowest();
+    for (const auto &[id, route] : routes) {
+        for (const auto &node : route.nodes) {
+            minLon = std::min(minLon, node.lon());
+            minLat = std::min(minLat, node.lat());
+            maxLon = std::max(maxLon, node.lon());
+            maxLat = std::max(maxLat, node.lat());
+        }
+    }
+    if (minLon > maxLon) {
+        minLon = maxLon = minLat = maxLat = 0.0;
+    }
+    originLon_ = 0.5 * (minLon + maxLon);
+    originLat_ = 0.5 * (minLat + maxLat);
+    lonScale_ = std::cos(originLat_ * DEG_TO_RAD);
+
+    for (const auto &[id, route] : routes) {
+        routeIndices_[id] = static_cast<uint32_t>(routeIds_.size());
+        routeIds_.push_back(id);
+        const size_t count = segments_.size();
+        AddSegments(route, segments_);
+        routeSegmentCounts_.push_back(static_cast<uint32_t>(segments_.size() - count));
+    }
+
+    Rebuild();
+}
+
+void SegmentIndex::Insert(const OSMLoader::Route_t &route) {
+    Remove(route.id);
+
+    routeIndices_[route.id] = static_cast<uint32_t>(routeIds_.size());
+    routeIds_.push_back(route.id);
+    const size_t count = segments_.size();
+    AddSegments(route, segments_);
+    routeSegmentCounts_.push_back(static_cast<uint32_t>(segments_.size() - count));
+    for (size_t ii = count; ii < segments_.size(); ++ii) {
+        grid_.Insert(static_cast<uint32_t>(ii), SegmentBox(segments_[ii]));
+    }
+
+    if (grid_.ShouldRebuild(removedSegments_, segments_.size())) {
+        Rebuild();
+    }
+}
+
+void SegmentIndex::Remove(osmium::object_id_type id) {
+    auto it = routeIndices_.find(id);
+    if (it == routeIndices_.end()) {
+        return;
+    }
+    routeIds_[it->second] = 0;
+    removedSegments_ += routeSegmentCounts_[it->second];
+    routeIndices_.erase(it);
+
+    if (grid_.ShouldRebuild(removedSegments_, segments_.size())) {
+        Rebuild();
+    }
+}
+
+void SegmentIndex::AddSegments(const OSMLoader::Route_t &route, std::vector<Segment> &segments) {
+    const auto routeIndex = static_cast<uint32_t>(routeIndices_.at(route.id));
+    auto project = [this](const osmium::Location &location, float &x, float &y) {
+        x = static_cast<float>((location.lon() - originLon_) * lonScale_);
+        y = static_cast<float>(location.lat() - originLat_);
+    };
+
+    if (route.nodes.size() == 1) {
+        // keep single nodes pickable as a degenerate segment
+        Segment segment{};
+        project(route.nodes[0], segment.x0, segment.y0);
+        project(route.nodes[0], segment.x1, segment.y1);
+        segment.route = routeIndex;
+        segments.push_back(segment);
+        return;
+    }
+    auto nextBreak = route.breaks.begin();
+    for (size_t ii = 1; ii < route.nodes.size(); ++ii) {
+        // no segment between the pieces of a clipped route
+        if (nextBreak != route.breaks.end() && ii == *nextBreak) {
+            ++nextBreak;
+            continue;
+        }
+        Segment segment{};
+        project(route.nodes[ii - 1], segment.x0, segment.y0);
+        project(route.nodes[ii], segment.x1, segment.y1);
+        segment.route = routeIndex;
+        segments.push_back(segment);
+    }
+}
+
+void SegmentIndex::Rebuild() {
+    // Drop the segments of removed routes and renumber the remaining routes
+    std::vector<uint32_t> remap(routeIds_.size(), 0);
+    std::vector<osmium::object_id_type> routeIds;
+    std::vector<uint32_t> routeSegmentCounts;
+    for (size_t ii = 0; ii < routeIds_.size(); ++ii) {
+        if (routeIds_[ii] != 0) {
+            remap[ii] = static_cast<uint32_t>(routeIds.size());
+            routeIndices_[routeIds_[ii]] = remap[ii];
+            routeIds.push_back(routeIds_[ii]);
+            routeSegmentCounts.push_back(routeSegmentCounts_[ii]);
+        }
+    }
+
+    std::vector<Segment> segments;
+    segments.reserve(segments_.size() - std::min(removedSegments_, segments_.size()));
+    for (const auto &segment : segments_) {
+        if (routeIds_[segment.route] != 0) {
+            segments.push_back(segment);
+            segments.back().route = remap[segment.route];
+        }
+    }
+
+    segments_ = std::move(segments);
+    routeIds_ = std::move(routeIds);
+    routeSegmentCounts_ = std::move(routeSegmentCounts);
+    removedSegments_ = 0;
+
+    grid_.Build(segments_.size(), [this](uint32_t ii) { return SegmentBox(segments_[ii]); }, SEGMENTS_PER_CELL);
+}
+
+float SegmentIndex::DistanceSquared(const Segment &segment, float x, float y) {
+    const float dx = segment.x1 - segment.x0;
+    const float dy = segment.y1 - segment.y0;
+    const float lengthSquared = dx * dx + dy * dy;
+    float t = 0.0f;
+    if (lengthSquared > 0.0f) {
+        t = std::clamp(((x - segment.x0) * dx + (y - segment.y0) * dy) / lengthSquared, 0.0f, 1.0f);
+    }
+    const float px = segment.x0 + t * dx - x;
+    const float py = segment.y0 + t * dy - y;
+    return px * px + py * py;
+}
+
+std::optional<SegmentIndex::Hit> SegmentIndex::Nearest(const osmium::Location &location, double maxDistance) const {
+    const float x = static_cast<float>((location.lon() - originLon_) * lonScale_);
+    const float y = static_cast<float>(location.lat() - originLat_);
+    const float radius = static_cast<float>(maxDistance);
+
+    float bestDistance = radius * radius;
+    uint32_t bestRoute = std::numeric_limits<uint32_t>::max();
+    auto test = [&](const Segment &segment) {
+        if (routeIds_[segment.route] == 0) {
+            return;
+        }
+        if (float distance = DistanceSquared(segment, x, y); distance <= bestDistance) {
+            bestDistance = distance;
+            bestRoute = segment.route;
+        }
+    };
+
+    grid_.Query({x - radius, y - radius, x + radius, y + radius},
+                [this](uint32_t ii) { return SegmentBox(segments_[ii]); },
+                [&](uint32_t ii) { test(segments_[ii]); });
+
+    if (bestRoute == std::numeric_limits<uint32_t>::max()) {
+        return std::nullopt;
+    }
+    return Hit{routeIds_[bestRoute], std::sqrt(static_cast<double>(bestDistance))};
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "osm_loader.h"
+#include "uniform_grid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Uniform grid over the segments of all routes, for hit-testing.
+ *
+ * Segments are stored in a local planar frame (longitude scaled by the cosine
+ * of the latitude at the center of the data) so that distances are isotropic,
+ * in degrees of latitude. The UniformGrid is sized for a handful of segments
+ * per cell, so a query only touches the few cells around the query point.
+ *
+ * Removed routes are tombstoned and the segments of added routes are inserted
+ * into the cells of the grid; it is rebuilt once either grows too large.
+ */
+class SegmentIndex {
+  public:
+    struct Hit {
+        osmium::object_id_type id;
+        // distance to the closest segment, in degrees of latitude
+        double distance;
+    };
+
+    void Build(const OSMLoader::Id2Route &routes);
+    void Insert(const OSMLoader::Route_t &route);
+    void Remove(osmium::object_id_type id);
+
+    // Closest route within `maxDistance` (degrees of latitude) of `location`
+    std::optional<Hit> Nearest(const osmium::Location &location, double maxDistance) const;
+
+  protected:
+    struct Segment {
+        float x0, y0, x1, y1;
+        uint32_t route;
+    };
+
+    void AddSegments(const OSMLoader::Route_t &route, std::vector<Segment> &segments);
+    void Rebuild();
+    static UniformGrid::Box SegmentBox(const Segment &segment) {
+        return {std::min(segment.x0, segment.x1), std::min(segment.y0, segment.y1), std::max(segment.x0, segment.x1),
+                std::max(segment.y0, segment.y1)};
+    }
+    static float DistanceSquared(const Segment &segment, float x, float y);
+
+    // local frame
+    double originLon_{0.0};
+    double originLat_{0.0};
+    double lonScale_{1.0};
+
+    std::vector<Segment> segments_{};
+    UniformGrid grid_{};
+
+    // route index -> id; 0 marks a removed route
+    std::vector<osmium::object_id_type> routeIds_{};
+    std::vector<uint32_t> routeSegmentCounts_{};
+    std::unordered_map<osmium::object_id_type, uint32_t> routeIndices_{};
+    size_t removedSegments_{0};
+};
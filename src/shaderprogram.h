@@ -2,71 +2,227 @@
 
 #include <GL/glew.h>
 
-#include <optional>
-#include <sstream>
-#include <string>
-
-struct ShaderProgram {
+#include "program_cache.h"
 
-    void Build() {
-        lastBuildLog_ = {};
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * A linked GL program built from any combination of compute, vertex, geometry
+ * and fragment stages.
+ *
+ * After linking, the locations of all active uniforms and the binding points
+ * of all shader storage blocks are resolved once and cached, so per-frame code
+ * never has to ask the driver for them by name.
+ */
+class ShaderProgram {
+  public:
+    ShaderProgram() = default;
+    ~ShaderProgram() { Release(); }
+
+    ShaderProgram(const ShaderProgram &) = delete;
+    ShaderProgram &operator=(const ShaderProgram &) = delete;
+    ShaderProgram(ShaderProgram &&other) noexcept { *this = std::move(other); }
+    ShaderProgram &operator=(ShaderProgram &&other) noexcept {
+        std::swap(program_, other.program_);
+        std::swap(stages_, other.stages_);
+        std::swap(uniforms_, other.uniforms_);
+        std::swap(storageBlocks_, other.storageBlocks_);
+        std::swap(lastBuildLog_, other.lastBuildLog_);
+        return *this;
+    }
 
-        unsigned int vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource_.c_str());
-        unsigned int fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource_.c_str());
+    void SetSource(GLenum shaderType, const std::string &source) { stages_.emplace_back(shaderType, source); }
 
-        shaderProgram_ = glCreateProgram();
-        glAttachShader(shaderProgram_.value(), vertexShader);
-        glAttachShader(shaderProgram_.value(), fragmentShader);
+    // Compile and link all stages, or restore the program from `cache` when
+    // possible. Returns false on failure; BuildLog() then holds the complete
+    // compiler and linker output.
+    bool Build(const ProgramBinaryCache &cache = ProgramBinaryCache()) {
+        lastBuildLog_.clear();
+        Release();
 
-        unsigned int geometryShader = 0;
-        if (geometryShaderSource_.size() > 0) {
-            geometryShader = CompileShader(GL_GEOMETRY_SHADER, geometryShaderSource_.c_str());
-            glAttachShader(shaderProgram_.value(), geometryShader);
+        std::vector<std::string> keySources;
+        for (const auto &[type, source] : stages_) {
+            keySources.push_back(std::to_string(type));
+            keySources.push_back(source);
+        }
+        const auto cacheKey = ProgramBinaryCache::Key(keySources);
+
+        GLuint program = cache.Load(cacheKey);
+        if (program == 0) {
+            program = CompileAndLink();
+            if (program == 0) {
+                return false;
+            }
+            cache.Store(cacheKey, program);
         }
 
-        glLinkProgram(shaderProgram_.value());
+        program_ = program;
+        ResolveLocations();
+        return true;
+    }
 
-        // check linking errors
-        int success;
+    bool IsValid() const { return program_ != 0; }
+    GLuint Id() const { return program_; }
+    void Use() const { glUseProgram(program_); }
 
-        glGetProgramiv(shaderProgram_.value(), GL_LINK_STATUS, &success);
+    // Location of an active uniform, or -1 (ignored by glUniform*) if the
+    // uniform does not exist or was optimized away
+    GLint Uniform(const std::string &name) const {
+        auto it = uniforms_.find(name);
+        return it != uniforms_.end() ? it->second : -1;
+    }
 
-        if (!success) {
-            char infoLog[512];
-            glGetProgramInfoLog(shaderProgram_.value(), 512, nullptr, infoLog);
-            lastBuildLog_ << "Shader program linking failed: " << infoLog;
+    // Binding point of a shader storage block, from its layout(binding = N)
+    GLuint StorageBlockBinding(const std::string &name) const {
+        auto it = storageBlocks_.find(name);
+        return it != storageBlocks_.end() ? it->second : GL_INVALID_INDEX;
+    }
+
+    // Bind `buffer` to the binding point of the storage block `name`, if the
+    // program uses it
+    void BindStorageBlock(const std::string &name, GLuint buffer) const {
+        if (GLuint binding = StorageBlockBinding(name); binding != GL_INVALID_INDEX) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
         }
+    }
 
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+    const std::string &BuildLog() const { return lastBuildLog_; }
 
-        if (geometryShaderSource_.size() > 0) {
-            glDeleteShader(geometryShader);
+    // Delete the GL program, e.g. before the context goes away
+    void Release() {
+        // GL function pointers are not loaded before GLEW initialization
+        if (program_ != 0) {
+            glDeleteProgram(program_);
         }
+        program_ = 0;
+        uniforms_.clear();
+        storageBlocks_.clear();
     }
 
-    unsigned int CompileShader(unsigned int shaderType, const char *shaderSource) {
-        unsigned int shader = glCreateShader(shaderType);
-        glShaderSource(shader, 1, &shaderSource, nullptr);
+  protected:
+    GLuint CompileShader(GLenum shaderType, const std::string &shaderSource) {
+        GLuint shader = glCreateShader(shaderType);
+        const char *source = shaderSource.c_str();
+        glShaderSource(shader, 1, &source, nullptr);
         glCompileShader(shader);
 
-        int success;
+        GLint success = GL_FALSE;
         glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-
         if (!success) {
-            char infoLog[512];
-            glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-            lastBuildLog_ << "Shader compilation failed: " << infoLog;
+            GLint length = 0;
+            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+            std::string infoLog(std::max(length, 1), '\0');
+            glGetShaderInfoLog(shader, length, nullptr, infoLog.data());
+            lastBuildLog_ += "Shader compilation failed (" + StageName(shaderType) + "): " + infoLog.c_str() + "\n";
+            glDeleteShader(shader);
+            return 0;
         }
 
         return shader;
     }
 
-    std::optional<unsigned int> shaderProgram_ = std::nullopt;
+    GLuint CompileAndLink() {
+        std::vector<GLuint> shaders;
+        bool success = !stages_.empty();
+        for (const auto &[type, source] : stages_) {
+            GLuint shader = CompileShader(type, source);
+            success = success && shader != 0;
+            if (shader != 0) {
+                shaders.push_back(shader);
+            }
+        }
+
+        GLuint program = 0;
+        if (success) {
+            program = glCreateProgram();
+            for (GLuint shader : shaders) {
+                glAttachShader(program, shader);
+            }
+            if (GLEW_ARB_get_program_binary) {
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+            glLinkProgram(program);
+
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if (!linked) {
+                GLint length = 0;
+                glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+                std::string infoLog(std::max(length, 1), '\0');
+                glGetProgramInfoLog(program, length, nullptr, infoLog.data());
+                lastBuildLog_ += std::string("Shader program linking failed: ") + infoLog.c_str() + "\n";
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+
+        for (GLuint shader : shaders) {
+            glDeleteShader(shader);
+        }
+        return program;
+    }
+
+    void ResolveLocations() {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(program_, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(std::max(maxLength, 1));
+        for (GLint ii = 0; ii < count; ++ii) {
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program_, ii, maxLength, nullptr, &size, &type, name.data());
+            GLint location = glGetUniformLocation(program_, name.data());
+            if (location < 0) {
+                // member of a uniform block
+                continue;
+            }
+            std::string uniformName = name.data();
+            // arrays are reported as "name[0]", allow looking them up as "name"
+            if (auto pos = uniformName.rfind("[0]"); pos != std::string::npos && pos + 3 == uniformName.size()) {
+                uniforms_[uniformName.substr(0, pos)] = location;
+            }
+            uniforms_[uniformName] = location;
+        }
 
-    std::string vertexShaderSource_{};
-    std::string geometryShaderSource_{};
-    std::string fragmentShaderSource_{};
+        // Storage blocks need program interface queries (GL 4.3)
+        if (!GLEW_ARB_program_interface_query) {
+            return;
+        }
+        glGetProgramInterfaceiv(program_, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(program_, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &maxLength);
+        name.resize(std::max(maxLength, 1));
+        for (GLint ii = 0; ii < count; ++ii) {
+            glGetProgramResourceName(program_, GL_SHADER_STORAGE_BLOCK, ii, maxLength, nullptr, name.data());
+            const GLenum property = GL_BUFFER_BINDING;
+            GLint binding = 0;
+            glGetProgramResourceiv(program_, GL_SHADER_STORAGE_BLOCK, ii, 1, &property, 1, nullptr, &binding);
+            storageBlocks_[name.data()] = static_cast<GLuint>(binding);
+        }
+    }
+
+    static std::string StageName(GLenum shaderType) {
+        switch (shaderType) {
+        case GL_COMPUTE_SHADER:
+            return "compute";
+        case GL_VERTEX_SHADER:
+            return "vertex";
+        case GL_GEOMETRY_SHADER:
+            return "geometry";
+        case GL_FRAGMENT_SHADER:
+            return "fragment";
+        default:
+            return "unknown";
+        }
+    }
 
-    std::stringstream lastBuildLog_;
+    GLuint program_{0};
+    std::vector<std::pair<GLenum, std::string>> stages_{};
+    std::unordered_map<std::string, GLint> uniforms_{};
+    std::unordered_map<std::string, GLuint> storageBlocks_{};
+    std::string lastBuildLog_{};
 };
@@ -1,12 +1,17 @@
 #version 430 core
-layout(local_size_x = 128) in;
-
-struct InputVertex {
-    float lon;
-    float lat;
-    float r;
-    float g;
-    float b;
+// Invocations per workgroup, set by the application when building the program
+#ifndef WORKGROUP_SIZE
+#define WORKGROUP_SIZE 128
+#endif
+layout(local_size_x = WORKGROUP_SIZE) in;
+
+// Must match StyleSheet::GpuStyle
+struct Style {
+    vec4 color;
+    float width;
+    float minZoom;
+    int zOrder;
+    float _pad;
 };
 
 struct OutputVertex {
@@ -15,8 +20,14 @@ struct OutputVertex {
     vec4 color;
 };
 
-layout(std430, binding = 1) readonly buffer InputVBO {
-    float inputData[];
+// The input as structure of arrays: positions per node, style ids and
+// indices (node << 2 | flags) per slot. Routes meeting at a node share it.
+layout(std430, binding = 1) readonly buffer InputPositions {
+    vec2 positions[];
+};
+
+layout(std430, binding = 6) readonly buffer InputStyleIds {
+    uint styleIds[];
 };
 
 layout(std430, binding = 2) readonly buffer InputEBO {
@@ -31,70 +42,93 @@ layout(std430, binding = 4) writeonly buffer OutputEBO {
     uint outputIndices[];
 };
 
+layout(std430, binding = 5) readonly buffer StyleTable {
+    Style styles[];
+};
+
+#ifdef CULL_ROUTES
+// Written by cull.comp.glsl: the input positions of the indices of the
+// visible routes, each route in one piece, and their count
+layout(std430, binding = 7) readonly buffer VisibleSlots {
+    uint visibleSlots[];
+};
+
+layout(std430, binding = 8) readonly buffer CullResult {
+    uint numGroupsX;
+    uint numGroupsY;
+    uint numGroupsZ;
+    uint visibleSlotCount;
+};
+#endif
+
 uniform vec4 uBounds;
 uniform vec2 uScreenSize;
 uniform uint uNumIndices;
-uniform float uWidth;
+uniform float uZoom;
 
 const uint INVALID_IDX = uint(-1);
 
-vec2 mapToScreen(float lon, float lat) {
-    float x = (lon - uBounds.x) / uBounds.z;
-    float y = (lat - uBounds.y) / uBounds.w;
+const uint BEGIN_BIT = 1 << 0;
+const uint END_BIT = 1 << 1;
+
+// The indices of the workgroup plus one on either side, and the screen
+// positions of their vertices. Every vertex is read from the input once per
+// workgroup; the neighbours of an index come from here.
+shared uint tileIndices[WORKGROUP_SIZE + 2];
+shared vec2 tilePositions[WORKGROUP_SIZE + 2];
+
+vec2 mapToScreen(vec2 lonLat) {
+    float x = (lonLat.x - uBounds.x) / uBounds.z;
+    float y = (lonLat.y - uBounds.y) / uBounds.w;
     return vec2(x * uScreenSize.x, y * uScreenSize.y);
 }
 
-InputVertex fetchVertex(uint index) {
-    uint base = index * 5;
-    InputVertex v;
-    v.lon = inputData[base];
-    v.lat = inputData[base + 1];
-    v.r = inputData[base + 2];
-    v.g = inputData[base + 3];
-    v.b = inputData[base + 4];
-    return v;
+// The number of indices to extrude, and the input position of the k-th
+uint indexCount() {
+#ifdef CULL_ROUTES
+    return visibleSlotCount;
+#else
+    return uNumIndices;
+#endif
 }
 
-uint getIndex(uint id) {
-  if(id >= uNumIndices) return INVALID_IDX;
-  return indices[id] >> 2;
+uint inputId(uint k) {
+#ifdef CULL_ROUTES
+    return visibleSlots[k];
+#else
+    return k;
+#endif
 }
 
-const uint BEGIN_BIT = 1 << 0;
-const uint END_BIT = 1 << 1;
-
-bool isBeginning(uint id) {
-  if(id >= uNumIndices) return true;
-  return (indices[id] & BEGIN_BIT) == BEGIN_BIT;
-}
-bool isEnd(uint id) {
-  if(id >= uNumIndices) return true;
-  return (indices[id] & END_BIT) == END_BIT;
+// Indices past the end are strip ends without a vertex. Neighbours in the
+// culled list belong to the same route unless the flags end the strip.
+void loadTile(uint tileId, uint k) {
+    if (k < indexCount()) {
+        uint index = indices[inputId(k)];
+        tileIndices[tileId] = index;
+        tilePositions[tileId] = mapToScreen(positions[index >> 2]);
+    } else {
+        tileIndices[tileId] = BEGIN_BIT | END_BIT;
+        tilePositions[tileId] = vec2(0.0);
+    }
 }
 
-void main() {
-    uint id = gl_GlobalInvocationID.x;
-    if (id >= uNumIndices) return;
-
-    uint idx = getIndex(id);
+// Extrude index `id`, which is at `tileId` of the loaded tile
+void extrude(uint id, uint tileId) {
+    uint index = tileIndices[tileId];
     // determine if this point is the beginning or end of a strip
-    const bool beginPt = isBeginning(id);
-    const bool endPt = isEnd(id);
+    const bool beginPt = (index & BEGIN_BIT) == BEGIN_BIT;
+    const bool endPt = (index & END_BIT) == END_BIT;
 
-    InputVertex v = fetchVertex(idx);
-    vec2 p = mapToScreen(v.lon, v.lat);
+    vec2 p = tilePositions[tileId];
 
     vec2 dir = vec2(0.0);
     if (!beginPt) {
-        uint idxPrev = getIndex(id-1);
-        InputVertex v_prev = fetchVertex(idxPrev);
-        vec2 p_prev = mapToScreen(v_prev.lon, v_prev.lat);
+        vec2 p_prev = tilePositions[tileId - 1];
         dir += normalize((p - p_prev));
     }
-    if (!endPt) {    
-        uint idxNext = getIndex(id+1);
-        InputVertex v_next = fetchVertex(idxNext);
-        vec2 p_next = mapToScreen(v_next.lon, v_next.lat);
+    if (!endPt) {
+        vec2 p_next = tilePositions[tileId + 1];
         dir += normalize((p_next - p));
     }
 
@@ -104,11 +138,19 @@ void main() {
         normal = vec2(-dir.y, dir.x);
     }
 
-    vec4 color = vec4(v.r, v.g, v.b, 1.0);
+    Style style = styles[styleIds[id]];
+    // all vertices of a route share its style, so hiding them all drops
+    // every segment of the route
+    const bool visible = uZoom >= style.minZoom;
+
+    vec4 color = style.color;
     // vec4 color = vec4(abs(normal), 0.0, 1.0); // color;
     // vec4 color = vec4(beginPt?0.0:1.0, endPt?0.0:1.0, 0.0, 1.0);
 
-    float halfWidth = uWidth * 0.5;
+    // Output vertices are per index, not per node: routes sharing a node
+    // have their own normals and widths there
+
+    float halfWidth = style.width * 0.5;
     uint vertIdx = id * 2;
     outputVertices[vertIdx].pos = p + normal * halfWidth;
     outputVertices[vertIdx]._pad = vec2(0.0);
@@ -118,9 +160,8 @@ void main() {
     outputVertices[vertIdx + 1].color = color;
 
     uint base = id * 6;
-    if (!endPt) {
-        uint idxNext = getIndex(id+1);
-        uint nextVertIdx = idxNext * 2;
+    if (!endPt && visible) {
+        uint nextVertIdx = (id + 1) * 2;
         outputIndices[base + 0] = vertIdx;
         outputIndices[base + 1] = vertIdx + 1;
         outputIndices[base + 2] = nextVertIdx;
@@ -135,4 +176,31 @@ void main() {
         outputIndices[base + 4] = INVALID_IDX;
         outputIndices[base + 5] = INVALID_IDX;
     }
-}
\ No newline at end of file
+}
+
+void main() {
+    // Without culling there is a workgroup per tile. The culled list is
+    // covered by at most uMaxGroups workgroups of the cull pass, each taking
+    // every gl_NumWorkGroups.x-th tile; the loop bounds are the same for the
+    // whole workgroup, as the barriers require.
+    const uint count = indexCount();
+    for (uint first = gl_WorkGroupID.x * WORKGROUP_SIZE; first < count; first += gl_NumWorkGroups.x * WORKGROUP_SIZE) {
+        uint k = first + gl_LocalInvocationID.x;
+        // The predecessor of index 0 wraps around and loads a strip end
+        loadTile(gl_LocalInvocationID.x + 1, k);
+        if (gl_LocalInvocationID.x == 0) {
+            loadTile(0, k - 1);
+        }
+        if (gl_LocalInvocationID.x == WORKGROUP_SIZE - 1) {
+            loadTile(WORKGROUP_SIZE + 1, k + 1);
+        }
+        memoryBarrierShared();
+        barrier();
+
+        if (k < count) {
+            extrude(inputId(k), gl_LocalInvocationID.x + 1);
+        }
+        // the next tile overwrites this one
+        barrier();
+    }
+}
@@ -3,8 +3,11 @@ layout(location = 0) in vec2 aPos;
 layout(location = 1) in vec4 aColor;
 out vec4 vColor;
 uniform vec2 uScreenSize;
+// scale.xy, offset.xy from the extruded view to the current view, in pixels
+uniform vec4 uTransform;
 void main() {
-    vec2 ndc = (aPos / uScreenSize) * 2.0 - 1.0;
+    vec2 pos = aPos * uTransform.xy + uTransform.zw;
+    vec2 ndc = (pos / uScreenSize) * 2.0 - 1.0;
     gl_Position = vec4(ndc, 0.0, 1.0);
     vColor = aColor;
 }
\ No newline at end of file
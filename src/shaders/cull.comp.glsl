@@ -0,0 +1,89 @@
+#version 430 core
+// Culling pre-pass of the extrusion: tests the bounds of every route against
+// the view, writes one draw command per route (empty when culled) and appends
+// the input slots of the visible routes to the list extruded by
+// compute.comp.glsl with CULL_ROUTES, whose indirect dispatch arguments it
+// fills in.
+layout(local_size_x = 64) in;
+
+// Must match OpenGLCanvas::RouteRecord
+struct RouteRecord {
+    vec4 bounds; // min lon, min lat, max lon, max lat
+    uint first;
+    uint count;
+    uint styleId;
+    uint _pad;
+};
+
+struct Style {
+    vec4 color;
+    float width;
+    float minZoom;
+    int zOrder;
+    float _pad;
+};
+
+// Matches the layout expected by glMultiDrawElementsIndirect
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 1) readonly buffer RouteRecords {
+    RouteRecord routes[];
+};
+
+layout(std430, binding = 2) writeonly buffer VisibleSlots {
+    uint visibleSlots[];
+};
+
+// Arguments of glDispatchComputeIndirect followed by the length of
+// visibleSlots. Reset to 0, 1, 1, 0 before every pass.
+layout(std430, binding = 3) buffer CullResult {
+    uint numGroupsX;
+    uint numGroupsY;
+    uint numGroupsZ;
+    uint visibleSlotCount;
+};
+
+layout(std430, binding = 4) writeonly buffer DrawCommands {
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 5) readonly buffer StyleTable {
+    Style styles[];
+};
+
+// min lon, min lat, max lon, max lat
+uniform vec4 uCullBounds;
+uniform float uZoom;
+uniform uint uNumRoutes;
+// Invocations per workgroup of the extrusion, and the most workgroups to
+// dispatch it with
+uniform uint uWorkgroupSize;
+uniform uint uMaxGroups;
+
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= uNumRoutes) return;
+
+    RouteRecord route = routes[id];
+    const bool visible = route.count > 0 && uZoom >= styles[route.styleId].minZoom &&
+                         all(lessThanEqual(route.bounds.xy, uCullBounds.zw)) &&
+                         all(greaterThanEqual(route.bounds.zw, uCullBounds.xy));
+
+    // Each input index is extruded into 6 output indices
+    commands[id] = DrawCommand(visible ? route.count * 6u : 0u, 1u, route.first * 6u, 0, 0u);
+    if (visible) {
+        // Routes are short, so one invocation writes all of its slots
+        uint base = atomicAdd(visibleSlotCount, route.count);
+        for (uint ii = 0; ii < route.count; ++ii) {
+            visibleSlots[base + ii] = route.first + ii;
+        }
+        uint groups = (base + route.count + uWorkgroupSize - 1) / uWorkgroupSize;
+        atomicMax(numGroupsX, min(groups, uMaxGroups));
+    }
+}
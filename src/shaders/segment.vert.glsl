@@ -0,0 +1,76 @@
+#version 330 core
+// Instanced alternative to compute.comp.glsl: one instance per input index,
+// drawing the segment from that index to the next one as a quad expanded from
+// gl_VertexID (triangle strip). The input buffers are read through texture
+// buffers, so this only needs OpenGL 3.3 and no intermediate buffers.
+
+uniform samplerBuffer uPositions; // RG32F: lon, lat per node
+uniform usamplerBuffer uStyleIds; // R32UI: style id per slot
+uniform usamplerBuffer uIndices;  // R32UI: node << 2 | flags per slot
+uniform samplerBuffer uStyles;    // RGBA32F: StyleSheet::GpuStyle, 2 texels each
+
+uniform vec4 uBounds;
+uniform vec2 uScreenSize;
+// first index of the style layer being drawn
+uniform int uFirstIndex;
+uniform int uNumIndices;
+uniform float uZoom;
+
+out vec4 vColor;
+
+const uint BEGIN_BIT = 1u << 0;
+const uint END_BIT = 1u << 1;
+
+vec2 mapToScreen(vec2 lonLat) {
+    return (lonLat - uBounds.xy) / uBounds.zw * uScreenSize;
+}
+
+vec2 vertexPosition(uint index) {
+    return mapToScreen(texelFetch(uPositions, int(index >> 2)).rg);
+}
+
+// Same as compute.comp.glsl: the normal of the average direction of the
+// segments meeting at index `id`
+vec2 vertexNormal(int id, uint index, vec2 p) {
+    vec2 dir = vec2(0.0);
+    if ((index & BEGIN_BIT) == 0u) {
+        dir += normalize(p - vertexPosition(texelFetch(uIndices, id - 1).r));
+    }
+    if ((index & END_BIT) == 0u) {
+        dir += normalize(vertexPosition(texelFetch(uIndices, id + 1).r) - p);
+    }
+    if (length(dir) > 0.0) {
+        dir = normalize(dir);
+        return vec2(-dir.y, dir.x);
+    }
+    return vec2(0.0);
+}
+
+void main() {
+    int id = uFirstIndex + gl_InstanceID;
+    uint index = texelFetch(uIndices, id).r;
+
+    int styleId = int(texelFetch(uStyleIds, id).r);
+    vec4 color = texelFetch(uStyles, styleId * 2);
+    // width, minZoom, zOrder bits, padding
+    vec4 style = texelFetch(uStyles, styleId * 2 + 1);
+
+    // The last index of a strip starts no segment. Collapse the quad outside
+    // of the clip volume.
+    if ((index & END_BIT) != 0u || id + 1 >= uNumIndices || uZoom < style.y) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        vColor = vec4(0.0);
+        return;
+    }
+
+    // Corners 0 and 1 at this index, 2 and 3 at the next one
+    int cornerId = id + (gl_VertexID >> 1);
+    uint cornerIndex = cornerId == id ? index : texelFetch(uIndices, cornerId).r;
+    vec2 p = vertexPosition(cornerIndex);
+    vec2 normal = vertexNormal(cornerId, cornerIndex, p);
+    float side = (gl_VertexID & 1) == 0 ? 1.0 : -1.0;
+    vec2 pos = p + normal * side * style.x * 0.5;
+
+    gl_Position = vec4(pos / uScreenSize * 2.0 - 1.0, 0.0, 1.0);
+    vColor = color;
+}
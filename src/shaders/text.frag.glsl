@@ -0,0 +1,25 @@
+#version 330 core
+
+in vec2 vTexCoord;
+in vec4 vColor;
+in vec4 vHaloColor;
+out vec4 FragColor;
+
+// Signed distance field, 0.5 on the glyph outline
+uniform sampler2D uAtlas;
+
+// Halo width in distance field units
+const float HALO = 0.2;
+
+void main() {
+    float dist = texture(uAtlas, vTexCoord).r;
+    float aa = fwidth(dist);
+    float fill = smoothstep(0.5 - aa, 0.5 + aa, dist);
+    float halo = smoothstep(0.5 - HALO - aa, 0.5 - HALO + aa, dist) * vHaloColor.a;
+
+    vec4 color = mix(vec4(vHaloColor.rgb, halo), vColor, fill);
+    if (color.a <= 0.0) {
+        discard;
+    }
+    FragColor = color;
+}
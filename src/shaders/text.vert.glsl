@@ -0,0 +1,28 @@
+#version 330 core
+// One instance per glyph, expanded to a quad from gl_VertexID (triangle strip)
+layout(location = 0) in vec4 aPlacement; // pen position (pixels, y-up), baseline direction
+layout(location = 1) in vec4 aQuad;      // glyph quad relative to the pen, in em
+layout(location = 2) in vec4 aTexRect;   // atlas coordinates of the quad corners
+layout(location = 3) in float aSize;     // font size in pixels
+layout(location = 4) in vec4 aColor;
+layout(location = 5) in vec4 aHaloColor;
+
+uniform vec2 uScreenSize;
+uniform vec4 uPenTransform; // scale.xy, offset.xy applied to the pen position
+
+out vec2 vTexCoord;
+out vec4 vColor;
+out vec4 vHaloColor;
+
+void main() {
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 local = mix(aQuad.xy, aQuad.zw, corner) * aSize;
+    vec2 dir = aPlacement.zw;
+    vec2 pen = aPlacement.xy * uPenTransform.xy + uPenTransform.zw;
+    vec2 pos = pen + vec2(local.x * dir.x - local.y * dir.y, local.x * dir.y + local.y * dir.x);
+
+    gl_Position = vec4(pos / uScreenSize * 2.0 - 1.0, 0.0, 1.0);
+    vTexCoord = mix(aTexRect.xy, aTexRect.zw, corner);
+    vColor = aColor;
+    vHaloColor = aHaloColor;
+}
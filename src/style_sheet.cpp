@@ -0,0 +1,201 @@
+#include "style_sheet.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+namespace {
+
+constexpr auto DEFAULT_STYLE = R"(
+# name          predicates                                  color    width  minzoom  z
+motorway        highway=motorway                            #ff5959  8      0        5
+motorway_link   highway=motorway_link                       #ff9999  6      0        5
+primary         highway=trunk|trunk_link|primary|primary_link  #ff9980  7   0        4
+secondary       highway=secondary|secondary_link            #ffbf66  6      0        3
+tertiary        highway=tertiary|tertiary_link              #ffff99  5      0        3
+residential     highway=residential|living_street           #ffffff  4      0        2
+unclassified    highway=unclassified                        #f2f2f2  4      0        2
+service         highway=service                             #cccccc  3      0        2
+track           highway=track                               #a68c66  2      0        1
+pedestrian      highway=pedestrian                          #d9ccd9  2      0        1
+footway         highway=footway                             #e6b3b3  2      0        1
+path            highway=path|cycleway|bridleway             #99b399  2      0        1
+steps           highway=steps                               #b36666  2      0        1
+platform        highway=platform                            #9999cc  2      0        1
+other           *                                           #808080  2      0        0
+)";
+
+bool ParseColor(const std::string &text, std::array<float, 3> &color) {
+    if (text.size() != 7 || text[0] != '#') {
+        return false;
+    }
+    for (size_t ii = 0; ii < 3; ++ii) {
+        char *end = nullptr;
+        const std::string component = text.substr(1 + ii * 2, 2);
+        const long value = std::strtol(component.c_str(), &end, 16);
+        if (*end != '\0') {
+            return false;
+        }
+        color[ii] = static_cast<float>(value) / 255.0f;
+    }
+    return true;
+}
+
+std::vector<std::string> Split(const std::string &text, char separator) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream ss(text);
+    while (std::getline(ss, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+bool ParsePredicates(const std::string &text, std::vector<StyleSheet::Predicate> &predicates) {
+    if (text == "*") {
+        return true;
+    }
+    for (const auto &term : Split(text, '&')) {
+        StyleSheet::Predicate predicate;
+        auto pos = term.find("!=");
+        size_t valuePos = pos + 2;
+        if (pos != std::string::npos) {
+            predicate.negate = true;
+        } else {
+            pos = term.find('=');
+            valuePos = pos + 1;
+        }
+        if (pos == std::string::npos || pos == 0 || valuePos >= term.size()) {
+            return false;
+        }
+        predicate.key = term.substr(0, pos);
+        const std::string values = term.substr(valuePos);
+        if (values != "*") {
+            predicate.values = Split(values, '|');
+        }
+        predicates.push_back(predicate);
+    }
+    return true;
+}
+
+bool Matches(const StyleSheet::Predicate &predicate, const OSMLoader::Tags &tags) {
+    auto it = tags.find(predicate.key);
+    bool matches = it != tags.end() && !it->second.empty();
+    if (matches && !predicate.values.empty()) {
+        matches = std::find(predicate.values.begin(), predicate.values.end(), it->second) != predicate.values.end();
+    }
+    return matches != predicate.negate;
+}
+
+} // namespace
+
+StyleSheet StyleSheet::Default() {
+    std::string error;
+    auto styleSheet = Parse(DEFAULT_STYLE, error);
+    assert(styleSheet);
+    return *styleSheet;
+}
+
+std::optional<StyleSheet> StyleSheet::FromFile(const std::string &filepath) {
+    std::ifstream file(filepath);
+    if (!file) {
+        std::cerr << "Could not open style file " << filepath << std::endl;
+        return std::nullopt;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+
+    std::string error;
+    auto styleSheet = Parse(text.str(), error);
+    if (!styleSheet) {
+        std::cerr << "Invalid style file " << filepath << ": " << error << std::endl;
+    }
+    return styleSheet;
+}
+
+std::optional<StyleSheet> StyleSheet::Parse(const std::string &text, std::string &error) {
+    StyleSheet styleSheet;
+
+    std::istringstream lines(text);
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(lines, line)) {
+        ++lineNumber;
+        // Only whole line comments, since colors start with '#' as well
+        if (auto comment = line.find_first_not_of(" \t"); comment == std::string::npos || line[comment] == '#') {
+            continue;
+        }
+
+        std::istringstream columns(line);
+        Style style;
+        std::string predicates;
+        std::string color;
+        if (!(columns >> style.name >> predicates >> color >> style.width >> style.minZoom >> style.zOrder)) {
+            error = "line " + std::to_string(lineNumber) + ": expected 6 columns";
+            return std::nullopt;
+        }
+        if (!ParsePredicates(predicates, style.predicates)) {
+            error = "line " + std::to_string(lineNumber) + ": invalid predicates '" + predicates + "'";
+            return std::nullopt;
+        }
+        if (!ParseColor(color, style.color)) {
+            error = "line " + std::to_string(lineNumber) + ": invalid color '" + color + "'";
+            return std::nullopt;
+        }
+        styleSheet.styles_.push_back(style);
+    }
+
+    if (styleSheet.styles_.empty()) {
+        error = "no styles defined";
+        return std::nullopt;
+    }
+    return styleSheet;
+}
+
+uint32_t StyleSheet::Match(const OSMLoader::Tags &tags) const {
+    for (size_t ii = 0; ii < styles_.size(); ++ii) {
+        const auto &predicates = styles_[ii].predicates;
+        if (std::all_of(predicates.begin(), predicates.end(),
+                        [&tags](const Predicate &predicate) { return Matches(predicate, tags); })) {
+            return static_cast<uint32_t>(ii);
+        }
+    }
+    return NO_STYLE;
+}
+
+bool StyleSheet::SameClassification(const StyleSheet &other) const {
+    return std::equal(
+        styles_.begin(), styles_.end(), other.styles_.begin(), other.styles_.end(),
+        [](const Style &a, const Style &b) { return a.predicates == b.predicates && a.zOrder == b.zOrder; });
+}
+
+std::vector<StyleSheet::GpuStyle> StyleSheet::GpuTable() const {
+    std::vector<GpuStyle> table;
+    table.reserve(styles_.size());
+    for (const auto &style : styles_) {
+        GpuStyle entry{};
+        entry.color[0] = style.color[0];
+        entry.color[1] = style.color[1];
+        entry.color[2] = style.color[2];
+        entry.color[3] = 1.0f;
+        entry.width = style.width;
+        entry.minZoom = style.minZoom;
+        entry.zOrder = style.zOrder;
+        table.push_back(entry);
+    }
+    return table;
+}
+
+std::vector<std::string> StyleSheet::TagKeys() const {
+    std::set<std::string> keys;
+    for (const auto &style : styles_) {
+        for (const auto &predicate : style.predicates) {
+            keys.insert(predicate.key);
+        }
+    }
+    return {keys.begin(), keys.end()};
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "osm_loader.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Data-driven map style.
+ *
+ * A style sheet is an ordered list of styles. Each style selects routes by tag
+ * predicates and assigns them a color, a line width (in pixels), a minimum zoom
+ * level below which they are hidden, and a z-order. The first style whose
+ * predicates all match a route wins.
+ *
+ * Style files contain one style per line, with whitespace separated columns.
+ * Lines starting with '#' are comments:
+ *
+ *   # name      predicates                        color    width  minzoom  z
+ *   motorway    highway=motorway|motorway_link    #ff5959  8      0        5
+ *   footway     highway=footway&access!=private   #e6b3b3  2      15       1
+ *   other       *                                 #808080  2      0        0
+ *
+ * A predicate is `key=v1|v2` (value is one of), `key!=v1|v2` (key missing or
+ * value is none of), `key=*` (key exists) or `*` (always matches). Predicates
+ * are combined with `&`.
+ *
+ * Routes are baked into the GPU buffers with their style id only; the style
+ * attributes live in a small table that the shaders read from an SSBO. So any
+ * change that keeps the classification (predicates and z-orders) is just an
+ * upload of that table.
+ */
+class StyleSheet {
+  public:
+    static constexpr uint32_t NO_STYLE = ~0u;
+
+    struct Predicate {
+        std::string key;
+        // empty means that the key only needs to exist
+        std::vector<std::string> values;
+        bool negate{false};
+
+        bool operator==(const Predicate &other) const {
+            return key == other.key && values == other.values && negate == other.negate;
+        }
+    };
+
+    struct Style {
+        std::string name;
+        std::vector<Predicate> predicates;
+        std::array<float, 3> color{};
+        float width{1.0f};
+        float minZoom{0.0f};
+        int zOrder{0};
+    };
+
+    // std430 layout of one entry of the style table in compute.comp.glsl
+    struct GpuStyle {
+        float color[4];
+        float width;
+        float minZoom;
+        int32_t zOrder;
+        float pad;
+    };
+
+    // Built-in style used when no style file is given
+    static StyleSheet Default();
+    static std::optional<StyleSheet> FromFile(const std::string &filepath);
+    static std::optional<StyleSheet> Parse(const std::string &text, std::string &error);
+
+    // Returns the id of the first matching style or NO_STYLE
+    uint32_t Match(const OSMLoader::Tags &tags) const;
+
+    // True if both style sheets assign every route to the same style id and
+    // z-order, i.e. switching between them does not require a buffer rebuild
+    bool SameClassification(const StyleSheet &other) const;
+
+    std::vector<GpuStyle> GpuTable() const;
+
+    // Keys referenced by the predicates, which the loader needs to retain
+    std::vector<std::string> TagKeys() const;
+
+    const std::vector<Style> &styles() const { return styles_; }
+
+  protected:
+    std::vector<Style> styles_{};
+};
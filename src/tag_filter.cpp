@@ -0,0 +1,450 @@
+#include "tag_filter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+constexpr auto DEFAULT_ROUTE_FILTER = "highway or area";
+constexpr auto DEFAULT_AREA_FILTER = "type=boundary or building=yes or area=yes";
+
+// Free slot of a hash table
+constexpr uint32_t EMPTY = ~0u;
+// Value index of a key the object does not have, or of a value no test mentions
+constexpr uint32_t ABSENT = ~0u;
+constexpr uint32_t OTHER_VALUE = ~0u - 1;
+// Depth of the evaluation stack, and of nested parentheses and `not`
+constexpr size_t MAX_DEPTH = 64;
+// Seeds tried for a table size before doubling it
+constexpr uint32_t SEEDS_PER_SIZE = 64;
+
+// FNV-1a with a finalizer, since the table index comes from the low bits
+uint32_t hashString(uint32_t seed, const char *text) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (; *text != '\0'; ++text) {
+        hash ^= static_cast<uint8_t>(*text);
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+uint32_t hashPair(uint32_t seed, uint32_t key, const char *value) {
+    return hashString(seed + key * 0x9e3779b9u, value);
+}
+
+// Find a seed for which `hash` puts the `count` entries into distinct slots
+// of a power of two table, doubling the table when no seed does
+template <typename Hash> void buildPerfectHash(size_t count, Hash hash, uint32_t &seed, std::vector<uint32_t> &slots) {
+    size_t size = 1;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    for (;; size *= 2) {
+        for (seed = 0; seed < SEEDS_PER_SIZE; ++seed) {
+            slots.assign(size, EMPTY);
+            bool collided = false;
+            for (uint32_t ii = 0; ii < count && !collided; ++ii) {
+                auto &slot = slots[hash(seed, ii) & (size - 1)];
+                collided = slot != EMPTY;
+                slot = ii;
+            }
+            if (!collided) {
+                return;
+            }
+        }
+    }
+}
+
+// One step of the parsed expression in postfix order, before keys and values
+// are numbered
+struct Step {
+    enum class Kind { True, Exists, Equals, In, Not, And, Or };
+    Kind kind;
+    std::string key{};
+    std::vector<std::string> values{};
+};
+
+// Recursive descent over
+//   or      := and ('or' and)*
+//   and     := unary ('and' unary)*
+//   unary   := 'not' unary | primary
+//   primary := '(' or ')' | '*' | name ['=' name | '!=' name | 'in' '(' name (',' name)* ')']
+class ExpressionParser {
+  public:
+    ExpressionParser(const std::string &text, std::vector<Step> &steps, std::string &error)
+        : text_(text), steps_(steps), error_(error) {}
+
+    bool Parse() {
+        Next();
+        if (!ParseOr()) {
+            return false;
+        }
+        if (token_.kind != Kind::End) {
+            return Fail(Unexpected());
+        }
+        return true;
+    }
+
+  protected:
+    enum class Kind { End, Word, String, LeftParen, RightParen, Comma, Equals, NotEquals, Star, Invalid };
+    struct Token {
+        Kind kind;
+        std::string text;
+        size_t position;
+    };
+
+    static bool isNameChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':' || c == '.' || c == '-';
+    }
+
+    void Next() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+        token_ = {Kind::End, "end of expression", pos_};
+        if (pos_ >= text_.size()) {
+            return;
+        }
+        const char c = text_[pos_];
+        if (isNameChar(c)) {
+            const size_t begin = pos_;
+            while (pos_ < text_.size() && isNameChar(text_[pos_])) {
+                ++pos_;
+            }
+            token_ = {Kind::Word, text_.substr(begin, pos_ - begin), begin};
+        } else if (c == '"') {
+            const size_t end = text_.find('"', pos_ + 1);
+            if (end == std::string::npos) {
+                token_ = {Kind::Invalid, "unterminated string", pos_};
+                pos_ = text_.size();
+            } else {
+                token_ = {Kind::String, text_.substr(pos_ + 1, end - pos_ - 1), pos_};
+                pos_ = end + 1;
+            }
+        } else if (c == '!' && pos_ + 1 < text_.size() && text_[pos_ + 1] == '=') {
+            token_ = {Kind::NotEquals, "!=", pos_};
+            pos_ += 2;
+        } else {
+            static const std::string singles = "(),=*";
+            const size_t single = singles.find(c);
+            const Kind kinds[] = {Kind::LeftParen, Kind::RightParen, Kind::Comma, Kind::Equals, Kind::Star};
+            if (single == std::string::npos) {
+                token_ = {Kind::Invalid, "unexpected '" + std::string(1, c) + "'", pos_};
+            } else {
+                token_ = {kinds[single], std::string(1, c), pos_};
+            }
+            ++pos_;
+        }
+    }
+
+    bool IsKeyword(const char *keyword) const { return token_.kind == Kind::Word && token_.text == keyword; }
+    bool IsName() const {
+        return token_.kind == Kind::String ||
+               (token_.kind == Kind::Word && !IsKeyword("and") && !IsKeyword("or") && !IsKeyword("not") &&
+                !IsKeyword("in"));
+    }
+
+    // Invalid tokens carry their own message
+    std::string Unexpected() const {
+        return token_.kind == Kind::Invalid ? token_.text : "unexpected '" + token_.text + "'";
+    }
+
+    bool Fail(const std::string &message) {
+        error_ = "position " + std::to_string(token_.position + 1) + ": " + message;
+        return false;
+    }
+
+    // Track the depth of the evaluation stack the steps so far need
+    void Emit(Step step) {
+        if (step.kind == Step::Kind::And || step.kind == Step::Kind::Or) {
+            --depth_;
+        } else if (step.kind != Step::Kind::Not) {
+            ++depth_;
+            maxDepth_ = std::max(maxDepth_, depth_);
+        }
+        steps_.push_back(std::move(step));
+    }
+
+    bool ParseOr() {
+        if (!ParseAnd()) {
+            return false;
+        }
+        while (IsKeyword("or")) {
+            Next();
+            if (!ParseAnd()) {
+                return false;
+            }
+            Emit({Step::Kind::Or});
+        }
+        return true;
+    }
+
+    bool ParseAnd() {
+        if (!ParseUnary()) {
+            return false;
+        }
+        while (IsKeyword("and")) {
+            Next();
+            if (!ParseUnary()) {
+                return false;
+            }
+            Emit({Step::Kind::And});
+        }
+        return true;
+    }
+
+    bool ParseUnary() {
+        if (++nesting_ > MAX_DEPTH) {
+            return Fail("expression nested too deeply");
+        }
+        bool parsed;
+        if (IsKeyword("not")) {
+            Next();
+            parsed = ParseUnary();
+            if (parsed) {
+                Emit({Step::Kind::Not});
+            }
+        } else {
+            parsed = ParsePrimary();
+        }
+        --nesting_;
+        if (parsed && maxDepth_ > MAX_DEPTH) {
+            return Fail("expression nested too deeply");
+        }
+        return parsed;
+    }
+
+    bool ParsePrimary() {
+        if (token_.kind == Kind::LeftParen) {
+            Next();
+            if (!ParseOr()) {
+                return false;
+            }
+            if (token_.kind != Kind::RightParen) {
+                return Fail("expected ')'");
+            }
+            Next();
+            return true;
+        }
+        if (token_.kind == Kind::Star) {
+            Next();
+            Emit({Step::Kind::True});
+            return true;
+        }
+        if (!IsName()) {
+            return Fail(token_.kind == Kind::Invalid ? token_.text : "expected a tag key");
+        }
+
+        Step step{Step::Kind::Exists, token_.text};
+        Next();
+        if (token_.kind == Kind::Equals || token_.kind == Kind::NotEquals) {
+            const bool negate = token_.kind == Kind::NotEquals;
+            Next();
+            if (!IsName()) {
+                return Fail("expected a value");
+            }
+            step.kind = Step::Kind::Equals;
+            step.values.push_back(token_.text);
+            Next();
+            Emit(std::move(step));
+            if (negate) {
+                Emit({Step::Kind::Not});
+            }
+            return true;
+        }
+        if (IsKeyword("in")) {
+            Next();
+            if (token_.kind != Kind::LeftParen) {
+                return Fail("expected '(' after 'in'");
+            }
+            do {
+                Next();
+                if (!IsName()) {
+                    return Fail("expected a value");
+                }
+                step.values.push_back(token_.text);
+                Next();
+            } while (token_.kind == Kind::Comma);
+            if (token_.kind != Kind::RightParen) {
+                return Fail("expected ',' or ')'");
+            }
+            Next();
+            step.kind = Step::Kind::In;
+        }
+        Emit(std::move(step));
+        return true;
+    }
+
+    const std::string &text_;
+    std::vector<Step> &steps_;
+    std::string &error_;
+    size_t pos_{0};
+    Token token_{Kind::End, {}, 0};
+    size_t depth_{0};
+    size_t maxDepth_{0};
+    size_t nesting_{0};
+};
+
+} // namespace
+
+TagFilter TagFilter::DefaultRoutes() {
+    std::string error;
+    auto filter = Parse(DEFAULT_ROUTE_FILTER, error);
+    assert(filter);
+    return *filter;
+}
+
+TagFilter TagFilter::DefaultAreas() {
+    std::string error;
+    auto filter = Parse(DEFAULT_AREA_FILTER, error);
+    assert(filter);
+    return *filter;
+}
+
+std::optional<TagFilter> TagFilter::Parse(const std::string &expression, std::string &error) {
+    std::vector<Step> steps;
+    ExpressionParser parser(expression, steps, error);
+    if (!parser.Parse()) {
+        return std::nullopt;
+    }
+
+    TagFilter filter;
+    filter.expression_ = expression;
+    auto keyIndex = [&](const std::string &key) {
+        auto it = std::find(filter.keys_.begin(), filter.keys_.end(), key);
+        if (it == filter.keys_.end()) {
+            filter.keys_.push_back(key);
+            return static_cast<uint32_t>(filter.keys_.size() - 1);
+        }
+        return static_cast<uint32_t>(it - filter.keys_.begin());
+    };
+    auto pairIndex = [&](uint32_t key, const std::string &value) {
+        auto it = std::find_if(filter.pairs_.begin(), filter.pairs_.end(),
+                               [&](const Pair &pair) { return pair.key == key && pair.value == value; });
+        if (it == filter.pairs_.end()) {
+            filter.pairs_.push_back({key, value});
+            return static_cast<uint32_t>(filter.pairs_.size() - 1);
+        }
+        return static_cast<uint32_t>(it - filter.pairs_.begin());
+    };
+
+    for (const auto &step : steps) {
+        switch (step.kind) {
+        case Step::Kind::True:
+            filter.program_.push_back({Op::True, 0, 0});
+            break;
+        case Step::Kind::Exists:
+            filter.program_.push_back({Op::Exists, keyIndex(step.key), 0});
+            break;
+        case Step::Kind::Equals: {
+            const uint32_t key = keyIndex(step.key);
+            filter.program_.push_back({Op::Equals, key, pairIndex(key, step.values.front())});
+            break;
+        }
+        case Step::Kind::In: {
+            const uint32_t key = keyIndex(step.key);
+            std::vector<uint32_t> set;
+            for (const auto &value : step.values) {
+                set.push_back(pairIndex(key, value));
+            }
+            std::sort(set.begin(), set.end());
+            set.erase(std::unique(set.begin(), set.end()), set.end());
+            filter.valueSets_.push_back(std::move(set));
+            filter.program_.push_back({Op::In, key, static_cast<uint32_t>(filter.valueSets_.size() - 1)});
+            break;
+        }
+        case Step::Kind::Not:
+            filter.program_.push_back({Op::Not, 0, 0});
+            break;
+        case Step::Kind::And:
+            filter.program_.push_back({Op::And, 0, 0});
+            break;
+        case Step::Kind::Or:
+            filter.program_.push_back({Op::Or, 0, 0});
+            break;
+        }
+    }
+    if (filter.keys_.size() > MAX_KEYS) {
+        error = "more than " + std::to_string(MAX_KEYS) + " different keys";
+        return std::nullopt;
+    }
+
+    filter.BuildTables();
+    return filter;
+}
+
+void TagFilter::BuildTables() {
+    buildPerfectHash(
+        keys_.size(), [&](uint32_t seed, uint32_t ii) { return hashString(seed, keys_[ii].c_str()); }, keySeed_,
+        keySlots_);
+    buildPerfectHash(
+        pairs_.size(),
+        [&](uint32_t seed, uint32_t ii) { return hashPair(seed, pairs_[ii].key, pairs_[ii].value.c_str()); },
+        pairSeed_, pairSlots_);
+}
+
+int TagFilter::FindKey(const char *key) const {
+    const uint32_t entry = keySlots_[hashString(keySeed_, key) & (keySlots_.size() - 1)];
+    if (entry == EMPTY || std::strcmp(keys_[entry].c_str(), key) != 0) {
+        return -1;
+    }
+    return static_cast<int>(entry);
+}
+
+uint32_t TagFilter::FindPair(uint32_t key, const char *value) const {
+    const uint32_t entry = pairSlots_[hashPair(pairSeed_, key, value) & (pairSlots_.size() - 1)];
+    if (entry == EMPTY || pairs_[entry].key != key || std::strcmp(pairs_[entry].value.c_str(), value) != 0) {
+        return OTHER_VALUE;
+    }
+    return entry;
+}
+
+bool TagFilter::Matches(const osmium::TagList &tags) const {
+    // the value of every key the expression uses, looked up once
+    uint32_t values[MAX_KEYS];
+    std::fill_n(values, keys_.size(), ABSENT);
+    for (const auto &tag : tags) {
+        const int key = FindKey(tag.key());
+        if (key >= 0) {
+            values[key] = FindPair(static_cast<uint32_t>(key), tag.value());
+        }
+    }
+
+    bool stack[MAX_DEPTH];
+    size_t depth = 0;
+    for (const auto &instruction : program_) {
+        switch (instruction.op) {
+        case Op::True:
+            stack[depth++] = true;
+            break;
+        case Op::Exists:
+            stack[depth++] = values[instruction.key] != ABSENT;
+            break;
+        case Op::Equals:
+            stack[depth++] = values[instruction.key] == instruction.arg;
+            break;
+        case Op::In: {
+            const auto &set = valueSets_[instruction.arg];
+            stack[depth++] = std::binary_search(set.begin(), set.end(), values[instruction.key]);
+            break;
+        }
+        case Op::Not:
+            stack[depth - 1] = !stack[depth - 1];
+            break;
+        case Op::And:
+            --depth;
+            stack[depth - 1] = stack[depth - 1] && stack[depth];
+            break;
+        case Op::Or:
+            --depth;
+            stack[depth - 1] = stack[depth - 1] || stack[depth];
+            break;
+        }
+    }
+    return stack[0];
+}
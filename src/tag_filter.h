@@ -0,0 +1,75 @@
+#pragma once
+
+#include <osmium/osm/tag.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Tag filter deciding which ways and relations the loader keeps.
+ *
+ * An expression combines tag tests with `and`, `or`, `not` and parentheses:
+ *
+ *   highway in (motorway, primary) and not access=private
+ *
+ * A test is `key` (key exists), `key=value`, `key!=value` (key missing or
+ * another value), `key in (v1, v2)` or `*` (always matches). Keys and values
+ * are runs of letters, digits and `_:.-`, or double quoted strings.
+ *
+ * Parse() compiles the expression once: the keys and the key/value pairs it
+ * mentions go into perfect hash tables and the expression into a postfix
+ * program. Matches() looks up every tag of an object once, remembering the
+ * value of each key the expression uses, and then runs the program on that,
+ * so the cost per object does not depend on how often a key is tested.
+ */
+class TagFilter {
+  public:
+    // Keys one expression can mention
+    static constexpr size_t MAX_KEYS = 64;
+
+    // What the loader kept before filters were configurable
+    static TagFilter DefaultRoutes();
+    static TagFilter DefaultAreas();
+    static std::optional<TagFilter> Parse(const std::string &expression, std::string &error);
+
+    bool Matches(const osmium::TagList &tags) const;
+
+    const std::string &Expression() const { return expression_; }
+
+  protected:
+    TagFilter() = default;
+
+    enum class Op : uint8_t { True, Exists, Equals, In, Not, And, Or };
+
+    struct Instruction {
+        Op op;
+        uint32_t key;
+        // pair index for Equals, index into valueSets_ for In
+        uint32_t arg;
+    };
+
+    struct Pair {
+        uint32_t key;
+        std::string value;
+    };
+
+    int FindKey(const char *key) const;
+    uint32_t FindPair(uint32_t key, const char *value) const;
+    void BuildTables();
+
+    std::string expression_{};
+    std::vector<Instruction> program_{};
+    std::vector<std::string> keys_{};
+    std::vector<Pair> pairs_{};
+    // sorted pair indices
+    std::vector<std::vector<uint32_t>> valueSets_{};
+
+    // Perfect hash tables of keys_ and pairs_: a seed for which no two
+    // entries share a slot, and the entry index (or EMPTY) per slot
+    uint32_t keySeed_{0};
+    std::vector<uint32_t> keySlots_{};
+    uint32_t pairSeed_{0};
+    std::vector<uint32_t> pairSlots_{};
+};
@@ -0,0 +1,351 @@
+#include "text_renderer.h"
+
+#include <wx/dcmemory.h>
+#include <wx/wx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// 1D squared Euclidean distance transform (Felzenszwalb & Huttenlocher) of
+// `count` samples of `f` with the given stride, in place
+void DistanceTransform1D(float *f, size_t count, size_t stride, std::vector<float> &d, std::vector<int> &v,
+                         std::vector<float> &z) {
+    constexpr float INF = std::numeric_limits<float>::max();
+    auto intersection = [&](int q, int p) {
+        return ((f[q * stride] + q * q) - (f[p * stride] + p * p)) / (2.0f * (q - p));
+    };
+
+    // lower envelope of the parabolas rooted at each sample
+    int k = 0;
+    v[0] = 0;
+    z[0] = -INF;
+    z[1] = INF;
+    for (int q = 1; q < static_cast<int>(count); ++q) {
+        float s = intersection(q, v[k]);
+        while (s <= z[k]) {
+            --k;
+            s = intersection(q, v[k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = INF;
+    }
+
+    k = 0;
+    for (int q = 0; q < static_cast<int>(count); ++q) {
+        while (z[k + 1] < q) {
+            ++k;
+        }
+        const int p = v[k];
+        d[q] = (q - p) * (q - p) + f[p * stride];
+    }
+    for (size_t q = 0; q < count; ++q) {
+        f[q * stride] = d[q];
+    }
+}
+
+// Squared distance of every pixel to the nearest pixel where `grid` is 0;
+// all other pixels must be set to a large value
+void DistanceTransform2D(std::vector<float> &grid, int width, int height) {
+    const size_t longest = std::max(width, height);
+    std::vector<float> d(longest);
+    std::vector<int> v(longest);
+    std::vector<float> z(longest + 1);
+    for (int x = 0; x < width; ++x) {
+        DistanceTransform1D(grid.data() + x, height, width, d, v, z);
+    }
+    for (int y = 0; y < height; ++y) {
+        DistanceTransform1D(grid.data() + static_cast<size_t>(y) * width, width, 1, d, v, z);
+    }
+}
+
+} // namespace
+
+const GlyphAtlas::Glyph *GlyphAtlas::Get(char32_t codepoint) {
+    auto it = glyphs_.find(codepoint);
+    if (it == glyphs_.end()) {
+        it = glyphs_.emplace(codepoint, Rasterize(codepoint)).first;
+    }
+    return it->second ? &*it->second : nullptr;
+}
+
+std::optional<GlyphAtlas::Glyph> GlyphAtlas::Rasterize(char32_t codepoint) {
+    static const wxFont font(wxFontInfo(wxSize(0, REFERENCE_SIZE)).Family(wxFONTFAMILY_SWISS));
+
+    const wxString text(wxUniChar(static_cast<wxUint32>(codepoint)));
+    wxMemoryDC measureDc;
+    measureDc.SetFont(font);
+    wxCoord width = 0;
+    wxCoord height = 0;
+    wxCoord descent = 0;
+    measureDc.GetTextExtent(text, &width, &height, &descent);
+
+    const int bitmapWidth = width + 2 * SPREAD;
+    const int bitmapHeight = height + 2 * SPREAD;
+    if (bitmapWidth > ATLAS_SIZE || bitmapHeight > ATLAS_SIZE) {
+        return std::nullopt;
+    }
+
+    // Next shelf when this one is full
+    if (shelfX_ + bitmapWidth > ATLAS_SIZE) {
+        shelfX_ = 0;
+        shelfY_ += shelfHeight_;
+        shelfHeight_ = 0;
+    }
+    if (shelfY_ + bitmapHeight > ATLAS_SIZE) {
+        static bool reported = false;
+        if (!reported) {
+            std::cerr << "Glyph atlas is full, some characters will not be drawn" << std::endl;
+            reported = true;
+        }
+        return std::nullopt;
+    }
+
+    // White on black coverage
+    wxBitmap bitmap(bitmapWidth, bitmapHeight, 24);
+    {
+        wxMemoryDC dc(bitmap);
+        dc.SetBackground(*wxBLACK_BRUSH);
+        dc.Clear();
+        dc.SetFont(font);
+        dc.SetTextForeground(*wxWHITE);
+        dc.DrawText(text, SPREAD, SPREAD);
+    }
+    const wxImage image = bitmap.ConvertToImage();
+
+    // Squared distances to the nearest outside and inside pixel
+    constexpr float FAR = 1e20f;
+    const size_t pixelCount = static_cast<size_t>(bitmapWidth) * bitmapHeight;
+    std::vector<float> toOutside(pixelCount);
+    std::vector<float> toInside(pixelCount);
+    for (int y = 0; y < bitmapHeight; ++y) {
+        for (int x = 0; x < bitmapWidth; ++x) {
+            const bool inside = image.GetRed(x, y) >= 128;
+            const size_t ii = static_cast<size_t>(y) * bitmapWidth + x;
+            toOutside[ii] = inside ? FAR : 0.0f;
+            toInside[ii] = inside ? 0.0f : FAR;
+        }
+    }
+    DistanceTransform2D(toOutside, bitmapWidth, bitmapHeight);
+    DistanceTransform2D(toInside, bitmapWidth, bitmapHeight);
+
+    for (int y = 0; y < bitmapHeight; ++y) {
+        uint8_t *row = &pixels_[static_cast<size_t>(shelfY_ + y) * ATLAS_SIZE + shelfX_];
+        for (int x = 0; x < bitmapWidth; ++x) {
+            const size_t ii = static_cast<size_t>(y) * bitmapWidth + x;
+            const float distance = std::sqrt(toOutside[ii]) - std::sqrt(toInside[ii]);
+            const float value = std::clamp(0.5f + distance / (2.0f * SPREAD), 0.0f, 1.0f);
+            row[x] = static_cast<uint8_t>(std::lround(value * 255.0f));
+        }
+    }
+
+    // The bitmap is top-down while the quad is y-up from the baseline
+    const float em = static_cast<float>(REFERENCE_SIZE);
+    const float ascent = static_cast<float>(height - descent);
+    Glyph glyph{};
+    glyph.advance = width / em;
+    glyph.quad[0] = -SPREAD / em;
+    glyph.quad[1] = -(descent + SPREAD) / em;
+    glyph.quad[2] = (width + SPREAD) / em;
+    glyph.quad[3] = (ascent + SPREAD) / em;
+    glyph.texRect[0] = static_cast<float>(shelfX_) / ATLAS_SIZE;
+    glyph.texRect[1] = static_cast<float>(shelfY_ + bitmapHeight) / ATLAS_SIZE;
+    glyph.texRect[2] = static_cast<float>(shelfX_ + bitmapWidth) / ATLAS_SIZE;
+    glyph.texRect[3] = static_cast<float>(shelfY_) / ATLAS_SIZE;
+
+    dirtyBegin_ = std::min(dirtyBegin_, shelfY_);
+    dirtyEnd_ = std::max(dirtyEnd_, shelfY_ + bitmapHeight);
+    shelfX_ += bitmapWidth;
+    shelfHeight_ = std::max(shelfHeight_, bitmapHeight);
+    return glyph;
+}
+
+void GlyphAtlas::Upload() {
+    if (texture_ == 0) {
+        glGenTextures(1, &texture_);
+        glBindTexture(GL_TEXTURE_2D, texture_);
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, ATLAS_SIZE, ATLAS_SIZE);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        dirtyBegin_ = 0;
+        dirtyEnd_ = ATLAS_SIZE;
+    }
+    if (dirtyBegin_ >= dirtyEnd_) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, dirtyBegin_, ATLAS_SIZE, dirtyEnd_ - dirtyBegin_, GL_RED, GL_UNSIGNED_BYTE,
+                    &pixels_[static_cast<size_t>(dirtyBegin_) * ATLAS_SIZE]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    dirtyBegin_ = ATLAS_SIZE;
+    dirtyEnd_ = 0;
+}
+
+void GlyphAtlas::Release() {
+    if (texture_ != 0) {
+        glDeleteTextures(1, &texture_);
+    }
+    texture_ = 0;
+}
+
+uint32_t TextRenderer::PackColor(float r, float g, float b, float a) {
+    auto channel = [](float value) { return static_cast<uint32_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255)); };
+    // little endian RGBA8, read as normalized unsigned bytes
+    return channel(r) | channel(g) << 8 | channel(b) << 16 | channel(a) << 24;
+}
+
+void TextRenderer::Initialize() {
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &instanceBuffer_);
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+
+    const GLsizei stride = sizeof(GlyphInstance);
+    auto floatAttribute = [stride](GLuint location, GLint size, size_t offset) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(offset));
+        glVertexAttribDivisor(location, 1);
+    };
+    auto colorAttribute = [stride](GLuint location, size_t offset) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, reinterpret_cast<void *>(offset));
+        glVertexAttribDivisor(location, 1);
+    };
+    floatAttribute(0, 4, offsetof(GlyphInstance, placement));
+    floatAttribute(1, 4, offsetof(GlyphInstance, quad));
+    floatAttribute(2, 4, offsetof(GlyphInstance, texRect));
+    floatAttribute(3, 1, offsetof(GlyphInstance, size));
+    colorAttribute(4, offsetof(GlyphInstance, color));
+    colorAttribute(5, offsetof(GlyphInstance, haloColor));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TextRenderer::Release() {
+    atlas_.Release();
+    program_.Release();
+    if (vao_ != 0) {
+        glDeleteVertexArrays(1, &vao_);
+    }
+    if (instanceBuffer_ != 0) {
+        glDeleteBuffers(1, &instanceBuffer_);
+    }
+    vao_ = 0;
+    instanceBuffer_ = 0;
+}
+
+float TextRenderer::Measure(const std::u32string &text, float size) {
+    float width = 0.0f;
+    for (char32_t codepoint : text) {
+        if (const auto *glyph = atlas_.Get(codepoint); glyph) {
+            width += glyph->advance;
+        }
+    }
+    return width * size;
+}
+
+void TextRenderer::AddText(const std::u32string &text, float x, float y, float size, uint32_t color,
+                           uint32_t haloColor) {
+    for (char32_t codepoint : text) {
+        if (const auto *glyph = atlas_.Get(codepoint); glyph) {
+            AddGlyph(*glyph, x, y, 1.0f, 0.0f, size, color, haloColor);
+            x += glyph->advance * size;
+        }
+    }
+}
+
+void TextRenderer::AddGlyph(const GlyphAtlas::Glyph &glyph, float x, float y, float dirX, float dirY, float size,
+                            uint32_t color, uint32_t haloColor) {
+    GlyphInstance instance{};
+    instance.placement[0] = x;
+    instance.placement[1] = y;
+    instance.placement[2] = dirX;
+    instance.placement[3] = dirY;
+    std::copy(std::begin(glyph.quad), std::end(glyph.quad), instance.quad);
+    std::copy(std::begin(glyph.texRect), std::end(glyph.texRect), instance.texRect);
+    instance.size = size;
+    instance.color = color;
+    instance.haloColor = haloColor;
+    instances_.push_back(instance);
+}
+
+void TextRenderer::Draw(float screenWidth, float screenHeight, const std::array<float, 4> &penTransform) {
+    if (instances_.empty() || !program_.IsValid()) {
+        instances_.clear();
+        return;
+    }
+
+    atlas_.Upload();
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+    glBufferData(GL_ARRAY_BUFFER, instances_.size() * sizeof(GlyphInstance), instances_.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    program_.Use();
+    glUniform2f(program_.Uniform("uScreenSize"), screenWidth, screenHeight);
+    glUniform4fv(program_.Uniform("uPenTransform"), 1, penTransform.data());
+    glUniform1i(program_.Uniform("uAtlas"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas_.Texture());
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances_.size()));
+    glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    instances_.clear();
+}
+
+std::u32string TextRenderer::DecodeUtf8(const std::string &text) {
+    std::u32string result;
+    result.reserve(text.size());
+    for (size_t ii = 0; ii < text.size();) {
+        const auto lead = static_cast<unsigned char>(text[ii]);
+        size_t length = 1;
+        char32_t codepoint = lead;
+        if (lead >= 0xF0) {
+            length = 4;
+            codepoint = lead & 0x07;
+        } else if (lead >= 0xE0) {
+            length = 3;
+            codepoint = lead & 0x0F;
+        } else if (lead >= 0xC0) {
+            length = 2;
+            codepoint = lead & 0x1F;
+        } else if (lead >= 0x80) {
+            // stray continuation byte
+            ++ii;
+            continue;
+        }
+        if (ii + length > text.size()) {
+            break;
+        }
+        for (size_t jj = 1; jj < length; ++jj) {
+            codepoint = codepoint << 6 | (static_cast<unsigned char>(text[ii + jj]) & 0x3F);
+        }
+        result.push_back(codepoint);
+        ii += length;
+    }
+    return result;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "shaderprogram.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Single channel signed distance field atlas of glyphs.
+ *
+ * Glyphs are rasterized on demand with the platform font renderer at
+ * REFERENCE_SIZE pixels, converted into a distance field (0.5 on the outline,
+ * SPREAD pixels of range on either side) and packed into shelves of one
+ * ATLAS_SIZE x ATLAS_SIZE texture. The distance field scales to any text
+ * size, so one atlas serves every label and the HUD.
+ */
+class GlyphAtlas {
+  public:
+    static constexpr int ATLAS_SIZE = 1024;
+    static constexpr int REFERENCE_SIZE = 32;
+    static constexpr int SPREAD = 4;
+
+    struct Glyph {
+        float advance;    // in em
+        float quad[4];    // x0, y0, x1, y1 relative to the pen, in em, y-up
+        float texRect[4]; // atlas coordinates of (x0, y0) and (x1, y1)
+    };
+
+    GlyphAtlas() = default;
+    ~GlyphAtlas() { Release(); }
+
+    GlyphAtlas(const GlyphAtlas &) = delete;
+    GlyphAtlas &operator=(const GlyphAtlas &) = delete;
+
+    // Glyph for `codepoint`, rasterized if needed. nullptr once the atlas is
+    // full.
+    const Glyph *Get(char32_t codepoint);
+
+    // Upload the glyphs added since the last call
+    void Upload();
+    GLuint Texture() const { return texture_; }
+    void Release();
+
+  protected:
+    std::optional<Glyph> Rasterize(char32_t codepoint);
+
+    std::vector<uint8_t> pixels_ = std::vector<uint8_t>(ATLAS_SIZE * ATLAS_SIZE, 0);
+    std::unordered_map<char32_t, std::optional<Glyph>> glyphs_{};
+
+    // shelf packer state
+    int shelfX_{0};
+    int shelfY_{0};
+    int shelfHeight_{0};
+
+    // rows changed since the last upload
+    int dirtyBegin_{ATLAS_SIZE};
+    int dirtyEnd_{0};
+
+    GLuint texture_{0};
+};
+
+/**
+ * Draws text from a GlyphAtlas as instanced quads, one instance per glyph.
+ *
+ * Glyphs are queued during a frame with Add* and drawn in one call by Draw.
+ * Positions are in screen pixels with the origin at the bottom left, like the
+ * map.
+ */
+class TextRenderer {
+  public:
+    TextRenderer() = default;
+    ~TextRenderer() { Release(); }
+
+    TextRenderer(const TextRenderer &) = delete;
+    TextRenderer &operator=(const TextRenderer &) = delete;
+
+    static uint32_t PackColor(float r, float g, float b, float a = 1.0f);
+
+    void Initialize();
+    void Release();
+
+    // The program built from text.vert.glsl and text.frag.glsl
+    void SetProgram(ShaderProgram &&program) { program_ = std::move(program); }
+
+    GlyphAtlas &Atlas() { return atlas_; }
+
+    // Width of `text` in pixels at font size `size`
+    float Measure(const std::u32string &text, float size);
+
+    // Queue a horizontal string with its baseline starting at (x, y)
+    void AddText(const std::u32string &text, float x, float y, float size, uint32_t color, uint32_t haloColor = 0);
+
+    // Queue one glyph with its pen at (x, y) and baseline direction (dirX,
+    // dirY), which must be a unit vector
+    void AddGlyph(const GlyphAtlas::Glyph &glyph, float x, float y, float dirX, float dirY, float size, uint32_t color,
+                  uint32_t haloColor);
+
+    // Draw and clear the queued glyphs. `penTransform` (scale x/y, offset
+    // x/y) moves the pen positions, keeping the glyph size.
+    void Draw(float screenWidth, float screenHeight,
+              const std::array<float, 4> &penTransform = {1.0f, 1.0f, 0.0f, 0.0f});
+
+    static std::u32string DecodeUtf8(const std::string &text);
+
+  protected:
+    // Per instance attributes, see text.vert.glsl
+    struct GlyphInstance {
+        float placement[4];
+        float quad[4];
+        float texRect[4];
+        float size;
+        uint32_t color;
+        uint32_t haloColor;
+    };
+
+    GlyphAtlas atlas_{};
+    ShaderProgram program_{};
+    GLuint vao_{0};
+    GLuint instanceBuffer_{0}; // orphaned and refilled every frame
+    std::vector<GlyphInstance> instances_{};
+};
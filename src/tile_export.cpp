@@ -0,0 +1,269 @@
+// Command line tool which loads an OSM file like the renderer does and writes
+// its routes and areas as Mapbox Vector Tiles to an MBTiles file. Does not
+// need a display, so it runs on the machines feeding the tile servers.
+//
+// With --regions it writes one MBTiles file per region of a list instead: the
+// file is loaded once into memory (OSMLoader::setResident()) and the regions
+// are cut from it concurrently.
+
+#include "osm_loader.h"
+#include "style_sheet.h"
+#include "tag_filter.h"
+#include "tile_exporter.h"
+
+#include <osmium/thread/pool.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <input.osm> <output.mbtiles> -c minLon,minLat,maxLon,maxLat [options]\n"
+              << "       " << program << " <input.osm> --regions=<file> [options]\n"
+              << "  -c, --coordinates=<bounds>  Coordinate boundary of the exported tiles\n"
+              << "  -s, --style=<file>          Style sheet selecting the routes and their minimum zoom\n"
+              << "  --min-zoom=<zoom>           Lowest zoom level to export (default: 0)\n"
+              << "  --max-zoom=<zoom>           Highest zoom level to export (default: 14)\n"
+              << "  --threads=<count>           Threads used to load the data and encode tiles (default: all cores)\n"
+              << "  --margin=<degrees>          Also load nodes this far outside of the coordinate boundary\n"
+              << "  --node-index=<index>        Where node locations are kept while loading: auto, memory or file\n"
+              << "  --filter=<expression>       Ways exported as routes (default: 'highway or area')\n"
+              << "  --area-filter=<expression>  Relations exported as areas\n"
+              << "                              (default: 'type=boundary or building=yes or area=yes')\n"
+              << "  --fast-xml                  Parse .osm input with the parallel XML reader instead of libosmium\n"
+              << "  --regions=<file>            Export every '<output.mbtiles> minLon,minLat,maxLon,maxLat' line\n"
+              << "                              of the file, loading the input only once\n"
+              << "  --validate-resident         Compare the coordinate boundary loaded from the file and from the\n"
+              << "                              data kept in memory for --regions, then exit\n";
+}
+
+// Value of `--name=value`, `--name value` or `-short value` at argv[index]
+std::optional<std::string> optionValue(int argc, char **argv, int &index, const std::string &name,
+                                       const std::string &shortName = {}) {
+    const std::string argument = argv[index];
+    const std::string longName = "--" + name;
+    if (argument.rfind(longName + "=", 0) == 0) {
+        return argument.substr(longName.size() + 1);
+    }
+    if ((argument == longName || (!shortName.empty() && argument == "-" + shortName)) && index + 1 < argc) {
+        return std::string(argv[++index]);
+    }
+    return std::nullopt;
+}
+
+// `minLon,minLat,maxLon,maxLat`
+std::optional<osmium::Box> parseBounds(const std::string &text) {
+    double minLon{0.0};
+    double minLat{0.0};
+    double maxLon{0.0};
+    double maxLat{0.0};
+    if (sscanf(text.c_str(), "%lf,%lf,%lf,%lf", &minLon, &minLat, &maxLon, &maxLat) != 4) {
+        std::cerr << "Invalid coordinate boundary '" << text << "'. Expected 'minLon,minLat,maxLon,maxLat'."
+                  << std::endl;
+        return std::nullopt;
+    }
+    return osmium::Box({minLon, minLat}, {maxLon, maxLat});
+}
+
+// One output of --regions
+struct Region {
+    std::string output;
+    osmium::Box bounds;
+};
+
+// Lines of `<output.mbtiles> minLon,minLat,maxLon,maxLat`; empty lines and
+// lines starting with # are skipped
+std::optional<std::vector<Region>> readRegions(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not read regions file '" << path << "'." << std::endl;
+        return std::nullopt;
+    }
+    std::vector<Region> regions;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string output;
+        std::string boundsStr;
+        if (!(fields >> output) || output[0] == '#') {
+            continue;
+        }
+        if (!(fields >> boundsStr)) {
+            std::cerr << "Region '" << output << "' has no coordinate boundary." << std::endl;
+            return std::nullopt;
+        }
+        auto bounds = parseBounds(boundsStr);
+        if (!bounds) {
+            return std::nullopt;
+        }
+        regions.push_back({output, *bounds});
+    }
+    if (regions.empty()) {
+        std::cerr << "Regions file '" << path << "' lists no regions." << std::endl;
+        return std::nullopt;
+    }
+    return regions;
+}
+
+// Compile the expression of a filter option, printing what is wrong with it
+std::optional<TagFilter> parseFilter(const std::string &name, const std::string &expression) {
+    std::string error;
+    auto filter = TagFilter::Parse(expression, error);
+    if (!filter) {
+        std::cerr << "Invalid --" << name << " '" << expression << "': " << error << std::endl;
+    }
+    return filter;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> positional;
+    std::string boundsStr;
+    std::string stylePath;
+    std::string nodeIndex{"auto"};
+    std::optional<std::string> routeFilter;
+    std::optional<std::string> areaFilter;
+    std::optional<double> boundsMargin;
+    bool fastXml = false;
+    std::string regionsPath;
+    bool validateResident = false;
+    int threadCount = 0;
+    TileExporter::Options options;
+
+    for (int ii = 1; ii < argc; ++ii) {
+        if (auto value = optionValue(argc, argv, ii, "coordinates", "c")) {
+            boundsStr = *value;
+        } else if (auto value = optionValue(argc, argv, ii, "style", "s")) {
+            stylePath = *value;
+        } else if (auto value = optionValue(argc, argv, ii, "min-zoom")) {
+            options.minZoom = std::atoi(value->c_str());
+        } else if (auto value = optionValue(argc, argv, ii, "max-zoom")) {
+            options.maxZoom = std::atoi(value->c_str());
+        } else if (auto value = optionValue(argc, argv, ii, "threads")) {
+            threadCount = std::atoi(value->c_str());
+        } else if (auto value = optionValue(argc, argv, ii, "margin")) {
+            boundsMargin = std::atof(value->c_str());
+        } else if (auto value = optionValue(argc, argv, ii, "node-index")) {
+            nodeIndex = *value;
+        } else if (auto value = optionValue(argc, argv, ii, "filter")) {
+            routeFilter = value;
+        } else if (auto value = optionValue(argc, argv, ii, "area-filter")) {
+            areaFilter = value;
+        } else if (std::string(argv[ii]) == "--fast-xml") {
+            fastXml = true;
+        } else if (auto value = optionValue(argc, argv, ii, "regions")) {
+            regionsPath = *value;
+        } else if (std::string(argv[ii]) == "--validate-resident") {
+            validateResident = true;
+        } else if (argv[ii][0] == '-') {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            positional.emplace_back(argv[ii]);
+        }
+    }
+
+    // the input and either one output with its bounds, a regions file, or
+    // the bounds to validate
+    bool validUsage = false;
+    if (validateResident) {
+        validUsage = positional.size() == 1 && !boundsStr.empty() && regionsPath.empty();
+    } else if (!regionsPath.empty()) {
+        validUsage = positional.size() == 1 && boundsStr.empty();
+    } else {
+        validUsage = positional.size() == 2 && !boundsStr.empty();
+    }
+    if (!validUsage) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::vector<Region> regions;
+    if (!regionsPath.empty()) {
+        auto read = readRegions(regionsPath);
+        if (!read) {
+            return EXIT_FAILURE;
+        }
+        regions = std::move(*read);
+    } else {
+        auto bounds = parseBounds(boundsStr);
+        if (!bounds) {
+            return EXIT_FAILURE;
+        }
+        regions.push_back({validateResident ? std::string{} : positional[1], *bounds});
+    }
+
+    StyleSheet styleSheet = StyleSheet::Default();
+    if (!stylePath.empty()) {
+        auto loaded = StyleSheet::FromFile(stylePath);
+        if (!loaded) {
+            std::cerr << "Could not load style sheet '" << stylePath << "'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        styleSheet = *loaded;
+    }
+
+    OSMLoader loader;
+    loader.setFilepath(positional[0]);
+    loader.addTagKeys(styleSheet.TagKeys());
+    loader.setThreadCount(threadCount);
+    loader.setFastXml(fastXml);
+    if (boundsMargin) {
+        loader.setBoundsMargin(*boundsMargin);
+    }
+    if (nodeIndex == "memory") {
+        loader.setNodeIndex(OSMLoader::NodeIndex::Memory);
+    } else if (nodeIndex == "file") {
+        loader.setNodeIndex(OSMLoader::NodeIndex::File);
+    } else if (nodeIndex != "auto") {
+        std::cerr << "Invalid node index '" << nodeIndex << "'. Expected 'auto', 'memory' or 'file'." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (routeFilter) {
+        auto filter = parseFilter("filter", *routeFilter);
+        if (!filter) {
+            return EXIT_FAILURE;
+        }
+        loader.setRouteFilter(*filter);
+    }
+    if (areaFilter) {
+        auto filter = parseFilter("area-filter", *areaFilter);
+        if (!filter) {
+            return EXIT_FAILURE;
+        }
+        loader.setAreaFilter(*filter);
+    }
+
+    if (validateResident) {
+        return loader.validateResident(regions.front().bounds) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!regionsPath.empty()) {
+        loader.setResident(true);
+    }
+
+    // The regions are cut from the resident data on all threads at once and
+    // exported one after another as they come in
+    osmium::thread::Pool pool{threadCount};
+    std::vector<std::future<std::optional<OSMLoader::OSMData>>> futures;
+    for (const auto &region : regions) {
+        futures.push_back(pool.submit([&loader, bounds = region.bounds] { return loader.getData(bounds); }));
+    }
+    options.threadCount = threadCount;
+    bool exported = true;
+    for (size_t ii = 0; ii < regions.size(); ++ii) {
+        const auto data = futures[ii].get();
+        if (!data) {
+            exported = false;
+            continue;
+        }
+        const TileExporter exporter(*data, regions[ii].bounds, styleSheet, options);
+        exported = exporter.Export(regions[ii].output) && exported;
+    }
+    return exported ? EXIT_SUCCESS : EXIT_FAILURE;
+}
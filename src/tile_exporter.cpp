@@ -0,0 +1,797 @@
+#include "tile_exporter.h"
+
+#include <protozero/pbf_writer.hpp>
+
+#include <osmium/thread/pool.hpp>
+
+#include <sqlite3.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+namespace {
+constexpr double PI = 3.14159265358979323846;
+// Web Mercator is cut off where the world becomes square
+constexpr double MAX_LATITUDE = 85.0511287798066;
+constexpr int MAX_ZOOM = 24;
+// Tiles encoded per batch, bounding the compressed tiles waiting to be written
+constexpr size_t TILE_BATCH_SIZE = 4096;
+
+// Field numbers of vector_tile.proto (version 2 of the MVT specification)
+constexpr uint32_t TILE_LAYERS = 3;
+constexpr uint32_t LAYER_VERSION = 15;
+constexpr uint32_t LAYER_NAME = 1;
+constexpr uint32_t LAYER_FEATURES = 2;
+constexpr uint32_t LAYER_KEYS = 3;
+constexpr uint32_t LAYER_VALUES = 4;
+constexpr uint32_t LAYER_EXTENT = 5;
+constexpr uint32_t FEATURE_ID = 1;
+constexpr uint32_t FEATURE_TAGS = 2;
+constexpr uint32_t FEATURE_TYPE = 3;
+constexpr uint32_t FEATURE_GEOMETRY = 4;
+constexpr uint32_t VALUE_STRING = 1;
+
+// Geometry commands
+constexpr uint32_t MOVE_TO = 1;
+constexpr uint32_t LINE_TO = 2;
+constexpr uint32_t CLOSE_PATH = 7;
+
+constexpr const char *ROADS_LAYER = "roads";
+constexpr const char *AREAS_LAYER = "areas";
+
+// Tile coordinates before and after rounding
+struct LocalPoint {
+    double x;
+    double y;
+};
+using LocalPart = std::vector<LocalPoint>;
+
+struct TilePoint {
+    int32_t x;
+    int32_t y;
+
+    bool operator==(const TilePoint &other) const { return x == other.x && y == other.y; }
+};
+using TilePart = std::vector<TilePoint>;
+
+struct Rect {
+    double minX, minY, maxX, maxY;
+};
+
+double mercatorX(double lon) { return (lon + 180.0) / 360.0; }
+
+double mercatorY(double lat) {
+    const double phi = std::clamp(lat, -MAX_LATITUDE, MAX_LATITUDE) * PI / 180.0;
+    return 0.5 - std::log(std::tan(PI / 4.0 + phi / 2.0)) / (2.0 * PI);
+}
+
+uint32_t tileIndex(double mercator, int zoom) {
+    const uint32_t count = 1u << zoom;
+    return static_cast<uint32_t>(std::clamp(std::floor(mercator * count), 0.0, count - 1.0));
+}
+
+uint32_t commandInteger(uint32_t command, uint32_t count) { return (command & 0x7) | (count << 3); }
+
+// Squared distance of `p` from the segment a-b
+template <typename TPoint> double segmentDistance2(const TPoint &p, const TPoint &a, const TPoint &b) {
+    const double dx = b.x - a.x;
+    const double dy = b.y - a.y;
+    const double length2 = dx * dx + dy * dy;
+    const double t = length2 > 0.0 ? std::clamp(((p.x - a.x) * dx + (p.y - a.y) * dy) / length2, 0.0, 1.0) : 0.0;
+    const double ex = a.x + t * dx - p.x;
+    const double ey = a.y + t * dy - p.y;
+    return ex * ex + ey * ey;
+}
+
+// Douglas-Peucker, with an explicit stack so long ways do not recurse deeply
+template <typename TPoint> std::vector<TPoint> simplify(const std::vector<TPoint> &points, double tolerance) {
+    if (points.size() < 3) {
+        return points;
+    }
+    const double tolerance2 = tolerance * tolerance;
+    std::vector<bool> keep(points.size(), false);
+    keep.front() = keep.back() = true;
+    std::vector<std::pair<size_t, size_t>> stack{{0, points.size() - 1}};
+    while (!stack.empty()) {
+        const auto [first, last] = stack.back();
+        stack.pop_back();
+        double maxDistance2 = 0.0;
+        size_t farthest = first;
+        for (size_t ii = first + 1; ii < last; ++ii) {
+            const double distance2 = segmentDistance2(points[ii], points[first], points[last]);
+            if (distance2 > maxDistance2) {
+                maxDistance2 = distance2;
+                farthest = ii;
+            }
+        }
+        if (maxDistance2 > tolerance2) {
+            keep[farthest] = true;
+            stack.emplace_back(first, farthest);
+            stack.emplace_back(farthest, last);
+        }
+    }
+    std::vector<TPoint> simplified;
+    for (size_t ii = 0; ii < points.size(); ++ii) {
+        if (keep[ii]) {
+            simplified.push_back(points[ii]);
+        }
+    }
+    return simplified;
+}
+
+// One Liang-Barsky boundary test, narrowing [t0, t1]
+bool clipParameter(double p, double q, double &t0, double &t1) {
+    if (p == 0.0) {
+        return q >= 0.0;
+    }
+    const double r = q / p;
+    if (p < 0.0) {
+        if (r > t1) {
+            return false;
+        }
+        t0 = std::max(t0, r);
+    } else {
+        if (r < t0) {
+            return false;
+        }
+        t1 = std::min(t1, r);
+    }
+    return true;
+}
+
+// The pieces of a line inside `rect`
+std::vector<LocalPart> clipLine(const LocalPart &points, const Rect &rect) {
+    std::vector<LocalPart> pieces;
+    LocalPart piece;
+    auto flush = [&]() {
+        if (piece.size() >= 2) {
+            pieces.push_back(std::move(piece));
+        }
+        piece.clear();
+    };
+    for (size_t ii = 1; ii < points.size(); ++ii) {
+        const auto &a = points[ii - 1];
+        const auto &b = points[ii];
+        const double dx = b.x - a.x;
+        const double dy = b.y - a.y;
+        double t0 = 0.0;
+        double t1 = 1.0;
+        if (!clipParameter(-dx, a.x - rect.minX, t0, t1) || !clipParameter(dx, rect.maxX - a.x, t0, t1) ||
+            !clipParameter(-dy, a.y - rect.minY, t0, t1) || !clipParameter(dy, rect.maxY - a.y, t0, t1)) {
+            flush();
+            continue;
+        }
+        // a segment entering the rectangle starts a new piece
+        if (t0 > 0.0) {
+            flush();
+        }
+        if (piece.empty()) {
+            piece.push_back({a.x + t0 * dx, a.y + t0 * dy});
+        }
+        piece.push_back({a.x + t1 * dx, a.y + t1 * dy});
+        if (t1 < 1.0) {
+            flush();
+        }
+    }
+    flush();
+    return pieces;
+}
+
+// Sutherland-Hodgman clipping of an open ring (no repeated first point)
+LocalPart clipRing(LocalPart ring, const Rect &rect) {
+    auto clipEdge = [&ring](const auto &inside, const auto &intersect) {
+        if (ring.empty()) {
+            return;
+        }
+        LocalPart clipped;
+        const LocalPoint *previous = &ring.back();
+        for (const auto &current : ring) {
+            const bool currentInside = inside(current);
+            if (currentInside != inside(*previous)) {
+                clipped.push_back(intersect(*previous, current));
+            }
+            if (currentInside) {
+                clipped.push_back(current);
+            }
+            previous = &current;
+        }
+        ring = std::move(clipped);
+    };
+    auto atX = [](double x) {
+        return [x](const LocalPoint &a, const LocalPoint &b) {
+            return LocalPoint{x, a.y + (x - a.x) / (b.x - a.x) * (b.y - a.y)};
+        };
+    };
+    auto atY = [](double y) {
+        return [y](const LocalPoint &a, const LocalPoint &b) {
+            return LocalPoint{a.x + (y - a.y) / (b.y - a.y) * (b.x - a.x), y};
+        };
+    };
+    clipEdge([&](const LocalPoint &p) { return p.x >= rect.minX; }, atX(rect.minX));
+    clipEdge([&](const LocalPoint &p) { return p.x <= rect.maxX; }, atX(rect.maxX));
+    clipEdge([&](const LocalPoint &p) { return p.y >= rect.minY; }, atY(rect.minY));
+    clipEdge([&](const LocalPoint &p) { return p.y <= rect.maxY; }, atY(rect.maxY));
+    return ring;
+}
+
+// Round to integer tile coordinates, dropping repeated points
+TilePart roundPart(const LocalPart &points) {
+    TilePart rounded;
+    rounded.reserve(points.size());
+    for (const auto &point : points) {
+        const TilePoint tilePoint{static_cast<int32_t>(std::lround(point.x)),
+                                 static_cast<int32_t>(std::lround(point.y))};
+        if (rounded.empty() || !(rounded.back() == tilePoint)) {
+            rounded.push_back(tilePoint);
+        }
+    }
+    return rounded;
+}
+
+// Twice the signed area, positive for clockwise rings in tile coordinates
+// (y down), which is what MVT expects of exterior rings
+int64_t ringArea2(const TilePart &ring) {
+    int64_t area2 = 0;
+    for (size_t ii = 0; ii < ring.size(); ++ii) {
+        const auto &a = ring[ii];
+        const auto &b = ring[(ii + 1) % ring.size()];
+        area2 += static_cast<int64_t>(a.x) * b.y - static_cast<int64_t>(b.x) * a.y;
+    }
+    return area2;
+}
+
+// Collects the features of one layer of a tile, with their keys and values
+// interned as the layer tables require
+class LayerBuilder {
+  public:
+    explicit LayerBuilder(const char *name) : name_(name) {}
+
+    bool Empty() const { return features_.empty(); }
+
+    void AddFeature(uint64_t id, bool polygon, const std::vector<TilePart> &parts,
+                    const std::vector<std::pair<std::string, std::string>> &tags) {
+        std::string data;
+        {
+            protozero::pbf_writer feature{data};
+            feature.add_uint64(FEATURE_ID, id);
+            if (!tags.empty()) {
+                protozero::packed_field_uint32 tagField{feature, FEATURE_TAGS};
+                for (const auto &[key, value] : tags) {
+                    tagField.add_element(Intern(keys_, keyIndices_, key));
+                    tagField.add_element(Intern(values_, valueIndices_, value));
+                }
+            }
+            feature.add_enum(FEATURE_TYPE, polygon ? 3 : 2);
+
+            // Coordinates are deltas from the previous point, across parts
+            protozero::packed_field_uint32 geometry{feature, FEATURE_GEOMETRY};
+            TilePoint cursor{0, 0};
+            auto addPoint = [&](const TilePoint &point) {
+                geometry.add_element(protozero::encode_zigzag32(point.x - cursor.x));
+                geometry.add_element(protozero::encode_zigzag32(point.y - cursor.y));
+                cursor = point;
+            };
+            for (const auto &part : parts) {
+                geometry.add_element(commandInteger(MOVE_TO, 1));
+                addPoint(part.front());
+                geometry.add_element(commandInteger(LINE_TO, static_cast<uint32_t>(part.size() - 1)));
+                for (size_t ii = 1; ii < part.size(); ++ii) {
+                    addPoint(part[ii]);
+                }
+                if (polygon) {
+                    geometry.add_element(commandInteger(CLOSE_PATH, 1));
+                }
+            }
+        }
+        features_.push_back(std::move(data));
+    }
+
+    void Write(protozero::pbf_writer &tile, uint32_t extent) const {
+        protozero::pbf_writer layer{tile, TILE_LAYERS};
+        layer.add_uint32(LAYER_VERSION, 2);
+        layer.add_string(LAYER_NAME, name_);
+        for (const auto &feature : features_) {
+            layer.add_message(LAYER_FEATURES, feature);
+        }
+        for (const auto &key : keys_) {
+            layer.add_string(LAYER_KEYS, key);
+        }
+        for (const auto &value : values_) {
+            protozero::pbf_writer valueWriter{layer, LAYER_VALUES};
+            valueWriter.add_string(VALUE_STRING, value);
+        }
+        layer.add_uint32(LAYER_EXTENT, extent);
+    }
+
+  protected:
+    static uint32_t Intern(std::vector<std::string> &strings, std::unordered_map<std::string, uint32_t> &indices,
+                           const std::string &string) {
+        auto [it, inserted] = indices.emplace(string, static_cast<uint32_t>(strings.size()));
+        if (inserted) {
+            strings.push_back(string);
+        }
+        return it->second;
+    }
+
+    std::string name_;
+    std::vector<std::string> features_{};
+    std::vector<std::string> keys_{};
+    std::unordered_map<std::string, uint32_t> keyIndices_{};
+    std::vector<std::string> values_{};
+    std::unordered_map<std::string, uint32_t> valueIndices_{};
+};
+
+// MBTiles stores tiles gzip compressed
+std::string gzip(const std::string &data) {
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return {};
+    }
+    std::string compressed(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    const int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        return {};
+    }
+    compressed.resize(stream.total_out);
+    return compressed;
+}
+
+std::string jsonString(const std::string &string) {
+    std::string quoted = "\"";
+    for (char c : string) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::vector<std::pair<std::string, std::string>> sortedTags(const OSMLoader::Tags &tags) {
+    // the loader fills in empty names and highway types, leave those out
+    std::vector<std::pair<std::string, std::string>> sorted;
+    for (const auto &[key, value] : tags) {
+        if (!value.empty()) {
+            sorted.emplace_back(key, value);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+// Join the outer member ways of an area end to end into closed rings. The
+// ways are split at nodes which were not loaded first; chains which do not
+// close are left out.
+std::vector<OSMLoader::Coordinates> assembleRings(const std::vector<OSMLoader::Coordinates> &ways) {
+    std::vector<OSMLoader::Coordinates> rings;
+    std::vector<OSMLoader::Coordinates> pieces;
+    for (const auto &way : ways) {
+        OSMLoader::Coordinates piece;
+        for (const auto &location : way) {
+            if (location.valid()) {
+                piece.push_back(location);
+                continue;
+            }
+            if (piece.size() >= 2) {
+                pieces.push_back(std::move(piece));
+            }
+            piece.clear();
+        }
+        if (piece.size() >= 2) {
+            pieces.push_back(std::move(piece));
+        }
+    }
+
+    // open pieces by both of their end points
+    std::multimap<osmium::Location, size_t> ends;
+    std::vector<bool> used(pieces.size(), false);
+    for (size_t ii = 0; ii < pieces.size(); ++ii) {
+        if (pieces[ii].front() == pieces[ii].back()) {
+            used[ii] = true;
+            rings.push_back(std::move(pieces[ii]));
+            continue;
+        }
+        ends.emplace(pieces[ii].front(), ii);
+        ends.emplace(pieces[ii].back(), ii);
+    }
+    // Append unused pieces to the end of `chain` until it closes or no piece
+    // continues it
+    auto extend = [&](OSMLoader::Coordinates &chain) {
+        while (chain.front() != chain.back()) {
+            auto [begin, end] = ends.equal_range(chain.back());
+            auto next = std::find_if(begin, end, [&](const auto &entry) { return !used[entry.second]; });
+            if (next == end) {
+                return;
+            }
+            used[next->second] = true;
+            const auto &piece = pieces[next->second];
+            if (piece.front() == chain.back()) {
+                chain.insert(chain.end(), piece.begin() + 1, piece.end());
+            } else {
+                chain.insert(chain.end(), piece.rbegin() + 1, piece.rend());
+            }
+        }
+    };
+    for (size_t ii = 0; ii < pieces.size(); ++ii) {
+        if (used[ii]) {
+            continue;
+        }
+        used[ii] = true;
+        OSMLoader::Coordinates chain = std::move(pieces[ii]);
+        extend(chain);
+        if (chain.front() != chain.back()) {
+            // the piece may have started in the middle of the ring
+            std::reverse(chain.begin(), chain.end());
+            extend(chain);
+        }
+        if (chain.front() == chain.back()) {
+            rings.push_back(std::move(chain));
+        }
+    }
+    return rings;
+}
+} // namespace
+
+TileExporter::TileExporter(const OSMLoader::OSMData &data, const osmium::Box &bounds, const StyleSheet &styleSheet,
+                           const Options &options)
+    : options_(options), bounds_(bounds) {
+    options_.minZoom = std::clamp(options_.minZoom, 0, MAX_ZOOM);
+    options_.maxZoom = std::clamp(options_.maxZoom, options_.minZoom, MAX_ZOOM);
+
+    auto project = [](const osmium::Location &location) {
+        return Point{mercatorX(location.lon()), mercatorY(location.lat())};
+    };
+    auto addFeature = [this](Feature feature) {
+        if (feature.parts.empty()) {
+            return;
+        }
+        feature.minX = feature.minY = std::numeric_limits<double>::max();
+        feature.maxX = feature.maxY = std::numeric_limits<double>::lowest();
+        for (const auto &part : feature.parts) {
+            for (const auto &point : part) {
+                feature.minX = std::min(feature.minX, point.x);
+                feature.minY = std::min(feature.minY, point.y);
+                feature.maxX = std::max(feature.maxX, point.x);
+                feature.maxY = std::max(feature.maxY, point.y);
+            }
+        }
+        features_.push_back(std::move(feature));
+    };
+
+    const auto &[routes, areas] = data;
+    for (const auto &[id, route] : routes) {
+        const auto style = styleSheet.Match(route.tags);
+        if (style == StyleSheet::NO_STYLE) {
+            continue;
+        }
+        Feature feature{static_cast<uint64_t>(id), GeometryType::LineString, {}, sortedTags(route.tags),
+                        styleSheet.styles()[style].minZoom};
+        // one part per piece left by clipping at the bounds
+        std::vector<size_t> ends(route.breaks.begin(), route.breaks.end());
+        ends.push_back(route.nodes.size());
+        size_t begin = 0;
+        for (size_t end : ends) {
+            Part part;
+            for (size_t ii = begin; ii < end; ++ii) {
+                if (route.nodes[ii].valid()) {
+                    part.push_back(project(route.nodes[ii]));
+                }
+            }
+            if (part.size() >= 2) {
+                feature.parts.push_back(std::move(part));
+            }
+            begin = end;
+        }
+        addFeature(std::move(feature));
+    }
+    for (const auto &[id, area] : areas) {
+        Feature feature{static_cast<uint64_t>(id), GeometryType::Polygon, {}, sortedTags(area.tags), 0.0f};
+        for (const auto &ring : assembleRings(area.outerRings)) {
+            Part part;
+            part.reserve(ring.size());
+            for (const auto &location : ring) {
+                part.push_back(project(location));
+            }
+            if (part.size() >= 4) {
+                feature.parts.push_back(std::move(part));
+            }
+        }
+        addFeature(std::move(feature));
+    }
+
+    // Same output for the same input
+    std::sort(features_.begin(), features_.end(), [](const Feature &a, const Feature &b) {
+        return a.type != b.type ? a.type < b.type : a.id < b.id;
+    });
+}
+
+TileExporter::ZoomLevel TileExporter::PrepareZoom(int zoom) const {
+    ZoomLevel level{zoom, {}, {}};
+
+    const double tileCount = std::ldexp(1.0, zoom);
+    // tile coordinate units per Mercator unit
+    const double scale = tileCount * options_.extent;
+    const double tolerance = options_.tolerance / scale;
+    const double buffer = options_.buffer / scale;
+
+    const uint32_t minTileX = tileIndex(mercatorX(bounds_.left()), zoom);
+    const uint32_t maxTileX = tileIndex(mercatorX(bounds_.right()), zoom);
+    const uint32_t minTileY = tileIndex(mercatorY(bounds_.top()), zoom);
+    const uint32_t maxTileY = tileIndex(mercatorY(bounds_.bottom()), zoom);
+
+    for (size_t index = 0; index < features_.size(); ++index) {
+        const auto &feature = features_[index];
+        // shown somewhere between this zoom level and the next one
+        if (zoom < options_.maxZoom && feature.minZoom >= zoom + 1) {
+            continue;
+        }
+
+        std::vector<Part> parts;
+        for (const auto &part : feature.parts) {
+            auto simplified = simplify(part, tolerance);
+            if (simplified.size() >= (feature.type == GeometryType::Polygon ? 4u : 2u)) {
+                parts.push_back(std::move(simplified));
+            }
+        }
+        if (parts.empty()) {
+            continue;
+        }
+
+        const uint32_t x0 = std::max(tileIndex(feature.minX - buffer, zoom), minTileX);
+        const uint32_t x1 = std::min(tileIndex(feature.maxX + buffer, zoom), maxTileX);
+        const uint32_t y0 = std::max(tileIndex(feature.minY - buffer, zoom), minTileY);
+        const uint32_t y1 = std::min(tileIndex(feature.maxY + buffer, zoom), maxTileY);
+        if (x0 > x1 || y0 > y1) {
+            continue;
+        }
+        const auto featureIndex = static_cast<uint32_t>(level.features.size());
+        level.features.emplace_back(static_cast<uint32_t>(index), std::move(parts));
+        for (uint32_t y = y0; y <= y1; ++y) {
+            for (uint32_t x = x0; x <= x1; ++x) {
+                level.tiles[TileKey(x, y)].push_back(featureIndex);
+            }
+        }
+    }
+    return level;
+}
+
+std::string TileExporter::EncodeTile(int zoom, uint32_t x, uint32_t y) const {
+    if (zoom < 0 || zoom > MAX_ZOOM) {
+        return {};
+    }
+    return EncodeTile(PrepareZoom(zoom), x, y);
+}
+
+std::string TileExporter::EncodeTile(const ZoomLevel &level, uint32_t x, uint32_t y) const {
+    auto tile = level.tiles.find(TileKey(x, y));
+    if (tile == level.tiles.end()) {
+        return {};
+    }
+
+    const double extent = options_.extent;
+    const double scale = std::ldexp(extent, level.zoom);
+    const double buffer = options_.buffer;
+    const Rect clip{-buffer, -buffer, extent + buffer, extent + buffer};
+
+    LayerBuilder roads{ROADS_LAYER};
+    LayerBuilder areas{AREAS_LAYER};
+    std::vector<TilePart> tileParts;
+    for (uint32_t featureIndex : tile->second) {
+        const auto &[source, parts] = level.features[featureIndex];
+        const auto &feature = features_[source];
+        const bool polygon = feature.type == GeometryType::Polygon;
+
+        tileParts.clear();
+        for (const auto &part : parts) {
+            LocalPart local;
+            local.reserve(part.size());
+            for (const auto &point : part) {
+                local.push_back({point.x * scale - x * extent, point.y * scale - y * extent});
+            }
+
+            if (!polygon) {
+                for (const auto &piece : clipLine(local, clip)) {
+                    if (auto rounded = roundPart(piece); rounded.size() >= 2) {
+                        tileParts.push_back(std::move(rounded));
+                    }
+                }
+                continue;
+            }
+
+            local.pop_back(); // the closing point
+            auto ring = roundPart(clipRing(std::move(local), clip));
+            if (ring.size() > 1 && ring.front() == ring.back()) {
+                ring.pop_back();
+            }
+            if (ring.size() < 3) {
+                continue;
+            }
+            const int64_t area2 = ringArea2(ring);
+            if (area2 == 0) {
+                continue;
+            }
+            if (area2 < 0) {
+                std::reverse(ring.begin(), ring.end());
+            }
+            tileParts.push_back(std::move(ring));
+        }
+
+        if (!tileParts.empty()) {
+            (polygon ? areas : roads).AddFeature(feature.id, polygon, tileParts, feature.tags);
+        }
+    }
+
+    std::string data;
+    if (!roads.Empty() || !areas.Empty()) {
+        protozero::pbf_writer tileWriter{data};
+        if (!roads.Empty()) {
+            roads.Write(tileWriter, options_.extent);
+        }
+        if (!areas.Empty()) {
+            areas.Write(tileWriter, options_.extent);
+        }
+    }
+    return data;
+}
+
+std::string TileExporter::MetadataJson() const {
+    std::map<std::string, std::set<std::string>> fields{{ROADS_LAYER, {}}, {AREAS_LAYER, {}}};
+    for (const auto &feature : features_) {
+        auto &layerFields = fields[feature.type == GeometryType::Polygon ? AREAS_LAYER : ROADS_LAYER];
+        for (const auto &tag : feature.tags) {
+            layerFields.insert(tag.first);
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\"vector_layers\":[";
+    for (const char *layer : {ROADS_LAYER, AREAS_LAYER}) {
+        json << (layer != ROADS_LAYER ? "," : "") << "{\"id\":" << jsonString(layer)
+             << ",\"minzoom\":" << options_.minZoom << ",\"maxzoom\":" << options_.maxZoom << ",\"fields\":{";
+        const char *separator = "";
+        for (const auto &field : fields[layer]) {
+            json << separator << jsonString(field) << ":\"String\"";
+            separator = ",";
+        }
+        json << "}}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+bool TileExporter::Export(const std::string &path) const {
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    sqlite3 *db = nullptr;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        std::cerr << "Could not create " << path << ": " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        return false;
+    }
+    std::unique_ptr<sqlite3, decltype(&sqlite3_close)> database{db, sqlite3_close};
+    auto fail = [&](const char *what) {
+        std::cerr << "Could not " << what << " " << path << ": " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    };
+
+    // Schema of the MBTiles 1.3 specification
+    if (sqlite3_exec(db,
+                     "PRAGMA synchronous = OFF;"
+                     "PRAGMA journal_mode = MEMORY;"
+                     "CREATE TABLE metadata (name TEXT, value TEXT);"
+                     "CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB);"
+                     "CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, tile_column, tile_row);"
+                     "BEGIN;",
+                     nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return fail("initialize");
+    }
+
+    sqlite3_stmt *statement = nullptr;
+    if (sqlite3_prepare_v2(db, "INSERT INTO metadata (name, value) VALUES (?, ?);", -1, &statement, nullptr) !=
+        SQLITE_OK) {
+        return fail("write metadata to");
+    }
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> insertMetadata{statement, sqlite3_finalize};
+    std::ostringstream boundsValue;
+    boundsValue.precision(9);
+    boundsValue << bounds_.left() << "," << bounds_.bottom() << "," << bounds_.right() << "," << bounds_.top();
+    std::ostringstream centerValue;
+    centerValue.precision(9);
+    centerValue << 0.5 * (bounds_.left() + bounds_.right()) << "," << 0.5 * (bounds_.bottom() + bounds_.top()) << ","
+                << options_.minZoom;
+    const std::vector<std::pair<std::string, std::string>> metadata{
+        {"name", std::filesystem::path(path).stem().string()},
+        {"format", "pbf"},
+        {"type", "baselayer"},
+        {"version", "2"},
+        {"bounds", boundsValue.str()},
+        {"center", centerValue.str()},
+        {"minzoom", std::to_string(options_.minZoom)},
+        {"maxzoom", std::to_string(options_.maxZoom)},
+        {"json", MetadataJson()},
+    };
+    for (const auto &[name, value] : metadata) {
+        sqlite3_bind_text(statement, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(statement, 2, value.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(statement) != SQLITE_DONE) {
+            return fail("write metadata to");
+        }
+        sqlite3_reset(statement);
+    }
+
+    if (sqlite3_prepare_v2(db, "INSERT INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?);",
+                           -1, &statement, nullptr) != SQLITE_OK) {
+        return fail("write tiles to");
+    }
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> insertTile{statement, sqlite3_finalize};
+
+    osmium::thread::Pool pool{options_.threadCount};
+    for (int zoom = options_.minZoom; zoom <= options_.maxZoom; ++zoom) {
+        const auto level = PrepareZoom(zoom);
+        std::vector<uint64_t> keys;
+        keys.reserve(level.tiles.size());
+        for (const auto &entry : level.tiles) {
+            keys.push_back(entry.first);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        size_t tileCount = 0;
+        size_t byteCount = 0;
+        for (size_t begin = 0; begin < keys.size(); begin += TILE_BATCH_SIZE) {
+            const size_t end = std::min(begin + TILE_BATCH_SIZE, keys.size());
+            std::vector<std::future<std::string>> tiles;
+            for (size_t ii = begin; ii < end; ++ii) {
+                tiles.push_back(pool.submit([this, &level, key = keys[ii]] {
+                    const auto tile = EncodeTile(level, static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key));
+                    return tile.empty() ? tile : gzip(tile);
+                }));
+            }
+            for (size_t ii = begin; ii < end; ++ii) {
+                const auto tile = tiles[ii - begin].get();
+                if (tile.empty()) {
+                    continue;
+                }
+                // MBTiles numbers rows from the south (TMS)
+                const auto x = static_cast<uint32_t>(keys[ii] >> 32);
+                const auto y = static_cast<uint32_t>(keys[ii]);
+                sqlite3_bind_int(statement, 1, zoom);
+                sqlite3_bind_int64(statement, 2, x);
+                sqlite3_bind_int64(statement, 3, (int64_t{1} << zoom) - 1 - y);
+                sqlite3_bind_blob(statement, 4, tile.data(), static_cast<int>(tile.size()), SQLITE_TRANSIENT);
+                if (sqlite3_step(statement) != SQLITE_DONE) {
+                    // the pending tasks still reference `level`
+                    for (auto &pending : tiles) {
+                        if (pending.valid()) {
+                            pending.wait();
+                        }
+                    }
+                    return fail("write tiles to");
+                }
+                sqlite3_reset(statement);
+                ++tileCount;
+                byteCount += tile.size();
+            }
+        }
+        std::cout << "Zoom " << zoom << ": " << tileCount << " tiles, " << byteCount / 1024 << " kB" << std::endl;
+    }
+
+    if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return fail("commit");
+    }
+    return true;
+}
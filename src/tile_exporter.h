@@ -0,0 +1,97 @@
+#pragma once
+
+#include "osm_loader.h"
+#include "style_sheet.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Cuts loaded routes and areas into Mapbox Vector Tiles.
+ *
+ * Routes are kept from the zoom level below the minimum zoom of their style
+ * on, so a tile holds what the renderer draws between its zoom level and the
+ * next one; the last level holds everything for overzooming. Routes without a
+ * style are not exported.
+ *
+ * Every zoom level projects the data to Web Mercator tile units, simplifies
+ * it with Douglas-Peucker to the resolution of the level and bins it into the
+ * tiles it touches. The tiles are then clipped (with a small buffer so line
+ * joins and area edges do not show at tile borders) and encoded in parallel.
+ * Routes go into the "roads" layer and the outer rings of areas into the
+ * "areas" layer, both with their tags as string properties. Rings are joined
+ * from the outer member ways of an area; those which do not close within the
+ * loaded nodes are left out.
+ *
+ * Export() writes an MBTiles file: an SQLite database with the gzipped tiles
+ * in TMS row order and the metadata tile servers expect.
+ */
+class TileExporter {
+  public:
+    struct Options {
+        int minZoom{0};
+        int maxZoom{14};
+        // tile coordinate range, and the buffer around it kept by clipping
+        uint32_t extent{4096};
+        uint32_t buffer{64};
+        // Douglas-Peucker tolerance, in tile coordinate units
+        double tolerance{1.0};
+        // Threads encoding tiles: 0 uses all cores, a negative number leaves
+        // that many cores free
+        int threadCount{0};
+    };
+
+    TileExporter(const OSMLoader::OSMData &data, const osmium::Box &bounds, const StyleSheet &styleSheet,
+                 const Options &options);
+
+    // Write every tile covering the bounds to the MBTiles file at `path`,
+    // replacing it. Empty tiles are skipped.
+    bool Export(const std::string &path) const;
+
+    // The uncompressed MVT of tile zoom/x/y (y from the top, as in XYZ
+    // URLs), empty when no feature touches it
+    std::string EncodeTile(int zoom, uint32_t x, uint32_t y) const;
+
+  protected:
+    enum class GeometryType : uint8_t { LineString = 2, Polygon = 3 };
+
+    // Web Mercator, 0..1 from west to east and north to south
+    struct Point {
+        double x;
+        double y;
+    };
+    using Part = std::vector<Point>;
+
+    struct Feature {
+        uint64_t id;
+        GeometryType type;
+        // line pieces or closed outer rings
+        std::vector<Part> parts;
+        // sorted by key
+        std::vector<std::pair<std::string, std::string>> tags;
+        float minZoom;
+        double minX, minY, maxX, maxY;
+    };
+
+    // The features shown at one zoom level, as indices into features_ with
+    // their parts simplified to the resolution of the level, and the
+    // features touching each tile
+    struct ZoomLevel {
+        int zoom;
+        std::vector<std::pair<uint32_t, std::vector<Part>>> features;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> tiles;
+    };
+
+    ZoomLevel PrepareZoom(int zoom) const;
+    std::string EncodeTile(const ZoomLevel &level, uint32_t x, uint32_t y) const;
+    std::string MetadataJson() const;
+
+    static uint64_t TileKey(uint32_t x, uint32_t y) { return (static_cast<uint64_t>(x) << 32) | y; }
+
+    Options options_;
+    osmium::Box bounds_;
+    // roads (line strings) and areas (polygons)
+    std::vector<Feature> features_{};
+};
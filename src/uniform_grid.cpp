@@ -0,0 +1,79 @@
+#include "uniform_grid.h"
+
+namespace {
+// Keep the grid itself bounded
+constexpr double MAX_CELLS = 1 << 22;
+// Boxes spanning more cells than this go into the list scanned by every query
+constexpr int64_t MAX_ITEM_CELLS = 64;
+// Inserted items sit in their cells like built ones, so rebuilding only
+// refits the grid to data that moved or grew; do it after this many
+// insertions or an eighth of the built items, whichever is more
+constexpr size_t MIN_REBUILD_INSERTS = 1024;
+} // namespace
+
+void UniformGrid::Build(size_t count, const std::function<Box(uint32_t)> &boxOf, double itemsPerCell) {
+    inserted_.clear();
+    large_.clear();
+    builtCount_ = count;
+    insertedCount_ = 0;
+
+    // Grid over the extent of all boxes
+    double maxX = 0.0;
+    double maxY = 0.0;
+    minX_ = minY_ = 0.0;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        const Box box = boxOf(ii);
+        minX_ = ii == 0 ? box.minX : std::min(minX_, box.minX);
+        minY_ = ii == 0 ? box.minY : std::min(minY_, box.minY);
+        maxX = ii == 0 ? box.maxX : std::max(maxX, box.maxX);
+        maxY = ii == 0 ? box.maxY : std::max(maxY, box.maxY);
+    }
+    const double width = maxX - minX_;
+    const double height = maxY - minY_;
+    const double cells = std::clamp(static_cast<double>(count) / itemsPerCell, 1.0, MAX_CELLS);
+    double cellSize = std::sqrt(width * height / cells);
+    // Very elongated data: don't let one dimension exceed the cell budget
+    cellSize = std::max({cellSize, width / cells, height / cells});
+    cellScale_ = cellSize > 0.0 ? 1.0 / cellSize : 1.0;
+    columns_ = static_cast<int>(width * cellScale_) + 1;
+    rows_ = static_cast<int>(height * cellScale_) + 1;
+
+    // Count the boxes per cell, then place them (CSR)
+    cellStart_.assign(static_cast<size_t>(columns_) * rows_ + 1, 0);
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        const Box box = boxOf(ii);
+        if (IsLarge(box)) {
+            large_.push_back(ii);
+        } else {
+            ForEachCell(box, [this](size_t cell) { ++cellStart_[cell + 1]; });
+        }
+    }
+    for (size_t cell = 1; cell < cellStart_.size(); ++cell) {
+        cellStart_[cell] += cellStart_[cell - 1];
+    }
+    cellItems_.resize(cellStart_.back());
+    std::vector<uint32_t> fill(cellStart_.begin(), cellStart_.end() - 1);
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        if (const Box box = boxOf(ii); !IsLarge(box)) {
+            ForEachCell(box, [&](size_t cell) { cellItems_[fill[cell]++] = ii; });
+        }
+    }
+}
+
+void UniformGrid::Insert(uint32_t item, const Box &box) {
+    ++insertedCount_;
+    if (IsLarge(box)) {
+        large_.push_back(item);
+    } else {
+        ForEachCell(box, [&](size_t cell) { inserted_[cell].push_back(item); });
+    }
+}
+
+bool UniformGrid::ShouldRebuild(size_t removed, size_t items) const {
+    return insertedCount_ > std::max(MIN_REBUILD_INSERTS, builtCount_ / 8) || removed > items / 2;
+}
+
+bool UniformGrid::IsLarge(const Box &box) const {
+    return static_cast<int64_t>(CellX(box.maxX) - CellX(box.minX) + 1) * (CellY(box.maxY) - CellY(box.minY) + 1) >
+           MAX_ITEM_CELLS;
+}
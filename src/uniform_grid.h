@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Uniform grid over axis-aligned boxes, the spatial index behind MapStore and
+ * SegmentIndex. Items are the indices of the boxes in the owner's array.
+ *
+ * Build() sizes the grid for a few boxes per cell over the extent of all boxes
+ * and lays it out as one contiguous array per cell range (CSR). A box is
+ * listed in every cell it overlaps and reported only from the first of those
+ * cells the query overlaps, so a query visits the cells of its bounds plus its
+ * results and never deduplicates. Boxes spanning too many cells (long
+ * boundaries, large areas) are kept in a short list that every query scans.
+ *
+ * Insert() bins a box into the cells of the built grid, in a sparse map of per
+ * cell lists next to the CSR arrays, so items added later cost queries no more
+ * than built ones. Removing is left to the owner, which tombstones its items
+ * and skips them when visited; ShouldRebuild() tells when compacting them and
+ * building the grid again pays off.
+ */
+class UniformGrid {
+  public:
+    struct Box {
+        double minX, minY, maxX, maxY;
+    };
+
+    // Bin the boxes of items [0, count) into a new grid with about
+    // `itemsPerCell` boxes per cell
+    void Build(size_t count, const std::function<Box(uint32_t)> &boxOf, double itemsPerCell);
+
+    // Add `item` to the cells its box overlaps, without resizing the grid
+    void Insert(uint32_t item, const Box &box);
+
+    // True once many items were inserted since Build(), so that the grid no
+    // longer fits the data, or more than half of the `items` are `removed`
+    bool ShouldRebuild(size_t removed, size_t items) const;
+
+    // Call `visit(item)` once for every item whose box overlaps the cells of
+    // `query`, `boxOf(item)` returning its box. The visitor tests the box
+    // itself.
+    template <typename TBoxOf, typename TVisit>
+    void Query(const Box &query, const TBoxOf &boxOf, const TVisit &visit) const {
+        const int firstX = CellX(query.minX);
+        const int firstY = CellY(query.minY);
+        const int lastX = CellX(query.maxX);
+        const int lastY = CellY(query.maxY);
+        // A box in several cells is reported by the first cell both it and
+        // the query overlap. In the first column and row of the query that
+        // is any cell of the box, elsewhere the first cell of the box.
+        auto visitOnce = [&](uint32_t item, int cx, int cy) {
+            if (cx == firstX && cy == firstY) {
+                visit(item);
+                return;
+            }
+            const Box box = boxOf(item);
+            if ((cx == firstX || CellX(box.minX) == cx) && (cy == firstY || CellY(box.minY) == cy)) {
+                visit(item);
+            }
+        };
+        for (int cy = firstY; cy <= lastY; ++cy) {
+            for (int cx = firstX; cx <= lastX; ++cx) {
+                const size_t cell = static_cast<size_t>(cy) * columns_ + cx;
+                for (uint32_t ii = cellStart_[cell]; ii < cellStart_[cell + 1]; ++ii) {
+                    visitOnce(cellItems_[ii], cx, cy);
+                }
+                if (inserted_.empty()) {
+                    continue;
+                }
+                if (auto it = inserted_.find(cell); it != inserted_.end()) {
+                    for (uint32_t item : it->second) {
+                        visitOnce(item, cx, cy);
+                    }
+                }
+            }
+        }
+        for (uint32_t item : large_) {
+            visit(item);
+        }
+    }
+
+  protected:
+    bool IsLarge(const Box &box) const;
+    template <typename TFunction> void ForEachCell(const Box &box, const TFunction &callback) const {
+        for (int cy = CellY(box.minY); cy <= CellY(box.maxY); ++cy) {
+            for (int cx = CellX(box.minX); cx <= CellX(box.maxX); ++cx) {
+                callback(static_cast<size_t>(cy) * columns_ + cx);
+            }
+        }
+    }
+
+    // Clamp before converting, queries can reach far outside of the grid
+    int CellX(double x) const {
+        return static_cast<int>(std::clamp(std::floor((x - minX_) * cellScale_), 0.0, columns_ - 1.0));
+    }
+    int CellY(double y) const {
+        return static_cast<int>(std::clamp(std::floor((y - minY_) * cellScale_), 0.0, rows_ - 1.0));
+    }
+
+    double minX_{0.0};
+    double minY_{0.0};
+    // cells per unit
+    double cellScale_{1.0};
+    int columns_{1};
+    int rows_{1};
+    std::vector<uint32_t> cellStart_{0, 0}; // columns_ * rows_ + 1 offsets into cellItems_
+    std::vector<uint32_t> cellItems_{};
+    // items inserted since Build(), by cell
+    std::unordered_map<size_t, std::vector<uint32_t>> inserted_{};
+    std::vector<uint32_t> large_{};
+    size_t builtCount_{0};
+    size_t insertedCount_{0};
+};
@@ -0,0 +1,142 @@
+#include "upload_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+bool StorageBuffer::Reserve(GLsizeiptr size) {
+    if (buffer_ != 0 && size <= capacity_) {
+        return false;
+    }
+
+    // Grow geometrically so that repeated growth stays cheap. Never allocate
+    // an empty buffer, binding those is an error on some drivers.
+    const GLsizeiptr capacity = std::max<GLsizeiptr>({size, capacity_ + capacity_ / 2, 16});
+    Release();
+    capacity_ = capacity;
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    if (GLEW_ARB_buffer_storage) {
+        glBufferStorage(GL_COPY_WRITE_BUFFER, capacity_, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity_, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+void StorageBuffer::Release() {
+    if (buffer_ != 0) {
+        glDeleteBuffers(1, &buffer_);
+    }
+    buffer_ = 0;
+    capacity_ = 0;
+}
+
+bool UploadRing::Initialize(GLsizeiptr regionSize) {
+    Release();
+
+    if (!GLEW_ARB_buffer_storage) {
+        std::cerr << "ARB_buffer_storage is not available, uploading with glBufferSubData" << std::endl;
+        return false;
+    }
+
+    regionSize_ = regionSize;
+    const GLsizeiptr size = regionSize_ * static_cast<GLsizeiptr>(REGION_COUNT);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &staging_);
+    glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+    glBufferStorage(GL_COPY_READ_BUFFER, size, nullptr, flags);
+    mapped_ = static_cast<char *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (!mapped_) {
+        std::cerr << "Could not map the upload ring, uploading with glBufferSubData" << std::endl;
+        Release();
+        return false;
+    }
+
+    region_ = 0;
+    cursor_ = 0;
+    return true;
+}
+
+void UploadRing::Release() {
+    for (auto &fence : fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+        fence = nullptr;
+    }
+    if (staging_ != 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &staging_);
+    }
+    staging_ = 0;
+    mapped_ = nullptr;
+    regionSize_ = 0;
+}
+
+void UploadRing::Upload(GLuint dst, GLintptr dstOffset, const void *data, GLsizeiptr size) {
+    if (size <= 0) {
+        return;
+    }
+
+    if (!mapped_) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, dstOffset, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+
+    const char *src = static_cast<const char *>(data);
+    while (size > 0) {
+        if (cursor_ == regionSize_) {
+            NextRegion();
+        }
+        const GLsizeiptr chunk = std::min(size, regionSize_ - cursor_);
+        const GLintptr stagingOffset = static_cast<GLintptr>(region_) * regionSize_ + cursor_;
+
+        std::memcpy(mapped_ + stagingOffset, src, chunk);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagingOffset, dstOffset, chunk);
+
+        // keep copies 4 byte aligned, the buffers only hold floats and uints
+        cursor_ = std::min(regionSize_, (cursor_ + chunk + 3) & ~GLsizeiptr(3));
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void UploadRing::Submit() {
+    if (mapped_ && cursor_ > 0) {
+        NextRegion();
+    }
+}
+
+void UploadRing::NextRegion() {
+    fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    region_ = (region_ + 1) % REGION_COUNT;
+    cursor_ = 0;
+
+    auto &fence = fences_[region_];
+    if (fence) {
+        // Flush on the first wait so the fence is guaranteed to signal
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+            flags = 0;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstddef>
+
+/**
+ * A GPU buffer with immutable storage (glBufferStorage) that is written with
+ * sub-range updates only. It is reallocated only when it has to grow.
+ */
+class StorageBuffer {
+  public:
+    StorageBuffer() = default;
+    ~StorageBuffer() { Release(); }
+
+    StorageBuffer(const StorageBuffer &) = delete;
+    StorageBuffer &operator=(const StorageBuffer &) = delete;
+
+    // Make sure the buffer holds at least `size` bytes. Returns true if the
+    // buffer was (re)created, in which case its previous contents are lost
+    // and any VAO referencing it must be set up again.
+    bool Reserve(GLsizeiptr size);
+    void Release();
+
+    GLuint Id() const { return buffer_; }
+    GLsizeiptr Capacity() const { return capacity_; }
+
+  protected:
+    GLuint buffer_{0};
+    GLsizeiptr capacity_{0};
+};
+
+/**
+ * Streaming upload path for geometry updates.
+ *
+ * A staging buffer is persistently and coherently mapped (glBufferStorage +
+ * glMapBufferRange) and split into REGION_COUNT regions used round robin.
+ * Data is written into the current region on the CPU and copied into the
+ * destination buffer on the GPU with glCopyBufferSubData. Submit() places a
+ * fence behind the copies of a region; a region is only written again once
+ * its fence signalled, so the CPU never overwrites data the GPU still reads
+ * and never waits for the whole pipeline to drain.
+ *
+ * Without ARB_buffer_storage the ring degrades to glBufferSubData.
+ */
+class UploadRing {
+  public:
+    static constexpr size_t REGION_COUNT = 3;
+
+    UploadRing() = default;
+    ~UploadRing() { Release(); }
+
+    UploadRing(const UploadRing &) = delete;
+    UploadRing &operator=(const UploadRing &) = delete;
+
+    bool Initialize(GLsizeiptr regionSize);
+    void Release();
+
+    // Copy `size` bytes from `data` to `dstOffset` in `dst`. Uploads larger
+    // than a region are split over several regions.
+    void Upload(GLuint dst, GLintptr dstOffset, const void *data, GLsizeiptr size);
+
+    // Fence the copies issued so far and move on to the next region
+    void Submit();
+
+  protected:
+    // Switch to the next region, waiting for the GPU to be done with it
+    void NextRegion();
+
+    GLuint staging_{0};
+    char *mapped_{nullptr};
+    GLsizeiptr regionSize_{0};
+    size_t region_{0};
+    GLsizeiptr cursor_{0};
+    std::array<GLsync, REGION_COUNT> fences_{};
+};